@@ -20,6 +20,10 @@
 
 #import <Foundation/Foundation.h>
 
+@class RMAppReceiptIAP;
+@class RMAppReceiptRenewalChain;
+@class RMAppReceiptSubscriptionTimeline;
+
 /** Represents the app receipt.
  */
 __attribute__((availability(ios,introduced=7.0)))
@@ -53,6 +57,11 @@ __attribute__((availability(ios,introduced=7.0)))
  */
 @property (nonatomic, strong, readonly) NSArray *inAppPurchases;
 
+/** Array of the renewal chains of the auto-renewable subscriptions in the receipt, in order of first appearance of each chain. Built when the receipt is created.
+ @see RMAppReceiptRenewalChain
+ */
+@property (nonatomic, strong, readonly) NSArray *renewalChains;
+
 /** The version of the app that was originally purchased. This corresponds to the value of CFBundleVersion (in iOS) or CFBundleShortVersionString (in OS X) in the Info.plist file when the purchase was originally made. In the sandbox environment, the value of this field is always “1.0”.
  */
 @property (nonatomic, strong, readonly) NSString *originalAppVersion;
@@ -65,9 +74,22 @@ __attribute__((availability(ios,introduced=7.0)))
  @param asn1Data ASN1 data
  @return An initialized app receipt from the given data.
  */
-- (instancetype)initWithASN1Data:(NSData*)asn1Data NS_DESIGNATED_INITIALIZER;
+- (instancetype)initWithASN1Data:(NSData*)asn1Data;
+
+/** Returns an initialized app receipt from the given data, reusing the work done to parse a previous version of the receipt. In-app purchases that are byte-identical to one of the previous receipt keep the fields it already decoded, and only new or changed in-app purchases are parsed. Useful after refreshing a receipt, which usually only adds a few in-app purchases. bundleReceipt does this automatically when the receipt file changes.
+ @param asn1Data ASN1 data
+ @param previousReceipt A previous version of the receipt, or nil.
+ @return An initialized app receipt from the given data.
+ */
+- (instancetype)initWithASN1Data:(NSData*)asn1Data previousReceipt:(RMAppReceipt*)previousReceipt NS_DESIGNATED_INITIALIZER;
 - (instancetype)init NS_UNAVAILABLE;
 
+/** Returns the in-app purchases in the receipt for the given product, in receipt order.
+ @param productIdentifier The identifier of the product.
+ @return The in-app purchases for the given product, or an empty array if there are none.
+ */
+- (NSArray*)inAppPurchasesOfProductIdentifier:(NSString*)productIdentifier;
+
 /** Returns whether there is an in-app purchase in the receipt for the given product.
  @param productIdentifier The identifier of the product.
  @return YES if there is an in-app purchase for the given product, NO otherwise.
@@ -80,9 +102,52 @@ __attribute__((availability(ios,introduced=7.0)))
  @return YES if the latest auto-renewable subscription is active for the given date, NO otherwise.
  @warning Auto-renewable subscription lapses are possible. If you are checking against the current date, you might want to deduct some time as tolerance.
  @warning If this method fails Apple recommends to refresh the receipt and try again once.
+ @see subscriptionTimelineOfProductIdentifier:
  */
 - (BOOL)containsActiveAutoRenewableSubscriptionOfProductIdentifier:(NSString *)productIdentifier forDate:(NSDate *)date;
 
+/** Returns the renewal chain with the given original transaction identifier. Takes constant time.
+ @param originalTransactionIdentifier The original transaction identifier shared by the in-app purchases of the chain.
+ @return The renewal chain, or nil if there is no auto-renewable subscription in the receipt with the given original transaction identifier.
+ @see renewalChains
+ */
+- (RMAppReceiptRenewalChain*)renewalChainOfOriginalTransactionIdentifier:(NSString*)originalTransactionIdentifier;
+
+/** Returns the timeline of the given auto-renewable subscription, which considers all of its in-app purchases instead of only the latest. Useful for repeated queries about past dates, such as when a subscription lapsed. The timeline is created the first time it is requested and kept by the receipt.
+ @param productIdentifier The identifier of the auto-renewable subscription.
+ @return The timeline of the subscription, or nil if no in-app purchase of the given product has a subscription expiration date.
+ @see RMAppReceiptSubscriptionTimeline
+ */
+- (RMAppReceiptSubscriptionTimeline*)subscriptionTimelineOfProductIdentifier:(NSString*)productIdentifier;
+
+/** Returns the in-app purchases in the receipt with a purchase date in the given interval, in receipt order.
+ @param startDate The start of the interval, included.
+ @param endDate The end of the interval, excluded.
+ @return The in-app purchases in the interval, or an empty array if there are none.
+ @see setPurchaseTableEnabled:
+ */
+- (NSArray*)inAppPurchasesFromDate:(NSDate*)startDate toDate:(NSDate*)endDate;
+
+/** Returns the number of in-app purchases in the receipt of each product.
+ @return A dictionary of product identifiers to numbers of in-app purchases.
+ @see setPurchaseTableEnabled:
+ */
+- (NSDictionary*)inAppPurchaseCountsByProductIdentifier;
+
+/** Returns the latest subscription expiration date of each auto-renewable subscription in the receipt.
+ @return A dictionary of product identifiers to expiration dates. Products without expiration dates are not included.
+ @see setPurchaseTableEnabled:
+ */
+- (NSDictionary*)latestSubscriptionExpirationDatesByProductIdentifier;
+
+/** Returns whether the given receipt data contains an in-app purchase for the given product, without creating a receipt. Only the product identifiers of the in-app purchases are read, and the scan stops at the first match. Useful for one-off checks on large receipts.
+ @param productIdentifier The identifier of the product.
+ @param asn1Data ASN1 data, as returned in the payload of the receipt.
+ @return YES if there is an in-app purchase for the given product, NO otherwise.
+ @see containsInAppPurchaseOfProductIdentifier:
+ */
++ (BOOL)containsInAppPurchaseOfProductIdentifier:(NSString*)productIdentifier inASN1Data:(NSData*)asn1Data;
+
 /** Returns wheter the receipt hash corresponds to the device's GUID by calcuting the expected hash using the GUID, bundleIdentifierData and opaqueValue.
  @return YES if the hash contained in the receipt corresponds to the device's GUID, NO otherwise.
  */
@@ -90,6 +155,8 @@ __attribute__((availability(ios,introduced=7.0)))
 
 /**
  Returns the app receipt contained in the bundle, if any and valid. Extracts the receipt in ASN1 from the PKCS #7 container, and then parses the ASN1 data into a RMAppReceipt instance. If an Apple Root certificate is available, it will also verify that the signature of the receipt is valid.
+ 
+ The receipt is cached, so the same instance is returned until the size, modification date or contents of the receipt file change.
  @return The app receipt contained in the bundle, or nil if there is no receipt or if it is invalid.
  @see refreshReceipt
  @see setAppleRootCertificateURL:
@@ -97,7 +164,50 @@ __attribute__((availability(ios,introduced=7.0)))
 + (RMAppReceipt*)bundleReceipt;
 
 /**
- Sets the url of the Apple Root certificate that will be used to verifiy the signature of the bundle receipt. If none is provided, the resource AppleIncRootCertificate.cer will be used. If no certificate is available, no signature verification will be performed.
+ Loads the app receipt contained in the bundle like bundleReceipt, but on a low-priority background queue. Concurrent calls share a single load.
+ @param completion Called on the main queue with the app receipt, or nil if there is no receipt or if it is invalid.
+ @see bundleReceipt
+ */
++ (void)loadBundleReceiptWithCompletion:(void (^)(RMAppReceipt *receipt))completion;
+
+/**
+ Loads the app receipt contained in the bundle like bundleReceipt, but on a low-priority background queue. Concurrent calls share a single load.
+ @param queue The queue on which the completion will be called.
+ @param completion Called with the app receipt, or nil if there is no receipt or if it is invalid.
+ @see bundleReceipt
+ */
++ (void)loadBundleReceiptOnQueue:(dispatch_queue_t)queue completion:(void (^)(RMAppReceipt *receipt))completion;
+
+/** Returns the number of times bundleReceipt returned the cached receipt.
+ */
++ (NSUInteger)bundleReceiptCacheHits;
+
+/** Returns the number of times bundleReceipt had to read, verify and parse the receipt file.
+ */
++ (NSUInteger)bundleReceiptCacheMisses;
+
+/**
+ Enables or disables the persistent verification cache, which is disabled by default. When enabled, the bundle receipt that last passed signature verification is remembered across launches, and its signature is not verified again while the receipt file and the Apple Root certificate don't change. The cache is authenticated with a secret that is kept in the keychain and never leaves the device.
+ @param enabled YES to enable the cache, NO to disable it and forget the remembered receipt.
+ @see bundleReceipt
+ */
++ (void)setVerificationCacheEnabled:(BOOL)enabled;
+
+/**
+ Enables or disables snapshots of the bundle receipt, which are disabled by default. When enabled, a compact snapshot of the parsed bundle receipt is written to the caches directory after it is verified, and later launches restore the receipt from it without verifying or parsing the receipt file again, as long as the receipt file and the Apple Root certificate don't change. Otherwise the receipt is verified and parsed as usual. Snapshots are authenticated with the same keychain secret as the verification cache, and are only written when an Apple Root certificate is available.
+ @param enabled YES to enable snapshots, NO to disable them and delete the current snapshot.
+ @see bundleReceipt
+ */
++ (void)setSnapshotsEnabled:(BOOL)enabled;
+
+/**
+ Enables or disables the purchase table of receipts, which is disabled by default. When enabled, receipts also store the product, dates, quantity and web order line item ID of their in-app purchases in contiguous columns as they are parsed, which makes inAppPurchasesFromDate:toDate:, inAppPurchaseCountsByProductIdentifier and latestSubscriptionExpirationDatesByProductIdentifier much faster on large receipts at the cost of a slower parse. Only affects receipts created afterwards.
+ @param enabled YES to enable the purchase table, NO to disable it.
+ */
++ (void)setPurchaseTableEnabled:(BOOL)enabled;
+
+/**
+ Sets the url of the Apple Root certificate that will be used to verifiy the signature of the bundle receipt. If none is provided, the resource AppleIncRootCertificate.cer will be used. If no certificate is available, no signature verification will be performed. Setting it discards the cached bundle receipt.
  @param url The url of the Apple Root certificate.
  */
 + (void)setAppleRootCertificateURL:(NSURL*)url;
@@ -105,6 +215,8 @@ __attribute__((availability(ios,introduced=7.0)))
 @end
 
 /** Represents an in-app purchase in the app receipt.
+ 
+ In-app purchases share the data of the receipt they belong to. Their strings and dates are decoded the first time they are read.
  */
 @interface RMAppReceiptIAP : NSObject
 
@@ -176,3 +288,68 @@ __attribute__((availability(ios,introduced=7.0)))
 - (BOOL)isActiveAutoRenewableSubscriptionForDate:(NSDate*)date;
 
 @end
+
+/** The in-app purchases of an auto-renewable subscription that share the same original transaction identifier: the original purchase and its renewals.
+ */
+@interface RMAppReceiptRenewalChain : NSObject
+
+/** The original transaction identifier shared by the in-app purchases of the chain.
+ */
+@property (nonatomic, strong, readonly) NSString *originalTransactionIdentifier;
+
+/** Array of the in-app purchases of the chain, sorted by purchase date. In-app purchases with the same purchase date keep their order, and those without purchase date go first.
+ @see RMAppReceiptIAP
+ */
+@property (nonatomic, strong, readonly) NSArray *inAppPurchases;
+
+/** The in-app purchase of the chain with the earliest purchase date.
+ */
+@property (nonatomic, strong, readonly) RMAppReceiptIAP *head;
+
+/** The in-app purchase of the chain with the latest purchase date.
+ */
+@property (nonatomic, strong, readonly) RMAppReceiptIAP *tail;
+
+/** The number of in-app purchases of the chain.
+ */
+@property (nonatomic, readonly) NSUInteger count;
+
+/** Returns a renewal chain with the given in-app purchases.
+ @param inAppPurchases In-app purchases with the same original transaction identifier, in any order.
+ @return A renewal chain with the given in-app purchases.
+ */
+- (instancetype)initWithInAppPurchases:(NSArray*)inAppPurchases NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+/** The periods in which an auto-renewable subscription is active according to its in-app purchases. The subscription is active for a date if any of its in-app purchases is active for that date, as in isActiveAutoRenewableSubscriptionForDate:. Purchases that overlap or follow each other without a lapse form a single period.
+ 
+ The periods are merged and sorted when the timeline is created, so queries take logarithmic time in the number of in-app purchases.
+ */
+@interface RMAppReceiptSubscriptionTimeline : NSObject
+
+/** The number of separate periods in which the subscription is active.
+ */
+@property (nonatomic, readonly) NSUInteger periodCount;
+
+/** Returns a timeline from the given in-app purchases. In-app purchases without subscription expiration date or that were canceled are ignored.
+ @param inAppPurchases In-app purchases of the same auto-renewable subscription, in any order.
+ @return A timeline from the given in-app purchases.
+ */
+- (instancetype)initWithInAppPurchases:(NSArray*)inAppPurchases NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+/** Returns whether the subscription is active for the given date. Periods include both their start and their end.
+ @param date The date in which the auto-renewable subscription should be active.
+ @return YES if an in-app purchase of the subscription is active for the given date, NO otherwise.
+ */
+- (BOOL)isActiveForDate:(NSDate*)date;
+
+/** Returns the first start or end of a period after the given date. If the subscription is active for the given date, this is the date in which it lapses or expires, and otherwise the date in which it becomes active again.
+ @param date The date from which to look.
+ @return The first start or end of a period after the given date, or nil if there is none.
+ */
+- (NSDate*)nextChangeAfterDate:(NSDate*)date;
+
+@end
@@ -19,181 +19,497 @@
 //
 
 #import "RMAppReceipt.h"
+#import "RMAppReceiptCore.h"
+#import <Security/Security.h>
 #import <UIKit/UIKit.h>
-#import <openssl/pkcs7.h>
+#import <openssl/crypto.h>
+#import <openssl/hmac.h>
 #import <openssl/objects.h>
 #import <openssl/sha.h>
-#import <openssl/x509.h>
-
-// From https://developer.apple.com/library/ios/releasenotes/General/ValidateAppStoreReceipt/Chapters/ReceiptFields.html#//apple_ref/doc/uid/TP40010573-CH106-SW1
-NSInteger const RMAppReceiptASN1TypeBundleIdentifier = 2;
-NSInteger const RMAppReceiptASN1TypeAppVersion = 3;
-NSInteger const RMAppReceiptASN1TypeOpaqueValue = 4;
-NSInteger const RMAppReceiptASN1TypeHash = 5;
-NSInteger const RMAppReceiptASN1TypeInAppPurchaseReceipt = 17;
-NSInteger const RMAppReceiptASN1TypeOriginalAppVersion = 19;
-NSInteger const RMAppReceiptASN1TypeExpirationDate = 21;
-
-NSInteger const RMAppReceiptASN1TypeQuantity = 1701;
-NSInteger const RMAppReceiptASN1TypeProductIdentifier = 1702;
-NSInteger const RMAppReceiptASN1TypeTransactionIdentifier = 1703;
-NSInteger const RMAppReceiptASN1TypePurchaseDate = 1704;
-NSInteger const RMAppReceiptASN1TypeOriginalTransactionIdentifier = 1705;
-NSInteger const RMAppReceiptASN1TypeOriginalPurchaseDate = 1706;
-NSInteger const RMAppReceiptASN1TypeSubscriptionExpirationDate = 1708;
-NSInteger const RMAppReceiptASN1TypeWebOrderLineItemID = 1711;
-NSInteger const RMAppReceiptASN1TypeCancellationDate = 1712;
+#import <pthread.h>
+
+static NSString* const RMAppReceiptVerificationCacheKey = @"RMAppReceiptVerification";
+static NSString* const RMAppReceiptSnapshotFileName = @"RMAppReceipt.snapshot";
+
+@interface RMAppReceipt()
+
+/** Restores a receipt from a snapshot that was made from the given data.
+ @param snapshotData The mapping of a snapshot returned by RMReceiptSnapshotOpen.
+ */
+- (instancetype)initWithASN1Data:(NSData*)asn1Data snapshotData:(NSData*)snapshotData NS_DESIGNATED_INITIALIZER;
+
++ (NSDate*)dateFromRFC3339Bytes:(const uint8_t*)bytes length:(long)length;
+
++ (NSData*)SHA256DigestOfBytes:(const uint8_t*)bytes length:(NSUInteger)length;
+
+@end
 
 #pragma mark - ANS1
 
-static int RMASN1ReadInteger(const uint8_t **pp, long omax)
+static NSString* RMASN1ReadUTF8String(const uint8_t **pp, long omax)
 {
-    int tag, asn1Class;
     long length;
-    int value = 0;
-    ASN1_get_object(pp, &length, &tag, &asn1Class, omax);
-    if (tag == V_ASN1_INTEGER)
-    {
-        for (int i = 0; i < length; i++)
-        {
-            value = value * 0x100 + (*pp)[i];
-        }
-    }
-    *pp += length;
-    return value;
+    const uint8_t *bytes = RMReceiptASN1ReadString(pp, omax, V_ASN1_UTF8STRING, &length);
+    if (!bytes) return nil;
+    return [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
 }
 
-static NSData* RMASN1ReadOctectString(const uint8_t **pp, long omax)
+static NSDate* RMASN1ReadIA5SDate(const uint8_t **pp, long omax)
 {
-    int tag, asn1Class;
     long length;
-    NSData *data = nil;
-    ASN1_get_object(pp, &length, &tag, &asn1Class, omax);
-    if (tag == V_ASN1_OCTET_STRING)
-    {
-        data = [NSData dataWithBytes:*pp length:length];
-    }
-    *pp += length;
-    return data;
+    const uint8_t *bytes = RMReceiptASN1ReadString(pp, omax, V_ASN1_IA5STRING, &length);
+    if (!bytes) return nil;
+    return [RMAppReceipt dateFromRFC3339Bytes:bytes length:length];
 }
 
-static NSString* RMASN1ReadString(const uint8_t **pp, long omax, int expectedTag, NSStringEncoding encoding)
+static int64_t RMAppReceiptPurchaseTableDate(NSDate *date)
 {
-    int tag, asn1Class;
-    long length;
-    NSString *value = nil;
-    ASN1_get_object(pp, &length, &tag, &asn1Class, omax);
-    if (tag == expectedTag)
-    {
-        value = [[NSString alloc] initWithBytes:*pp length:length encoding:encoding];
-    }
-    *pp += length;
-    return value;
+    return date ? (int64_t)floor(date.timeIntervalSince1970) : RMReceiptPurchaseTableNoDate;
 }
 
-static NSString* RMASN1ReadUTF8String(const uint8_t **pp, long omax)
+static RMReceiptSnapshotRange RMAppReceiptSnapshotRangeMake(NSRange range)
+{
+    return (RMReceiptSnapshotRange){(uint32_t)range.location, (uint32_t)range.length};
+}
+
+static NSData* RMAppReceiptSnapshotData(const uint8_t *bytes, RMReceiptSnapshotRange range)
+{
+    return range.length > 0 ? [NSData dataWithBytes:bytes + range.offset length:range.length] : nil;
+}
+
+static NSString* RMAppReceiptSnapshotUTF8String(const uint8_t *bytes, RMReceiptSnapshotRange range)
+{
+    const uint8_t *p = bytes + range.offset;
+    return range.length > 0 ? RMASN1ReadUTF8String(&p, range.length) : nil;
+}
+
+#pragma mark - Keychain
+
+static NSMutableDictionary* RMAppReceiptKeychainGetSearchDictionary(void)
+{
+    NSMutableDictionary *dictionary = [NSMutableDictionary dictionary];
+    dictionary[(__bridge id)kSecClass] = (__bridge id)kSecClassGenericPassword;
+    dictionary[(__bridge id)kSecAttrService] = [NSBundle mainBundle].bundleIdentifier ? : @"RMStore";
+    dictionary[(__bridge id)kSecAttrAccount] = RMAppReceiptVerificationCacheKey;
+    return dictionary;
+}
+
+/** Returns the secret used to authenticate the verification cache and snapshots, creating it if needed. The secret never leaves the device, not even in backups.
+ */
+static NSData* RMAppReceiptKeychainGetVerificationSecret(void)
 {
-    return RMASN1ReadString(pp, omax, V_ASN1_UTF8STRING, NSUTF8StringEncoding);
+    NSMutableDictionary *searchDictionary = RMAppReceiptKeychainGetSearchDictionary();
+    searchDictionary[(__bridge id)kSecMatchLimit] = (__bridge id)kSecMatchLimitOne;
+    searchDictionary[(__bridge id)kSecReturnData] = (id)kCFBooleanTrue;
+    
+    CFTypeRef value = NULL;
+    OSStatus status = SecItemCopyMatching((__bridge CFDictionaryRef)searchDictionary, &value);
+    if (status == errSecSuccess) return (__bridge_transfer NSData*)value;
+    if (status != errSecItemNotFound)
+    {
+        NSLog(@"RMAppReceipt: failed to get the verification secret with error %ld.", (long)status);
+        return nil;
+    }
+    
+    NSMutableData *secret = [NSMutableData dataWithLength:32];
+    if (SecRandomCopyBytes(kSecRandomDefault, secret.length, (uint8_t*)secret.mutableBytes) != 0) return nil;
+    
+    NSMutableDictionary *addDictionary = RMAppReceiptKeychainGetSearchDictionary();
+    addDictionary[(__bridge id)kSecValueData] = secret;
+    addDictionary[(__bridge id)kSecAttrAccessible] = (__bridge id)kSecAttrAccessibleAfterFirstUnlockThisDeviceOnly;
+    status = SecItemAdd((__bridge CFDictionaryRef)addDictionary, NULL);
+    if (status == errSecDuplicateItem)
+    { // Created by a concurrent load
+        value = NULL;
+        status = SecItemCopyMatching((__bridge CFDictionaryRef)searchDictionary, &value);
+        if (status == errSecSuccess) return (__bridge_transfer NSData*)value;
+    }
+    if (status != errSecSuccess)
+    {
+        NSLog(@"RMAppReceipt: failed to add the verification secret with error %ld.", (long)status);
+        return nil;
+    }
+    return secret;
 }
 
-static NSString* RMASN1ReadIA5SString(const uint8_t **pp, long omax)
+static uuid_t _vendorIdentifierBytes;
+static BOOL _vendorIdentifierLoaded = NO;
+// Not the class lock, which loads of the receipt hold
+static pthread_mutex_t _vendorIdentifierLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Gets the bytes of the vendor identifier of the device. They are read once per process, as the identifier only changes when every app of the vendor is deleted.
+ @return NO if the identifier isn't available yet, e.g., after the device restarts and before it is unlocked.
+ */
+static BOOL RMAppReceiptGetVendorIdentifierBytes(uuid_t bytes)
 {
-    return RMASN1ReadString(pp, omax, V_ASN1_IA5STRING, NSASCIIStringEncoding);
+    pthread_mutex_lock(&_vendorIdentifierLock);
+    if (!_vendorIdentifierLoaded)
+    {
+        // TODO: Getting the uuid in Mac is different. See: https://developer.apple.com/library/ios/releasenotes/General/ValidateAppStoreReceipt/Chapters/ValidateLocally.html#//apple_ref/doc/uid/TP40010573-CH1-SW5
+        NSUUID *uuid = [UIDevice currentDevice].identifierForVendor;
+        if (uuid)
+        {
+            [uuid getUUIDBytes:_vendorIdentifierBytes];
+            _vendorIdentifierLoaded = YES;
+        }
+    }
+    // Not cached if the identifier isn't available, so that it is read again next time
+    const BOOL loaded = _vendorIdentifierLoaded;
+    if (loaded) memcpy(bytes, _vendorIdentifierBytes, sizeof(uuid_t));
+    pthread_mutex_unlock(&_vendorIdentifierLock);
+    return loaded;
 }
 
+/** Verification context of a root certificate. Loads hold on to it, so it outlives a change of certificate until they finish.
+ */
+@interface RMAppReceiptRootCertificate : NSObject
+
+- (instancetype)initWithURL:(NSURL*)URL;
+
+@property (nonatomic, readonly) RMReceiptVerifier *verifier; // NULL if there is no certificate to verify with
+@property (nonatomic, readonly) NSData *digest; // SHA256 of the certificate, or nil if there is none
+@property (nonatomic, readonly, getter=isValid) BOOL valid; // NO if the certificate is available but can't be decoded
+
+@end
+
+/** A load of the receipt at a path, which concurrent callers wait for instead of parsing the same receipt in parallel.
+ */
+@interface RMAppReceiptLoad : NSObject
+
+- (instancetype)initWithDigest:(NSData*)digest;
+
+@property (nonatomic, readonly) NSData *digest; // Of the receipt file being loaded
+
+- (void)finishWithReceipt:(RMAppReceipt*)receipt;
+
+- (RMAppReceipt*)waitForReceipt;
+
+@end
+
 static NSURL *_appleRootCertificateURL = nil;
 
-@implementation RMAppReceipt
+// Created on first use
+static RMAppReceiptRootCertificate *_rootCertificate = nil;
+// Changes with the root certificate, so that loads that started with the previous one don't update the cache
+static NSUInteger _rootCertificateGeneration = 0;
+
+static BOOL _verificationCacheEnabled = NO;
+
+static BOOL _snapshotsEnabled = NO;
+
+static BOOL _purchaseTableEnabled = NO;
+
+static BOOL _stringInterningEnabled = YES;
+
+// In-app purchases are parsed in parallel from this count on
+static const NSUInteger RMAppReceiptParallelParsingThreshold = 1000;
+static NSUInteger _parsingConcurrency = 0; // 0 uses all active processors
+
+// Completions waiting for the next bundle receipt load
+static NSMutableArray *_pendingLoadCompletions = nil;
+
+// Loads in progress by path
+static NSMutableDictionary *_receiptLoads = nil;
+
+// Process-wide cache of the last parsed receipt, keyed by the identity of its file
+static RMAppReceipt *_cachedReceipt = nil;
+static NSString *_cachedReceiptPath = nil;
+static unsigned long long _cachedReceiptFileSize = 0;
+static NSDate *_cachedReceiptModificationDate = nil;
+static NSData *_cachedReceiptDigest = nil;
+static NSUInteger _cachedReceiptHits = 0;
+static NSUInteger _cachedReceiptMisses = 0;
+
+/** Interned strings of a receipt, for the product and original transaction identifiers that repeat across its in-app purchases. Each distinct string is decoded once, and its characters are stored without copying in a string pool that is freed once the table and all of its strings are gone.
+ */
+@interface RMAppReceiptStringTable : NSObject
+
+- (NSString*)stringWithUTF8Bytes:(const uint8_t*)bytes length:(long)length;
+
+@end
+
+@interface RMAppReceiptIAP()
+
+- (instancetype)initWithASN1Data:(NSData*)asn1Data range:(NSRange)range strings:(RMAppReceiptStringTable*)strings NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)initWithInAppPurchase:(RMAppReceiptIAP*)purchase ASN1Data:(NSData*)asn1Data range:(NSRange)range strings:(RMAppReceiptStringTable*)strings NS_DESIGNATED_INITIALIZER;
+
+/** Restores an in-app purchase from its record in a snapshot. The record must stay alive as long as the snapshot data.
+ */
+- (instancetype)initWithASN1Data:(NSData*)asn1Data snapshotData:(NSData*)snapshotData record:(const RMReceiptSnapshotPurchase*)record strings:(RMAppReceiptStringTable*)strings NS_DESIGNATED_INITIALIZER;
+
+- (const uint8_t*)ASN1BytesWithLength:(long*)length;
+
+- (void)getSnapshotPurchase:(RMReceiptSnapshotPurchase*)record;
+
+- (BOOL)getPurchaseInterval:(NSTimeInterval*)interval;
+
+- (BOOL)getSubscriptionExpirationInterval:(NSTimeInterval*)interval;
+
+@end
+
+@implementation RMAppReceipt {
+    NSData *_asn1Data;
+    NSDictionary *_purchasesByProductIdentifier;
+    NSDictionary *_latestSubscriptionsByProductIdentifier;
+    NSDictionary *_renewalChainsByOriginalTransactionIdentifier;
+    RMReceiptPurchaseTable *_purchaseTable; // NULL unless enabled
+    NSMutableDictionary *_subscriptionTimelines; // By product identifier, built on demand. NSNull for products that are not subscriptions.
+}
 
 - (instancetype)initWithASN1Data:(NSData*)asn1Data
+{
+    return [self initWithASN1Data:asn1Data previousReceipt:nil];
+}
+
+- (instancetype)initWithASN1Data:(NSData*)asn1Data previousReceipt:(RMAppReceipt*)previousReceipt
 {
     if (self = [super init])
     {
-        NSMutableArray *purchases = [NSMutableArray array];
-         // Explicit casting to avoid errors when compiling as Objective-C++
-        [RMAppReceipt enumerateASN1Attributes:(const uint8_t*)asn1Data.bytes length:asn1Data.length usingBlock:^(NSData *data, int type) {
-            const uint8_t *s = (const uint8_t*)data.bytes;
-            const NSUInteger length = data.length;
+        // Keep a single backing buffer. In-app purchases only hold ranges into it and decode their fields on demand.
+        _asn1Data = [asn1Data copy];
+        NSMutableData *purchaseRanges = [NSMutableData data];
+        // Explicit casting to avoid errors when compiling as Objective-C++
+        const uint8_t *bytes = (const uint8_t*)_asn1Data.bytes;
+        [RMAppReceipt enumerateASN1Attributes:bytes length:_asn1Data.length usingBlock:^(const uint8_t *value, long length, int type) {
+            const uint8_t *s = value;
             switch (type)
             {
-                case RMAppReceiptASN1TypeBundleIdentifier:
-                    _bundleIdentifierData = data;
+                case RMReceiptAttributeTypeBundleIdentifier:
+                    _bundleIdentifierData = [NSData dataWithBytes:value length:length];
                     _bundleIdentifier = RMASN1ReadUTF8String(&s, length);
                     break;
-                case RMAppReceiptASN1TypeAppVersion:
+                case RMReceiptAttributeTypeAppVersion:
                     _appVersion = RMASN1ReadUTF8String(&s, length);
                     break;
-                case RMAppReceiptASN1TypeOpaqueValue:
-                    _opaqueValue = data;
+                case RMReceiptAttributeTypeOpaqueValue:
+                    _opaqueValue = [NSData dataWithBytes:value length:length];
                     break;
-                case RMAppReceiptASN1TypeHash:
-                    _receiptHash = data;
+                case RMReceiptAttributeTypeHash:
+                    _receiptHash = [NSData dataWithBytes:value length:length];
                     break;
-                case RMAppReceiptASN1TypeInAppPurchaseReceipt:
+                case RMReceiptAttributeTypeInAppPurchaseReceipt:
                 {
-                    RMAppReceiptIAP *purchase = [[RMAppReceiptIAP alloc] initWithASN1Data:data];
-                    [purchases addObject:purchase];
+                    // In-app purchases are independent of each other, so they are parsed once all of them are found
+                    const NSRange range = NSMakeRange(value - bytes, length);
+                    [purchaseRanges appendBytes:&range length:sizeof(range)];
                     break;
                 }
-                case RMAppReceiptASN1TypeOriginalAppVersion:
+                case RMReceiptAttributeTypeOriginalAppVersion:
                     _originalAppVersion = RMASN1ReadUTF8String(&s, length);
                     break;
-                case RMAppReceiptASN1TypeExpirationDate:
+                case RMReceiptAttributeTypeExpirationDate:
                 {
-                    NSString *string = RMASN1ReadIA5SString(&s, length);
-                    _expirationDate = [RMAppReceipt formatRFC3339String:string];
+                    _expirationDate = RMASN1ReadIA5SDate(&s, length);
                     break;
                 }
             }
         }];
-        _inAppPurchases = purchases;
+        RMAppReceiptStringTable *strings = _stringInterningEnabled ? [[RMAppReceiptStringTable alloc] init] : nil;
+        _inAppPurchases = [RMAppReceipt inAppPurchasesWithASN1Data:_asn1Data ranges:(const NSRange*)purchaseRanges.bytes count:purchaseRanges.length / sizeof(NSRange) strings:strings previousPurchases:previousReceipt.inAppPurchases];
+        [self indexInAppPurchases];
+        [self createPurchaseTableIfEnabled];
     }
     return self;
 }
 
-- (BOOL)containsInAppPurchaseOfProductIdentifier:(NSString*)productIdentifier
+- (instancetype)initWithASN1Data:(NSData*)asn1Data snapshotData:(NSData*)snapshotData
 {
-    for (RMAppReceiptIAP *purchase in _inAppPurchases)
+    if (self = [super init])
     {
-        if ([purchase.productIdentifier isEqualToString:productIdentifier]) return YES;
+        // The snapshot has the ranges and decoded values that parsing would find, so nothing is enumerated
+        _asn1Data = asn1Data;
+        // Explicit casting to avoid errors when compiling as Objective-C++
+        const uint8_t *bytes = (const uint8_t*)_asn1Data.bytes;
+        const RMReceiptSnapshotHeader *header = (const RMReceiptSnapshotHeader*)snapshotData.bytes;
+        _bundleIdentifierData = RMAppReceiptSnapshotData(bytes, header->bundleIdentifier);
+        _bundleIdentifier = RMAppReceiptSnapshotUTF8String(bytes, header->bundleIdentifier);
+        _appVersion = RMAppReceiptSnapshotUTF8String(bytes, header->appVersion);
+        _opaqueValue = RMAppReceiptSnapshotData(bytes, header->opaqueValue);
+        _receiptHash = RMAppReceiptSnapshotData(bytes, header->receiptHash);
+        _originalAppVersion = RMAppReceiptSnapshotUTF8String(bytes, header->originalAppVersion);
+        _expirationDate = isnan(header->expirationDate) ? nil : [NSDate dateWithTimeIntervalSince1970:header->expirationDate];
+        
+        const RMReceiptSnapshotPurchase *records = (const RMReceiptSnapshotPurchase*)((const uint8_t*)snapshotData.bytes + header->purchasesOffset);
+        const NSUInteger count = (NSUInteger)header->purchaseCount;
+        RMAppReceiptStringTable *strings = _stringInterningEnabled ? [[RMAppReceiptStringTable alloc] init] : nil;
+        NSMutableArray *purchases = [NSMutableArray arrayWithCapacity:count];
+        for (NSUInteger i = 0; i < count; i++)
+        {
+            RMAppReceiptIAP *purchase = [[RMAppReceiptIAP alloc] initWithASN1Data:_asn1Data snapshotData:snapshotData record:&records[i] strings:strings];
+            [purchases addObject:purchase];
+        }
+        _inAppPurchases = [purchases copy];
+        [self indexInAppPurchases];
+        [self createPurchaseTableIfEnabled];
     }
-    return NO;
+    return self;
+}
+
+- (void)dealloc
+{
+    RMReceiptPurchaseTableFree(_purchaseTable);
+}
+
+- (NSArray*)inAppPurchasesOfProductIdentifier:(NSString*)productIdentifier
+{
+    NSArray *purchases = productIdentifier ? _purchasesByProductIdentifier[productIdentifier] : nil;
+    return purchases ? : @[];
+}
+
+- (BOOL)containsInAppPurchaseOfProductIdentifier:(NSString*)productIdentifier
+{
+    return productIdentifier && _purchasesByProductIdentifier[productIdentifier] != nil;
 }
 
 -(BOOL)containsActiveAutoRenewableSubscriptionOfProductIdentifier:(NSString *)productIdentifier forDate:(NSDate *)date
 {
-    RMAppReceiptIAP *lastTransaction = nil;
+    RMAppReceiptIAP *lastTransaction = productIdentifier ? _latestSubscriptionsByProductIdentifier[productIdentifier] : nil;
+    return [lastTransaction isActiveAutoRenewableSubscriptionForDate:date];
+}
+
+- (RMAppReceiptRenewalChain*)renewalChainOfOriginalTransactionIdentifier:(NSString*)originalTransactionIdentifier
+{
+    return originalTransactionIdentifier ? _renewalChainsByOriginalTransactionIdentifier[originalTransactionIdentifier] : nil;
+}
+
+- (RMAppReceiptSubscriptionTimeline*)subscriptionTimelineOfProductIdentifier:(NSString*)productIdentifier
+{
+    if (!productIdentifier) return nil;
     
-    for (RMAppReceiptIAP *iap in self.inAppPurchases)
+    @synchronized(self)
     {
-        if (![iap.productIdentifier isEqualToString:productIdentifier]) continue;
+        id timeline = _subscriptionTimelines[productIdentifier];
+        if (timeline) return timeline == [NSNull null] ? nil : timeline;
+        
+        // The latest subscription only lacks an expiration date if all the purchases of the product do
+        NSTimeInterval interval;
+        const BOOL subscription = [_latestSubscriptionsByProductIdentifier[productIdentifier] getSubscriptionExpirationInterval:&interval];
+        timeline = subscription ? [[RMAppReceiptSubscriptionTimeline alloc] initWithInAppPurchases:_purchasesByProductIdentifier[productIdentifier]] : [NSNull null];
+        if (!timeline) return nil;
         
-        if (!lastTransaction || [iap.subscriptionExpirationDate compare:lastTransaction.subscriptionExpirationDate] == NSOrderedDescending)
+        if (!_subscriptionTimelines) _subscriptionTimelines = [NSMutableDictionary dictionary];
+        _subscriptionTimelines[productIdentifier] = timeline;
+        return timeline == [NSNull null] ? nil : timeline;
+    }
+}
+
+- (NSArray*)inAppPurchasesFromDate:(NSDate*)startDate toDate:(NSDate*)endDate
+{
+    NSParameterAssert(startDate);
+    NSParameterAssert(endDate);
+    if (!_purchaseTable)
+    {
+        NSMutableArray *purchases = [NSMutableArray array];
+        for (RMAppReceiptIAP *purchase in _inAppPurchases)
         {
-            lastTransaction = iap;
+            NSDate *purchaseDate = purchase.purchaseDate;
+            if (purchaseDate && [purchaseDate compare:startDate] != NSOrderedAscending && [purchaseDate compare:endDate] == NSOrderedAscending)
+            {
+                [purchases addObject:purchase];
+            }
         }
+        return purchases;
     }
     
-    return [lastTransaction isActiveAutoRenewableSubscriptionForDate:date];
+    // Purchase dates are whole seconds
+    const int64_t start = (int64_t)ceil(startDate.timeIntervalSince1970);
+    const int64_t end = (int64_t)ceil(endDate.timeIntervalSince1970);
+    long *rows = (long*)malloc(MAX(_purchaseTable->count, 1) * sizeof(long)); // Explicit casting to avoid errors when compiling as Objective-C++
+    if (!rows) return @[];
+    const long count = RMReceiptPurchaseTableSelectPurchasesBetween(_purchaseTable, start, end, rows);
+    NSMutableArray *purchases = [NSMutableArray arrayWithCapacity:count];
+    for (long i = 0; i < count; i++)
+    {
+        [purchases addObject:_inAppPurchases[rows[i]]];
+    }
+    free(rows);
+    return purchases;
 }
 
-- (BOOL)verifyReceiptHash
+- (NSDictionary*)inAppPurchaseCountsByProductIdentifier
+{
+    NSMutableDictionary *counts = [NSMutableDictionary dictionary];
+    if (!_purchaseTable)
+    {
+        for (RMAppReceiptIAP *purchase in _inAppPurchases)
+        {
+            NSString *productIdentifier = purchase.productIdentifier;
+            if (!productIdentifier) continue;
+            
+            counts[productIdentifier] = @([counts[productIdentifier] integerValue] + 1);
+        }
+        return counts;
+    }
+    
+    long *productCounts = (long*)calloc(MAX(_purchaseTable->productCount, 1), sizeof(long)); // Explicit casting to avoid errors when compiling as Objective-C++
+    if (!productCounts) return counts;
+    RMReceiptPurchaseTableCountProducts(_purchaseTable, productCounts);
+    for (long i = 0; i < _purchaseTable->productCount; i++)
+    {
+        NSString *productIdentifier = [self productIdentifierAtIndex:i];
+        if (productIdentifier) counts[productIdentifier] = @(productCounts[i]);
+    }
+    free(productCounts);
+    return counts;
+}
+
+- (NSDictionary*)latestSubscriptionExpirationDatesByProductIdentifier
 {
-    // TODO: Getting the uuid in Mac is different. See: https://developer.apple.com/library/ios/releasenotes/General/ValidateAppStoreReceipt/Chapters/ValidateLocally.html#//apple_ref/doc/uid/TP40010573-CH1-SW5
-    NSUUID *uuid = [UIDevice currentDevice].identifierForVendor;
-    unsigned char uuidBytes[16];
-    [uuid getUUIDBytes:uuidBytes];
+    NSMutableDictionary *dates = [NSMutableDictionary dictionary];
+    if (!_purchaseTable)
+    {
+        for (RMAppReceiptIAP *purchase in _inAppPurchases)
+        {
+            NSString *productIdentifier = purchase.productIdentifier;
+            NSDate *expirationDate = purchase.subscriptionExpirationDate;
+            if (!productIdentifier || !expirationDate) continue;
+            
+            NSDate *latestDate = dates[productIdentifier];
+            if (!latestDate || [expirationDate compare:latestDate] == NSOrderedDescending)
+            {
+                dates[productIdentifier] = expirationDate;
+            }
+        }
+        return dates;
+    }
     
-    // Order taken from: https://developer.apple.com/library/ios/releasenotes/General/ValidateAppStoreReceipt/Chapters/ValidateLocally.html#//apple_ref/doc/uid/TP40010573-CH1-SW5
-    NSMutableData *data = [NSMutableData data];
-    [data appendBytes:uuidBytes length:sizeof(uuidBytes)];
-    [data appendData:self.opaqueValue];
-    [data appendData:self.bundleIdentifierData];
+    int64_t *latest = (int64_t*)malloc(MAX(_purchaseTable->productCount, 1) * sizeof(int64_t)); // Explicit casting to avoid errors when compiling as Objective-C++
+    if (!latest) return dates;
+    RMReceiptPurchaseTableGetLatestExpirations(_purchaseTable, latest);
+    for (long i = 0; i < _purchaseTable->productCount; i++)
+    {
+        if (latest[i] == RMReceiptPurchaseTableNoDate) continue;
+        
+        NSString *productIdentifier = [self productIdentifierAtIndex:i];
+        if (productIdentifier) dates[productIdentifier] = [NSDate dateWithTimeIntervalSince1970:latest[i]];
+    }
+    free(latest);
+    return dates;
+}
+
++ (BOOL)containsInAppPurchaseOfProductIdentifier:(NSString*)productIdentifier inASN1Data:(NSData*)asn1Data
+{
+    NSData *productIdentifierData = [productIdentifier dataUsingEncoding:NSUTF8StringEncoding];
+    if (!productIdentifierData) return NO;
     
-    NSMutableData *expectedHash = [NSMutableData dataWithLength:SHA_DIGEST_LENGTH];
-    SHA1((const uint8_t*)data.bytes, data.length, (uint8_t*)expectedHash.mutableBytes); // Explicit casting to avoid errors when compiling as Objective-C++
+    // Explicit casting to avoid errors when compiling as Objective-C++
+    return RMReceiptContainsProduct((const uint8_t*)asn1Data.bytes, (long)asn1Data.length, (const char*)productIdentifierData.bytes, (long)productIdentifierData.length) != 0;
+}
+
+- (BOOL)verifyReceiptHash
+{
+    uuid_t uuidBytes;
+    if (!RMAppReceiptGetVendorIdentifierBytes(uuidBytes)) return NO;
     
-    return [expectedHash isEqualToData:self.receiptHash];
+    NSData *opaqueValue = self.opaqueValue;
+    NSData *bundleIdentifierData = self.bundleIdentifierData;
+    NSData *receiptHash = self.receiptHash;
+    // Explicit casting to avoid errors when compiling as Objective-C++
+    return RMReceiptVerifyHash(uuidBytes,
+                               (const uint8_t*)opaqueValue.bytes, (long)opaqueValue.length,
+                               (const uint8_t*)bundleIdentifierData.bytes, (long)bundleIdentifierData.length,
+                               (const uint8_t*)receiptHash.bytes, (long)receiptHash.length) != 0;
 }
 
 + (RMAppReceipt*)bundleReceipt
@@ -203,183 +519,1166 @@ static NSURL *_appleRootCertificateURL = nil;
     const BOOL exists = [[NSFileManager defaultManager] fileExistsAtPath:path isDirectory:nil];
     if (!exists) return nil;
     
-    NSData *data = [RMAppReceipt dataFromPCKS7Path:path];
-    if (!data) return nil;
+    return [RMAppReceipt cachedReceiptAtPath:path];
+}
+
++ (void)loadBundleReceiptWithCompletion:(void (^)(RMAppReceipt *receipt))completion
+{
+    [RMAppReceipt loadBundleReceiptOnQueue:dispatch_get_main_queue() completion:completion];
+}
+
++ (void)loadBundleReceiptOnQueue:(dispatch_queue_t)queue completion:(void (^)(RMAppReceipt *receipt))completion
+{
+    NSParameterAssert(queue);
+    NSParameterAssert(completion);
+    static dispatch_queue_t loadQueue;
+    static NSObject *loadLock;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        loadQueue = dispatch_queue_create("net.robotmedia.RMAppReceipt.load", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(loadQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0));
+        loadLock = [[NSObject alloc] init];
+    });
+    
+    void (^delivery)(RMAppReceipt *receipt) = ^(RMAppReceipt *receipt) {
+        dispatch_async(queue, ^{
+            completion(receipt);
+        });
+    };
+    BOOL scheduled;
+    @synchronized(loadLock)
+    {
+        // Callers that arrive before the load starts join it. Later callers schedule the next load, which is a cache hit if the receipt didn't change.
+        scheduled = _pendingLoadCompletions != nil;
+        if (!scheduled) _pendingLoadCompletions = [NSMutableArray array];
+        [_pendingLoadCompletions addObject:[delivery copy]];
+    }
+    if (scheduled) return;
     
-    RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
-    return receipt;
+    dispatch_async(loadQueue, ^{
+        NSArray *deliveries;
+        @synchronized(loadLock)
+        {
+            deliveries = _pendingLoadCompletions;
+            _pendingLoadCompletions = nil;
+        }
+        RMAppReceipt *receipt = [RMAppReceipt bundleReceipt];
+        for (void (^delivery)(RMAppReceipt *receipt) in deliveries)
+        {
+            delivery(receipt);
+        }
+    });
+}
+
++ (NSUInteger)bundleReceiptCacheHits
+{
+    @synchronized([RMAppReceipt class])
+    {
+        return _cachedReceiptHits;
+    }
+}
+
++ (NSUInteger)bundleReceiptCacheMisses
+{
+    @synchronized([RMAppReceipt class])
+    {
+        return _cachedReceiptMisses;
+    }
+}
+
++ (void)setVerificationCacheEnabled:(BOOL)enabled
+{
+    @synchronized([RMAppReceipt class])
+    {
+        _verificationCacheEnabled = enabled;
+        if (!enabled)
+        {
+            [[NSUserDefaults standardUserDefaults] removeObjectForKey:RMAppReceiptVerificationCacheKey];
+        }
+    }
+}
+
++ (void)setSnapshotsEnabled:(BOOL)enabled
+{
+    @synchronized([RMAppReceipt class])
+    {
+        _snapshotsEnabled = enabled;
+    }
+    if (!enabled)
+    { // After any pending write
+        dispatch_sync([RMAppReceipt snapshotQueue], ^{
+            [[NSFileManager defaultManager] removeItemAtPath:[RMAppReceipt snapshotPath] error:nil];
+        });
+    }
+}
+
++ (void)setPurchaseTableEnabled:(BOOL)enabled
+{
+    @synchronized([RMAppReceipt class])
+    {
+        _purchaseTableEnabled = enabled;
+    }
 }
 
 + (void)setAppleRootCertificateURL:(NSURL*)url
 {
-    _appleRootCertificateURL = url;
+    @synchronized([RMAppReceipt class])
+    {
+        _appleRootCertificateURL = url;
+        // The cached receipt was verified with the previous certificate
+        _cachedReceipt = nil;
+        _rootCertificate = nil;
+        _rootCertificateGeneration++;
+    }
 }
 
 #pragma mark - Utils
 
-+ (NSData*)dataFromPCKS7Path:(NSString*)path
++ (NSArray*)inAppPurchasesWithASN1Data:(NSData*)asn1Data ranges:(const NSRange*)ranges count:(NSUInteger)count strings:(RMAppReceiptStringTable*)strings previousPurchases:(NSArray*)previousPurchases
 {
-    const char *cpath = path.stringByStandardizingPath.fileSystemRepresentation;
-    FILE *fp = fopen(cpath, "rb");
-    if (!fp) return nil;
+    if (count == 0) return @[];
     
-    PKCS7 *p7 = d2i_PKCS7_fp(fp, NULL);
-    fclose(fp);
+    long *matches = previousPurchases.count > 0 ? [RMAppReceipt matchesOfRanges:ranges count:count inASN1Data:asn1Data previousPurchases:previousPurchases] : NULL;
     
-    if (!p7) return nil;
+    NSUInteger concurrency = 1;
+    if (count >= RMAppReceiptParallelParsingThreshold)
+    {
+        concurrency = _parsingConcurrency > 0 ? _parsingConcurrency : [NSProcessInfo processInfo].activeProcessorCount;
+        concurrency = MIN(concurrency, count);
+    }
     
-    NSData *data;
-    NSURL *certificateURL = _appleRootCertificateURL ? : [[NSBundle mainBundle] URLForResource:@"AppleIncRootCertificate" withExtension:@"cer"];
-    NSData *certificateData = [NSData dataWithContentsOfURL:certificateURL];
-    if (!certificateData || [self verifyPCKS7:p7 withCertificateData:certificateData])
+    __strong RMAppReceiptIAP **purchases = (__strong RMAppReceiptIAP **)calloc(count, sizeof(RMAppReceiptIAP*));
+    if (!purchases)
     {
-        struct pkcs7_st *contents = p7->d.sign->contents;
-        if (PKCS7_type_is_data(contents))
+        free(matches);
+        return @[];
+    }
+    void (^parseChunk)(size_t chunk) = ^(size_t chunk) {
+        // Contiguous chunks keep the order of the receipt without any further sorting
+        const NSUInteger start = count * chunk / concurrency;
+        const NSUInteger end = count * (chunk + 1) / concurrency;
+        for (NSUInteger i = start; i < end; i++)
         {
-            ASN1_OCTET_STRING *octets = contents->d.data;
-            data = [NSData dataWithBytes:octets->data length:octets->length];
+            // Unchanged purchases take what the previous receipt already decoded
+            RMAppReceiptIAP *purchase = matches && matches[i] >= 0 ?
+                [[RMAppReceiptIAP alloc] initWithInAppPurchase:previousPurchases[matches[i]] ASN1Data:asn1Data range:ranges[i] strings:strings] :
+                [[RMAppReceiptIAP alloc] initWithASN1Data:asn1Data range:ranges[i] strings:strings];
+            if (!strings)
+            { // Needed by the index, so decode them here while in parallel
+                [purchase productIdentifier];
+                [purchase originalTransactionIdentifier];
+            }
+            purchases[i] = purchase;
         }
+    };
+    if (concurrency > 1)
+    {
+        dispatch_apply(concurrency, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), parseChunk);
     }
-    PKCS7_free(p7);
-    return data;
-}
-
-+ (BOOL)verifyPCKS7:(PKCS7*)container withCertificateData:(NSData*)certificateData
-{ // Based on: https://developer.apple.com/library/ios/releasenotes/General/ValidateAppStoreReceipt/Chapters/ValidateLocally.html#//apple_ref/doc/uid/TP40010573-CH1-SW17
-    static int verified = 1;
-    int result = 0;
-    OpenSSL_add_all_digests(); // Required for PKCS7_verify to work
-    X509_STORE *store = X509_STORE_new();
-    if (store)
+    else
     {
-        const uint8_t *certificateBytes = (uint8_t *)(certificateData.bytes);
-        X509 *certificate = d2i_X509(NULL, &certificateBytes, (long)certificateData.length);
-        if (certificate)
+        parseChunk(0);
+    }
+    if (strings)
+    { // Interned in a serial pass, so that the workers don't contend for the table. Repeated identifiers are only a lookup.
+        for (NSUInteger i = 0; i < count; i++)
         {
-            X509_STORE_add_cert(store, certificate);
-            
-            BIO *payload = BIO_new(BIO_s_mem());
-            result = PKCS7_verify(container, NULL, store, NULL, payload, 0);
-            BIO_free(payload);
-            
-            X509_free(certificate);
+            [purchases[i] productIdentifier];
+            [purchases[i] originalTransactionIdentifier];
         }
     }
-    X509_STORE_free(store);
-    EVP_cleanup(); // Balances OpenSSL_add_all_digests (), perhttp://www.openssl.org/docs/crypto/OpenSSL_add_all_algorithms.html
     
-    return result == verified;
+    NSArray *result = [NSArray arrayWithObjects:purchases count:count];
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        purchases[i] = nil;
+    }
+    free(purchases);
+    free(matches);
+    return result;
 }
 
-/*
- Based on https://github.com/rmaddy/VerifyStoreReceiptiOS
+/** Returns the index of the previous in-app purchase with the same bytes as each range, or -1 if there is none. Free the result with free.
  */
-+ (void)enumerateASN1Attributes:(const uint8_t*)p length:(long)tlength usingBlock:(void (^)(NSData *data, int type))block
++ (long*)matchesOfRanges:(const NSRange*)ranges count:(NSUInteger)count inASN1Data:(NSData*)asn1Data previousPurchases:(NSArray*)previousPurchases
 {
-    int type, tag;
-    long length;
-    
-    const uint8_t *end = p + tlength;
-    
-    ASN1_get_object(&p, &length, &type, &tag, end - p);
-    if (type != V_ASN1_SET) return;
-    
-    while (p < end)
+    const NSUInteger previousCount = previousPurchases.count;
+    // Explicit casting to avoid errors when compiling as Objective-C++
+    const uint8_t **previousEntries = (const uint8_t**)malloc(previousCount * sizeof(uint8_t*));
+    long *previousLengths = (long*)malloc(previousCount * sizeof(long));
+    const uint8_t **entries = (const uint8_t**)malloc(count * sizeof(uint8_t*));
+    long *lengths = (long*)malloc(count * sizeof(long));
+    long *matches = (long*)malloc(count * sizeof(long));
+    if (previousEntries && previousLengths && entries && lengths && matches)
     {
-        ASN1_get_object(&p, &length, &type, &tag, end - p);
-        if (type != V_ASN1_SEQUENCE) break;
-        
-        const uint8_t *sequenceEnd = p + length;
-        
-        const int attributeType = RMASN1ReadInteger(&p, sequenceEnd - p);
-        RMASN1ReadInteger(&p, sequenceEnd - p); // Consume attribute version
-        
-        NSData *data = RMASN1ReadOctectString(&p, sequenceEnd - p);
-        if (data)
+        for (NSUInteger i = 0; i < previousCount; i++)
         {
-            block(data, attributeType);
+            RMAppReceiptIAP *purchase = previousPurchases[i];
+            previousEntries[i] = [purchase ASN1BytesWithLength:&previousLengths[i]];
         }
-        
-        while (p < sequenceEnd)
-        { // Skip remaining fields
-            ASN1_get_object(&p, &length, &type, &tag, sequenceEnd - p);
-            p += length;
+        const uint8_t *bytes = (const uint8_t*)asn1Data.bytes;
+        for (NSUInteger i = 0; i < count; i++)
+        {
+            entries[i] = bytes + ranges[i].location;
+            lengths[i] = ranges[i].length;
         }
+        RMReceiptMatchEntries(previousEntries, previousLengths, previousCount, entries, lengths, count, matches);
     }
+    else
+    {
+        free(matches);
+        matches = NULL;
+    }
+    free(previousEntries);
+    free(previousLengths);
+    free(entries);
+    free(lengths);
+    return matches;
 }
 
-+ (NSDate*)formatRFC3339String:(NSString*)string
++ (void)setParsingConcurrency:(NSUInteger)concurrency
 {
-    static NSDateFormatter *formatter;
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        formatter = [[NSDateFormatter alloc] init];
-        formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
-        formatter.dateFormat = @"yyyy-MM-dd'T'HH:mm:ssZ";
-    });
-    NSDate *date = [formatter dateFromString:string];
-    return date;
+    _parsingConcurrency = concurrency;
 }
 
-@end
++ (void)setStringInterningEnabled:(BOOL)enabled
+{
+    _stringInterningEnabled = enabled;
+}
 
-@implementation RMAppReceiptIAP
+- (void)createPurchaseTableIfEnabled
+{
+    BOOL purchaseTableEnabled;
+    @synchronized([RMAppReceipt class])
+    {
+        purchaseTableEnabled = _purchaseTableEnabled;
+    }
+    if (purchaseTableEnabled)
+    {
+        _purchaseTable = [self createPurchaseTable];
+    }
+}
 
-- (instancetype)initWithASN1Data:(NSData*)asn1Data
+/** Creates the purchase table of the receipt. Dates that the table can't parse are taken from the in-app purchases, so that the table always agrees with them.
+ */
+- (RMReceiptPurchaseTable*)createPurchaseTable
 {
-    if (self = [super init])
+    // Explicit casting to avoid errors when compiling as Objective-C++
+    RMReceiptPurchaseTable *table = RMReceiptPurchaseTableCreate((const uint8_t*)_asn1Data.bytes, (long)_asn1Data.length);
+    if (!table) return NULL;
+    if (table->count != (long)_inAppPurchases.count)
     {
-        // Explicit casting to avoid errors when compiling as Objective-C++
-        [RMAppReceipt enumerateASN1Attributes:(const uint8_t*)asn1Data.bytes length:asn1Data.length usingBlock:^(NSData *data, int type) {
-            const uint8_t *p = (const uint8_t*)data.bytes;
-            const NSUInteger length = data.length;
-            switch (type)
-            {
-                case RMAppReceiptASN1TypeQuantity:
-                    _quantity = RMASN1ReadInteger(&p, length);
-                    break;
-                case RMAppReceiptASN1TypeProductIdentifier:
-                    _productIdentifier = RMASN1ReadUTF8String(&p, length);
-                    break;
-                case RMAppReceiptASN1TypeTransactionIdentifier:
-                    _transactionIdentifier = RMASN1ReadUTF8String(&p, length);
-                    break;
-                case RMAppReceiptASN1TypePurchaseDate:
+        RMReceiptPurchaseTableFree(table);
+        return NULL;
+    }
+    if (table->unparsedDateCount == 0) return table;
+    
+    for (long i = 0; i < table->count; i++)
+    {
+        RMAppReceiptIAP *purchase = _inAppPurchases[i];
+        if (table->purchaseDates[i] == RMReceiptPurchaseTableUnparsedDate) table->purchaseDates[i] = RMAppReceiptPurchaseTableDate(purchase.purchaseDate);
+        if (table->originalPurchaseDates[i] == RMReceiptPurchaseTableUnparsedDate) table->originalPurchaseDates[i] = RMAppReceiptPurchaseTableDate(purchase.originalPurchaseDate);
+        if (table->expirationDates[i] == RMReceiptPurchaseTableUnparsedDate) table->expirationDates[i] = RMAppReceiptPurchaseTableDate(purchase.subscriptionExpirationDate);
+        if (table->cancellationDates[i] == RMReceiptPurchaseTableUnparsedDate) table->cancellationDates[i] = RMAppReceiptPurchaseTableDate(purchase.cancellationDate);
+    }
+    table->unparsedDateCount = 0;
+    return table;
+}
+
+- (NSString*)productIdentifierAtIndex:(long)index
+{
+    return [[NSString alloc] initWithBytes:_purchaseTable->productIdentifiers[index] length:_purchaseTable->productIdentifierLengths[index] encoding:NSUTF8StringEncoding];
+}
+
++ (RMAppReceipt*)cachedReceiptAtPath:(NSString*)path
+{
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:nil];
+    NSData *contents = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:nil];
+    if (!attributes || !contents) return nil;
+    // Explicit casting to avoid errors when compiling as Objective-C++
+    NSData *digest = [RMAppReceipt SHA256DigestOfBytes:(const uint8_t*)contents.bytes length:contents.length];
+    
+    const unsigned long long fileSize = attributes.fileSize;
+    NSDate *modificationDate = attributes.fileModificationDate;
+    // Only the cache lookup and update hold the class lock. Reading, verifying and parsing happen outside of it.
+    RMAppReceiptLoad *load;
+    RMAppReceiptLoad *pendingLoad = nil;
+    RMAppReceipt *previousReceipt;
+    BOOL snapshotsEnabled;
+    NSUInteger generation;
+    @synchronized([RMAppReceipt class])
+    {
+        if (_cachedReceipt &&
+            [_cachedReceiptPath isEqualToString:path] &&
+            _cachedReceiptFileSize == fileSize &&
+            [_cachedReceiptModificationDate isEqualToDate:modificationDate] &&
+            [_cachedReceiptDigest isEqualToData:digest])
+        {
+            _cachedReceiptHits++;
+            return _cachedReceipt;
+        }
+        
+        // Concurrent callers wait for the receipt to be parsed once instead of parsing it in parallel
+        load = _receiptLoads[path];
+        if ([load.digest isEqualToData:digest])
+        {
+            _cachedReceiptHits++;
+            pendingLoad = load;
+        }
+        else
+        {
+            _cachedReceiptMisses++;
+            load = [[RMAppReceiptLoad alloc] initWithDigest:digest];
+            if (!_receiptLoads) _receiptLoads = [NSMutableDictionary dictionary];
+            _receiptLoads[path] = load;
+        }
+        // A refreshed receipt usually differs from the previous one in a few in-app purchases
+        previousReceipt = [_cachedReceiptPath isEqualToString:path] ? _cachedReceipt : nil;
+        snapshotsEnabled = _snapshotsEnabled;
+        generation = _rootCertificateGeneration;
+    }
+    if (pendingLoad) return [pendingLoad waitForReceipt];
+    
+    RMAppReceiptRootCertificate *rootCertificate = [RMAppReceipt rootCertificate];
+    // After a relaunch, the snapshot of the receipt saves verifying and parsing it again
+    NSData *snapshotDigest = snapshotsEnabled ? [RMAppReceipt snapshotDigestOfReceiptDigest:digest rootCertificate:rootCertificate] : nil;
+    NSString *snapshotPath = snapshotDigest ? [RMAppReceipt snapshotPath] : nil;
+    RMAppReceipt *receipt = snapshotDigest ? [RMAppReceipt receiptWithSnapshotAtPath:snapshotPath container:contents digest:snapshotDigest] : nil;
+    if (!receipt)
+    {
+        NSData *data = [RMAppReceipt dataFromPCKS7Path:path rootCertificate:rootCertificate];
+        receipt = data ? [[RMAppReceipt alloc] initWithASN1Data:data previousReceipt:previousReceipt] : nil;
+        if (receipt && snapshotDigest)
+        {
+            // Only later launches need the snapshot
+            dispatch_async([RMAppReceipt snapshotQueue], ^{
+                BOOL enabled;
+                @synchronized([RMAppReceipt class])
                 {
-                    NSString *string = RMASN1ReadIA5SString(&p, length);
-                    _purchaseDate = [RMAppReceipt formatRFC3339String:string];
-                    break;
+                    enabled = _snapshotsEnabled;
                 }
-                case RMAppReceiptASN1TypeOriginalTransactionIdentifier:
-                    _originalTransactionIdentifier = RMASN1ReadUTF8String(&p, length);
+                if (enabled) [receipt writeSnapshotToPath:snapshotPath container:contents digest:snapshotDigest];
+            });
+        }
+    }
+    
+    // Don't cache the receipt if the file changed while it was being parsed
+    NSDictionary *currentAttributes = receipt ? [[NSFileManager defaultManager] attributesOfItemAtPath:path error:nil] : nil;
+    const BOOL unchanged = currentAttributes.fileSize == fileSize && [currentAttributes.fileModificationDate isEqualToDate:modificationDate];
+    @synchronized([RMAppReceipt class])
+    {
+        if (_receiptLoads[path] == load) [_receiptLoads removeObjectForKey:path];
+        if (receipt && unchanged && generation == _rootCertificateGeneration)
+        {
+            _cachedReceipt = receipt;
+            _cachedReceiptPath = [path copy];
+            _cachedReceiptFileSize = fileSize;
+            _cachedReceiptModificationDate = modificationDate;
+            _cachedReceiptDigest = digest;
+        }
+    }
+    [load finishWithReceipt:receipt];
+    return receipt;
+}
+
+/** Serial queue of the snapshot writes, so that they don't hold the class lock and don't overlap.
+ */
++ (dispatch_queue_t)snapshotQueue
+{
+    static dispatch_queue_t queue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        queue = dispatch_queue_create("net.robotmedia.RMAppReceipt.snapshot", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(queue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    });
+    return queue;
+}
+
++ (NSString*)snapshotPath
+{
+    // The receipt lives in the bundle, which can't be written
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject;
+    return [cachesPath stringByAppendingPathComponent:RMAppReceiptSnapshotFileName];
+}
+
+/** Returns SHA256(SHA256(receipt) || SHA256(root certificate)), so that snapshots don't outlive the certificate, or nil if receipts are not verified.
+ */
++ (NSData*)snapshotDigestOfReceiptDigest:(NSData*)digest rootCertificate:(RMAppReceiptRootCertificate*)rootCertificate
+{
+    if (!rootCertificate.valid || !rootCertificate.verifier) return nil;
+    
+    NSMutableData *message = [digest mutableCopy];
+    [message appendData:rootCertificate.digest];
+    // Explicit casting to avoid errors when compiling as Objective-C++
+    return [RMAppReceipt SHA256DigestOfBytes:(const uint8_t*)message.bytes length:message.length];
+}
+
+/** Restores the receipt of the given PKCS #7 container from its snapshot, without verifying the container or parsing its payload. Snapshots are only written for verified receipts, and can't be forged without the keychain secret.
+ @param digest The digest of the container and root certificate, as returned by snapshotDigestOfReceiptDigest:.
+ @return The receipt, or nil if there is no snapshot of the container.
+ */
++ (RMAppReceipt*)receiptWithSnapshotAtPath:(NSString*)path container:(NSData*)container digest:(NSData*)digest
+{
+    NSData *secret = RMAppReceiptKeychainGetVerificationSecret();
+    const uint8_t *payload;
+    long payloadLength;
+    // Explicit casting to avoid errors when compiling as Objective-C++
+    if (!secret || digest.length != SHA256_DIGEST_LENGTH || !RMReceiptFindPKCS7Payload((const uint8_t*)container.bytes, (long)container.length, &payload, &payloadLength)) return nil;
+    
+    RMReceiptSnapshot *snapshot = RMReceiptSnapshotOpen(path.fileSystemRepresentation, (const uint8_t*)digest.bytes, payloadLength, (const uint8_t*)secret.bytes, (long)secret.length);
+    if (!snapshot) return nil;
+    
+    // Neither the snapshot nor the payload are copied. They stay mapped as long as the receipt or any of its in-app purchases is alive.
+    const RMReceiptSnapshotHeader *header = RMReceiptSnapshotGetHeader(snapshot);
+    NSData *snapshotData = [[NSData alloc] initWithBytesNoCopy:(void*)header length:(NSUInteger)header->length deallocator:^(void *bytes, NSUInteger length) {
+        RMReceiptSnapshotClose(snapshot);
+    }];
+    NSData *asn1Data = [[NSData alloc] initWithBytesNoCopy:(void*)payload length:payloadLength deallocator:^(void *bytes, NSUInteger length) {
+        (void)container; // Keeps the container alive
+    }];
+    return [[RMAppReceipt alloc] initWithASN1Data:asn1Data snapshotData:snapshotData];
+}
+
+/** Writes a snapshot of the receipt, which must be the payload of the given PKCS #7 container.
+ @param digest The digest of the container and root certificate, as returned by snapshotDigestOfReceiptDigest:.
+ @return YES if the snapshot was written, NO otherwise.
+ */
+- (BOOL)writeSnapshotToPath:(NSString*)path container:(NSData*)container digest:(NSData*)digest
+{
+    NSData *secret = RMAppReceiptKeychainGetVerificationSecret();
+    const uint8_t *payload;
+    long payloadLength;
+    // Explicit casting to avoid errors when compiling as Objective-C++
+    if (!secret || digest.length != SHA256_DIGEST_LENGTH || !RMReceiptFindPKCS7Payload((const uint8_t*)container.bytes, (long)container.length, &payload, &payloadLength)) return NO;
+    // The snapshot is bound to the container, so it must describe its payload. Ranges are 32 bits wide.
+    if (payloadLength != (long)_asn1Data.length || memcmp(payload, _asn1Data.bytes, payloadLength) != 0 || _asn1Data.length > UINT32_MAX) return NO;
+    
+    __block RMReceiptSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.digest, digest.bytes, SHA256_DIGEST_LENGTH);
+    header.purchaseCount = _inAppPurchases.count;
+    header.payloadLength = _asn1Data.length;
+    header.expirationDate = _expirationDate ? _expirationDate.timeIntervalSince1970 : NAN;
+    // The receipt doesn't keep the ranges of its attributes, which are found again without enumerating the in-app purchases
+    const uint8_t *bytes = (const uint8_t*)_asn1Data.bytes;
+    [RMAppReceipt enumerateASN1Attributes:bytes length:_asn1Data.length usingBlock:^(const uint8_t *value, long length, int type) {
+        const RMReceiptSnapshotRange range = RMAppReceiptSnapshotRangeMake(NSMakeRange(value - bytes, length));
+        switch (type)
+        {
+            case RMReceiptAttributeTypeBundleIdentifier:
+                header.bundleIdentifier = range;
+                break;
+            case RMReceiptAttributeTypeAppVersion:
+                header.appVersion = range;
+                break;
+            case RMReceiptAttributeTypeOpaqueValue:
+                header.opaqueValue = range;
+                break;
+            case RMReceiptAttributeTypeHash:
+                header.receiptHash = range;
+                break;
+            case RMReceiptAttributeTypeOriginalAppVersion:
+                header.originalAppVersion = range;
+                break;
+        }
+    }];
+    
+    const NSUInteger count = _inAppPurchases.count;
+    RMReceiptSnapshotPurchase *records = (RMReceiptSnapshotPurchase*)calloc(MAX(count, 1), sizeof(RMReceiptSnapshotPurchase));
+    if (!records) return NO;
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        RMAppReceiptIAP *purchase = _inAppPurchases[i];
+        [purchase getSnapshotPurchase:&records[i]];
+    }
+    const BOOL written = RMReceiptSnapshotWrite(path.fileSystemRepresentation, &header, records, (const uint8_t*)secret.bytes, (long)secret.length) != 0;
+    free(records);
+    return written;
+}
+
++ (NSData*)SHA256DigestOfBytes:(const uint8_t*)bytes length:(NSUInteger)length
+{
+    NSMutableData *digest = [NSMutableData dataWithLength:SHA256_DIGEST_LENGTH];
+    SHA256(bytes, length, (uint8_t*)digest.mutableBytes);
+    return digest;
+}
+
+/** Opens the receipt file and verifies its signature, unless the file is the one that passed verification last time.
+ */
++ (RMReceiptFile*)openFileWithVerificationCache:(const char*)path rootCertificate:(RMAppReceiptRootCertificate*)rootCertificate
+{
+    RMReceiptVerifier *verifier = rootCertificate.verifier;
+    RMReceiptFile *file = RMReceiptFileOpen(path, NULL);
+    if (!file) return NULL;
+    
+    long length;
+    const uint8_t *contents = RMReceiptFileGetContents(file, &length);
+    NSData *tag = [RMAppReceipt verificationTagOfBytes:contents length:length certificateDigest:rootCertificate.digest];
+    NSData *cachedTag = [[NSUserDefaults standardUserDefaults] dataForKey:RMAppReceiptVerificationCacheKey];
+    if (tag && cachedTag.length == tag.length && CRYPTO_memcmp(cachedTag.bytes, tag.bytes, tag.length) == 0) return file;
+    
+    if (!RMReceiptFileVerify(file, verifier))
+    {
+        RMReceiptFileClose(file);
+        return NULL;
+    }
+    if (tag)
+    {
+        [[NSUserDefaults standardUserDefaults] setObject:tag forKey:RMAppReceiptVerificationCacheKey];
+    }
+    return file;
+}
+
+/** Returns HMAC-SHA256(secret, SHA256(receipt) || SHA256(root certificate)), so that the cache can't be forged without the keychain secret and doesn't outlive the certificate.
+ */
++ (NSData*)verificationTagOfBytes:(const uint8_t*)bytes length:(long)length certificateDigest:(NSData*)certificateDigest
+{
+    NSData *secret = RMAppReceiptKeychainGetVerificationSecret();
+    if (!secret || !certificateDigest) return nil;
+    
+    uint8_t message[2 * SHA256_DIGEST_LENGTH];
+    SHA256(bytes, length, message);
+    memcpy(message + SHA256_DIGEST_LENGTH, certificateDigest.bytes, SHA256_DIGEST_LENGTH);
+    
+    NSMutableData *tag = [NSMutableData dataWithLength:SHA256_DIGEST_LENGTH];
+    unsigned int tagLength = 0;
+    // Explicit casting to avoid errors when compiling as Objective-C++
+    HMAC(EVP_sha256(), secret.bytes, (int)secret.length, message, sizeof(message), (uint8_t*)tag.mutableBytes, &tagLength);
+    return tagLength == SHA256_DIGEST_LENGTH ? tag : nil;
+}
+
+- (void)indexInAppPurchases
+{
+    NSMutableDictionary *purchasesByProductIdentifier = [NSMutableDictionary dictionary];
+    NSMutableDictionary *latestSubscriptions = [NSMutableDictionary dictionary];
+    NSMutableDictionary *chainPurchases = [NSMutableDictionary dictionary];
+    NSMutableArray *chainIdentifiers = [NSMutableArray array]; // In order of first appearance
+    for (RMAppReceiptIAP *purchase in _inAppPurchases)
+    {
+        NSTimeInterval interval, latestInterval;
+        const BOOL subscription = [purchase getSubscriptionExpirationInterval:&interval];
+        NSString *originalTransactionIdentifier = subscription ? purchase.originalTransactionIdentifier : nil;
+        if (originalTransactionIdentifier)
+        {
+            NSMutableArray *renewals = chainPurchases[originalTransactionIdentifier];
+            if (!renewals)
+            {
+                renewals = [NSMutableArray array];
+                chainPurchases[originalTransactionIdentifier] = renewals;
+                [chainIdentifiers addObject:originalTransactionIdentifier];
+            }
+            [renewals addObject:purchase];
+        }
+        
+        NSString *productIdentifier = purchase.productIdentifier;
+        if (!productIdentifier) continue;
+        
+        NSMutableArray *purchases = purchasesByProductIdentifier[productIdentifier];
+        if (!purchases)
+        {
+            purchases = [NSMutableArray array];
+            purchasesByProductIdentifier[productIdentifier] = purchases;
+        }
+        [purchases addObject:purchase];
+        
+        // The latest subscription is the one that expires last. Ties go to the first one, and purchases without expiration date only count if there is nothing else.
+        RMAppReceiptIAP *latestSubscription = latestSubscriptions[productIdentifier];
+        if (!latestSubscription ||
+            (subscription &&
+             (![latestSubscription getSubscriptionExpirationInterval:&latestInterval] || interval > latestInterval)))
+        {
+            latestSubscriptions[productIdentifier] = purchase;
+        }
+    }
+    NSMutableArray *renewalChains = [NSMutableArray arrayWithCapacity:chainIdentifiers.count];
+    NSMutableDictionary *renewalChainsByOriginalTransactionIdentifier = [NSMutableDictionary dictionaryWithCapacity:chainIdentifiers.count];
+    for (NSString *originalTransactionIdentifier in chainIdentifiers)
+    {
+        RMAppReceiptRenewalChain *chain = [[RMAppReceiptRenewalChain alloc] initWithInAppPurchases:chainPurchases[originalTransactionIdentifier]];
+        [renewalChains addObject:chain];
+        renewalChainsByOriginalTransactionIdentifier[originalTransactionIdentifier] = chain;
+    }
+    for (NSString *productIdentifier in purchasesByProductIdentifier.allKeys)
+    {
+        purchasesByProductIdentifier[productIdentifier] = [purchasesByProductIdentifier[productIdentifier] copy];
+    }
+    _purchasesByProductIdentifier = [purchasesByProductIdentifier copy];
+    _latestSubscriptionsByProductIdentifier = [latestSubscriptions copy];
+    _renewalChains = [renewalChains copy];
+    _renewalChainsByOriginalTransactionIdentifier = [renewalChainsByOriginalTransactionIdentifier copy];
+}
+
++ (NSData*)dataFromPCKS7Path:(NSString*)path rootCertificate:(RMAppReceiptRootCertificate*)rootCertificate
+{
+    if (!rootCertificate.valid) return nil;
+    
+    BOOL verificationCacheEnabled;
+    @synchronized([RMAppReceipt class])
+    {
+        verificationCacheEnabled = _verificationCacheEnabled;
+    }
+    const char *cpath = path.stringByStandardizingPath.fileSystemRepresentation;
+    RMReceiptVerifier *verifier = rootCertificate.verifier;
+    RMReceiptFile *file = verifier && verificationCacheEnabled ? [RMAppReceipt openFileWithVerificationCache:cpath rootCertificate:rootCertificate] : RMReceiptFileOpen(cpath, verifier);
+    if (!file) return nil;
+    
+    // The payload points into the mapped receipt, which stays mapped as long as the data is alive
+    long length;
+    const uint8_t *payload = RMReceiptFileGetPayload(file, &length);
+    return [[NSData alloc] initWithBytesNoCopy:(void*)payload length:length deallocator:^(void *bytes, NSUInteger length) {
+        RMReceiptFileClose(file);
+    }];
+}
+
+/** Returns the root certificate, creating its verifier if needed. The certificate is read without holding the class lock.
+ */
++ (RMAppReceiptRootCertificate*)rootCertificate
+{
+    NSURL *certificateURL;
+    NSUInteger generation;
+    @synchronized([RMAppReceipt class])
+    {
+        if (_rootCertificate) return _rootCertificate;
+        certificateURL = _appleRootCertificateURL;
+        generation = _rootCertificateGeneration;
+    }
+    
+    RMAppReceiptRootCertificate *rootCertificate = [[RMAppReceiptRootCertificate alloc] initWithURL:certificateURL ? : [[NSBundle mainBundle] URLForResource:@"AppleIncRootCertificate" withExtension:@"cer"]];
+    @synchronized([RMAppReceipt class])
+    {
+        // Another caller may have created it meanwhile
+        if (generation == _rootCertificateGeneration)
+        {
+            if (!_rootCertificate) _rootCertificate = rootCertificate;
+            rootCertificate = _rootCertificate;
+        }
+    }
+    return rootCertificate;
+}
+
+static int RMAppReceiptEnumerateAttribute(const uint8_t *value, long length, int type, void *context)
+{
+    void (^block)(const uint8_t *value, long length, int type) = (__bridge void (^)(const uint8_t *, long, int))(context);
+    block(value, length, type);
+    return 0;
+}
+
++ (void)enumerateASN1Attributes:(const uint8_t*)p length:(long)tlength usingBlock:(void (^)(const uint8_t *value, long length, int type))block
+{
+    RMReceiptEnumerateAttributes(p, tlength, RMAppReceiptEnumerateAttribute, (__bridge void*)block);
+}
+
++ (NSDate*)dateFromRFC3339Bytes:(const uint8_t*)bytes length:(long)length
+{
+    NSTimeInterval interval;
+    if (RMReceiptParseRFC3339Date(bytes, length, &interval))
+    {
+        return [NSDate dateWithTimeIntervalSince1970:interval];
+    }
+    NSString *string = [[NSString alloc] initWithBytes:bytes length:length encoding:NSASCIIStringEncoding];
+    return [self formatRFC3339String:string];
+}
+
++ (NSDate*)formatRFC3339String:(NSString*)string
+{
+    static NSDateFormatter *formatter;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        formatter = [[NSDateFormatter alloc] init];
+        formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+        formatter.dateFormat = @"yyyy-MM-dd'T'HH:mm:ssZ";
+    });
+    @synchronized(formatter)
+    {
+        NSDate *date = [formatter dateFromString:string];
+        return date;
+    }
+}
+
+@end
+
+@implementation RMAppReceiptRootCertificate
+
+- (instancetype)initWithURL:(NSURL*)URL
+{
+    if (self = [super init])
+    {
+        NSData *certificateData = URL ? [NSData dataWithContentsOfURL:URL] : nil;
+        // Explicit casting to avoid errors when compiling as Objective-C++
+        _verifier = certificateData ? RMReceiptVerifierCreate((const uint8_t*)certificateData.bytes, (long)certificateData.length) : NULL;
+        _valid = !certificateData || _verifier != NULL;
+        _digest = certificateData ? [RMAppReceipt SHA256DigestOfBytes:(const uint8_t*)certificateData.bytes length:certificateData.length] : nil;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    RMReceiptVerifierFree(_verifier);
+}
+
+@end
+
+@implementation RMAppReceiptLoad {
+    NSCondition *_condition;
+    BOOL _finished;
+    RMAppReceipt *_receipt;
+}
+
+- (instancetype)initWithDigest:(NSData*)digest
+{
+    if (self = [super init])
+    {
+        _digest = digest;
+        _condition = [[NSCondition alloc] init];
+    }
+    return self;
+}
+
+- (void)finishWithReceipt:(RMAppReceipt*)receipt
+{
+    [_condition lock];
+    _receipt = receipt;
+    _finished = YES;
+    [_condition broadcast];
+    [_condition unlock];
+}
+
+- (RMAppReceipt*)waitForReceipt
+{
+    [_condition lock];
+    while (!_finished)
+    {
+        [_condition wait];
+    }
+    RMAppReceipt *receipt = _receipt;
+    [_condition unlock];
+    return receipt;
+}
+
+@end
+
+static void RMAppReceiptStringPoolRelease(const void *info)
+{
+    RMReceiptStringPoolFree((RMReceiptStringPool*)info);
+}
+
+static void* RMAppReceiptStringPoolAllocate(CFIndex size, CFOptionFlags hint, void *info)
+{
+    return NULL;
+}
+
+static void RMAppReceiptStringPoolDeallocate(void *bytes, void *info)
+{
+    // The pool frees all of its strings at once
+}
+
+@implementation RMAppReceiptStringTable {
+    RMReceiptStringPool *_pool;
+    CFAllocatorRef _deallocator; // Owns the pool and is retained by every string created from it
+    NSMutableArray *_strings; // By pool index. NSNull for bytes that are not valid UTF-8.
+    pthread_mutex_t _lock; // Only contended by lazy decoding, as parsing interns in a serial pass
+}
+
+- (instancetype)init
+{
+    if (self = [super init])
+    {
+        _pool = RMReceiptStringPoolCreate();
+        if (!_pool) return nil;
+        
+        CFAllocatorContext context = {0, _pool, NULL, RMAppReceiptStringPoolRelease, NULL, RMAppReceiptStringPoolAllocate, NULL, RMAppReceiptStringPoolDeallocate, NULL};
+        _deallocator = CFAllocatorCreate(kCFAllocatorDefault, &context);
+        if (!_deallocator)
+        {
+            RMReceiptStringPoolFree(_pool);
+            return nil;
+        }
+        _strings = [NSMutableArray array];
+        pthread_mutex_init(&_lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (_deallocator)
+    {
+        CFRelease(_deallocator);
+        pthread_mutex_destroy(&_lock);
+    }
+}
+
+- (NSString*)stringWithUTF8Bytes:(const uint8_t*)bytes length:(long)length
+{
+    pthread_mutex_lock(&_lock);
+    const uint8_t *interned;
+    const long index = RMReceiptStringPoolIntern(_pool, bytes, length, &interned);
+    id string;
+    if (index < 0)
+    {
+        string = [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+    }
+    else if (index < (long)_strings.count)
+    {
+        string = _strings[index];
+        if (string == [NSNull null]) string = nil;
+    }
+    else
+    {
+        string = (__bridge_transfer NSString*)CFStringCreateWithBytesNoCopy(kCFAllocatorDefault, interned, length, kCFStringEncodingUTF8, false, _deallocator);
+        [_strings addObject:string ? : [NSNull null]];
+    }
+    pthread_mutex_unlock(&_lock);
+    return string;
+}
+
+@end
+
+typedef NS_ENUM(NSInteger, RMAppReceiptIAPField) {
+    RMAppReceiptIAPFieldProductIdentifier,
+    RMAppReceiptIAPFieldTransactionIdentifier,
+    RMAppReceiptIAPFieldOriginalTransactionIdentifier,
+    RMAppReceiptIAPFieldPurchaseDate,
+    RMAppReceiptIAPFieldOriginalPurchaseDate,
+    RMAppReceiptIAPFieldSubscriptionExpirationDate,
+    RMAppReceiptIAPFieldCancellationDate,
+    RMAppReceiptIAPFieldCount
+};
+
+// Fields are decoded once per in-app purchase, so a few locks shared by all of them are enough
+static pthread_mutex_t _fieldLocks[8] = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+};
+
+static pthread_mutex_t* RMAppReceiptIAPFieldLock(RMAppReceiptIAP *purchase)
+{
+    const uintptr_t address = (uintptr_t)(__bridge void*)purchase;
+    return &_fieldLocks[(address >> 4) % (sizeof(_fieldLocks) / sizeof(_fieldLocks[0]))];
+}
+
+@implementation RMAppReceiptIAP {
+    NSData *_asn1Data;
+    RMAppReceiptStringTable *_strings; // nil if strings are not interned
+    NSRange _range; // Range of the in-app purchase in _asn1Data
+    NSRange _ranges[RMAppReceiptIAPFieldCount]; // Ranges of the undecoded field values in _asn1Data
+    NSData *_snapshotData; // Keeps _record alive
+    const RMReceiptSnapshotPurchase *_record; // Decoded dates, or NULL unless restored from a snapshot
+    uint32_t _decodedFields; // Bit per RMAppReceiptIAPField. Set with release ordering once the field's ivar is final.
+    NSString *_productIdentifier;
+    NSString *_transactionIdentifier;
+    NSString *_originalTransactionIdentifier;
+    NSDate *_purchaseDate;
+    NSDate *_originalPurchaseDate;
+    NSDate *_subscriptionExpirationDate;
+    NSDate *_cancellationDate;
+}
+
+- (instancetype)initWithASN1Data:(NSData*)asn1Data
+{
+    NSData *data = [asn1Data copy];
+    return [self initWithASN1Data:data range:NSMakeRange(0, data.length) strings:nil];
+}
+
+- (instancetype)initWithASN1Data:(NSData*)asn1Data range:(NSRange)range strings:(RMAppReceiptStringTable*)strings
+{
+    if (self = [super init])
+    {
+        _asn1Data = asn1Data;
+        _strings = strings;
+        _range = range;
+        // Explicit casting to avoid errors when compiling as Objective-C++
+        const uint8_t *bytes = (const uint8_t*)asn1Data.bytes;
+        [RMAppReceipt enumerateASN1Attributes:bytes + range.location length:range.length usingBlock:^(const uint8_t *value, long length, int type) {
+            const uint8_t *p = value;
+            const NSRange valueRange = NSMakeRange(value - bytes, length);
+            switch (type)
+            {
+                case RMReceiptAttributeTypeQuantity:
+                    _quantity = RMReceiptASN1ReadInteger(&p, length);
                     break;
-                case RMAppReceiptASN1TypeOriginalPurchaseDate:
-                {
-                    NSString *string = RMASN1ReadIA5SString(&p, length);
-                    _originalPurchaseDate = [RMAppReceipt formatRFC3339String:string];
+                case RMReceiptAttributeTypeProductIdentifier:
+                    _ranges[RMAppReceiptIAPFieldProductIdentifier] = valueRange;
                     break;
-                }
-                case RMAppReceiptASN1TypeSubscriptionExpirationDate:
-                {
-                    NSString *string = RMASN1ReadIA5SString(&p, length);
-                    _subscriptionExpirationDate = [RMAppReceipt formatRFC3339String:string];
+                case RMReceiptAttributeTypeTransactionIdentifier:
+                    _ranges[RMAppReceiptIAPFieldTransactionIdentifier] = valueRange;
                     break;
-                }
-                case RMAppReceiptASN1TypeWebOrderLineItemID:
-                    _webOrderLineItemID = RMASN1ReadInteger(&p, length);
+                case RMReceiptAttributeTypePurchaseDate:
+                    _ranges[RMAppReceiptIAPFieldPurchaseDate] = valueRange;
                     break;
-                case RMAppReceiptASN1TypeCancellationDate:
-                {
-                    NSString *string = RMASN1ReadIA5SString(&p, length);
-                    _cancellationDate = [RMAppReceipt formatRFC3339String:string];
+                case RMReceiptAttributeTypeOriginalTransactionIdentifier:
+                    _ranges[RMAppReceiptIAPFieldOriginalTransactionIdentifier] = valueRange;
+                    break;
+                case RMReceiptAttributeTypeOriginalPurchaseDate:
+                    _ranges[RMAppReceiptIAPFieldOriginalPurchaseDate] = valueRange;
+                    break;
+                case RMReceiptAttributeTypeSubscriptionExpirationDate:
+                    _ranges[RMAppReceiptIAPFieldSubscriptionExpirationDate] = valueRange;
+                    break;
+                case RMReceiptAttributeTypeWebOrderLineItemID:
+                    // Far above INT_MAX in real receipts
+                    _webOrderLineItemID = (NSInteger)RMReceiptASN1ReadInteger64(&p, length);
+                    break;
+                case RMReceiptAttributeTypeCancellationDate:
+                    _ranges[RMAppReceiptIAPFieldCancellationDate] = valueRange;
                     break;
-                }
             }
         }];
     }
     return self;
 }
 
+- (instancetype)initWithASN1Data:(NSData*)asn1Data snapshotData:(NSData*)snapshotData record:(const RMReceiptSnapshotPurchase*)record strings:(RMAppReceiptStringTable*)strings
+{
+    if (self = [super init])
+    {
+        _asn1Data = asn1Data;
+        _strings = strings;
+        _snapshotData = snapshotData;
+        _record = record;
+        _range = NSMakeRange(record->entry.offset, record->entry.length);
+        _ranges[RMAppReceiptIAPFieldProductIdentifier] = NSMakeRange(record->productIdentifier.offset, record->productIdentifier.length);
+        _ranges[RMAppReceiptIAPFieldTransactionIdentifier] = NSMakeRange(record->transactionIdentifier.offset, record->transactionIdentifier.length);
+        _ranges[RMAppReceiptIAPFieldOriginalTransactionIdentifier] = NSMakeRange(record->originalTransactionIdentifier.offset, record->originalTransactionIdentifier.length);
+        _quantity = (NSInteger)record->quantity;
+        _webOrderLineItemID = (NSInteger)record->webOrderLineItemID;
+    }
+    return self;
+}
+
+- (instancetype)initWithInAppPurchase:(RMAppReceiptIAP*)purchase ASN1Data:(NSData*)asn1Data range:(NSRange)range strings:(RMAppReceiptStringTable*)strings
+{
+    NSParameterAssert(range.length == purchase->_range.length);
+    if (self = [super init])
+    {
+        _asn1Data = asn1Data;
+        _strings = strings;
+        _range = range;
+        // The bytes are the same, so the fields are at the same offsets
+        for (NSUInteger i = 0; i < RMAppReceiptIAPFieldCount; i++)
+        {
+            const NSRange fieldRange = purchase->_ranges[i];
+            if (fieldRange.length == 0) continue;
+            _ranges[i] = NSMakeRange(range.location + (fieldRange.location - purchase->_range.location), fieldRange.length);
+        }
+        _snapshotData = purchase->_snapshotData;
+        _record = purchase->_record;
+        _quantity = purchase->_quantity;
+        _webOrderLineItemID = purchase->_webOrderLineItemID;
+        // Only fields that are already decoded are final, so the others are decoded again if needed
+        const uint32_t decodedFields = __atomic_load_n(&purchase->_decodedFields, __ATOMIC_ACQUIRE);
+        if (decodedFields & (1u << RMAppReceiptIAPFieldProductIdentifier)) _productIdentifier = purchase->_productIdentifier;
+        if (decodedFields & (1u << RMAppReceiptIAPFieldTransactionIdentifier)) _transactionIdentifier = purchase->_transactionIdentifier;
+        if (decodedFields & (1u << RMAppReceiptIAPFieldOriginalTransactionIdentifier)) _originalTransactionIdentifier = purchase->_originalTransactionIdentifier;
+        if (decodedFields & (1u << RMAppReceiptIAPFieldPurchaseDate)) _purchaseDate = purchase->_purchaseDate;
+        if (decodedFields & (1u << RMAppReceiptIAPFieldOriginalPurchaseDate)) _originalPurchaseDate = purchase->_originalPurchaseDate;
+        if (decodedFields & (1u << RMAppReceiptIAPFieldSubscriptionExpirationDate)) _subscriptionExpirationDate = purchase->_subscriptionExpirationDate;
+        if (decodedFields & (1u << RMAppReceiptIAPFieldCancellationDate)) _cancellationDate = purchase->_cancellationDate;
+        _decodedFields = decodedFields;
+    }
+    return self;
+}
+
+#pragma mark - Properties
+
+- (NSString*)productIdentifier
+{
+    if ([self beginDecodingField:RMAppReceiptIAPFieldProductIdentifier])
+    {
+        _productIdentifier = [self UTF8StringOfField:RMAppReceiptIAPFieldProductIdentifier];
+        [self endDecodingField:RMAppReceiptIAPFieldProductIdentifier];
+    }
+    return _productIdentifier;
+}
+
+- (NSString*)transactionIdentifier
+{
+    if ([self beginDecodingField:RMAppReceiptIAPFieldTransactionIdentifier])
+    {
+        _transactionIdentifier = [self UTF8StringOfField:RMAppReceiptIAPFieldTransactionIdentifier];
+        [self endDecodingField:RMAppReceiptIAPFieldTransactionIdentifier];
+    }
+    return _transactionIdentifier;
+}
+
+- (NSString*)originalTransactionIdentifier
+{
+    if ([self beginDecodingField:RMAppReceiptIAPFieldOriginalTransactionIdentifier])
+    {
+        _originalTransactionIdentifier = [self UTF8StringOfField:RMAppReceiptIAPFieldOriginalTransactionIdentifier];
+        [self endDecodingField:RMAppReceiptIAPFieldOriginalTransactionIdentifier];
+    }
+    return _originalTransactionIdentifier;
+}
+
+- (NSDate*)purchaseDate
+{
+    if ([self beginDecodingField:RMAppReceiptIAPFieldPurchaseDate])
+    {
+        _purchaseDate = [self dateOfField:RMAppReceiptIAPFieldPurchaseDate];
+        [self endDecodingField:RMAppReceiptIAPFieldPurchaseDate];
+    }
+    return _purchaseDate;
+}
+
+- (NSDate*)originalPurchaseDate
+{
+    if ([self beginDecodingField:RMAppReceiptIAPFieldOriginalPurchaseDate])
+    {
+        _originalPurchaseDate = [self dateOfField:RMAppReceiptIAPFieldOriginalPurchaseDate];
+        [self endDecodingField:RMAppReceiptIAPFieldOriginalPurchaseDate];
+    }
+    return _originalPurchaseDate;
+}
+
+- (NSDate*)subscriptionExpirationDate
+{
+    if ([self beginDecodingField:RMAppReceiptIAPFieldSubscriptionExpirationDate])
+    {
+        _subscriptionExpirationDate = [self dateOfField:RMAppReceiptIAPFieldSubscriptionExpirationDate];
+        [self endDecodingField:RMAppReceiptIAPFieldSubscriptionExpirationDate];
+    }
+    return _subscriptionExpirationDate;
+}
+
+- (NSDate*)cancellationDate
+{
+    if ([self beginDecodingField:RMAppReceiptIAPFieldCancellationDate])
+    {
+        _cancellationDate = [self dateOfField:RMAppReceiptIAPFieldCancellationDate];
+        [self endDecodingField:RMAppReceiptIAPFieldCancellationDate];
+    }
+    return _cancellationDate;
+}
+
+#pragma mark - Private
+
+/** Returns NO without locking if the field is already decoded. Otherwise returns YES holding the lock of the field, which must be released with endDecodingField: once the field's ivar is set.
+ */
+- (BOOL)beginDecodingField:(RMAppReceiptIAPField)field
+{
+    const uint32_t bit = 1u << field;
+    if (__atomic_load_n(&_decodedFields, __ATOMIC_ACQUIRE) & bit) return NO;
+    
+    pthread_mutex_lock(RMAppReceiptIAPFieldLock(self));
+    if (__atomic_load_n(&_decodedFields, __ATOMIC_ACQUIRE) & bit)
+    { // Decoded by another thread meanwhile
+        pthread_mutex_unlock(RMAppReceiptIAPFieldLock(self));
+        return NO;
+    }
+    return YES;
+}
+
+- (void)endDecodingField:(RMAppReceiptIAPField)field
+{
+    // Absent fields are recorded as decoded too, so that they are not decoded on every access
+    __atomic_fetch_or(&_decodedFields, 1u << field, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(RMAppReceiptIAPFieldLock(self));
+}
+
+- (const uint8_t*)ASN1BytesWithLength:(long*)length
+{
+    *length = _range.length;
+    return (const uint8_t*)_asn1Data.bytes + _range.location;
+}
+
+- (NSString*)UTF8StringOfField:(RMAppReceiptIAPField)field
+{
+    const NSRange range = _ranges[field];
+    if (range.length == 0) return nil;
+    const uint8_t *p = (const uint8_t*)_asn1Data.bytes + range.location;
+    // Transaction identifiers are unique, so interning them would only cost memory
+    if (!_strings || field == RMAppReceiptIAPFieldTransactionIdentifier) return RMASN1ReadUTF8String(&p, range.length);
+    
+    long length;
+    const uint8_t *bytes = RMReceiptASN1ReadString(&p, range.length, V_ASN1_UTF8STRING, &length);
+    if (!bytes) return nil;
+    return [_strings stringWithUTF8Bytes:bytes length:length];
+}
+
+- (void)getSnapshotPurchase:(RMReceiptSnapshotPurchase*)record
+{
+    record->entry = RMAppReceiptSnapshotRangeMake(_range);
+    record->productIdentifier = RMAppReceiptSnapshotRangeMake(_ranges[RMAppReceiptIAPFieldProductIdentifier]);
+    record->transactionIdentifier = RMAppReceiptSnapshotRangeMake(_ranges[RMAppReceiptIAPFieldTransactionIdentifier]);
+    record->originalTransactionIdentifier = RMAppReceiptSnapshotRangeMake(_ranges[RMAppReceiptIAPFieldOriginalTransactionIdentifier]);
+    record->quantity = _quantity;
+    record->webOrderLineItemID = _webOrderLineItemID;
+    NSTimeInterval interval;
+    record->purchaseDate = [self getInterval:&interval ofField:RMAppReceiptIAPFieldPurchaseDate] ? interval : NAN;
+    record->originalPurchaseDate = [self getInterval:&interval ofField:RMAppReceiptIAPFieldOriginalPurchaseDate] ? interval : NAN;
+    record->subscriptionExpirationDate = [self getInterval:&interval ofField:RMAppReceiptIAPFieldSubscriptionExpirationDate] ? interval : NAN;
+    record->cancellationDate = [self getInterval:&interval ofField:RMAppReceiptIAPFieldCancellationDate] ? interval : NAN;
+}
+
+/** Returns the date of the given field in the snapshot record, or NaN if the in-app purchase doesn't have it.
+ */
+- (NSTimeInterval)recordedIntervalOfField:(RMAppReceiptIAPField)field
+{
+    switch (field)
+    {
+        case RMAppReceiptIAPFieldPurchaseDate:
+            return _record->purchaseDate;
+        case RMAppReceiptIAPFieldOriginalPurchaseDate:
+            return _record->originalPurchaseDate;
+        case RMAppReceiptIAPFieldSubscriptionExpirationDate:
+            return _record->subscriptionExpirationDate;
+        case RMAppReceiptIAPFieldCancellationDate:
+            return _record->cancellationDate;
+        default:
+            return NAN;
+    }
+}
+
+- (NSDate*)dateOfField:(RMAppReceiptIAPField)field
+{
+    if (_record)
+    {
+        const NSTimeInterval interval = [self recordedIntervalOfField:field];
+        return isnan(interval) ? nil : [NSDate dateWithTimeIntervalSince1970:interval];
+    }
+    const NSRange range = _ranges[field];
+    if (range.length == 0) return nil;
+    const uint8_t *p = (const uint8_t*)_asn1Data.bytes + range.location;
+    return RMASN1ReadIA5SDate(&p, range.length);
+}
+
+- (BOOL)getInterval:(NSTimeInterval*)interval ofField:(RMAppReceiptIAPField)field
+{
+    if (_record)
+    {
+        const NSTimeInterval recordedInterval = [self recordedIntervalOfField:field];
+        if (isnan(recordedInterval)) return NO;
+        *interval = recordedInterval;
+        return YES;
+    }
+    const NSRange range = _ranges[field];
+    if (range.length == 0) return NO;
+    
+    // Compare the raw dates when possible to avoid creating a NSDate for every purchase
+    const uint8_t *p = (const uint8_t*)_asn1Data.bytes + range.location;
+    long length;
+    const uint8_t *bytes = RMReceiptASN1ReadString(&p, range.length, V_ASN1_IA5STRING, &length);
+    if (!bytes) return NO;
+    if (RMReceiptParseRFC3339Date(bytes, length, interval)) return YES;
+    
+    NSDate *date = [self dateOfField:field];
+    if (!date) return NO;
+    *interval = date.timeIntervalSince1970;
+    return YES;
+}
+
+- (BOOL)getPurchaseInterval:(NSTimeInterval*)interval
+{
+    return [self getInterval:interval ofField:RMAppReceiptIAPFieldPurchaseDate];
+}
+
+- (BOOL)getSubscriptionExpirationInterval:(NSTimeInterval*)interval
+{
+    return [self getInterval:interval ofField:RMAppReceiptIAPFieldSubscriptionExpirationDate];
+}
+
 - (BOOL)isActiveAutoRenewableSubscriptionForDate:(NSDate*)date
 {
     NSAssert(self.subscriptionExpirationDate != nil, @"The product %@ is not an auto-renewable subscription.", self.productIdentifier);
@@ -390,3 +1689,149 @@ static NSURL *_appleRootCertificateURL = nil;
 }
 
 @end
+
+@implementation RMAppReceiptSubscriptionTimeline {
+    RMReceiptTimeline *_timeline;
+}
+
+- (instancetype)initWithInAppPurchases:(NSArray*)inAppPurchases
+{
+    if (self = [super init])
+    {
+        const NSUInteger count = inAppPurchases.count;
+        // Explicit casting to avoid errors when compiling as Objective-C++
+        double *starts = (double*)malloc(MAX(count, 1) * sizeof(double));
+        double *ends = (double*)malloc(MAX(count, 1) * sizeof(double));
+        long intervalCount = 0;
+        for (NSUInteger i = 0; starts && ends && i < count; i++)
+        {
+            RMAppReceiptIAP *purchase = inAppPurchases[i];
+            NSTimeInterval start, end;
+            // Same rules as isActiveAutoRenewableSubscriptionForDate:, where a missing purchase date doesn't bound the period
+            if (![purchase getSubscriptionExpirationInterval:&end] || purchase.cancellationDate) continue;
+            if (![purchase getPurchaseInterval:&start]) start = -INFINITY;
+            
+            starts[intervalCount] = start;
+            ends[intervalCount] = end;
+            intervalCount++;
+        }
+        if (starts && ends) _timeline = RMReceiptTimelineCreate(starts, ends, intervalCount);
+        free(starts);
+        free(ends);
+        if (!_timeline) return nil;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    RMReceiptTimelineFree(_timeline);
+}
+
+- (NSUInteger)periodCount
+{
+    return _timeline->count;
+}
+
+- (BOOL)isActiveForDate:(NSDate*)date
+{
+    NSParameterAssert(date);
+    return RMReceiptTimelineIsActiveAt(_timeline, date.timeIntervalSince1970) != 0;
+}
+
+- (NSDate*)nextChangeAfterDate:(NSDate*)date
+{
+    NSParameterAssert(date);
+    double change;
+    if (!RMReceiptTimelineGetNextChangeAfter(_timeline, date.timeIntervalSince1970, &change)) return nil;
+    return [NSDate dateWithTimeIntervalSince1970:change];
+}
+
+@end
+
+typedef struct
+{
+    NSTimeInterval purchaseInterval;
+    NSUInteger index;
+} RMAppReceiptRenewal;
+
+static int RMAppReceiptCompareRenewals(const void *a, const void *b)
+{
+    // Explicit casting to avoid errors when compiling as Objective-C++
+    const RMAppReceiptRenewal *x = (const RMAppReceiptRenewal*)a;
+    const RMAppReceiptRenewal *y = (const RMAppReceiptRenewal*)b;
+    if (x->purchaseInterval != y->purchaseInterval) return x->purchaseInterval < y->purchaseInterval ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index; // Keeps receipt order for equal dates
+}
+
+@implementation RMAppReceiptRenewalChain
+
+- (instancetype)initWithInAppPurchases:(NSArray*)inAppPurchases
+{
+    if (self = [super init])
+    {
+        _inAppPurchases = [RMAppReceiptRenewalChain inAppPurchasesSortedByPurchaseDate:inAppPurchases];
+        _originalTransactionIdentifier = [_inAppPurchases.firstObject originalTransactionIdentifier];
+    }
+    return self;
+}
+
+- (RMAppReceiptIAP*)head
+{
+    return _inAppPurchases.firstObject;
+}
+
+- (RMAppReceiptIAP*)tail
+{
+    return _inAppPurchases.lastObject;
+}
+
+- (NSUInteger)count
+{
+    return _inAppPurchases.count;
+}
+
+#pragma mark - Private
+
++ (NSArray*)inAppPurchasesSortedByPurchaseDate:(NSArray*)inAppPurchases
+{
+    const NSUInteger count = inAppPurchases.count;
+    if (count < 2) return [inAppPurchases copy];
+    
+    RMAppReceiptRenewal *renewals = (RMAppReceiptRenewal*)malloc(count * sizeof(RMAppReceiptRenewal)); // Explicit casting to avoid errors when compiling as Objective-C++
+    if (!renewals)
+    {
+        return [inAppPurchases sortedArrayWithOptions:NSSortStable usingComparator:^NSComparisonResult(RMAppReceiptIAP *purchase1, RMAppReceiptIAP *purchase2) {
+            NSTimeInterval interval1, interval2;
+            if (![purchase1 getPurchaseInterval:&interval1]) interval1 = -INFINITY;
+            if (![purchase2 getPurchaseInterval:&interval2]) interval2 = -INFINITY;
+            return interval1 < interval2 ? NSOrderedAscending : interval1 > interval2 ? NSOrderedDescending : NSOrderedSame;
+        }];
+    }
+    
+    // Receipts usually list renewals in order, so only sort when needed. Purchases without purchase date go first.
+    BOOL sorted = YES;
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        RMAppReceiptIAP *purchase = inAppPurchases[i];
+        if (![purchase getPurchaseInterval:&renewals[i].purchaseInterval]) renewals[i].purchaseInterval = -INFINITY;
+        renewals[i].index = i;
+        sorted = sorted && (i == 0 || renewals[i - 1].purchaseInterval <= renewals[i].purchaseInterval);
+    }
+    if (sorted)
+    {
+        free(renewals);
+        return [inAppPurchases copy];
+    }
+    
+    qsort(renewals, count, sizeof(RMAppReceiptRenewal), RMAppReceiptCompareRenewals);
+    NSMutableArray *sortedPurchases = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        [sortedPurchases addObject:inAppPurchases[renewals[i].index]];
+    }
+    free(renewals);
+    return [sortedPurchases copy];
+}
+
+@end
@@ -0,0 +1,1609 @@
+//
+//  RMAppReceiptCore.c
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "RMAppReceiptCore.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/objects.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// MARK: - ASN1
+
+/* A DER reader specialised for the receipt grammar: SET OF SEQUENCE { INTEGER, INTEGER, OCTET STRING }. Elements are bounds-checked against the end of their container before anything is read. */
+
+enum
+{
+    RMReceiptDERInteger = 0x02,
+    RMReceiptDEROctetString = 0x04,
+    RMReceiptDERSequence = 0x30,
+    RMReceiptDERSet = 0x31,
+};
+
+/** Reads the identifier and length octets of a DER element and advances *pp to its content. Only single-octet identifiers and definite lengths of up to 4 octets are accepted, which covers receipts.
+ @return The identifier octet, or -1 if the header is malformed or the content doesn't fit before end.
+ */
+static inline int RMReceiptDERReadHeader(const uint8_t **pp, const uint8_t *end, long *length)
+{
+    const uint8_t *p = *pp;
+    if (end - p < 2) return -1;
+
+    const int identifier = *p++;
+    if ((identifier & 0x1F) == 0x1F) return -1;
+
+    unsigned long l = *p++;
+    if (l & 0x80)
+    {
+        const long count = l & 0x7F;
+        if (count == 0 || count > 4 || end - p < count) return -1;
+        l = 0;
+        for (long i = 0; i < count; i++)
+        {
+            l = (l << 8) | *p++;
+        }
+    }
+    if (l > (unsigned long)(end - p)) return -1;
+
+    *pp = p;
+    *length = (long)l;
+    return identifier;
+}
+
+/** Reads the content of a non-negative INTEGER of up to INT64_MAX.
+ */
+static inline int RMReceiptDERReadInteger64Content(const uint8_t *p, long length, int64_t *value)
+{
+    if (length < 1 || length > 9 || (p[0] & 0x80)) return 0;
+    if (length == 9 && p[0] != 0) return 0;
+
+    uint64_t result = 0;
+    for (long i = 0; i < length; i++)
+    {
+        result = (result << 8) | p[i];
+    }
+    if (result > INT64_MAX) return 0;
+    *value = (int64_t)result;
+    return 1;
+}
+
+/** Reads the content of a non-negative INTEGER of up to INT_MAX.
+ */
+static inline int RMReceiptDERReadIntegerContent(const uint8_t *p, long length, int *value)
+{
+    int64_t result;
+    if (!RMReceiptDERReadInteger64Content(p, length, &result) || result > INT_MAX) return 0;
+    *value = (int)result;
+    return 1;
+}
+
+int64_t RMReceiptASN1ReadInteger64(const uint8_t **pp, long omax)
+{
+    const uint8_t *end = *pp + omax;
+    long length;
+    const int identifier = RMReceiptDERReadHeader(pp, end, &length);
+    if (identifier < 0)
+    {
+        *pp = end;
+        return 0;
+    }
+    int64_t value = 0;
+    if (identifier == RMReceiptDERInteger && !RMReceiptDERReadInteger64Content(*pp, length, &value))
+    {
+        value = 0;
+    }
+    *pp += length;
+    return value;
+}
+
+int RMReceiptASN1ReadInteger(const uint8_t **pp, long omax)
+{
+    const int64_t value = RMReceiptASN1ReadInteger64(pp, omax);
+    return value <= INT_MAX ? (int)value : 0;
+}
+
+const uint8_t *RMReceiptASN1ReadString(const uint8_t **pp, long omax, int expectedTag, long *length)
+{
+    const uint8_t *end = *pp + omax;
+    const int identifier = RMReceiptDERReadHeader(pp, end, length);
+    if (identifier < 0)
+    {
+        *pp = end;
+        *length = 0;
+        return NULL;
+    }
+    const uint8_t *value = identifier == expectedTag ? *pp : NULL;
+    *pp += *length;
+    return value;
+}
+
+void RMReceiptEnumerateAttributes(const uint8_t *p, long tlength, RMReceiptAttributeFunction function, void *context)
+{
+    if (!p || tlength <= 0) return;
+
+    long length;
+    if (RMReceiptDERReadHeader(&p, p + tlength, &length) != RMReceiptDERSet) return;
+    const uint8_t *end = p + length;
+
+    while (p < end)
+    {
+        if (RMReceiptDERReadHeader(&p, end, &length) != RMReceiptDERSequence) return;
+        const uint8_t *sequenceEnd = p + length;
+
+        int attributeType;
+        if (RMReceiptDERReadHeader(&p, sequenceEnd, &length) != RMReceiptDERInteger || !RMReceiptDERReadIntegerContent(p, length, &attributeType)) return;
+        p += length;
+
+        // The attribute version is not used
+        if (RMReceiptDERReadHeader(&p, sequenceEnd, &length) != RMReceiptDERInteger) return;
+        p += length;
+
+        // The octet string is passed in place, without copying it
+        if (RMReceiptDERReadHeader(&p, sequenceEnd, &length) != RMReceiptDEROctetString) return;
+        if (function(p, length, attributeType, context) != 0) return;
+
+        // Fields added in later versions of the grammar are skipped
+        p = sequenceEnd;
+    }
+}
+
+// MARK: - Search
+
+/* Each implementation compares the first and the last byte of the needle at 64 positions per iteration and only confirms the positions where both match with memcmp. The remaining positions are searched by the scalar implementation. */
+
+static const uint8_t *RMReceiptFindBytesScalar(const uint8_t *bytes, long length, const uint8_t *needle, long needleLength)
+{
+    const uint8_t *p = bytes;
+    const uint8_t *last = bytes + length - needleLength;
+    while (p <= last)
+    {
+        p = memchr(p, needle[0], (size_t)(last - p + 1));
+        if (!p) return NULL;
+        if (p[needleLength - 1] == needle[needleLength - 1] && memcmp(p + 1, needle + 1, (size_t)(needleLength - 1)) == 0) return p;
+        p++;
+    }
+    return NULL;
+}
+
+/** Confirms the candidates of a 64-bit mask, one bit per position from bytes.
+ */
+static const uint8_t *RMReceiptFindBytesConfirm(const uint8_t *bytes, uint64_t mask, const uint8_t *needle, long needleLength)
+{
+    while (mask)
+    {
+        const int offset = __builtin_ctzll(mask);
+        if (memcmp(bytes + offset + 1, needle + 1, (size_t)(needleLength - 1)) == 0) return bytes + offset;
+        mask &= mask - 1;
+    }
+    return NULL;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#if defined(__SSE2__)
+static const uint8_t *RMReceiptFindBytesSSE2(const uint8_t *bytes, long length, const uint8_t *needle, long needleLength)
+{
+    const __m128i first = _mm_set1_epi8((char)needle[0]);
+    const __m128i last = _mm_set1_epi8((char)needle[needleLength - 1]);
+    long i = 0;
+    for (; i + needleLength - 1 + 64 <= length; i += 64)
+    {
+        uint64_t mask = 0;
+        for (int block = 0; block < 64; block += 16)
+        {
+            const __m128i firstBlock = _mm_loadu_si128((const __m128i*)(bytes + i + block));
+            const __m128i lastBlock = _mm_loadu_si128((const __m128i*)(bytes + i + block + needleLength - 1));
+            mask |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, firstBlock), _mm_cmpeq_epi8(last, lastBlock))) << block;
+        }
+        if (mask)
+        {
+            const uint8_t *found = RMReceiptFindBytesConfirm(bytes + i, mask, needle, needleLength);
+            if (found) return found;
+        }
+    }
+    return RMReceiptFindBytesScalar(bytes + i, length - i, needle, needleLength);
+}
+#endif
+
+__attribute__((target("avx2")))
+static const uint8_t *RMReceiptFindBytesAVX2(const uint8_t *bytes, long length, const uint8_t *needle, long needleLength)
+{
+    const __m256i first = _mm256_set1_epi8((char)needle[0]);
+    const __m256i last = _mm256_set1_epi8((char)needle[needleLength - 1]);
+    long i = 0;
+    for (; i + needleLength - 1 + 64 <= length; i += 64)
+    {
+        uint64_t mask = 0;
+        for (int block = 0; block < 64; block += 32)
+        {
+            const __m256i firstBlock = _mm256_loadu_si256((const __m256i*)(bytes + i + block));
+            const __m256i lastBlock = _mm256_loadu_si256((const __m256i*)(bytes + i + block + needleLength - 1));
+            mask |= (uint64_t)(unsigned int)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, firstBlock), _mm256_cmpeq_epi8(last, lastBlock))) << block;
+        }
+        if (mask)
+        {
+            const uint8_t *found = RMReceiptFindBytesConfirm(bytes + i, mask, needle, needleLength);
+            if (found) return found;
+        }
+    }
+    return RMReceiptFindBytesScalar(bytes + i, length - i, needle, needleLength);
+}
+
+#elif defined(__ARM_NEON)
+
+static const uint8_t *RMReceiptFindBytesNEON(const uint8_t *bytes, long length, const uint8_t *needle, long needleLength)
+{
+    const uint8x16_t first = vdupq_n_u8(needle[0]);
+    const uint8x16_t last = vdupq_n_u8(needle[needleLength - 1]);
+    long i = 0;
+    for (; i + needleLength - 1 + 64 <= length; i += 64)
+    {
+        uint8x16_t matches[4];
+        for (int block = 0; block < 4; block++)
+        {
+            matches[block] = vandq_u8(vceqq_u8(first, vld1q_u8(bytes + i + block * 16)), vceqq_u8(last, vld1q_u8(bytes + i + block * 16 + needleLength - 1)));
+        }
+        // NEON has no movemask: a narrowing shift keeps 4 bits per byte, so each block is confirmed with its own 64-bit mask
+        const uint8x16_t any = vorrq_u8(vorrq_u8(matches[0], matches[1]), vorrq_u8(matches[2], matches[3]));
+        if (vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(any), 4)), 0) == 0) continue;
+
+        for (int block = 0; block < 4; block++)
+        {
+            const uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches[block]), 4)), 0);
+            const uint64_t mask = nibbles & 0x1111111111111111ULL;
+            for (uint64_t bits = mask; bits; bits &= bits - 1)
+            {
+                const long offset = block * 16 + (__builtin_ctzll(bits) >> 2);
+                if (memcmp(bytes + i + offset + 1, needle + 1, (size_t)(needleLength - 1)) == 0) return bytes + i + offset;
+            }
+        }
+    }
+    return RMReceiptFindBytesScalar(bytes + i, length - i, needle, needleLength);
+}
+
+#endif
+
+int RMReceiptSearchIsAvailable(RMReceiptSearchImplementation implementation)
+{
+    switch (implementation)
+    {
+        case RMReceiptSearchAutomatic:
+        case RMReceiptSearchScalar:
+            return 1;
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__SSE2__)
+        case RMReceiptSearchSSE2:
+            return 1;
+#endif
+        case RMReceiptSearchAVX2:
+            return __builtin_cpu_supports("avx2");
+#elif defined(__ARM_NEON)
+        case RMReceiptSearchNEON:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+const uint8_t *RMReceiptFindBytes(const uint8_t *bytes, long length, const uint8_t *needle, long needleLength, RMReceiptSearchImplementation implementation)
+{
+    if (needleLength <= 0) return bytes;
+    if (needleLength > length) return NULL;
+
+    if (implementation == RMReceiptSearchAutomatic)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        implementation = __builtin_cpu_supports("avx2") ? RMReceiptSearchAVX2 : RMReceiptSearchSSE2;
+#elif defined(__ARM_NEON)
+        implementation = RMReceiptSearchNEON;
+#endif
+    }
+    switch (implementation)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__SSE2__)
+        case RMReceiptSearchSSE2:
+            return RMReceiptFindBytesSSE2(bytes, length, needle, needleLength);
+#endif
+        case RMReceiptSearchAVX2:
+            if (__builtin_cpu_supports("avx2")) return RMReceiptFindBytesAVX2(bytes, length, needle, needleLength);
+            break;
+#elif defined(__ARM_NEON)
+        case RMReceiptSearchNEON:
+            return RMReceiptFindBytesNEON(bytes, length, needle, needleLength);
+#endif
+        default:
+            break;
+    }
+    return RMReceiptFindBytesScalar(bytes, length, needle, needleLength);
+}
+
+// MARK: - Queries
+
+typedef struct
+{
+    uint32_t typeMask;
+    uint32_t foundMask;
+    RMReceiptPurchase purchase;
+    RMReceiptPurchasePredicate predicate;
+    void *context;
+    int stopped;
+    const uint8_t *payload;
+    long length;
+    const uint8_t *needle;
+    long needleLength;
+    long candidate;
+} RMReceiptScan;
+
+static int RMReceiptScanPurchaseAttribute(const uint8_t *value, long length, int type, void *context)
+{
+    RMReceiptScan *scan = context;
+    if (type < RMReceiptAttributeTypeQuantity || type > RMReceiptAttributeTypeCancellationDate) return 0;
+
+    const uint32_t bit = RMReceiptPurchaseAttributeBit(type);
+    if (!(scan->typeMask & bit)) return 0;
+
+    scan->purchase.values[type - RMReceiptAttributeTypeQuantity] = value;
+    scan->purchase.lengths[type - RMReceiptAttributeTypeQuantity] = length;
+    scan->foundMask |= bit;
+    return scan->foundMask == scan->typeMask;
+}
+
+static int RMReceiptScanAttribute(const uint8_t *value, long length, int type, void *context)
+{
+    if (type != RMReceiptAttributeTypeInAppPurchaseReceipt) return 0;
+
+    RMReceiptScan *scan = context;
+    if (scan->needle)
+    {
+        // Purchases that don't contain the next occurrence of the needle can't match and are skipped without decoding them
+        const long offset = value - scan->payload;
+        if (scan->candidate < offset)
+        {
+            const uint8_t *candidate = RMReceiptFindBytes(value, scan->length - offset, scan->needle, scan->needleLength, RMReceiptSearchAutomatic);
+            if (!candidate) return 1;
+            scan->candidate = candidate - scan->payload;
+        }
+        if (scan->candidate >= offset + length) return 0;
+    }
+
+    scan->foundMask = 0;
+    memset(&scan->purchase, 0, sizeof(scan->purchase));
+    if (scan->typeMask != 0)
+    {
+        RMReceiptEnumerateAttributes(value, length, RMReceiptScanPurchaseAttribute, scan);
+    }
+    scan->stopped = scan->predicate(&scan->purchase, scan->context) != 0;
+    return scan->stopped;
+}
+
+/** Scans only the purchases whose bytes contain needle, if given, starting from its first occurrence in the payload.
+ */
+static int RMReceiptScanPurchasesContaining(const uint8_t *payload, long length, const uint8_t *needle, long needleLength, const uint8_t *candidate, uint32_t typeMask, RMReceiptPurchasePredicate predicate, void *context)
+{
+    RMReceiptScan scan = {.typeMask = typeMask, .predicate = predicate, .context = context, .payload = payload, .length = length, .needle = needle, .needleLength = needleLength, .candidate = candidate ? candidate - payload : -1};
+    RMReceiptEnumerateAttributes(payload, length, RMReceiptScanAttribute, &scan);
+    return scan.stopped;
+}
+
+int RMReceiptScanPurchases(const uint8_t *payload, long length, uint32_t typeMask, RMReceiptPurchasePredicate predicate, void *context)
+{
+    return RMReceiptScanPurchasesContaining(payload, length, NULL, 0, NULL, typeMask, predicate, context);
+}
+
+typedef struct
+{
+    const char *productIdentifier;
+    long productIdentifierLength;
+} RMReceiptProductQuery;
+
+static int RMReceiptMatchProduct(const RMReceiptPurchase *purchase, void *context)
+{
+    const RMReceiptProductQuery *query = context;
+    long length;
+    const uint8_t *p = RMReceiptPurchaseGetValue(purchase, RMReceiptAttributeTypeProductIdentifier, &length);
+    if (!p) return 0;
+
+    long stringLength;
+    const uint8_t *string = RMReceiptASN1ReadString(&p, length, V_ASN1_UTF8STRING, &stringLength);
+    return string && stringLength == query->productIdentifierLength && memcmp(string, query->productIdentifier, stringLength) == 0;
+}
+
+int RMReceiptContainsProduct(const uint8_t *payload, long length, const char *productIdentifier, long productIdentifierLength)
+{
+    if (productIdentifierLength < 0) return 0;
+
+    // The prefilter looks for the last length octet of the UTF8String followed by its contents, which are the same whatever form the length is encoded in
+    uint8_t buffer[256];
+    const long needleLength = productIdentifierLength + 1;
+    uint8_t *needle = needleLength <= (long)sizeof(buffer) ? buffer : malloc((size_t)needleLength);
+    if (!needle) return 0;
+    needle[0] = (uint8_t)(productIdentifierLength & 0xFF);
+    memcpy(needle + 1, productIdentifier, (size_t)productIdentifierLength);
+
+    int result = 0;
+    const uint8_t *candidate = RMReceiptFindBytes(payload, length, needle, needleLength, RMReceiptSearchAutomatic);
+    if (candidate)
+    {
+        RMReceiptProductQuery query = {productIdentifier, productIdentifierLength};
+        result = RMReceiptScanPurchasesContaining(payload, length, needle, needleLength, candidate, RMReceiptPurchaseAttributeBit(RMReceiptAttributeTypeProductIdentifier), RMReceiptMatchProduct, &query);
+    }
+    if (needle != buffer) free(needle);
+    return result;
+}
+
+// MARK: - Table
+
+typedef struct
+{
+    RMReceiptPurchaseTable *table;
+    long row;
+    int32_t *slots; // Open addressing set of product indices, -1 if empty
+    long slotCount;
+    long productCapacity;
+    int failed;
+} RMReceiptTableBuilder;
+
+static uint32_t RMReceiptHashBytes(const uint8_t *bytes, long length)
+{
+    // Multiplicative hash of 8 bytes at a time, as identifiers are long and hashed often
+    uint64_t hash = (uint64_t)length * 0x9E3779B97F4A7C15ull;
+    long i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+    uint64_t tail = 0;
+    if (i < length) memcpy(&tail, bytes + i, length - i);
+    hash = (hash ^ tail) * 0xC4CEB9FE1A85EC53ull;
+    return (uint32_t)(hash ^ (hash >> 29));
+}
+
+static int RMReceiptTableGrowProducts(RMReceiptTableBuilder *builder)
+{
+    RMReceiptPurchaseTable *table = builder->table;
+    const long capacity = builder->productCapacity > 0 ? builder->productCapacity * 2 : 16;
+    const uint8_t **identifiers = realloc(table->productIdentifiers, capacity * sizeof(*identifiers));
+    if (!identifiers) return 0;
+    table->productIdentifiers = identifiers;
+    long *lengths = realloc(table->productIdentifierLengths, capacity * sizeof(*lengths));
+    if (!lengths) return 0;
+    table->productIdentifierLengths = lengths;
+
+    // Keep the set at most half full
+    int32_t *slots = malloc(capacity * 2 * sizeof(*slots));
+    if (!slots) return 0;
+    memset(slots, 0xFF, capacity * 2 * sizeof(*slots));
+    for (long i = 0; i < table->productCount; i++)
+    {
+        uint32_t slot = RMReceiptHashBytes(identifiers[i], lengths[i]) & (capacity * 2 - 1);
+        while (slots[slot] >= 0) slot = (slot + 1) & (capacity * 2 - 1);
+        slots[slot] = (int32_t)i;
+    }
+    free(builder->slots);
+    builder->slots = slots;
+    builder->slotCount = capacity * 2;
+    builder->productCapacity = capacity;
+    return 1;
+}
+
+static int32_t RMReceiptTableInternProduct(RMReceiptTableBuilder *builder, const uint8_t *bytes, long length)
+{
+    RMReceiptPurchaseTable *table = builder->table;
+    if (table->productCount == builder->productCapacity && !RMReceiptTableGrowProducts(builder)) return -1;
+
+    uint32_t slot = RMReceiptHashBytes(bytes, length) & (builder->slotCount - 1);
+    for (; builder->slots[slot] >= 0; slot = (slot + 1) & (builder->slotCount - 1))
+    {
+        const int32_t index = builder->slots[slot];
+        if (table->productIdentifierLengths[index] == length && memcmp(table->productIdentifiers[index], bytes, length) == 0) return index;
+    }
+    const int32_t index = (int32_t)table->productCount++;
+    table->productIdentifiers[index] = bytes;
+    table->productIdentifierLengths[index] = length;
+    builder->slots[slot] = index;
+    return index;
+}
+
+static int64_t RMReceiptTableReadDate(const uint8_t *p, long length, long *unparsedCount)
+{
+    long stringLength;
+    const uint8_t *string = RMReceiptASN1ReadString(&p, length, V_ASN1_IA5STRING, &stringLength);
+    if (!string) return RMReceiptPurchaseTableNoDate;
+
+    double interval;
+    if (RMReceiptParseRFC3339Date(string, stringLength, &interval)) return (int64_t)interval;
+    (*unparsedCount)++;
+    return RMReceiptPurchaseTableUnparsedDate;
+}
+
+static int RMReceiptTableReadAttribute(const uint8_t *value, long length, int type, void *context)
+{
+    RMReceiptTableBuilder *builder = context;
+    RMReceiptPurchaseTable *table = builder->table;
+    const long row = builder->row;
+    const uint8_t *p = value;
+    switch (type)
+    {
+        case RMReceiptAttributeTypeQuantity:
+            table->quantities[row] = RMReceiptASN1ReadInteger(&p, length);
+            break;
+        case RMReceiptAttributeTypeProductIdentifier:
+        {
+            long stringLength;
+            const uint8_t *string = RMReceiptASN1ReadString(&p, length, V_ASN1_UTF8STRING, &stringLength);
+            if (string)
+            {
+                table->productIndices[row] = RMReceiptTableInternProduct(builder, string, stringLength);
+                builder->failed |= table->productIndices[row] < 0;
+            }
+            break;
+        }
+        case RMReceiptAttributeTypePurchaseDate:
+            table->purchaseDates[row] = RMReceiptTableReadDate(value, length, &table->unparsedDateCount);
+            break;
+        case RMReceiptAttributeTypeOriginalPurchaseDate:
+            table->originalPurchaseDates[row] = RMReceiptTableReadDate(value, length, &table->unparsedDateCount);
+            break;
+        case RMReceiptAttributeTypeSubscriptionExpirationDate:
+            table->expirationDates[row] = RMReceiptTableReadDate(value, length, &table->unparsedDateCount);
+            break;
+        case RMReceiptAttributeTypeCancellationDate:
+            table->cancellationDates[row] = RMReceiptTableReadDate(value, length, &table->unparsedDateCount);
+            break;
+        case RMReceiptAttributeTypeWebOrderLineItemID:
+            // Same reader as RMAppReceiptIAP, so that both agree
+            table->webOrderLineItemIDs[row] = RMReceiptASN1ReadInteger64(&p, length);
+            break;
+    }
+    return builder->failed;
+}
+
+static int RMReceiptTableCountPurchase(const uint8_t *value, long length, int type, void *context)
+{
+    (void)value, (void)length;
+    long *count = context;
+    *count += type == RMReceiptAttributeTypeInAppPurchaseReceipt;
+    return 0;
+}
+
+static int RMReceiptTableReadPurchase(const uint8_t *value, long length, int type, void *context)
+{
+    if (type != RMReceiptAttributeTypeInAppPurchaseReceipt) return 0;
+
+    RMReceiptTableBuilder *builder = context;
+    RMReceiptPurchaseTable *table = builder->table;
+    const long row = builder->row;
+    table->productIndices[row] = -1;
+    table->purchaseDates[row] = RMReceiptPurchaseTableNoDate;
+    table->originalPurchaseDates[row] = RMReceiptPurchaseTableNoDate;
+    table->expirationDates[row] = RMReceiptPurchaseTableNoDate;
+    table->cancellationDates[row] = RMReceiptPurchaseTableNoDate;
+    RMReceiptEnumerateAttributes(value, length, RMReceiptTableReadAttribute, builder);
+    builder->row++;
+    return builder->failed;
+}
+
+RMReceiptPurchaseTable *RMReceiptPurchaseTableCreate(const uint8_t *payload, long length)
+{
+    long count = 0;
+    RMReceiptEnumerateAttributes(payload, length, RMReceiptTableCountPurchase, &count);
+
+    RMReceiptPurchaseTable *table = calloc(1, sizeof(*table));
+    if (!table) return NULL;
+    table->count = count;
+    // All the columns share one allocation, the 64-bit ones first to keep them aligned
+    uint8_t *columns = calloc(count > 0 ? count : 1, 5 * sizeof(int64_t) + 2 * sizeof(int32_t));
+    if (!columns)
+    {
+        free(table);
+        return NULL;
+    }
+    table->purchaseDates = (int64_t*)columns;
+    table->originalPurchaseDates = table->purchaseDates + count;
+    table->expirationDates = table->originalPurchaseDates + count;
+    table->cancellationDates = table->expirationDates + count;
+    table->webOrderLineItemIDs = table->cancellationDates + count;
+    table->productIndices = (int32_t*)(table->webOrderLineItemIDs + count);
+    table->quantities = table->productIndices + count;
+
+    RMReceiptTableBuilder builder = {.table = table};
+    RMReceiptEnumerateAttributes(payload, length, RMReceiptTableReadPurchase, &builder);
+    free(builder.slots);
+    if (builder.failed)
+    {
+        RMReceiptPurchaseTableFree(table);
+        return NULL;
+    }
+    return table;
+}
+
+void RMReceiptPurchaseTableFree(RMReceiptPurchaseTable *table)
+{
+    if (!table) return;
+
+    free(table->purchaseDates);
+    free(table->productIdentifiers);
+    free(table->productIdentifierLengths);
+    free(table);
+}
+
+long RMReceiptPurchaseTableFindProduct(const RMReceiptPurchaseTable *table, const char *productIdentifier, long productIdentifierLength)
+{
+    // Catalogues are small, so a linear search is enough
+    for (long i = 0; i < table->productCount; i++)
+    {
+        if (table->productIdentifierLengths[i] == productIdentifierLength && memcmp(table->productIdentifiers[i], productIdentifier, productIdentifierLength) == 0) return i;
+    }
+    return -1;
+}
+
+/* The scans below are branchless so that the compiler can vectorise them. */
+
+long RMReceiptPurchaseTableCountPurchasesBetween(const RMReceiptPurchaseTable *table, int64_t start, int64_t end)
+{
+    const int64_t *dates = table->purchaseDates;
+    const long count = table->count;
+    long result = 0;
+    for (long i = 0; i < count; i++)
+    {
+        result += (dates[i] >= start) & (dates[i] < end);
+    }
+    return result;
+}
+
+long RMReceiptPurchaseTableSelectPurchasesBetween(const RMReceiptPurchaseTable *table, int64_t start, int64_t end, long *rows)
+{
+    const int64_t *dates = table->purchaseDates;
+    const long count = table->count;
+    long result = 0;
+    for (long i = 0; i < count; i++)
+    {
+        rows[result] = i;
+        result += (dates[i] >= start) & (dates[i] < end);
+    }
+    return result;
+}
+
+void RMReceiptPurchaseTableCountProducts(const RMReceiptPurchaseTable *table, long *counts)
+{
+    const int32_t *indices = table->productIndices;
+    const long count = table->count;
+    memset(counts, 0, table->productCount * sizeof(*counts));
+    for (long i = 0; i < count; i++)
+    {
+        if (indices[i] >= 0) counts[indices[i]]++;
+    }
+}
+
+void RMReceiptPurchaseTableGetLatestExpirations(const RMReceiptPurchaseTable *table, int64_t *latest)
+{
+    const int32_t *indices = table->productIndices;
+    const int64_t *dates = table->expirationDates;
+    const long count = table->count;
+    for (long i = 0; i < table->productCount; i++)
+    {
+        latest[i] = RMReceiptPurchaseTableNoDate;
+    }
+    for (long i = 0; i < count; i++)
+    {
+        const int32_t index = indices[i];
+        if (index >= 0 && dates[i] > latest[index]) latest[index] = dates[i];
+    }
+}
+
+// MARK: - Strings
+
+enum
+{
+    RMReceiptStringChunkSize = 16384,
+};
+
+typedef struct RMReceiptStringChunk
+{
+    struct RMReceiptStringChunk *next;
+    size_t used;
+    size_t capacity;
+    uint8_t bytes[];
+} RMReceiptStringChunk;
+
+typedef struct
+{
+    const uint8_t *bytes;
+    uint32_t length;
+    uint32_t hash;
+} RMReceiptStringEntry;
+
+struct RMReceiptStringPool
+{
+    RMReceiptStringChunk *chunks; // The current chunk first
+    RMReceiptStringEntry *entries; // By index
+    long entryCapacity;
+    int32_t *slots; // Open addressing set of entry indices, -1 if empty
+    long slotCount;
+    long count;
+    size_t size;
+};
+
+static int RMReceiptStringPoolGrowSlots(RMReceiptStringPool *pool, long slotCount)
+{
+    int32_t *slots = malloc(slotCount * sizeof(*slots));
+    if (!slots) return 0;
+    memset(slots, 0xFF, slotCount * sizeof(*slots));
+    for (long i = 0; i < pool->count; i++)
+    {
+        long slot = pool->entries[i].hash & (slotCount - 1);
+        while (slots[slot] >= 0) slot = (slot + 1) & (slotCount - 1);
+        slots[slot] = (int32_t)i;
+    }
+    free(pool->slots);
+    pool->size += (slotCount - pool->slotCount) * sizeof(*slots);
+    pool->slots = slots;
+    pool->slotCount = slotCount;
+    return 1;
+}
+
+static int RMReceiptStringPoolGrowEntries(RMReceiptStringPool *pool, long entryCapacity)
+{
+    RMReceiptStringEntry *entries = realloc(pool->entries, entryCapacity * sizeof(*entries));
+    if (!entries) return 0;
+    pool->size += (entryCapacity - pool->entryCapacity) * sizeof(*entries);
+    pool->entries = entries;
+    pool->entryCapacity = entryCapacity;
+    return 1;
+}
+
+RMReceiptStringPool *RMReceiptStringPoolCreate(void)
+{
+    RMReceiptStringPool *pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    pool->size = sizeof(*pool);
+    if (!RMReceiptStringPoolGrowEntries(pool, 32) || !RMReceiptStringPoolGrowSlots(pool, 64))
+    {
+        RMReceiptStringPoolFree(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+static const uint8_t *RMReceiptStringPoolCopy(RMReceiptStringPool *pool, const uint8_t *bytes, long length)
+{
+    // Empty strings still need a distinct non-NULL address
+    const size_t reserved = length > 0 ? (size_t)length : 1;
+    RMReceiptStringChunk *chunk = pool->chunks;
+    if (!chunk || chunk->capacity - chunk->used < reserved)
+    {
+        // Strings larger than a chunk get a chunk of their own
+        const size_t capacity = reserved > RMReceiptStringChunkSize ? reserved : RMReceiptStringChunkSize;
+        chunk = malloc(sizeof(*chunk) + capacity);
+        if (!chunk) return NULL;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        pool->size += sizeof(*chunk) + capacity;
+        if (pool->chunks && capacity > RMReceiptStringChunkSize)
+        { // Keep filling the current chunk
+            chunk->next = pool->chunks->next;
+            pool->chunks->next = chunk;
+        }
+        else
+        {
+            chunk->next = pool->chunks;
+            pool->chunks = chunk;
+        }
+    }
+    uint8_t *copy = chunk->bytes + chunk->used;
+    if (length > 0) memcpy(copy, bytes, length);
+    chunk->used += reserved;
+    return copy;
+}
+
+long RMReceiptStringPoolIntern(RMReceiptStringPool *pool, const uint8_t *bytes, long length, const uint8_t **interned)
+{
+    if (length < 0 || length > (long)INT32_MAX) return -1;
+    // Keep the set at most half full
+    if (pool->count * 2 >= pool->slotCount && !RMReceiptStringPoolGrowSlots(pool, pool->slotCount * 2)) return -1;
+
+    const uint32_t hash = RMReceiptHashBytes(bytes, length);
+    long slot = hash & (pool->slotCount - 1);
+    for (; pool->slots[slot] >= 0; slot = (slot + 1) & (pool->slotCount - 1))
+    {
+        const RMReceiptStringEntry *entry = &pool->entries[pool->slots[slot]];
+        if (entry->hash == hash && entry->length == (uint32_t)length && memcmp(entry->bytes, bytes, length) == 0)
+        {
+            *interned = entry->bytes;
+            return pool->slots[slot];
+        }
+    }
+
+    if (pool->count == pool->entryCapacity && !RMReceiptStringPoolGrowEntries(pool, pool->entryCapacity * 2)) return -1;
+    const uint8_t *copy = RMReceiptStringPoolCopy(pool, bytes, length);
+    if (!copy) return -1;
+    pool->entries[pool->count] = (RMReceiptStringEntry){copy, (uint32_t)length, hash};
+    pool->slots[slot] = (int32_t)pool->count;
+    *interned = copy;
+    return pool->count++;
+}
+
+long RMReceiptStringPoolGetCount(const RMReceiptStringPool *pool)
+{
+    return pool->count;
+}
+
+size_t RMReceiptStringPoolGetSize(const RMReceiptStringPool *pool)
+{
+    return pool->size;
+}
+
+void RMReceiptStringPoolFree(RMReceiptStringPool *pool)
+{
+    if (!pool) return;
+
+    for (RMReceiptStringChunk *chunk = pool->chunks; chunk; )
+    {
+        RMReceiptStringChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(pool->entries);
+    free(pool->slots);
+    free(pool);
+}
+
+// MARK: - Timeline
+
+static int RMReceiptTimelineCompareIntervals(const void *a, const void *b)
+{
+    const double *x = (const double*)a;
+    const double *y = (const double*)b;
+    if (x[0] != y[0]) return x[0] < y[0] ? -1 : 1;
+    if (x[1] != y[1]) return x[1] < y[1] ? -1 : 1;
+    return 0;
+}
+
+RMReceiptTimeline *RMReceiptTimelineCreate(const double *starts, const double *ends, long count)
+{
+    if (count < 0) count = 0;
+    // The boundaries follow the timeline in the same allocation
+    RMReceiptTimeline *timeline = (RMReceiptTimeline*)malloc(sizeof(RMReceiptTimeline) + 2 * count * sizeof(double));
+    if (!timeline) return NULL;
+    
+    timeline->boundaries = (double*)(timeline + 1);
+    long n = 0;
+    for (long i = 0; i < count; i++)
+    {
+        if (!(starts[i] <= ends[i])) continue; // Also false for NaN
+        
+        timeline->boundaries[2 * n] = starts[i];
+        timeline->boundaries[2 * n + 1] = ends[i];
+        n++;
+    }
+    qsort(timeline->boundaries, n, 2 * sizeof(double), RMReceiptTimelineCompareIntervals);
+    
+    // Merge in place. Each interval starts strictly after the end of the previous one.
+    long merged = 0;
+    for (long i = 0; i < n; i++)
+    {
+        const double start = timeline->boundaries[2 * i];
+        const double end = timeline->boundaries[2 * i + 1];
+        if (merged > 0 && start <= timeline->boundaries[2 * merged - 1])
+        {
+            if (end > timeline->boundaries[2 * merged - 1]) timeline->boundaries[2 * merged - 1] = end;
+            continue;
+        }
+        timeline->boundaries[2 * merged] = start;
+        timeline->boundaries[2 * merged + 1] = end;
+        merged++;
+    }
+    timeline->count = merged;
+    return timeline;
+}
+
+void RMReceiptTimelineFree(RMReceiptTimeline *timeline)
+{
+    free(timeline);
+}
+
+/** Returns the number of boundaries that are not after the given time.
+ */
+static long RMReceiptTimelineCountBoundariesUntil(const RMReceiptTimeline *timeline, double time)
+{
+    long low = 0;
+    long high = 2 * timeline->count;
+    while (low < high)
+    {
+        const long middle = low + (high - low) / 2;
+        if (timeline->boundaries[middle] <= time)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+int RMReceiptTimelineIsActiveAt(const RMReceiptTimeline *timeline, double time)
+{
+    const long index = RMReceiptTimelineCountBoundariesUntil(timeline, time);
+    // After a start, or exactly at an end
+    return (index & 1) || (index > 0 && timeline->boundaries[index - 1] == time);
+}
+
+int RMReceiptTimelineGetNextChangeAfter(const RMReceiptTimeline *timeline, double time, double *change)
+{
+    const long index = RMReceiptTimelineCountBoundariesUntil(timeline, time);
+    if (index == 2 * timeline->count) return 0;
+    
+    *change = timeline->boundaries[index];
+    return 1;
+}
+
+// MARK: - Incremental
+
+long RMReceiptMatchEntries(const uint8_t *const *previousEntries, const long *previousLengths, long previousCount, const uint8_t *const *entries, const long *lengths, long count, long *matches)
+{
+    // Refreshed receipts usually keep the previous entries in place and append the new ones
+    long matched = 0;
+    for (long i = 0; i < count; i++)
+    {
+        const int same = i < previousCount && lengths[i] == previousLengths[i] && memcmp(entries[i], previousEntries[i], lengths[i]) == 0;
+        matches[i] = same ? i : -1;
+        matched += same;
+    }
+    if (matched == count || matched == previousCount) return matched;
+    
+    // Open addressing set of the previous entries that are left, kept at most half full. -1 is empty and -2 is an entry that already matched.
+    long slotCount = 16;
+    while (slotCount < 2 * (previousCount - matched)) slotCount *= 2;
+    long *slots = (long*)malloc(slotCount * sizeof(long));
+    if (!slots) return matched;
+    memset(slots, 0xFF, slotCount * sizeof(long));
+    for (long j = 0; j < previousCount; j++)
+    {
+        if (j < count && matches[j] == j) continue;
+        
+        uint32_t slot = RMReceiptHashBytes(previousEntries[j], previousLengths[j]) & (slotCount - 1);
+        while (slots[slot] != -1) slot = (slot + 1) & (slotCount - 1);
+        slots[slot] = j;
+    }
+    for (long i = 0; i < count; i++)
+    {
+        if (matches[i] >= 0) continue;
+        
+        for (uint32_t slot = RMReceiptHashBytes(entries[i], lengths[i]) & (slotCount - 1); slots[slot] != -1; slot = (slot + 1) & (slotCount - 1))
+        {
+            const long j = slots[slot];
+            if (j < 0 || previousLengths[j] != lengths[i] || memcmp(previousEntries[j], entries[i], lengths[i]) != 0) continue;
+            
+            matches[i] = j;
+            matched++;
+            slots[slot] = -2;
+            break;
+        }
+    }
+    free(slots);
+    return matched;
+}
+
+// MARK: - Dates
+
+static int RMReceiptReadDigits(const uint8_t *p, int count, int *value)
+{
+    int result = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const uint8_t c = p[i];
+        if (c < '0' || c > '9') return 0;
+        result = result * 10 + (c - '0');
+    }
+    *value = result;
+    return 1;
+}
+
+int RMReceiptParseRFC3339Date(const uint8_t *p, long length, double *interval)
+{
+    if (length != 20 && length != 24) return 0;
+
+    int year, month, day, hour, minute, second;
+    if (!RMReceiptReadDigits(p, 4, &year) || p[4] != '-' ||
+        !RMReceiptReadDigits(p + 5, 2, &month) || p[7] != '-' ||
+        !RMReceiptReadDigits(p + 8, 2, &day) || p[10] != 'T' ||
+        !RMReceiptReadDigits(p + 11, 2, &hour) || p[13] != ':' ||
+        !RMReceiptReadDigits(p + 14, 2, &minute) || p[16] != ':' ||
+        !RMReceiptReadDigits(p + 17, 2, &second)) return 0;
+
+    int offset = 0;
+    const uint8_t *zone = p + 19;
+    if (length == 20)
+    {
+        if (zone[0] != 'Z') return 0;
+    }
+    else
+    { // +hhmm or -hhmm
+        int offsetHours, offsetMinutes;
+        if (zone[0] != '+' && zone[0] != '-') return 0;
+        if (!RMReceiptReadDigits(zone + 1, 2, &offsetHours) || !RMReceiptReadDigits(zone + 3, 2, &offsetMinutes)) return 0;
+        if (offsetHours > 23 || offsetMinutes > 59) return 0;
+        offset = (offsetHours * 60 + offsetMinutes) * 60;
+        if (zone[0] == '-') offset = -offset;
+    }
+
+    if (year < 1583 || month < 1 || month > 12 || day < 1 || hour > 23 || minute > 59 || second > 59) return 0;
+    static const int daysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    const int leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if (day > daysInMonth[month - 1] + (month == 2 ? leap : 0)) return 0;
+
+    // Days since 1970-01-01. From: http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+    const int y = year - (month <= 2);
+    const int era = y / 400;
+    const int yoe = y - era * 400;
+    const int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    const long long days = era * 146097LL + doe - 719468;
+
+    *interval = (double)(days * 86400 + hour * 3600 + minute * 60 + second - offset);
+    return 1;
+}
+
+// MARK: - Hash
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static pthread_once_t _sha1Once = PTHREAD_ONCE_INIT;
+static EVP_MD *_sha1;
+
+static void RMReceiptFetchSHA1(void)
+{
+    // Fetched once for the life of the process instead of by every EVP_sha1 digest
+    _sha1 = EVP_MD_fetch(NULL, "SHA1", NULL);
+}
+#endif
+
+int RMReceiptVerifyHash(const uint8_t deviceIdentifier[16], const uint8_t *opaqueValue, long opaqueValueLength, const uint8_t *bundleIdentifier, long bundleIdentifierLength, const uint8_t *hash, long hashLength)
+{ // Order taken from: https://developer.apple.com/library/ios/releasenotes/General/ValidateAppStoreReceipt/Chapters/ValidateLocally.html#//apple_ref/doc/uid/TP40010573-CH1-SW5
+    if (hashLength != SHA_DIGEST_LENGTH || opaqueValueLength < 0 || bundleIdentifierLength < 0) return 0;
+
+    uint8_t digest[SHA_DIGEST_LENGTH];
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    SHA_CTX context; // On the stack, unlike an EVP_MD_CTX since 1.1.0
+    const int hashed = SHA1_Init(&context) &&
+        SHA1_Update(&context, deviceIdentifier, 16) &&
+        SHA1_Update(&context, opaqueValue, opaqueValueLength) &&
+        SHA1_Update(&context, bundleIdentifier, bundleIdentifierLength) &&
+        SHA1_Final(digest, &context);
+#else
+    pthread_once(&_sha1Once, RMReceiptFetchSHA1);
+    EVP_MD_CTX *context = EVP_MD_CTX_new(); // The SHA1_* functions are deprecated since 3.0
+    const int hashed = context && _sha1 &&
+        EVP_DigestInit_ex(context, _sha1, NULL) &&
+        EVP_DigestUpdate(context, deviceIdentifier, 16) &&
+        EVP_DigestUpdate(context, opaqueValue, opaqueValueLength) &&
+        EVP_DigestUpdate(context, bundleIdentifier, bundleIdentifierLength) &&
+        EVP_DigestFinal_ex(context, digest, NULL);
+    EVP_MD_CTX_free(context);
+#endif
+    return hashed && CRYPTO_memcmp(digest, hash, SHA_DIGEST_LENGTH) == 0;
+}
+
+// MARK: - PKCS7
+
+PKCS7 *RMReceiptReadPKCS7(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+
+    PKCS7 *p7 = d2i_PKCS7_fp(fp, NULL);
+    fclose(fp);
+    return p7;
+}
+
+int RMReceiptVerifyPKCS7(PKCS7 *container, const uint8_t *certificateBytes, long certificateLength)
+{
+    RMReceiptVerifier *verifier = RMReceiptVerifierCreate(certificateBytes, certificateLength);
+    if (!verifier) return 0;
+
+    const int result = RMReceiptVerifierVerify(verifier, container);
+    RMReceiptVerifierFree(verifier);
+    return result;
+}
+
+int RMReceiptGetPKCS7Payload(PKCS7 *container, const uint8_t **bytes, long *length)
+{
+    if (!PKCS7_type_is_signed(container)) return 0;
+
+    struct pkcs7_st *contents = container->d.sign->contents;
+    if (!contents || !PKCS7_type_is_data(contents)) return 0;
+
+    ASN1_OCTET_STRING *octets = contents->d.data;
+    if (!octets) return 0;
+
+    *bytes = octets->data;
+    *length = octets->length;
+    return 1;
+}
+
+uint8_t *RMReceiptCopyPayloadAtPath(const char *path, RMReceiptVerifier *verifier, long *length)
+{
+    PKCS7 *p7 = RMReceiptReadPKCS7(path);
+    if (!p7) return NULL;
+
+    uint8_t *payload = NULL;
+    if (!verifier || RMReceiptVerifierVerify(verifier, p7))
+    {
+        const uint8_t *bytes;
+        if (RMReceiptGetPKCS7Payload(p7, &bytes, length))
+        {
+            payload = malloc(*length > 0 ? *length : 1);
+            if (payload)
+            {
+                memcpy(payload, bytes, *length);
+            }
+        }
+    }
+    PKCS7_free(p7);
+    return payload;
+}
+
+// MARK: - Verifier
+
+struct RMReceiptVerifier
+{
+    X509_STORE *store;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    pthread_mutex_t mutex; // Before 1.1.0 the store is only locked if the app installs locking callbacks
+#endif
+};
+
+static pthread_once_t _digestsOnce = PTHREAD_ONCE_INIT;
+
+static void RMReceiptAddDigests(void)
+{
+    // Required for PKCS7_verify to work. The tables are kept for the life of the process instead of being torn down with EVP_cleanup after every verification.
+    OpenSSL_add_all_digests();
+}
+
+RMReceiptVerifier *RMReceiptVerifierCreate(const uint8_t *certificateBytes, long certificateLength)
+{
+    pthread_once(&_digestsOnce, RMReceiptAddDigests);
+
+    X509 *certificate = d2i_X509(NULL, &certificateBytes, certificateLength);
+    if (!certificate) return NULL;
+
+    RMReceiptVerifier *verifier = calloc(1, sizeof(RMReceiptVerifier));
+    X509_STORE *store = X509_STORE_new();
+    const int valid = verifier && store && X509_STORE_add_cert(store, certificate); // The store keeps its own reference to the certificate
+    X509_free(certificate);
+    if (!valid)
+    {
+        X509_STORE_free(store);
+        free(verifier);
+        return NULL;
+    }
+    verifier->store = store;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    pthread_mutex_init(&verifier->mutex, NULL);
+#endif
+    return verifier;
+}
+
+int RMReceiptVerifierVerify(RMReceiptVerifier *verifier, PKCS7 *container)
+{ // Based on: https://developer.apple.com/library/ios/releasenotes/General/ValidateAppStoreReceipt/Chapters/ValidateLocally.html#//apple_ref/doc/uid/TP40010573-CH1-SW17
+    static const int verified = 1;
+
+    // The verified content is discarded instead of being copied into a memory BIO
+    BIO *sink = BIO_new(BIO_s_null());
+    if (!sink) return 0;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    pthread_mutex_lock(&verifier->mutex);
+#endif
+    const int result = PKCS7_verify(container, NULL, verifier->store, NULL, sink, 0);
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    pthread_mutex_unlock(&verifier->mutex);
+#endif
+
+    BIO_free(sink);
+    return result == verified;
+}
+
+void RMReceiptVerifierFree(RMReceiptVerifier *verifier)
+{
+    if (!verifier) return;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    pthread_mutex_destroy(&verifier->mutex);
+#endif
+    X509_STORE_free(verifier->store);
+    free(verifier);
+}
+
+// MARK: - Files
+
+struct RMReceiptFile
+{
+    void *mapping;
+    size_t mappingLength;
+    const uint8_t *payload;
+    long payloadLength;
+    uint8_t *payloadCopy; // Only used when the payload is not contiguous in the container
+};
+
+/** Reads the identifier and length octets of a BER element. Sets *length to -1 for indefinite lengths.
+ */
+static int RMReceiptBERReadHeader(const uint8_t **pp, const uint8_t *end, int *tag, int *constructed, long *length)
+{
+    const uint8_t *p = *pp;
+    if (end - p < 2) return 0;
+    const uint8_t identifier = *p++;
+    if ((identifier & 0x1F) == 0x1F) return 0; // High tag numbers are not used in receipts
+    *tag = identifier & 0xDF;
+    *constructed = (identifier & 0x20) != 0;
+
+    const uint8_t first = *p++;
+    if (first < 0x80)
+    {
+        *length = first;
+    }
+    else if (first == 0x80)
+    {
+        if (!*constructed) return 0;
+        *length = -1;
+    }
+    else
+    {
+        const int count = first & 0x7F;
+        if (count > (int)sizeof(long) - 1 || end - p < count) return 0;
+        long value = 0;
+        for (int i = 0; i < count; i++)
+        {
+            value = (value << 8) | *p++;
+        }
+        *length = value;
+    }
+    if (*length > end - p) return 0;
+    *pp = p;
+    return 1;
+}
+
+static int RMReceiptBERIsEndOfContents(const uint8_t *p, const uint8_t *end)
+{
+    return end - p >= 2 && p[0] == 0 && p[1] == 0;
+}
+
+static int RMReceiptBERSkip(const uint8_t **pp, const uint8_t *end, int depth)
+{
+    int tag, constructed;
+    long length;
+    if (depth > 16 || !RMReceiptBERReadHeader(pp, end, &tag, &constructed, &length)) return 0;
+    if (length >= 0)
+    {
+        *pp += length;
+        return 1;
+    }
+    while (!RMReceiptBERIsEndOfContents(*pp, end))
+    {
+        if (!RMReceiptBERSkip(pp, end, depth + 1)) return 0;
+    }
+    *pp += 2;
+    return 1;
+}
+
+static int RMReceiptBEREnter(const uint8_t **pp, const uint8_t *end, int expectedTag)
+{
+    int tag, constructed;
+    long length;
+    return RMReceiptBERReadHeader(pp, end, &tag, &constructed, &length) && constructed && tag == expectedTag;
+}
+
+static int RMReceiptBERReadOID(const uint8_t **pp, const uint8_t *end, const uint8_t *oid, long oidLength)
+{
+    int tag, constructed;
+    long length;
+    if (!RMReceiptBERReadHeader(pp, end, &tag, &constructed, &length) || tag != V_ASN1_OBJECT || length != oidLength) return 0;
+    if (memcmp(*pp, oid, oidLength) != 0) return 0;
+    *pp += length;
+    return 1;
+}
+
+int RMReceiptFindPKCS7Payload(const uint8_t *bytes, long length, const uint8_t **payload, long *payloadLength)
+{
+    static const uint8_t signedDataOID[] = {0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x02}; // 1.2.840.113549.1.7.2
+    static const uint8_t dataOID[] = {0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x01}; // 1.2.840.113549.1.7.1
+    static const int contextTag0 = V_ASN1_CONTEXT_SPECIFIC | 0;
+
+    const uint8_t *p = bytes;
+    const uint8_t *end = bytes + length;
+    // ContentInfo ::= SEQUENCE { contentType, [0] EXPLICIT SignedData }
+    if (!RMReceiptBEREnter(&p, end, V_ASN1_SEQUENCE)) return 0;
+    if (!RMReceiptBERReadOID(&p, end, signedDataOID, sizeof(signedDataOID))) return 0;
+    if (!RMReceiptBEREnter(&p, end, contextTag0)) return 0;
+    // SignedData ::= SEQUENCE { version, digestAlgorithms, contentInfo, ... }
+    if (!RMReceiptBEREnter(&p, end, V_ASN1_SEQUENCE)) return 0;
+    if (!RMReceiptBERSkip(&p, end, 0)) return 0;
+    if (!RMReceiptBERSkip(&p, end, 0)) return 0;
+    if (!RMReceiptBEREnter(&p, end, V_ASN1_SEQUENCE)) return 0;
+    if (!RMReceiptBERReadOID(&p, end, dataOID, sizeof(dataOID))) return 0;
+    if (!RMReceiptBEREnter(&p, end, contextTag0)) return 0;
+
+    int tag, constructed;
+    long octetsLength;
+    if (!RMReceiptBERReadHeader(&p, end, &tag, &constructed, &octetsLength) || tag != V_ASN1_OCTET_STRING) return 0;
+    if (constructed)
+    { // Only a single segment can be used in place
+        const uint8_t *segmentsEnd = octetsLength >= 0 ? p + octetsLength : NULL;
+        if (!RMReceiptBERReadHeader(&p, end, &tag, &constructed, &octetsLength) || tag != V_ASN1_OCTET_STRING || constructed) return 0;
+        const uint8_t *next = p + octetsLength;
+        if (segmentsEnd ? next != segmentsEnd : !RMReceiptBERIsEndOfContents(next, end)) return 0;
+    }
+    *payload = p;
+    *payloadLength = octetsLength;
+    return 1;
+}
+
+/** Decodes the container of the file to verify it or to reassemble its payload. If the file already has a payload, it must be the one of the container.
+ */
+static int RMReceiptFileDecode(RMReceiptFile *file, RMReceiptVerifier *verifier)
+{
+    const uint8_t *bytes = file->mapping;
+    PKCS7 *p7 = d2i_PKCS7(NULL, &bytes, (long)file->mappingLength);
+    int valid = p7 && (!verifier || RMReceiptVerifierVerify(verifier, p7));
+    if (valid && file->payload)
+    { // Make sure that the payload found in place is the one that was verified
+        const uint8_t *payload;
+        long payloadLength;
+        valid = RMReceiptGetPKCS7Payload(p7, &payload, &payloadLength) && payloadLength == file->payloadLength && memcmp(payload, file->payload, payloadLength) == 0;
+    }
+    else if (valid)
+    {
+        const uint8_t *payload;
+        valid = RMReceiptGetPKCS7Payload(p7, &payload, &file->payloadLength);
+        if (valid)
+        {
+            file->payloadCopy = malloc(file->payloadLength > 0 ? file->payloadLength : 1);
+            valid = file->payloadCopy != NULL;
+        }
+        if (valid)
+        {
+            memcpy(file->payloadCopy, payload, file->payloadLength);
+            file->payload = file->payloadCopy;
+        }
+    }
+    PKCS7_free(p7);
+    return valid;
+}
+
+RMReceiptFile *RMReceiptFileOpen(const char *path, RMReceiptVerifier *verifier)
+{
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    { // Private mappings still see later writes to pages that weren't copied, hence the file must not be modified in place
+        mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) return NULL;
+
+    RMReceiptFile *file = calloc(1, sizeof(RMReceiptFile));
+    if (!file)
+    {
+        munmap(mapping, (size_t)st.st_size);
+        return NULL;
+    }
+    file->mapping = mapping;
+    file->mappingLength = (size_t)st.st_size;
+
+    const int inPlace = RMReceiptFindPKCS7Payload(mapping, (long)file->mappingLength, &file->payload, &file->payloadLength);
+    if (inPlace && !verifier) return file;
+
+    // The decoded container is only needed to verify the signature or to reassemble a segmented payload
+    if (!RMReceiptFileDecode(file, verifier))
+    {
+        RMReceiptFileClose(file);
+        return NULL;
+    }
+    return file;
+}
+
+int RMReceiptFileVerify(RMReceiptFile *file, RMReceiptVerifier *verifier)
+{
+    return RMReceiptFileDecode(file, verifier);
+}
+
+const uint8_t *RMReceiptFileGetContents(const RMReceiptFile *file, long *length)
+{
+    *length = (long)file->mappingLength;
+    return file->mapping;
+}
+
+const uint8_t *RMReceiptFileGetPayload(const RMReceiptFile *file, long *length)
+{
+    *length = file->payloadLength;
+    return file->payload;
+}
+
+void RMReceiptFileClose(RMReceiptFile *file)
+{
+    if (!file) return;
+    munmap(file->mapping, file->mappingLength);
+    free(file->payloadCopy);
+    free(file);
+}
+
+// MARK: - Snapshots
+
+#define RMReceiptSnapshotMagic 0x53534D52 // "RMSS" in little-endian order
+#define RMReceiptSnapshotVersion 2 // 2: web order line item IDs are no longer truncated to 32 bits
+
+struct RMReceiptSnapshot
+{
+    void *mapping;
+    size_t mappingLength;
+};
+
+/** Authenticates everything in the snapshot after its tag.
+ */
+static int RMReceiptSnapshotSign(const uint8_t *bytes, size_t length, const uint8_t *key, long keyLength, uint8_t tag[32])
+{
+    const size_t start = offsetof(RMReceiptSnapshotHeader, digest);
+    unsigned int tagLength = 0;
+    return HMAC(EVP_sha256(), key, (int)keyLength, bytes + start, length - start, tag, &tagLength) != NULL && tagLength == 32;
+}
+
+static int RMReceiptSnapshotRangeIsValid(RMReceiptSnapshotRange range, uint64_t payloadLength)
+{
+    return (uint64_t)range.offset + range.length <= payloadLength;
+}
+
+int RMReceiptSnapshotWrite(const char *path, RMReceiptSnapshotHeader *header, const RMReceiptSnapshotPurchase *purchases, const uint8_t *key, long keyLength)
+{
+    const size_t purchasesLength = (size_t)header->purchaseCount * sizeof(RMReceiptSnapshotPurchase);
+    const size_t length = sizeof(RMReceiptSnapshotHeader) + purchasesLength;
+    header->magic = RMReceiptSnapshotMagic;
+    header->version = RMReceiptSnapshotVersion;
+    header->length = length;
+    header->purchasesOffset = sizeof(RMReceiptSnapshotHeader);
+
+    uint8_t *bytes = (uint8_t*)malloc(length);
+    if (!bytes) return 0;
+    memcpy(bytes, header, sizeof(RMReceiptSnapshotHeader));
+    if (purchasesLength > 0) memcpy(bytes + header->purchasesOffset, purchases, purchasesLength);
+    int success = RMReceiptSnapshotSign(bytes, length, key, keyLength, header->tag);
+    memcpy(bytes + offsetof(RMReceiptSnapshotHeader, tag), header->tag, sizeof(header->tag));
+
+    // Readers must never see a partial snapshot, so it's written to a temporary file that replaces the previous one
+    const size_t pathLength = strlen(path);
+    char *temporaryPath = (char*)malloc(pathLength + 8);
+    int fd = -1;
+    if (success && temporaryPath)
+    {
+        memcpy(temporaryPath, path, pathLength);
+        memcpy(temporaryPath + pathLength, ".XXXXXX", 8);
+        fd = mkstemp(temporaryPath);
+    }
+    success = success && fd >= 0;
+    for (size_t written = 0; success && written < length;)
+    {
+        const ssize_t count = write(fd, bytes + written, length - written);
+        success = count > 0;
+        if (success) written += (size_t)count;
+    }
+    if (fd >= 0)
+    {
+        success = close(fd) == 0 && success;
+        success = success && rename(temporaryPath, path) == 0;
+        if (!success) unlink(temporaryPath);
+    }
+    free(temporaryPath);
+    free(bytes);
+    return success;
+}
+
+RMReceiptSnapshot *RMReceiptSnapshotOpen(const char *path, const uint8_t digest[32], long payloadLength, const uint8_t *key, long keyLength)
+{
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(RMReceiptSnapshotHeader))
+    {
+        mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) return NULL;
+
+    const RMReceiptSnapshotHeader *header = (const RMReceiptSnapshotHeader*)mapping;
+    const uint64_t length = (uint64_t)st.st_size;
+    int valid = header->magic == RMReceiptSnapshotMagic && header->version == RMReceiptSnapshotVersion
+        && header->length == length
+        && header->purchasesOffset == sizeof(RMReceiptSnapshotHeader)
+        && header->purchaseCount == (length - header->purchasesOffset) / sizeof(RMReceiptSnapshotPurchase)
+        && (length - header->purchasesOffset) % sizeof(RMReceiptSnapshotPurchase) == 0
+        && payloadLength >= 0 && header->payloadLength == (uint64_t)payloadLength
+        && memcmp(header->digest, digest, sizeof(header->digest)) == 0;
+
+    uint8_t tag[32];
+    valid = valid && RMReceiptSnapshotSign((const uint8_t*)mapping, (size_t)length, key, keyLength, tag) && CRYPTO_memcmp(tag, header->tag, sizeof(tag)) == 0;
+
+    // Once authenticated, the ranges can only be wrong if the snapshot was written from wrong data
+    valid = valid && RMReceiptSnapshotRangeIsValid(header->bundleIdentifier, header->payloadLength)
+        && RMReceiptSnapshotRangeIsValid(header->appVersion, header->payloadLength)
+        && RMReceiptSnapshotRangeIsValid(header->opaqueValue, header->payloadLength)
+        && RMReceiptSnapshotRangeIsValid(header->receiptHash, header->payloadLength)
+        && RMReceiptSnapshotRangeIsValid(header->originalAppVersion, header->payloadLength);
+    const RMReceiptSnapshotPurchase *purchases = (const RMReceiptSnapshotPurchase*)((const uint8_t*)mapping + sizeof(RMReceiptSnapshotHeader));
+    for (uint64_t i = 0; valid && i < header->purchaseCount; i++)
+    {
+        valid = RMReceiptSnapshotRangeIsValid(purchases[i].entry, header->payloadLength)
+            && RMReceiptSnapshotRangeIsValid(purchases[i].productIdentifier, header->payloadLength)
+            && RMReceiptSnapshotRangeIsValid(purchases[i].transactionIdentifier, header->payloadLength)
+            && RMReceiptSnapshotRangeIsValid(purchases[i].originalTransactionIdentifier, header->payloadLength);
+    }
+
+    RMReceiptSnapshot *snapshot = valid ? (RMReceiptSnapshot*)malloc(sizeof(RMReceiptSnapshot)) : NULL;
+    if (!snapshot)
+    {
+        munmap(mapping, (size_t)length);
+        return NULL;
+    }
+    snapshot->mapping = mapping;
+    snapshot->mappingLength = (size_t)length;
+    return snapshot;
+}
+
+const RMReceiptSnapshotHeader *RMReceiptSnapshotGetHeader(const RMReceiptSnapshot *snapshot)
+{
+    return (const RMReceiptSnapshotHeader*)snapshot->mapping;
+}
+
+const RMReceiptSnapshotPurchase *RMReceiptSnapshotGetPurchases(const RMReceiptSnapshot *snapshot, long *count)
+{
+    const RMReceiptSnapshotHeader *header = RMReceiptSnapshotGetHeader(snapshot);
+    *count = (long)header->purchaseCount;
+    return (const RMReceiptSnapshotPurchase*)((const uint8_t*)snapshot->mapping + header->purchasesOffset);
+}
+
+void RMReceiptSnapshotClose(RMReceiptSnapshot *snapshot)
+{
+    if (!snapshot) return;
+    munmap(snapshot->mapping, snapshot->mappingLength);
+    free(snapshot);
+}
@@ -0,0 +1,427 @@
+//
+//  RMAppReceiptCore.h
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#ifndef RMAppReceiptCore_h
+#define RMAppReceiptCore_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/pkcs7.h>
+
+/*
+ Portable C core of RMAppReceipt. It only depends on OpenSSL, so the same parser can be built and tested off-device (see CMakeLists.txt).
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// From https://developer.apple.com/library/ios/releasenotes/General/ValidateAppStoreReceipt/Chapters/ReceiptFields.html#//apple_ref/doc/uid/TP40010573-CH106-SW1
+enum
+{
+    RMReceiptAttributeTypeBundleIdentifier = 2,
+    RMReceiptAttributeTypeAppVersion = 3,
+    RMReceiptAttributeTypeOpaqueValue = 4,
+    RMReceiptAttributeTypeHash = 5,
+    RMReceiptAttributeTypeInAppPurchaseReceipt = 17,
+    RMReceiptAttributeTypeOriginalAppVersion = 19,
+    RMReceiptAttributeTypeExpirationDate = 21,
+
+    RMReceiptAttributeTypeQuantity = 1701,
+    RMReceiptAttributeTypeProductIdentifier = 1702,
+    RMReceiptAttributeTypeTransactionIdentifier = 1703,
+    RMReceiptAttributeTypePurchaseDate = 1704,
+    RMReceiptAttributeTypeOriginalTransactionIdentifier = 1705,
+    RMReceiptAttributeTypeOriginalPurchaseDate = 1706,
+    RMReceiptAttributeTypeSubscriptionExpirationDate = 1708,
+    RMReceiptAttributeTypeWebOrderLineItemID = 1711,
+    RMReceiptAttributeTypeCancellationDate = 1712,
+};
+
+// MARK: - ASN1
+
+/** Reads an INTEGER and advances *pp past it.
+ @return The value of the integer, or 0 if the element is not a non-negative INTEGER of up to INT_MAX.
+ */
+int RMReceiptASN1ReadInteger(const uint8_t **pp, long omax);
+
+/** Reads an INTEGER that may not fit in an int, such as a web order line item ID, and advances *pp past it.
+ @return The value of the integer, or 0 if the element is not a non-negative INTEGER of up to INT64_MAX.
+ */
+int64_t RMReceiptASN1ReadInteger64(const uint8_t **pp, long omax);
+
+/** Reads a string with the given tag (e.g., V_ASN1_UTF8STRING) and advances *pp past it. The string is not copied.
+ @return A pointer to the bytes of the string, or NULL if the element does not have the expected tag.
+ */
+const uint8_t *RMReceiptASN1ReadString(const uint8_t **pp, long omax, int expectedTag, long *length);
+
+/** Called for each attribute of a receipt or in-app purchase set. The value is the content of the attribute's OCTET STRING, passed in place.
+ @return 0 to continue the enumeration, any other value to stop it.
+ */
+typedef int (*RMReceiptAttributeFunction)(const uint8_t *value, long length, int type, void *context);
+
+/** Enumerates the attributes of the given SET of SEQUENCE { INTEGER type, INTEGER version, OCTET STRING value }.
+ Based on https://github.com/rmaddy/VerifyStoreReceiptiOS
+ */
+void RMReceiptEnumerateAttributes(const uint8_t *p, long length, RMReceiptAttributeFunction function, void *context);
+
+// MARK: - Search
+
+/** Implementations of RMReceiptFindBytes.
+ */
+typedef enum
+{
+    RMReceiptSearchAutomatic = 0,
+    RMReceiptSearchScalar,
+    RMReceiptSearchSSE2,
+    RMReceiptSearchAVX2,
+    RMReceiptSearchNEON,
+} RMReceiptSearchImplementation;
+
+/** Returns whether the given implementation of RMReceiptFindBytes can run on this device.
+ */
+int RMReceiptSearchIsAvailable(RMReceiptSearchImplementation implementation);
+
+/** Finds the first occurrence of needle in the given bytes, testing 64 positions per iteration with SSE2, AVX2 or NEON.
+ @param implementation RMReceiptSearchAutomatic picks the fastest implementation available. The others are meant for tests and benchmarks; unavailable ones fall back to the scalar search.
+ @return A pointer to the occurrence, or NULL if there is none.
+ */
+const uint8_t *RMReceiptFindBytes(const uint8_t *bytes, long length, const uint8_t *needle, long needleLength, RMReceiptSearchImplementation implementation);
+
+// MARK: - Queries
+
+/** Bit of an in-app purchase attribute type in a query mask.
+ */
+#define RMReceiptPurchaseAttributeBit(type) (1u << ((type) - RMReceiptAttributeTypeQuantity))
+
+/** The attributes of an in-app purchase that were requested by a query. Each value is the content of the attribute's OCTET STRING, passed in place, or NULL if the purchase doesn't have it or it wasn't requested.
+ */
+typedef struct
+{
+    const uint8_t *values[RMReceiptAttributeTypeCancellationDate - RMReceiptAttributeTypeQuantity + 1];
+    long lengths[RMReceiptAttributeTypeCancellationDate - RMReceiptAttributeTypeQuantity + 1];
+} RMReceiptPurchase;
+
+/** Returns the value of the given attribute type (e.g., RMReceiptAttributeTypeProductIdentifier) of a purchase.
+ */
+static inline const uint8_t *RMReceiptPurchaseGetValue(const RMReceiptPurchase *purchase, int type, long *length)
+{
+    *length = purchase->lengths[type - RMReceiptAttributeTypeQuantity];
+    return purchase->values[type - RMReceiptAttributeTypeQuantity];
+}
+
+/** Called for each in-app purchase of a scan.
+ @return 0 to continue the scan, any other value to stop it.
+ */
+typedef int (*RMReceiptPurchasePredicate)(const RMReceiptPurchase *purchase, void *context);
+
+/** Scans the in-app purchases of a receipt payload without decoding anything else. Only the attribute types in typeMask (see RMReceiptPurchaseAttributeBit) are collected, and the walk of each purchase stops as soon as all of them are found.
+ @return 1 if the predicate stopped the scan, 0 otherwise.
+ */
+int RMReceiptScanPurchases(const uint8_t *payload, long length, uint32_t typeMask, RMReceiptPurchasePredicate predicate, void *context);
+
+/** Returns whether the receipt payload has an in-app purchase of the given product. The raw payload is searched for the encoded identifier first, so that only the purchases that contain it are decoded, and the scan stops at the first match.
+ @param productIdentifier The UTF-8 product identifier, which doesn't need to be NUL-terminated.
+ */
+int RMReceiptContainsProduct(const uint8_t *payload, long length, const char *productIdentifier, long productIdentifierLength);
+
+// MARK: - Table
+
+/** Value of a date column when the purchase doesn't have the date.
+ */
+#define RMReceiptPurchaseTableNoDate INT64_MIN
+
+/** Value of a date column when the date can't be parsed by RMReceiptParseRFC3339Date, so that callers can fill it with another parser.
+ */
+#define RMReceiptPurchaseTableUnparsedDate (INT64_MIN + 1)
+
+/** A columnar view of the in-app purchases of a receipt payload, where row i is the i-th in-app purchase. Dates are seconds since 1970, and product identifiers are interned: each row holds the index of its product in productIdentifiers, or -1 if it doesn't have one. The product identifiers point into the payload, which must outlive the table.
+ */
+typedef struct
+{
+    long count;
+    int32_t *productIndices;
+    int32_t *quantities;
+    int64_t *purchaseDates;
+    int64_t *originalPurchaseDates;
+    int64_t *expirationDates;
+    int64_t *cancellationDates;
+    int64_t *webOrderLineItemIDs;
+    long productCount;
+    const uint8_t **productIdentifiers;
+    long *productIdentifierLengths;
+    long unparsedDateCount; // Number of RMReceiptPurchaseTableUnparsedDate values in the date columns
+} RMReceiptPurchaseTable;
+
+/** Creates the table of the in-app purchases of a receipt payload.
+ @return The table, or NULL if it can't be allocated. Release it with RMReceiptPurchaseTableFree.
+ */
+RMReceiptPurchaseTable *RMReceiptPurchaseTableCreate(const uint8_t *payload, long length);
+
+void RMReceiptPurchaseTableFree(RMReceiptPurchaseTable *table);
+
+/** Returns the index of the given product in the table, or -1 if no purchase has it.
+ */
+long RMReceiptPurchaseTableFindProduct(const RMReceiptPurchaseTable *table, const char *productIdentifier, long productIdentifierLength);
+
+/** Returns the number of purchases with a purchase date in [start, end). Purchases without a purchase date are never counted, as long as start is greater than RMReceiptPurchaseTableUnparsedDate.
+ */
+long RMReceiptPurchaseTableCountPurchasesBetween(const RMReceiptPurchaseTable *table, int64_t start, int64_t end);
+
+/** Writes the rows of the purchases with a purchase date in [start, end) in receipt order.
+ @param rows Room for table->count rows.
+ @return The number of rows written.
+ */
+long RMReceiptPurchaseTableSelectPurchasesBetween(const RMReceiptPurchaseTable *table, int64_t start, int64_t end, long *rows);
+
+/** Writes the number of purchases of each product.
+ @param counts Room for table->productCount counts.
+ */
+void RMReceiptPurchaseTableCountProducts(const RMReceiptPurchaseTable *table, long *counts);
+
+/** Writes the latest expiration date of each product, or RMReceiptPurchaseTableNoDate if none of its purchases has one.
+ @param latest Room for table->productCount dates.
+ */
+void RMReceiptPurchaseTableGetLatestExpirations(const RMReceiptPurchaseTable *table, int64_t *latest);
+
+// MARK: - Strings
+
+/** An interning pool of byte strings. Each distinct byte sequence is copied once into an arena of large chunks, which is released as a whole with the pool. A pool is not thread-safe.
+ */
+typedef struct RMReceiptStringPool RMReceiptStringPool;
+
+/** Creates an empty pool.
+ @return The pool, or NULL if it can't be allocated. Release it with RMReceiptStringPoolFree.
+ */
+RMReceiptStringPool *RMReceiptStringPoolCreate(void);
+
+/** Returns the index of the given bytes in the pool, adding them if they are new. Indices are consecutive from 0 in order of addition.
+ @param interned On success, the copy of the bytes in the pool, which lives as long as the pool.
+ @return The index, or -1 if the bytes can't be added.
+ */
+long RMReceiptStringPoolIntern(RMReceiptStringPool *pool, const uint8_t *bytes, long length, const uint8_t **interned);
+
+/** Returns the number of distinct strings in the pool.
+ */
+long RMReceiptStringPoolGetCount(const RMReceiptStringPool *pool);
+
+/** Returns the number of bytes allocated by the pool, including its chunks and its hash table.
+ */
+size_t RMReceiptStringPoolGetSize(const RMReceiptStringPool *pool);
+
+void RMReceiptStringPoolFree(RMReceiptStringPool *pool);
+
+// MARK: - Timeline
+
+/** The active intervals of a subscription, merged and sorted for binary search. Times are seconds since 1970. Intervals are closed, so the subscription is active both at the start and at the end of each of them.
+ */
+typedef struct
+{
+    long count;
+    double *boundaries; // Start and end of each interval, in non-decreasing order: 2 * count values
+} RMReceiptTimeline;
+
+/** Creates a timeline from the given intervals, in any order. Overlapping and touching intervals are merged. Intervals that end before they start, or with NaN times, are ignored.
+ @return The timeline, or NULL if it can't be allocated. Release it with RMReceiptTimelineFree.
+ */
+RMReceiptTimeline *RMReceiptTimelineCreate(const double *starts, const double *ends, long count);
+
+void RMReceiptTimelineFree(RMReceiptTimeline *timeline);
+
+/** Returns 1 if the given time is within an interval of the timeline, 0 otherwise. O(log n).
+ */
+int RMReceiptTimelineIsActiveAt(const RMReceiptTimeline *timeline, double time);
+
+/** Finds the first start or end of an interval after the given time. O(log n).
+ @param change On success, the time of the start or end.
+ @return 1 if there is a start or end after the given time, 0 otherwise.
+ */
+int RMReceiptTimelineGetNextChangeAfter(const RMReceiptTimeline *timeline, double time, double *change);
+
+// MARK: - Incremental
+
+/** Finds the entries that are byte-identical to entries of a previous version of the same data, such as the in-app purchases of a receipt before and after a refresh. Entries are first compared with the previous entry at the same position, and the rest are matched by a hash of their bytes. Matches are always confirmed in full, and each previous entry matches at most one entry.
+ @param matches Room for count indices. On return, the index of the previous entry that matches each entry, or -1 if there is none.
+ @return The number of entries with a match.
+ */
+long RMReceiptMatchEntries(const uint8_t *const *previousEntries, const long *previousLengths, long previousCount, const uint8_t *const *entries, const long *lengths, long count, long *matches);
+
+// MARK: - Dates
+
+/** Parses the yyyy-MM-dd'T'HH:mm:ssZ layout of receipt dates without allocating. Fails for anything else, including dates that NSDateFormatter would interpret differently (e.g., leap seconds or years before the Gregorian calendar), so that callers can fall back to it.
+ @param interval On success, the number of seconds since 1970-01-01T00:00:00Z.
+ @return 1 on success, 0 otherwise.
+ */
+int RMReceiptParseRFC3339Date(const uint8_t *p, long length, double *interval);
+
+// MARK: - Hash
+
+/** Returns whether the receipt hash is the SHA-1 digest of the device identifier, the opaque value and the bundle identifier, in that order. The inputs are fed to the digest in place instead of being concatenated, and the digests are compared in constant time.
+ @param deviceIdentifier The 16 bytes of the vendor identifier of the device.
+ @param bundleIdentifier The value of the bundle identifier attribute, i.e., the encoded UTF8String and not only its contents.
+ @return 1 if the hash matches, 0 otherwise.
+ */
+int RMReceiptVerifyHash(const uint8_t deviceIdentifier[16], const uint8_t *opaqueValue, long opaqueValueLength, const uint8_t *bundleIdentifier, long bundleIdentifierLength, const uint8_t *hash, long hashLength);
+
+// MARK: - PKCS7
+
+/** Reads the PKCS #7 container at the given path.
+ @return The container, or NULL if it can't be read. Release it with PKCS7_free.
+ */
+PKCS7 *RMReceiptReadPKCS7(const char *path);
+
+/** Verifies the signature of the container against the given DER-encoded root certificate. Use a RMReceiptVerifier to verify more than one container.
+ @return 1 if the signature is valid, 0 otherwise.
+ */
+int RMReceiptVerifyPKCS7(PKCS7 *container, const uint8_t *certificate, long certificateLength);
+
+/** A long-lived verification context holding the parsed root certificate in a certificate store. A verifier can be shared across threads.
+ */
+typedef struct RMReceiptVerifier RMReceiptVerifier;
+
+/** Creates a verifier for the given DER-encoded root certificate.
+ @return The verifier, or NULL if the certificate can't be decoded. Release it with RMReceiptVerifierFree.
+ */
+RMReceiptVerifier *RMReceiptVerifierCreate(const uint8_t *certificate, long certificateLength);
+
+/** Verifies the signature of the container against the root certificate of the verifier.
+ @return 1 if the signature is valid, 0 otherwise.
+ */
+int RMReceiptVerifierVerify(RMReceiptVerifier *verifier, PKCS7 *container);
+
+void RMReceiptVerifierFree(RMReceiptVerifier *verifier);
+
+/** Gets the signed payload of the container, without copying it. The payload lives as long as the container.
+ @return 1 if the container has a data payload, 0 otherwise.
+ */
+int RMReceiptGetPKCS7Payload(PKCS7 *container, const uint8_t **bytes, long *length);
+
+/** Reads the PKCS #7 container at the given path, verifies it if a verifier is given and returns a copy of its payload.
+ @return The payload, or NULL if the container can't be read, has no payload or fails verification. The caller must free it.
+ */
+uint8_t *RMReceiptCopyPayloadAtPath(const char *path, RMReceiptVerifier *verifier, long *length);
+
+// MARK: - Files
+
+/** A receipt file mapped in memory. Its payload points into the mapping when the container allows it, so the receipt is never copied.
+ */
+typedef struct RMReceiptFile RMReceiptFile;
+
+/** Maps the PKCS #7 container at the given path and verifies it if a verifier is given.
+ The verification only holds for the bytes as they were mapped. Later reads of the payload and contents go to the file itself, so the file must not be modified in place while the receipt file is open. Replacing it, e.g., by renaming a new file over it as StoreKit does, is safe.
+ @return The receipt file, or NULL if the container can't be read, has no payload or fails verification. Release it with RMReceiptFileClose.
+ */
+RMReceiptFile *RMReceiptFileOpen(const char *path, RMReceiptVerifier *verifier);
+
+/** Returns the signed payload of the receipt file. The payload lives as long as the receipt file.
+ */
+const uint8_t *RMReceiptFileGetPayload(const RMReceiptFile *file, long *length);
+
+/** Verifies a receipt file that was opened without a verifier. The file is verified as mapped, so the result applies to the bytes returned by RMReceiptFileGetContents.
+ @return 1 if the signature is valid and covers the payload of the file, 0 otherwise.
+ */
+int RMReceiptFileVerify(RMReceiptFile *file, RMReceiptVerifier *verifier);
+
+/** Returns the contents of the receipt file as mapped, i.e., the whole PKCS #7 container.
+ */
+const uint8_t *RMReceiptFileGetContents(const RMReceiptFile *file, long *length);
+
+void RMReceiptFileClose(RMReceiptFile *file);
+
+/** Finds the signed payload of a DER or BER encoded PKCS #7 container without decoding or copying it.
+ @return 1 if the payload is stored contiguously in the container, 0 otherwise.
+ */
+int RMReceiptFindPKCS7Payload(const uint8_t *bytes, long length, const uint8_t **payload, long *payloadLength);
+
+// MARK: - Snapshots
+
+/** A range of the payload of the receipt that a snapshot was made from. The length is 0 if the value is missing.
+ */
+typedef struct
+{
+    uint32_t offset;
+    uint32_t length;
+} RMReceiptSnapshotRange;
+
+/** The fixed-width record of an in-app purchase in a snapshot. Dates are seconds since 1970, or NaN if missing.
+ */
+typedef struct
+{
+    RMReceiptSnapshotRange entry; // The in-app purchase receipt, as enumerated from the payload
+    RMReceiptSnapshotRange productIdentifier; // Attribute values, as given by RMReceiptEnumerateAttributes
+    RMReceiptSnapshotRange transactionIdentifier;
+    RMReceiptSnapshotRange originalTransactionIdentifier;
+    int64_t quantity;
+    int64_t webOrderLineItemID;
+    double purchaseDate;
+    double originalPurchaseDate;
+    double subscriptionExpirationDate;
+    double cancellationDate;
+} RMReceiptSnapshotPurchase;
+
+/** The header of a snapshot, followed by its purchase records.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint8_t tag[32]; // HMAC-SHA256 of the rest of the snapshot
+    uint8_t digest[32]; // Identifies the receipt that the snapshot was made from
+    uint64_t length; // Of the whole snapshot
+    uint64_t purchaseCount;
+    uint64_t purchasesOffset;
+    uint64_t payloadLength; // Of the receipt
+    RMReceiptSnapshotRange bundleIdentifier; // Attribute values, as given by RMReceiptEnumerateAttributes
+    RMReceiptSnapshotRange appVersion;
+    RMReceiptSnapshotRange opaqueValue;
+    RMReceiptSnapshotRange receiptHash;
+    RMReceiptSnapshotRange originalAppVersion;
+    double expirationDate;
+} RMReceiptSnapshotHeader;
+
+/** A snapshot of a parsed receipt mapped in memory. A snapshot doesn't contain the receipt: its ranges refer to the payload of the receipt it was made from, which the digest identifies, so that the receipt can be used without parsing.
+ */
+typedef struct RMReceiptSnapshot RMReceiptSnapshot;
+
+/** Writes a snapshot of a parsed receipt atomically. The layout fields of the header (magic, version, tag, length and offset) are filled in; the rest must be set by the caller.
+ @param header The digest, purchase count, payload length, ranges and dates of the snapshot. Ranges must be within the payload.
+ @param key The key used to authenticate the snapshot.
+ @return 1 on success, 0 otherwise.
+ */
+int RMReceiptSnapshotWrite(const char *path, RMReceiptSnapshotHeader *header, const RMReceiptSnapshotPurchase *purchases, const uint8_t *key, long keyLength);
+
+/** Maps the snapshot at the given path if it was made from the receipt with the given digest and payload length, and authenticated with the given key. The snapshot is checked as a whole, so its ranges can be used on the payload without further bounds checks.
+ @return The snapshot, or NULL if it can't be read, is malformed, was made from another receipt or fails authentication. Release it with RMReceiptSnapshotClose.
+ */
+RMReceiptSnapshot *RMReceiptSnapshotOpen(const char *path, const uint8_t digest[32], long payloadLength, const uint8_t *key, long keyLength);
+
+/** Returns the header of the snapshot. The header and the purchases live as long as the snapshot.
+ */
+const RMReceiptSnapshotHeader *RMReceiptSnapshotGetHeader(const RMReceiptSnapshot *snapshot);
+
+const RMReceiptSnapshotPurchase *RMReceiptSnapshotGetPurchases(const RMReceiptSnapshot *snapshot, long *count);
+
+void RMReceiptSnapshotClose(RMReceiptSnapshot *snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
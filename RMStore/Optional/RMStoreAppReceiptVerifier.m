@@ -27,16 +27,19 @@
                            success:(void (^)())successBlock
                            failure:(void (^)(NSError *error))failureBlock
 {
-    RMAppReceipt *receipt = [RMAppReceipt bundleReceipt];
-    const BOOL verified = [self verifyTransaction:transaction inReceipt:receipt success:successBlock failure:nil]; // failureBlock is nil intentionally. See below.
-    if (verified) return;
-
-    // Apple recommends to refresh the receipt if validation fails on iOS
-    [[RMStore defaultStore] refreshReceiptOnSuccess:^{
-        RMAppReceipt *receipt = [RMAppReceipt bundleReceipt];
-        [self verifyTransaction:transaction inReceipt:receipt success:successBlock failure:failureBlock];
-    } failure:^(NSError *error) {
-        [self failWithBlock:failureBlock error:error];
+    // The receipt is loaded off the main thread. The blocks are called on the main queue, as before.
+    [RMAppReceipt loadBundleReceiptWithCompletion:^(RMAppReceipt *receipt) {
+        const BOOL verified = [self verifyTransaction:transaction inReceipt:receipt success:successBlock failure:nil]; // failureBlock is nil intentionally. See below.
+        if (verified) return;
+        
+        // Apple recommends to refresh the receipt if validation fails on iOS
+        [[RMStore defaultStore] refreshReceiptOnSuccess:^{
+            [RMAppReceipt loadBundleReceiptWithCompletion:^(RMAppReceipt *receipt) {
+                [self verifyTransaction:transaction inReceipt:receipt success:successBlock failure:failureBlock];
+            }];
+        } failure:^(NSError *error) {
+            [self failWithBlock:failureBlock error:error];
+        }];
     }];
 }
 
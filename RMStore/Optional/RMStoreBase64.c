@@ -0,0 +1,244 @@
+//
+//  RMStoreBase64.c
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "RMStoreBase64.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define RMSTORE_BASE64_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define RMSTORE_BASE64_NEON 1
+#include <arm_neon.h>
+#endif
+
+static const char _base64EncodingTable[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+size_t RMStoreBase64EncodedLength(size_t length)
+{
+    return length / 3 * 4 + (length % 3 ? 4 : 0);
+}
+
+// MARK: - Scalar
+
+static size_t RMStoreBase64EncodeScalar(const uint8_t *bytes, size_t length, char *output)
+{
+    char *p = output;
+    while (length > 2)
+    {
+        const uint32_t triple = (uint32_t)bytes[0] << 16 | (uint32_t)bytes[1] << 8 | bytes[2];
+        p[0] = _base64EncodingTable[triple >> 18];
+        p[1] = _base64EncodingTable[(triple >> 12) & 0x3f];
+        p[2] = _base64EncodingTable[(triple >> 6) & 0x3f];
+        p[3] = _base64EncodingTable[triple & 0x3f];
+        bytes += 3;
+        length -= 3;
+        p += 4;
+    }
+    if (length != 0)
+    {
+        p[0] = _base64EncodingTable[bytes[0] >> 2];
+        if (length > 1)
+        {
+            p[1] = _base64EncodingTable[((bytes[0] & 0x03) << 4) | (bytes[1] >> 4)];
+            p[2] = _base64EncodingTable[(bytes[1] & 0x0f) << 2];
+        }
+        else
+        {
+            p[1] = _base64EncodingTable[(bytes[0] & 0x03) << 4];
+            p[2] = '=';
+        }
+        p[3] = '=';
+        p += 4;
+    }
+    return (size_t)(p - output);
+}
+
+// MARK: - SSSE3 and AVX2
+
+// From: http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html
+// Each 32-bit lane gets three input bytes, which are split into four 6-bit indices with two multiplications. The indices are then turned into characters by adding the offset of their range of the alphabet, looked up with a byte shuffle.
+
+#if RMSTORE_BASE64_X86
+
+__attribute__((target("ssse3")))
+static inline __m128i RMStoreBase64IndicesSSSE3(__m128i input)
+{
+    input = _mm_shuffle_epi8(input, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+    const __m128i index0And2 = _mm_mulhi_epu16(_mm_and_si128(input, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    const __m128i index1And3 = _mm_mullo_epi16(_mm_and_si128(input, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(index0And2, index1And3);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i RMStoreBase64CharactersSSSE3(__m128i indices)
+{
+    // 0 for 52...63 shifted to 1...12, 13 for 0...25 (A-Z) and 0 for 26...51 (a-z)
+    __m128i ranges = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i uppercase = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    ranges = _mm_or_si128(ranges, _mm_and_si128(uppercase, _mm_set1_epi8(13)));
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, ranges), indices);
+}
+
+/** Encodes 12 bytes at a time while 16 can be read. Returns the number of bytes encoded.
+ */
+__attribute__((target("ssse3")))
+static size_t RMStoreBase64EncodeSSSE3(const uint8_t *bytes, size_t length, char *output)
+{
+    size_t i = 0;
+    for (; i + 16 <= length; i += 12, output += 16)
+    {
+        const __m128i input = _mm_loadu_si128((const __m128i *)(bytes + i));
+        _mm_storeu_si128((__m128i *)output, RMStoreBase64CharactersSSSE3(RMStoreBase64IndicesSSSE3(input)));
+    }
+    return i;
+}
+
+/** Encodes 24 bytes at a time while 28 can be read, with the SSSE3 algorithm on each 128-bit lane. Returns the number of bytes encoded.
+ */
+__attribute__((target("avx2")))
+static size_t RMStoreBase64EncodeAVX2(const uint8_t *bytes, size_t length, char *output)
+{
+    const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                             1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t i = 0;
+    for (; i + 28 <= length; i += 24, output += 32)
+    {
+        __m256i input = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(bytes + i)));
+        input = _mm256_inserti128_si256(input, _mm_loadu_si128((const __m128i *)(bytes + i + 12)), 1);
+        input = _mm256_shuffle_epi8(input, shuffle);
+        const __m256i index0And2 = _mm256_mulhi_epu16(_mm256_and_si256(input, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        const __m256i index1And3 = _mm256_mullo_epi16(_mm256_and_si256(input, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(index0And2, index1And3);
+
+        __m256i ranges = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i uppercase = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        ranges = _mm256_or_si256(ranges, _mm256_and_si256(uppercase, _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i *)output, _mm256_add_epi8(_mm256_shuffle_epi8(offsets, ranges), indices));
+    }
+    return i;
+}
+
+#endif
+
+// MARK: - NEON
+
+#if RMSTORE_BASE64_NEON
+
+/** Encodes 48 bytes at a time, deinterleaved into three registers and looked up in the 64-byte alphabet. Returns the number of bytes encoded.
+ */
+static size_t RMStoreBase64EncodeNEON(const uint8_t *bytes, size_t length, char *output)
+{
+    uint8x16x4_t table;
+    table.val[0] = vld1q_u8((const uint8_t *)_base64EncodingTable);
+    table.val[1] = vld1q_u8((const uint8_t *)_base64EncodingTable + 16);
+    table.val[2] = vld1q_u8((const uint8_t *)_base64EncodingTable + 32);
+    table.val[3] = vld1q_u8((const uint8_t *)_base64EncodingTable + 48);
+    const uint8x16_t mask = vdupq_n_u8(0x3f);
+    size_t i = 0;
+    for (; i + 48 <= length; i += 48, output += 64)
+    {
+        const uint8x16x3_t input = vld3q_u8(bytes + i);
+        uint8x16x4_t indices;
+        indices.val[0] = vshrq_n_u8(input.val[0], 2);
+        indices.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(input.val[0], 4), vshrq_n_u8(input.val[1], 4)), mask);
+        indices.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(input.val[1], 2), vshrq_n_u8(input.val[2], 6)), mask);
+        indices.val[3] = vandq_u8(input.val[2], mask);
+        uint8x16x4_t characters;
+        characters.val[0] = vqtbl4q_u8(table, indices.val[0]);
+        characters.val[1] = vqtbl4q_u8(table, indices.val[1]);
+        characters.val[2] = vqtbl4q_u8(table, indices.val[2]);
+        characters.val[3] = vqtbl4q_u8(table, indices.val[3]);
+        vst4q_u8((uint8_t *)output, characters);
+    }
+    return i;
+}
+
+#endif
+
+// MARK: - Dispatch
+
+int RMStoreBase64ImplementationIsAvailable(RMStoreBase64Implementation implementation)
+{
+    switch (implementation)
+    {
+        case RMStoreBase64ImplementationScalar:
+            return 1;
+#if RMSTORE_BASE64_X86
+        case RMStoreBase64ImplementationSSSE3:
+            return __builtin_cpu_supports("ssse3") ? 1 : 0;
+        case RMStoreBase64ImplementationAVX2:
+            return __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+#if RMSTORE_BASE64_NEON
+        case RMStoreBase64ImplementationNEON:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+size_t RMStoreBase64EncodeWithImplementation(const uint8_t *bytes, size_t length, char *output, RMStoreBase64Implementation implementation)
+{
+    size_t encoded = 0;
+    if (RMStoreBase64ImplementationIsAvailable(implementation))
+    {
+        switch (implementation)
+        {
+#if RMSTORE_BASE64_X86
+            case RMStoreBase64ImplementationSSSE3:
+                encoded = RMStoreBase64EncodeSSSE3(bytes, length, output);
+                break;
+            case RMStoreBase64ImplementationAVX2:
+                encoded = RMStoreBase64EncodeAVX2(bytes, length, output);
+                break;
+#endif
+#if RMSTORE_BASE64_NEON
+            case RMStoreBase64ImplementationNEON:
+                encoded = RMStoreBase64EncodeNEON(bytes, length, output);
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+    // The vector loops stop at a multiple of 3 bytes, so the rest continues the same encoding
+    const size_t written = encoded / 3 * 4;
+    return written + RMStoreBase64EncodeScalar(bytes + encoded, length - encoded, output + written);
+}
+
+size_t RMStoreBase64Encode(const uint8_t *bytes, size_t length, char *output)
+{
+#if RMSTORE_BASE64_NEON
+    return RMStoreBase64EncodeWithImplementation(bytes, length, output, RMStoreBase64ImplementationNEON);
+#elif RMSTORE_BASE64_X86
+    // __builtin_cpu_supports only reads the features detected at startup
+    const RMStoreBase64Implementation implementation = __builtin_cpu_supports("avx2") ? RMStoreBase64ImplementationAVX2 :
+                                                       __builtin_cpu_supports("ssse3") ? RMStoreBase64ImplementationSSSE3 : RMStoreBase64ImplementationScalar;
+    return RMStoreBase64EncodeWithImplementation(bytes, length, output, implementation);
+#else
+    return RMStoreBase64EncodeScalar(bytes, length, output);
+#endif
+}
@@ -0,0 +1,66 @@
+//
+//  RMStoreBase64.h
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#ifndef RMStoreBase64_h
+#define RMStoreBase64_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ Base64 encoder of RMStoreTransactionReceiptVerifier. It writes into a buffer of the caller and uses SSSE3, AVX2 or NEON when the CPU supports them. It has no dependencies, so it can be built and tested off-device (see CMakeLists.txt).
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+    RMStoreBase64ImplementationScalar,
+    RMStoreBase64ImplementationSSSE3,
+    RMStoreBase64ImplementationAVX2,
+    RMStoreBase64ImplementationNEON, // AArch64 only
+} RMStoreBase64Implementation;
+
+/** Returns the length of the base64 encoding of the given number of bytes, padding included and terminator excluded.
+ */
+size_t RMStoreBase64EncodedLength(size_t length);
+
+/** Encodes the bytes in standard base64 with padding and without line breaks, using the fastest implementation available.
+ @param output The output buffer. Must have room for RMStoreBase64EncodedLength(length) characters. No terminator is written.
+ @return The number of characters written.
+ */
+size_t RMStoreBase64Encode(const uint8_t *bytes, size_t length, char *output);
+
+/** Returns 1 if the implementation is compiled in and supported by this CPU, 0 otherwise.
+ */
+int RMStoreBase64ImplementationIsAvailable(RMStoreBase64Implementation implementation);
+
+/** Like RMStoreBase64Encode, with the given implementation. Meant for tests and benchmarks.
+ @param implementation The implementation. Falls back to the scalar one if it's not available.
+ */
+size_t RMStoreBase64EncodeWithImplementation(const uint8_t *bytes, size_t length, char *output, RMStoreBase64Implementation implementation);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
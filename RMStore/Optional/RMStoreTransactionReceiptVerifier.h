@@ -21,7 +21,67 @@
 #import <Foundation/Foundation.h>
 #import "RMStore.h"
 
+@protocol RMStoreVerificationMetricsSink;
+
+/**
+ Reference implementation of a receipt verifier that sends the transaction receipt to Apple. Requests are fully asynchronous: they run on a session shared by all verifiers, which keeps connections alive between requests, and no thread waits for their response.
+ */
 __attribute__((availability(ios,deprecated=7.0)))
-@interface RMStoreTransactionReceiptVerifier : NSObject<RMStoreReceiptVerifier>  
+@interface RMStoreTransactionReceiptVerifier : NSObject<RMStoreReceiptVerifier>
+
+/** Initializes a verifier that sends its requests with the given session. Use it to configure the session, e.g., to stub the verification server in tests.
+ @param session The session, or nil to use NSURLConnection. Requires iOS 7 or higher.
+ */
+- (instancetype)initWithSession:(NSURLSession*)session;
+
+/** The maximum number of verification requests of this verifier in flight. Further requests wait for one of them to finish. The limit is per verifier: verifiers that share a session may have up to the sum of their limits in flight. The default is 4.
+ */
+@property (nonatomic, assign) NSUInteger maximumConcurrentRequests;
+
+/** Whether to send the receipt straight to the environment that last answered for a receipt of the same origin (sandbox or production) and bundle version, instead of always trying production first. A receipt sent to the wrong environment is still retried in the other one. The routes persist in the user defaults. The default is YES.
+ */
+@property (nonatomic, assign) BOOL environmentRoutingEnabled;
+
+/** Whether to send the receipt to production and sandbox at once and take the first authoritative answer. Saves a round trip for receipts without a route at the cost of an extra request per verification. The default is NO.
+ */
+@property (nonatomic, assign) BOOL hedgedRequestsEnabled;
+
+/** Receives the metrics of every verification request, including the retries against the other environment.
+ */
+@property (nonatomic, weak) id<RMStoreVerificationMetricsSink> metricsSink;
+
+@end
+
+/** The metrics of a verification request.
+ */
+@interface RMStoreVerificationRequestMetrics : NSObject
+
+/** The URL of the verification server.
+ */
+@property (nonatomic, readonly) NSURL *URL;
+
+/** The time the request waited for a slot because of maximumConcurrentRequests.
+ */
+@property (nonatomic, readonly) NSTimeInterval queueDuration;
+
+/** The time from sending the request to receiving the response or the error.
+ */
+@property (nonatomic, readonly) NSTimeInterval duration;
+
+/** The HTTP status code of the response, or 0 if there is no response.
+ */
+@property (nonatomic, readonly) NSInteger HTTPStatusCode;
+
+/** The error of the connection, or nil if the response arrived.
+ */
+@property (nonatomic, readonly) NSError *error;
+
+@end
+
+@protocol RMStoreVerificationMetricsSink <NSObject>
+
+/** Called when a verification request finishes, on an arbitrary queue.
+ */
+- (void)receiptVerifier:(RMStoreTransactionReceiptVerifier*)verifier didFinishRequestWithMetrics:(RMStoreVerificationRequestMetrics*)metrics;
 
 @end
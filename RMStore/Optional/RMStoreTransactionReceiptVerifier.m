@@ -19,6 +19,7 @@
 //
 
 #import "RMStoreTransactionReceiptVerifier.h"
+#import "RMStoreBase64.h"
 
 #ifdef DEBUG
 #define RMStoreLog(...) NSLog(@"RMStore: %@", [NSString stringWithFormat:__VA_ARGS__]);
@@ -26,79 +27,139 @@
 #define RMStoreLog(...)
 #endif
 
-@interface NSData(rm_base64)
+/** Returns the JSON body of a verification request, {"receipt-data":"<base64 receipt>"}. The receipt is encoded straight into the body, as base64 needs no escaping in JSON.
+ */
+static NSData* RMStoreVerificationRequestData(NSData *receipt)
+{
+    static const char prefix[] = "{\"receipt-data\":\"";
+    static const char suffix[] = "\"}";
+    const size_t prefixLength = sizeof(prefix) - 1;
+    const size_t suffixLength = sizeof(suffix) - 1;
+    const size_t encodedLength = RMStoreBase64EncodedLength(receipt.length);
+    const size_t length = prefixLength + encodedLength + suffixLength;
+    // Explicit casting to avoid errors when compiling as Objective-C++
+    char *bytes = (char*)malloc(length);
+    if (!bytes) return nil;
+    
+    memcpy(bytes, prefix, prefixLength);
+    RMStoreBase64Encode((const uint8_t*)receipt.bytes, receipt.length, bytes + prefixLength);
+    memcpy(bytes + prefixLength + encodedLength, suffix, suffixLength);
+    return [NSData dataWithBytesNoCopy:bytes length:length freeWhenDone:YES];
+}
 
-- (NSString *)rm_stringByBase64Encoding;
+@interface RMStoreVerificationRequestMetrics()
+
+- (instancetype)initWithURL:(NSURL*)URL queueDuration:(NSTimeInterval)queueDuration duration:(NSTimeInterval)duration HTTPStatusCode:(NSInteger)HTTPStatusCode error:(NSError*)error;
 
 @end
 
-@implementation NSData(rm_base64)
+static NSString* const RMStoreVerificationProductionURL = @"https://buy.itunes.apple.com/verifyReceipt";
+static NSString* const RMStoreVerificationSandboxURL = @"https://sandbox.itunes.apple.com/verifyReceipt";
+static NSString* const RMStoreVerificationEnvironmentsKey = @"RMStoreTransactionReceiptVerifierEnvironments";
 
-static const char _base64EncodingTable[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static NSInteger const RMStoreVerificationStatusSuccess = 0;
+static NSInteger const RMStoreVerificationStatusServerUnavailable = 21005;
+static NSInteger const RMStoreVerificationStatusSandboxReceipt = 21007; // Sandbox receipt sent to production
+static NSInteger const RMStoreVerificationStatusProductionReceipt = 21008; // Production receipt sent to sandbox
 
-- (NSString *)rm_stringByBase64Encoding
-{ // From: http://stackoverflow.com/a/4727124/143378
-    const unsigned char * objRawData = self.bytes;
-    char * objPointer;
-    char * strResult;
-    
-    // Get the Raw Data length and ensure we actually have data
-    NSInteger intLength = self.length;
-    if (intLength == 0) return nil;
-    
-    // Setup the String-based Result placeholder and pointer within that placeholder
-    strResult = (char *)calloc((((intLength + 2) / 3) * 4) + 1, sizeof(char));
-    objPointer = strResult;
-    
-    // Iterate through everything
-    while (intLength > 2) { // keep going until we have less than 24 bits
-        *objPointer++ = _base64EncodingTable[objRawData[0] >> 2];
-        *objPointer++ = _base64EncodingTable[((objRawData[0] & 0x03) << 4) + (objRawData[1] >> 4)];
-        *objPointer++ = _base64EncodingTable[((objRawData[1] & 0x0f) << 2) + (objRawData[2] >> 6)];
-        *objPointer++ = _base64EncodingTable[objRawData[2] & 0x3f];
-        
-        // we just handled 3 octets (24 bits) of data
-        objRawData += 3;
-        intLength -= 3;
-    }
-    
-    // now deal with the tail end of things
-    if (intLength != 0) {
-        *objPointer++ = _base64EncodingTable[objRawData[0] >> 2];
-        if (intLength > 1) {
-            *objPointer++ = _base64EncodingTable[((objRawData[0] & 0x03) << 4) + (objRawData[1] >> 4)];
-            *objPointer++ = _base64EncodingTable[(objRawData[1] & 0x0f) << 2];
-            *objPointer++ = '=';
-        } else {
-            *objPointer++ = _base64EncodingTable[(objRawData[0] & 0x03) << 4];
-            *objPointer++ = '=';
-            *objPointer++ = '=';
-        }
+/** Returns whether the status is the final word of the environment that answered, i.e., the receipt belongs to that environment and the server was able to process it.
+ */
+static BOOL RMStoreVerificationStatusIsAuthoritative(NSInteger statusCode)
+{
+    if (statusCode == RMStoreVerificationStatusServerUnavailable) return NO;
+    if (statusCode == RMStoreVerificationStatusSandboxReceipt || statusCode == RMStoreVerificationStatusProductionReceipt) return NO;
+    if (statusCode >= 21100 && statusCode <= 21199) return NO; // Internal data access errors
+    return YES;
+}
+
+/** Returns the environment declared by the transaction receipt, which is a property list. Only sandbox receipts declare one.
+ */
+static NSString* RMStoreTransactionReceiptOrigin(NSData *receipt)
+{
+    id plist = [NSPropertyListSerialization propertyListWithData:receipt options:NSPropertyListImmutable format:NULL error:nil];
+    NSString *environment = [plist isKindOfClass:[NSDictionary class]] ? plist[@"environment"] : nil;
+    return [environment isKindOfClass:[NSString class]] ? environment : @"Production";
+}
+
+static NSString* RMStoreBundleVersion(void)
+{
+    NSString *bundleVersion = [[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleVersion"];
+    return bundleVersion ? : @"";
+}
+
+@implementation RMStoreVerificationRequestMetrics
+
+- (instancetype)initWithURL:(NSURL*)URL queueDuration:(NSTimeInterval)queueDuration duration:(NSTimeInterval)duration HTTPStatusCode:(NSInteger)HTTPStatusCode error:(NSError*)error
+{
+    if (self = [super init])
+    {
+        _URL = URL;
+        _queueDuration = queueDuration;
+        _duration = duration;
+        _HTTPStatusCode = HTTPStatusCode;
+        _error = error;
     }
-    
-    // Terminate the string-based result
-    *objPointer = '\0';
-    
-    // Create result NSString object
-    NSString *base64String = @(strResult);
-    
-    // Free memory
-    free(strResult);
-    
-    return base64String;
+    return self;
 }
 
 @end
 
+@implementation RMStoreTransactionReceiptVerifier {
+    NSURLSession *_session;
+    dispatch_queue_t _requestQueue; // Guards _activeRequestCount and _pendingRequests
+    NSUInteger _activeRequestCount;
+    NSMutableArray *_pendingRequests;
+}
+
++ (NSURLSession*)sharedSession
+{
+    static NSURLSession *session;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        if (![NSURLSession class]) return; // Before iOS 7
+        NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration defaultSessionConfiguration];
+        configuration.URLCache = nil; // Verification responses must never be cached
+        configuration.requestCachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+        session = [NSURLSession sessionWithConfiguration:configuration];
+    });
+    return session;
+}
 
-@implementation RMStoreTransactionReceiptVerifier
++ (NSOperationQueue*)connectionQueue
+{
+    static NSOperationQueue *queue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        queue = [[NSOperationQueue alloc] init];
+        queue.name = @"net.robotmedia.RMStoreTransactionReceiptVerifier.connections";
+    });
+    return queue;
+}
+
+- (instancetype)init
+{
+    return [self initWithSession:[RMStoreTransactionReceiptVerifier sharedSession]];
+}
+
+- (instancetype)initWithSession:(NSURLSession*)session
+{
+    if (self = [super init])
+    {
+        _session = session;
+        _maximumConcurrentRequests = 4;
+        _environmentRoutingEnabled = YES;
+        _requestQueue = dispatch_queue_create("net.robotmedia.RMStoreTransactionReceiptVerifier.requests", DISPATCH_QUEUE_SERIAL);
+        _pendingRequests = [NSMutableArray array];
+    }
+    return self;
+}
 
 - (void)verifyTransaction:(SKPaymentTransaction*)transaction
                            success:(void (^)())successBlock
                            failure:(void (^)(NSError *error))failureBlock
 {    
-    NSString *receipt = [transaction.transactionReceipt rm_stringByBase64Encoding];
-    if (receipt == nil)
+    NSData *receipt = transaction.transactionReceipt;
+    if (receipt.length == 0)
     {
         if (failureBlock != nil)
         {
@@ -107,30 +168,144 @@ static const char _base64EncodingTable[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefgh
         }
         return;
     }
-    static NSString *receiptDataKey = @"receipt-data";
-    NSDictionary *jsonReceipt = @{receiptDataKey : receipt};
-    
-    NSError *error;
-    NSData *requestData = [NSJSONSerialization dataWithJSONObject:jsonReceipt options:0 error:&error];
+    NSData *requestData = RMStoreVerificationRequestData(receipt);
     if (!requestData)
     {
-        RMStoreLog(@"Failed to serialize receipt into JSON");
+        RMStoreLog(@"Failed to create the request");
         if (failureBlock != nil)
         {
+            NSError *error = [NSError errorWithDomain:RMStoreErrorDomain code:RMStoreErrorCodeUnableToCompleteVerification userInfo:nil];
             failureBlock(error);
         }
         return;
     }
     
-    static NSString *productionURL = @"https://buy.itunes.apple.com/verifyReceipt";
+    NSString *origin = RMStoreTransactionReceiptOrigin(receipt);
+    if (self.hedgedRequestsEnabled)
+    {
+        [self verifyHedgedRequestData:requestData origin:origin success:successBlock failure:failureBlock];
+        return;
+    }
     
-    [self verifyRequestData:requestData url:productionURL success:successBlock failure:failureBlock];
+    // From: https://developer.apple.com/library/ios/#technotes/tn2259/_index.html
+    // Always verify your receipt first with the production URL; proceed to verify with the sandbox URL if you receive a 21007 status code.
+    // Once an environment answers, receipts of the same origin and bundle version go straight to it. A receipt sent to the wrong environment still falls back to the other one.
+    NSString *urlString = RMStoreVerificationProductionURL;
+    if (self.environmentRoutingEnabled && [[RMStoreTransactionReceiptVerifier environmentForOrigin:origin] isEqualToString:RMStoreVerificationSandboxURL])
+    {
+        urlString = RMStoreVerificationSandboxURL;
+    }
+    [self verifyRequestData:requestData url:urlString origin:origin fallback:YES success:successBlock failure:failureBlock];
 }
 
 - (void)verifyRequestData:(NSData*)requestData
                       url:(NSString*)urlString
+                   origin:(NSString*)origin
+                 fallback:(BOOL)fallback
                   success:(void (^)())successBlock
                   failure:(void (^)(NSError *error))failureBlock
+{
+    [self postRequestData:requestData url:urlString completion:^(NSInteger statusCode, NSError *error) {
+        if (error)
+        {
+            if (failureBlock != nil)
+            {
+                failureBlock(error);
+            }
+            return;
+        }
+        
+        const BOOL sandbox = [urlString isEqualToString:RMStoreVerificationSandboxURL];
+        if (fallback && statusCode == (sandbox ? RMStoreVerificationStatusProductionReceipt : RMStoreVerificationStatusSandboxReceipt))
+        {
+            RMStoreLog(@"Verifying %@ Receipt", sandbox ? @"Production" : @"Sandbox");
+            NSString *otherURL = sandbox ? RMStoreVerificationProductionURL : RMStoreVerificationSandboxURL;
+            [self verifyRequestData:requestData url:otherURL origin:origin fallback:NO success:successBlock failure:failureBlock];
+            return;
+        }
+        [self finishVerificationWithStatusCode:statusCode url:urlString origin:origin success:successBlock failure:failureBlock];
+    }];
+}
+
+/** Sends the request to both environments at once and finishes with the first authoritative answer. If neither is authoritative, finishes with the answer of production.
+ */
+- (void)verifyHedgedRequestData:(NSData*)requestData
+                         origin:(NSString*)origin
+                        success:(void (^)())successBlock
+                        failure:(void (^)(NSError *error))failureBlock
+{
+    // The completion blocks run on the main queue, so there's no need to guard this state
+    __block BOOL finished = NO;
+    __block NSInteger pendingCount = 2;
+    __block NSInteger productionStatusCode = 0;
+    __block NSError *productionError = nil;
+    for (NSString *urlString in @[RMStoreVerificationProductionURL, RMStoreVerificationSandboxURL])
+    {
+        [self postRequestData:requestData url:urlString completion:^(NSInteger statusCode, NSError *error) {
+            pendingCount--;
+            if (finished) return;
+            
+            if (!error && RMStoreVerificationStatusIsAuthoritative(statusCode))
+            {
+                finished = YES;
+                [self finishVerificationWithStatusCode:statusCode url:urlString origin:origin success:successBlock failure:failureBlock];
+                return;
+            }
+            if ([urlString isEqualToString:RMStoreVerificationProductionURL])
+            {
+                productionStatusCode = statusCode;
+                productionError = error;
+            }
+            if (pendingCount > 0) return;
+            
+            finished = YES;
+            if (productionError)
+            {
+                if (failureBlock != nil)
+                {
+                    failureBlock(productionError);
+                }
+                return;
+            }
+            [self finishVerificationWithStatusCode:productionStatusCode url:RMStoreVerificationProductionURL origin:origin success:successBlock failure:failureBlock];
+        }];
+    }
+}
+
+- (void)finishVerificationWithStatusCode:(NSInteger)statusCode
+                                     url:(NSString*)urlString
+                                  origin:(NSString*)origin
+                                 success:(void (^)())successBlock
+                                 failure:(void (^)(NSError *error))failureBlock
+{
+    if (self.environmentRoutingEnabled && RMStoreVerificationStatusIsAuthoritative(statusCode))
+    {
+        [RMStoreTransactionReceiptVerifier setEnvironment:urlString forOrigin:origin];
+    }
+    
+    if (statusCode == RMStoreVerificationStatusSuccess)
+    {
+        if (successBlock != nil)
+        {
+            successBlock();
+        }
+    }
+    else
+    {
+        RMStoreLog(@"Verification Failed With Code %ld", (long)statusCode);
+        NSError *serverError = [NSError errorWithDomain:RMStoreErrorDomain code:statusCode userInfo:nil];
+        if (failureBlock != nil)
+        {
+            failureBlock(serverError);
+        }
+    }
+}
+
+/** Posts the request data to the given URL and calls the completion block on the main queue with the status of the response, or with an error if there's no valid response.
+ */
+- (void)postRequestData:(NSData*)requestData
+                    url:(NSString*)urlString
+             completion:(void (^)(NSInteger statusCode, NSError *error))completion
 {
     NSURL *url = [NSURL URLWithString:urlString];
     NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url];
@@ -138,18 +313,17 @@ static const char _base64EncodingTable[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefgh
     static NSString *requestMethod = @"POST";
     request.HTTPMethod = requestMethod;
 
-    dispatch_async(dispatch_get_global_queue( DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        NSError *error;
-        NSData *data = [NSURLConnection sendSynchronousRequest:request returningResponse:nil error:&error];
+    [self sendRequest:request completion:^(NSData *data, NSError *error) {
         dispatch_async(dispatch_get_main_queue(), ^{
             if (!data)
             {
                 RMStoreLog(@"Server Connection Failed");
-                NSError *wrapperError = [NSError errorWithDomain:RMStoreErrorDomain code:RMStoreErrorCodeUnableToCompleteVerification userInfo:@{NSUnderlyingErrorKey : error, NSLocalizedDescriptionKey : NSLocalizedStringFromTable(@"Connection to Apple failed. Check the underlying error for more info.", @"RMStore", @"Error description")}];
-                if (failureBlock != nil)
-                {
-                    failureBlock(wrapperError);
-                }
+                NSMutableDictionary *userInfo = [NSMutableDictionary dictionary];
+                userInfo[NSLocalizedDescriptionKey] = NSLocalizedStringFromTable(@"Connection to Apple failed. Check the underlying error for more info.", @"RMStore", @"Error description");
+                // A response without a body has no underlying error
+                if (error) userInfo[NSUnderlyingErrorKey] = error;
+                NSError *wrapperError = [NSError errorWithDomain:RMStoreErrorDomain code:RMStoreErrorCodeUnableToCompleteVerification userInfo:userInfo];
+                completion(0, wrapperError);
                 return;
             }
             NSError *jsonError;
@@ -157,44 +331,98 @@ static const char _base64EncodingTable[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefgh
             if (!responseJSON)
             {
                 RMStoreLog(@"Failed To Parse Server Response");
-                if (failureBlock != nil)
-                {
-                    failureBlock(jsonError);
-                }
+                completion(0, jsonError);
+                return;
             }
             
             static NSString *statusKey = @"status";
             NSInteger statusCode = [responseJSON[statusKey] integerValue];
-            
-            static NSInteger successCode = 0;
-            static NSInteger sandboxCode = 21007;
-            if (statusCode == successCode)
-            {
-                if (successBlock != nil)
-                {
-                    successBlock();
-                }
-            }
-            else if (statusCode == sandboxCode)
-            {
-                RMStoreLog(@"Verifying Sandbox Receipt");
-                // From: https://developer.apple.com/library/ios/#technotes/tn2259/_index.html
-                // See also: http://stackoverflow.com/questions/9677193/ios-storekit-can-i-detect-when-im-in-the-sandbox
-                // Always verify your receipt first with the production URL; proceed to verify with the sandbox URL if you receive a 21007 status code. Following this approach ensures that you do not have to switch between URLs while your application is being tested or reviewed in the sandbox or is live in the App Store.
-                
-                static NSString *sandboxURL = @"https://sandbox.itunes.apple.com/verifyReceipt";
-                [self verifyRequestData:requestData url:sandboxURL success:successBlock failure:failureBlock];
-            }
-            else
-            {
-                RMStoreLog(@"Verification Failed With Code %ld", (long)statusCode);
-                NSError *serverError = [NSError errorWithDomain:RMStoreErrorDomain code:statusCode userInfo:nil];
-                if (failureBlock != nil)
-                {
-                    failureBlock(serverError);
-                }
-            }
+            completion(statusCode, nil);
         });
+    }];
+}
+
+#pragma mark - Environment routing
+
+/** Returns the URL of the environment that last answered for receipts of the given origin and the current bundle version, or nil if there's none.
+ */
++ (NSString*)environmentForOrigin:(NSString*)origin
+{
+    NSDictionary *environments = [[NSUserDefaults standardUserDefaults] dictionaryForKey:RMStoreVerificationEnvironmentsKey];
+    NSDictionary *environmentsByOrigin = environments[RMStoreBundleVersion()];
+    NSString *urlString = [environmentsByOrigin isKindOfClass:[NSDictionary class]] ? environmentsByOrigin[origin] : nil;
+    return [urlString isKindOfClass:[NSString class]] ? urlString : nil;
+}
+
++ (void)setEnvironment:(NSString*)urlString forOrigin:(NSString*)origin
+{
+    if ([[self environmentForOrigin:origin] isEqualToString:urlString]) return;
+    
+    NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+    NSString *bundleVersion = RMStoreBundleVersion();
+    NSDictionary *environments = [defaults dictionaryForKey:RMStoreVerificationEnvironmentsKey];
+    NSDictionary *environmentsByOrigin = environments[bundleVersion];
+    NSMutableDictionary *updatedEnvironmentsByOrigin = [environmentsByOrigin isKindOfClass:[NSDictionary class]] ? [environmentsByOrigin mutableCopy] : [NSMutableDictionary dictionary];
+    updatedEnvironmentsByOrigin[origin] = urlString;
+    // Routes of other bundle versions are dropped, as a new build may be distributed differently
+    [defaults setObject:@{bundleVersion : updatedEnvironmentsByOrigin} forKey:RMStoreVerificationEnvironmentsKey];
+}
+
+#pragma mark - Transport
+
+/** Sends the request asynchronously once fewer than maximumConcurrentRequests of this verifier are in flight, and calls the completion block on an arbitrary queue.
+ */
+- (void)sendRequest:(NSURLRequest*)request completion:(void (^)(NSData *data, NSError *error))completion
+{
+    const NSTimeInterval enqueued = [NSProcessInfo processInfo].systemUptime;
+    void (^send)(void) = ^{
+        const NSTimeInterval started = [NSProcessInfo processInfo].systemUptime;
+        void (^finish)(NSData*, NSURLResponse*, NSError*) = ^(NSData *data, NSURLResponse *response, NSError *error) {
+            const NSTimeInterval finished = [NSProcessInfo processInfo].systemUptime;
+            const NSInteger statusCode = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse*)response).statusCode : 0;
+            RMStoreVerificationRequestMetrics *metrics = [[RMStoreVerificationRequestMetrics alloc] initWithURL:request.URL queueDuration:started - enqueued duration:finished - started HTTPStatusCode:statusCode error:error];
+            [self.metricsSink receiptVerifier:self didFinishRequestWithMetrics:metrics];
+            [self didFinishRequest];
+            completion(data, error);
+        };
+        if (_session)
+        {
+            NSURLSessionDataTask *task = [_session dataTaskWithRequest:request completionHandler:finish];
+            [task resume];
+        }
+        else
+        {
+            [NSURLConnection sendAsynchronousRequest:request queue:[RMStoreTransactionReceiptVerifier connectionQueue] completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+                finish(data, response, error);
+            }];
+        }
+    };
+    dispatch_async(_requestQueue, ^{
+        if (_activeRequestCount < MAX(self.maximumConcurrentRequests, 1))
+        {
+            _activeRequestCount++;
+            send();
+        }
+        else
+        {
+            [_pendingRequests addObject:[send copy]];
+        }
+    });
+}
+
+- (void)didFinishRequest
+{
+    dispatch_async(_requestQueue, ^{
+        if (_pendingRequests.count > 0)
+        { // The slot goes to the oldest pending request
+            void (^send)(void) = _pendingRequests[0];
+            [_pendingRequests removeObjectAtIndex:0];
+            send();
+        }
+        else
+        {
+            _activeRequestCount--;
+        }
     });
 }
 
@@ -0,0 +1,1365 @@
+//
+//  RMAppReceiptCoreBenchmarks.c
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+//  Benchmarks of the portable receipt core. Run all cases with no arguments, or the given cases otherwise.
+//
+
+#include "RMAppReceiptCore.h"
+#include "RMAppReceiptCoreTestSupport.h"
+#include "RMStoreBase64.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#define RMBenchmarkMallocSize malloc_size
+#else
+#include <malloc.h>
+#define RMBenchmarkMallocSize malloc_usable_size
+#endif
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+
+static double RMBenchmarkNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *_executablePath;
+
+/** Returns the peak resident set size of the process in KB.
+ */
+static long RMBenchmarkPeakRSS(void)
+{
+    // VmHWM is reset by exec, unlike ru_maxrss on Linux
+    FILE *fp = fopen("/proc/self/status", "r");
+    char line[256];
+    long peak = -1;
+    while (fp && fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "VmHWM: %ld kB", &peak) == 1) break;
+    }
+    if (fp) fclose(fp);
+    if (peak < 0)
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        peak = usage.ru_maxrss;
+    }
+    return peak;
+}
+
+// MARK: - Load
+
+/* Each load runs in a fresh process so that its peak RSS is not polluted by the generated receipts. */
+
+static int RMBenchmarkLoadChild(const char *mode, const char *path, const char *certificatePath)
+{
+    RMTestBuffer certificate = {0};
+    FILE *fp = fopen(certificatePath, "rb");
+    uint8_t chunk[4096];
+    size_t read;
+    while (fp && (read = fread(chunk, 1, sizeof(chunk), fp)) > 0) RMTestBufferAppend(&certificate, chunk, read);
+    if (fp) fclose(fp);
+    const int verify = strstr(mode, "verified") != NULL && strstr(mode, "unverified") == NULL;
+
+    const double start = RMBenchmarkNow();
+    RMReceiptVerifier *verifier = verify ? RMReceiptVerifierCreate(certificate.bytes, certificate.length) : NULL;
+    long length = 0;
+    uint8_t checksum = 0;
+    if (strncmp(mode, "copy", 4) == 0)
+    {
+        uint8_t *payload = RMReceiptCopyPayloadAtPath(path, verifier, &length);
+        for (long i = 0; payload && i < length; i += 4096) checksum ^= payload[i];
+        free(payload);
+    }
+    else if (strcmp(mode, "mapped-cached") == 0)
+    { // What RMAppReceipt does on a verification cache hit: authenticate the digest of the file instead of verifying its signature
+        static const uint8_t secret[32] = {0};
+        RMReceiptFile *file = RMReceiptFileOpen(path, NULL);
+        long contentsLength = 0;
+        const uint8_t *contents = file ? RMReceiptFileGetContents(file, &contentsLength) : NULL;
+        uint8_t message[2 * SHA256_DIGEST_LENGTH];
+        SHA256(contents, contentsLength, message);
+        SHA256(certificate.bytes, certificate.length, message + SHA256_DIGEST_LENGTH);
+        uint8_t tag[SHA256_DIGEST_LENGTH];
+        unsigned int tagLength;
+        HMAC(EVP_sha256(), secret, sizeof(secret), message, sizeof(message), tag, &tagLength);
+        const uint8_t *payload = file ? RMReceiptFileGetPayload(file, &length) : NULL;
+        for (long i = 0; payload && i < length; i += 4096) checksum ^= payload[i];
+        checksum ^= tag[0];
+        RMReceiptFileClose(file);
+    }
+    else if (strncmp(mode, "mapped", 6) == 0)
+    {
+        RMReceiptFile *file = RMReceiptFileOpen(path, verifier);
+        const uint8_t *payload = file ? RMReceiptFileGetPayload(file, &length) : NULL;
+        for (long i = 0; payload && i < length; i += 4096) checksum ^= payload[i];
+        RMReceiptFileClose(file);
+    }
+    RMReceiptVerifierFree(verifier);
+    const double elapsed = RMBenchmarkNow() - start;
+    printf("%.3f %ld %ld %u\n", elapsed * 1000, RMBenchmarkPeakRSS(), length, checksum);
+    RMTestBufferFree(&certificate);
+    return length > 0 || strcmp(mode, "baseline") == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void RMBenchmarkLoadRun(const char *mode, const char *path, const char *certificatePath, double *milliseconds, long *maxRSS)
+{
+    int fds[2];
+    if (pipe(fds) != 0) return;
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        execl(_executablePath, _executablePath, "--load-child", mode, path, certificatePath, (char *)NULL);
+        _exit(EXIT_FAILURE);
+    }
+    close(fds[1]);
+    char output[128] = {0};
+    ssize_t count = read(fds[0], output, sizeof(output) - 1);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    *milliseconds = -1;
+    *maxRSS = -1;
+    if (count > 0)
+    {
+        sscanf(output, "%lf %ld", milliseconds, maxRSS);
+    }
+}
+
+static void RMBenchmarkLoad(void)
+{
+    EVP_PKEY *key;
+    X509 *certificate;
+    RMTestCreateCertificate(&key, &certificate);
+    RMTestBuffer certificateData = RMTestCertificateData(certificate);
+    const char *certificatePath = "/tmp/RMAppReceiptCoreBenchmarks.cer";
+    FILE *fp = fopen(certificatePath, "wb");
+    fwrite(certificateData.bytes, 1, certificateData.length, fp);
+    fclose(fp);
+
+    const char *path = "/tmp/RMAppReceiptCoreBenchmarks.receipt";
+    const size_t purchaseCounts[] = {5000, 20000, 80000};
+    const char *modes[] = {"copy-unverified", "mapped-unverified", "copy-verified", "mapped-verified", "mapped-cached"};
+    double milliseconds;
+    long baselineRSS;
+    RMBenchmarkLoadRun("baseline", "/dev/null", certificatePath, &milliseconds, &baselineRSS);
+    printf("load: receipt size, mode, time (ms), peak RSS above baseline (KB)\n");
+    for (size_t i = 0; i < sizeof(purchaseCounts) / sizeof(purchaseCounts[0]); i++)
+    {
+        RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", purchaseCounts[i], 10);
+        RMTestWritePKCS7(path, &payload, key, certificate);
+        for (size_t j = 0; j < sizeof(modes) / sizeof(modes[0]); j++)
+        {
+            long maxRSS;
+            RMBenchmarkLoadRun(modes[j], path, certificatePath, &milliseconds, &maxRSS);
+            printf("load: %7.2f MB, %-17s, %8.3f, %7ld\n", payload.length / 1048576.0, modes[j], milliseconds, maxRSS - baselineRSS);
+        }
+        RMTestBufferFree(&payload);
+    }
+    unlink(path);
+    unlink(certificatePath);
+    RMTestBufferFree(&certificateData);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+}
+
+// MARK: - Verify
+
+/** The verification as it was done before RMReceiptVerifier: digests, store and certificate are set up and torn down for every receipt.
+ */
+static int RMBenchmarkVerifyOneShot(PKCS7 *container, const uint8_t *certificateBytes, long certificateLength)
+{
+    int result = 0;
+    OpenSSL_add_all_digests();
+    X509_STORE *store = X509_STORE_new();
+    X509 *certificate = d2i_X509(NULL, &certificateBytes, certificateLength);
+    if (store && certificate)
+    {
+        X509_STORE_add_cert(store, certificate);
+        BIO *sink = BIO_new(BIO_s_null());
+        result = PKCS7_verify(container, NULL, store, NULL, sink, 0);
+        BIO_free(sink);
+    }
+    X509_free(certificate);
+    X509_STORE_free(store);
+    EVP_cleanup();
+    return result == 1;
+}
+
+typedef struct
+{
+    const RMTestBuffer *container;
+    const RMTestBuffer *certificate;
+    RMReceiptVerifier *verifier; // NULL for one-shot verifications
+    double duration;
+    int verified;
+} RMBenchmarkVerification;
+
+static void *RMBenchmarkVerifyThread(void *context)
+{
+    RMBenchmarkVerification *verification = context;
+    const uint8_t *bytes = verification->container->bytes;
+    PKCS7 *p7 = d2i_PKCS7(NULL, &bytes, verification->container->length);
+    const double start = RMBenchmarkNow();
+    while (p7 && RMBenchmarkNow() - start < verification->duration)
+    {
+        verification->verified += verification->verifier ?
+            RMReceiptVerifierVerify(verification->verifier, p7) :
+            RMBenchmarkVerifyOneShot(p7, verification->certificate->bytes, verification->certificate->length);
+    }
+    PKCS7_free(p7);
+    return NULL;
+}
+
+static void RMBenchmarkVerify(void)
+{
+    EVP_PKEY *key;
+    X509 *certificate;
+    RMTestCreateCertificate(&key, &certificate);
+    RMTestBuffer certificateData = RMTestCertificateData(certificate);
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 50, 10);
+    const char *path = "/tmp/RMAppReceiptCoreBenchmarks.receipt";
+    RMTestWritePKCS7(path, &payload, key, certificate);
+    RMTestBuffer container = {0};
+    FILE *fp = fopen(path, "rb");
+    uint8_t chunk[4096];
+    size_t read;
+    while (fp && (read = fread(chunk, 1, sizeof(chunk), fp)) > 0) RMTestBufferAppend(&container, chunk, read);
+    if (fp) fclose(fp);
+    unlink(path);
+
+    RMReceiptVerifier *verifier = RMReceiptVerifierCreate(certificateData.bytes, certificateData.length);
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("verify: %ld cores, %s\n", cores, OPENSSL_VERSION_TEXT);
+    printf("verify: threads, mode, verifications/s\n");
+    const long maxThreadCount = cores > 4 ? cores : 4; // Oversubscribe small machines to expose contention
+    for (long threadCount = 1; threadCount <= maxThreadCount && threadCount <= 64; threadCount *= 2)
+    {
+        for (int shared = 0; shared <= 1; shared++)
+        {
+            pthread_t threads[64];
+            RMBenchmarkVerification verifications[64];
+            for (long i = 0; i < threadCount; i++)
+            {
+                verifications[i] = (RMBenchmarkVerification){&container, &certificateData, shared ? verifier : NULL, 1.0, 0};
+                pthread_create(&threads[i], NULL, RMBenchmarkVerifyThread, &verifications[i]);
+            }
+            long verified = 0;
+            for (long i = 0; i < threadCount; i++)
+            {
+                pthread_join(threads[i], NULL);
+                verified += verifications[i].verified;
+            }
+            printf("verify: %3ld, %-8s, %9.1f\n", threadCount, shared ? "shared" : "one-shot", verified / verifications[0].duration);
+        }
+    }
+    RMReceiptVerifierFree(verifier);
+    RMTestBufferFree(&container);
+    RMTestBufferFree(&payload);
+    RMTestBufferFree(&certificateData);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+}
+
+// MARK: - ASN1
+
+/* The receipt walk as it was before the DER reader, built on ASN1_get_object. */
+
+static int RMBenchmarkLegacyReadInteger(const uint8_t **pp, long omax)
+{
+    int tag, asn1Class;
+    long length;
+    int value = 0;
+    ASN1_get_object(pp, &length, &tag, &asn1Class, omax);
+    if (tag == V_ASN1_INTEGER)
+    {
+        for (int i = 0; i < length; i++)
+        {
+            value = value * 0x100 + (*pp)[i];
+        }
+    }
+    *pp += length;
+    return value;
+}
+
+static const uint8_t *RMBenchmarkLegacyReadString(const uint8_t **pp, long omax, int expectedTag, long *length)
+{
+    int tag, asn1Class;
+    const uint8_t *value = NULL;
+    ASN1_get_object(pp, length, &tag, &asn1Class, omax);
+    if (tag == expectedTag)
+    {
+        value = *pp;
+    }
+    *pp += *length;
+    return value;
+}
+
+static void RMBenchmarkLegacyEnumerateAttributes(const uint8_t *p, long tlength, RMReceiptAttributeFunction function, void *context)
+{
+    int type, tag;
+    long length;
+    const uint8_t *end = p + tlength;
+    ASN1_get_object(&p, &length, &type, &tag, end - p);
+    if (type != V_ASN1_SET) return;
+    while (p < end)
+    {
+        ASN1_get_object(&p, &length, &type, &tag, end - p);
+        if (type != V_ASN1_SEQUENCE) break;
+        const uint8_t *sequenceEnd = p + length;
+        const int attributeType = RMBenchmarkLegacyReadInteger(&p, sequenceEnd - p);
+        RMBenchmarkLegacyReadInteger(&p, sequenceEnd - p);
+        ASN1_get_object(&p, &length, &type, &tag, sequenceEnd - p);
+        if (type == V_ASN1_OCTET_STRING)
+        {
+            if (function(p, length, attributeType, context) != 0) return;
+        }
+        p += length;
+        while (p < sequenceEnd)
+        {
+            ASN1_get_object(&p, &length, &type, &tag, sequenceEnd - p);
+            p += length;
+        }
+    }
+}
+
+typedef struct
+{
+    int legacy;
+    long checksum;
+} RMBenchmarkWalk;
+
+static int RMBenchmarkWalkAttribute(const uint8_t *value, long length, int type, void *context)
+{
+    RMBenchmarkWalk *walk = context;
+    const uint8_t *p = value;
+    long stringLength = 0;
+    switch (type)
+    {
+        case RMReceiptAttributeTypeInAppPurchaseReceipt:
+            if (walk->legacy) RMBenchmarkLegacyEnumerateAttributes(value, length, RMBenchmarkWalkAttribute, walk);
+            else RMReceiptEnumerateAttributes(value, length, RMBenchmarkWalkAttribute, walk);
+            break;
+        case RMReceiptAttributeTypeQuantity:
+            walk->checksum += walk->legacy ? RMBenchmarkLegacyReadInteger(&p, length) : RMReceiptASN1ReadInteger(&p, length);
+            break;
+        case RMReceiptAttributeTypeProductIdentifier:
+        case RMReceiptAttributeTypeTransactionIdentifier:
+            if (walk->legacy) RMBenchmarkLegacyReadString(&p, length, V_ASN1_UTF8STRING, &stringLength);
+            else RMReceiptASN1ReadString(&p, length, V_ASN1_UTF8STRING, &stringLength);
+            walk->checksum += stringLength;
+            break;
+        case RMReceiptAttributeTypePurchaseDate:
+        case RMReceiptAttributeTypeSubscriptionExpirationDate:
+            if (walk->legacy) RMBenchmarkLegacyReadString(&p, length, V_ASN1_IA5STRING, &stringLength);
+            else RMReceiptASN1ReadString(&p, length, V_ASN1_IA5STRING, &stringLength);
+            walk->checksum += stringLength;
+            break;
+    }
+    return 0;
+}
+
+static void RMBenchmarkASN1(void)
+{
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 50000, 10);
+    printf("asn1: walk of %.2f MB (50000 purchases), best of 10\n", payload.length / 1048576.0);
+    printf("asn1: decoder, time (ms), MB/s\n");
+    for (int legacy = 1; legacy >= 0; legacy--)
+    {
+        double best = -1;
+        long checksum = 0;
+        for (int run = 0; run < 10; run++)
+        {
+            RMBenchmarkWalk walk = {legacy, 0};
+            const double start = RMBenchmarkNow();
+            if (legacy) RMBenchmarkLegacyEnumerateAttributes(payload.bytes, payload.length, RMBenchmarkWalkAttribute, &walk);
+            else RMReceiptEnumerateAttributes(payload.bytes, payload.length, RMBenchmarkWalkAttribute, &walk);
+            const double elapsed = RMBenchmarkNow() - start;
+            if (best < 0 || elapsed < best) best = elapsed;
+            checksum = walk.checksum;
+        }
+        printf("asn1: %-15s, %8.3f, %8.1f (checksum %ld)\n", legacy ? "ASN1_get_object" : "DER reader", best * 1000, payload.length / 1048576.0 / best, checksum);
+    }
+    RMTestBufferFree(&payload);
+}
+
+// MARK: - Query
+
+/** Stands for the object graph of RMAppReceipt: every string is copied and every date is parsed.
+ */
+static int RMBenchmarkMaterializeAttribute(const uint8_t *value, long length, int type, void *context)
+{
+    long *checksum = context;
+    const uint8_t *p = value;
+    long stringLength;
+    const uint8_t *string;
+    double interval;
+    switch (type)
+    {
+        case RMReceiptAttributeTypeInAppPurchaseReceipt:
+            RMReceiptEnumerateAttributes(value, length, RMBenchmarkMaterializeAttribute, context);
+            break;
+        case RMReceiptAttributeTypeBundleIdentifier:
+        case RMReceiptAttributeTypeProductIdentifier:
+        case RMReceiptAttributeTypeTransactionIdentifier:
+        case RMReceiptAttributeTypeOriginalTransactionIdentifier:
+        {
+            string = RMReceiptASN1ReadString(&p, length, V_ASN1_UTF8STRING, &stringLength);
+            char *copy = string ? malloc(stringLength + 1) : NULL;
+            if (copy)
+            {
+                memcpy(copy, string, stringLength);
+                *checksum += stringLength;
+                free(copy);
+            }
+            break;
+        }
+        case RMReceiptAttributeTypePurchaseDate:
+        case RMReceiptAttributeTypeOriginalPurchaseDate:
+        case RMReceiptAttributeTypeSubscriptionExpirationDate:
+            string = RMReceiptASN1ReadString(&p, length, V_ASN1_IA5STRING, &stringLength);
+            if (string && RMReceiptParseRFC3339Date(string, stringLength, &interval)) *checksum += 1;
+            break;
+    }
+    return 0;
+}
+
+static void RMBenchmarkQuery(void)
+{
+    const size_t purchaseCounts[] = {1000, 10000, 50000};
+    const char *products[] = {"net.robotmedia.test.product9", "net.robotmedia.test.missing"};
+    printf("query: purchases, product, full parse (ms), scan (ms), speedup\n");
+    for (size_t i = 0; i < sizeof(purchaseCounts) / sizeof(purchaseCounts[0]); i++)
+    {
+        RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", purchaseCounts[i], 10);
+        double full = -1;
+        for (int run = 0; run < 5; run++)
+        {
+            long checksum = 0;
+            const double start = RMBenchmarkNow();
+            RMReceiptEnumerateAttributes(payload.bytes, payload.length, RMBenchmarkMaterializeAttribute, &checksum);
+            const double elapsed = RMBenchmarkNow() - start;
+            if (full < 0 || elapsed < full) full = elapsed;
+        }
+        for (size_t j = 0; j < sizeof(products) / sizeof(products[0]); j++)
+        {
+            double scan = -1;
+            int found = 0;
+            for (int run = 0; run < 5; run++)
+            {
+                const double start = RMBenchmarkNow();
+                found = RMReceiptContainsProduct(payload.bytes, payload.length, products[j], strlen(products[j]));
+                const double elapsed = RMBenchmarkNow() - start;
+                if (scan < 0 || elapsed < scan) scan = elapsed;
+            }
+            printf("query: %6zu, %-7s, %8.3f, %8.3f, %7.1fx\n", purchaseCounts[i], found ? "found" : "missing", full * 1000, scan * 1000, full / scan);
+        }
+        RMTestBufferFree(&payload);
+    }
+}
+
+// MARK: - Prefilter
+
+/* Raw search throughput of each implementation over a receipt, then RMReceiptContainsProduct against the scan without prefilter. The rare product is only bought by the last purchase, so the prefilter skips every other purchase without decoding it. */
+
+static int RMBenchmarkMatchProduct(const RMReceiptPurchase *purchase, void *context)
+{
+    const char *productIdentifier = context;
+    long length;
+    const uint8_t *p = RMReceiptPurchaseGetValue(purchase, RMReceiptAttributeTypeProductIdentifier, &length);
+    if (!p) return 0;
+
+    long stringLength;
+    const uint8_t *string = RMReceiptASN1ReadString(&p, length, V_ASN1_UTF8STRING, &stringLength);
+    return string && stringLength == (long)strlen(productIdentifier) && memcmp(string, productIdentifier, stringLength) == 0;
+}
+
+static RMTestBuffer RMBenchmarkRarePayload(size_t purchaseCount)
+{
+    RMTestBuffer attributes = {0};
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeBundleIdentifier, V_ASN1_UTF8STRING, "net.robotmedia.test");
+    for (size_t i = 0; i < purchaseCount; i++)
+    {
+        char productIdentifier[64], transactionIdentifier[32];
+        snprintf(productIdentifier, sizeof(productIdentifier), "net.robotmedia.test.product%zu", i % 10);
+        snprintf(transactionIdentifier, sizeof(transactionIdentifier), "%zu", 1000000000 + i);
+        RMTestBuffer iap = RMTestIAP(i + 1 == purchaseCount ? "net.robotmedia.test.rare" : productIdentifier, transactionIdentifier, "2013-10-15T12:00:00Z", "2013-11-15T12:00:00Z");
+        RMTestAppendAttribute(&attributes, RMReceiptAttributeTypeInAppPurchaseReceipt, &iap);
+        RMTestBufferFree(&iap);
+    }
+    RMTestBuffer set = RMTestSet(&attributes);
+    RMTestBufferFree(&attributes);
+    return set;
+}
+
+static void RMBenchmarkPrefilter(void)
+{
+    const struct { RMReceiptSearchImplementation implementation; const char *name; } implementations[] = {
+        {RMReceiptSearchScalar, "scalar"},
+        {RMReceiptSearchSSE2, "sse2"},
+        {RMReceiptSearchAVX2, "avx2"},
+        {RMReceiptSearchNEON, "neon"},
+    };
+    // Encoded identifiers as searched by RMReceiptContainsProduct. The second one has the same length as the identifiers of the receipt, so its first byte is frequent.
+    const char *needles[] = {"\x1bnet.robotmedia.test.missing", "\x1cnet.robotmedia.test.productX"};
+    RMTestBuffer payload = RMBenchmarkRarePayload(50000);
+    printf("prefilter: implementation, needle, MB, search (ms), GB/s\n");
+    for (size_t i = 0; i < sizeof(implementations) / sizeof(implementations[0]); i++)
+    {
+        if (!RMReceiptSearchIsAvailable(implementations[i].implementation)) continue;
+
+        for (size_t j = 0; j < sizeof(needles) / sizeof(needles[0]); j++)
+        {
+            double best = -1;
+            for (int run = 0; run < 10; run++)
+            {
+                const double start = RMBenchmarkNow();
+                const uint8_t *found = RMReceiptFindBytes(payload.bytes, payload.length, (const uint8_t*)needles[j], strlen(needles[j]), implementations[i].implementation);
+                const double elapsed = RMBenchmarkNow() - start;
+                if (found) printf("prefilter: unexpected match\n");
+                if (best < 0 || elapsed < best) best = elapsed;
+            }
+            printf("prefilter: %-6s, %-8s, %6.1f, %8.3f, %6.2f\n", implementations[i].name, j == 0 ? "rare" : "frequent", payload.length / 1e6, best * 1000, payload.length / best / 1e9);
+        }
+    }
+    RMTestBufferFree(&payload);
+
+    const size_t purchaseCounts[] = {1000, 10000, 50000};
+    const char *products[] = {"net.robotmedia.test.rare", "net.robotmedia.test.missing"};
+    printf("prefilter: purchases, product, scan (ms), prefiltered (ms), speedup\n");
+    for (size_t i = 0; i < sizeof(purchaseCounts) / sizeof(purchaseCounts[0]); i++)
+    {
+        RMTestBuffer payload = RMBenchmarkRarePayload(purchaseCounts[i]);
+        for (size_t j = 0; j < sizeof(products) / sizeof(products[0]); j++)
+        {
+            double scan = -1, prefiltered = -1;
+            int found = 0;
+            for (int run = 0; run < 5; run++)
+            {
+                double start = RMBenchmarkNow();
+                RMReceiptScanPurchases(payload.bytes, payload.length, RMReceiptPurchaseAttributeBit(RMReceiptAttributeTypeProductIdentifier), RMBenchmarkMatchProduct, (void*)products[j]);
+                double elapsed = RMBenchmarkNow() - start;
+                if (scan < 0 || elapsed < scan) scan = elapsed;
+
+                start = RMBenchmarkNow();
+                found = RMReceiptContainsProduct(payload.bytes, payload.length, products[j], strlen(products[j]));
+                elapsed = RMBenchmarkNow() - start;
+                if (prefiltered < 0 || elapsed < prefiltered) prefiltered = elapsed;
+            }
+            printf("prefilter: %6zu, %-7s, %8.3f, %8.3f, %7.1fx\n", purchaseCounts[i], found ? "found" : "missing", scan * 1000, prefiltered * 1000, scan / prefiltered);
+        }
+        RMTestBufferFree(&payload);
+    }
+}
+
+// MARK: - Table
+
+/* Queries over the columnar table against the same loops over one heap object per purchase, each with its own heap string and dates, which is the layout of RMAppReceiptIAP. */
+
+typedef struct
+{
+    char *productIdentifier;
+    double *purchaseDate;
+    double *expirationDate;
+} RMBenchmarkPurchaseObject;
+
+typedef struct
+{
+    RMBenchmarkPurchaseObject **objects;
+    long count;
+} RMBenchmarkObjects;
+
+static double *RMBenchmarkCopyDate(const uint8_t *p, long length)
+{
+    long stringLength;
+    const uint8_t *string = p ? RMReceiptASN1ReadString(&p, length, V_ASN1_IA5STRING, &stringLength) : NULL;
+    double interval;
+    if (!string || !RMReceiptParseRFC3339Date(string, stringLength, &interval)) return NULL;
+    double *date = malloc(sizeof(*date));
+    *date = interval;
+    return date;
+}
+
+static int RMBenchmarkCreateObject(const RMReceiptPurchase *purchase, void *context)
+{
+    RMBenchmarkObjects *objects = context;
+    RMBenchmarkPurchaseObject *object = calloc(1, sizeof(*object));
+    long length;
+    const uint8_t *p = RMReceiptPurchaseGetValue(purchase, RMReceiptAttributeTypeProductIdentifier, &length);
+    long stringLength;
+    const uint8_t *string = p ? RMReceiptASN1ReadString(&p, length, V_ASN1_UTF8STRING, &stringLength) : NULL;
+    if (string) object->productIdentifier = strndup((const char*)string, stringLength);
+    p = RMReceiptPurchaseGetValue(purchase, RMReceiptAttributeTypePurchaseDate, &length);
+    object->purchaseDate = RMBenchmarkCopyDate(p, length);
+    p = RMReceiptPurchaseGetValue(purchase, RMReceiptAttributeTypeSubscriptionExpirationDate, &length);
+    object->expirationDate = RMBenchmarkCopyDate(p, length);
+    objects->objects[objects->count++] = object;
+    return 0;
+}
+
+static void RMBenchmarkTable(void)
+{
+    const size_t purchaseCounts[] = {1000, 10000, 50000};
+    const int64_t start = 1381838400 - 86400, end = 1381838400 + 86400; // The test purchases are all on 2013-10-15
+    printf("table: purchases, query, objects (ms), columns (ms), speedup\n");
+    for (size_t i = 0; i < sizeof(purchaseCounts) / sizeof(purchaseCounts[0]); i++)
+    {
+        RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", purchaseCounts[i], 10);
+        double build = RMBenchmarkNow();
+        RMReceiptPurchaseTable *table = RMReceiptPurchaseTableCreate(payload.bytes, payload.length);
+        build = RMBenchmarkNow() - build;
+        RMBenchmarkObjects objects = {calloc(purchaseCounts[i], sizeof(RMBenchmarkPurchaseObject*)), 0};
+        const uint32_t mask = RMReceiptPurchaseAttributeBit(RMReceiptAttributeTypeProductIdentifier) | RMReceiptPurchaseAttributeBit(RMReceiptAttributeTypePurchaseDate) | RMReceiptPurchaseAttributeBit(RMReceiptAttributeTypeSubscriptionExpirationDate);
+        RMReceiptScanPurchases(payload.bytes, payload.length, mask, RMBenchmarkCreateObject, &objects);
+        printf("table: %6zu, build  , %8s, %8.3f\n", purchaseCounts[i], "-", build * 1000);
+
+        long *rows = malloc(table->count * sizeof(*rows));
+        long *counts = calloc(table->productCount, sizeof(*counts));
+        int64_t *latest = malloc(table->productCount * sizeof(*latest));
+        for (long j = 0; j < table->productCount; j++) latest[j] = RMReceiptPurchaseTableNoDate;
+        for (int query = 0; query < 3; query++)
+        {
+            double bestObjects = -1, bestColumns = -1;
+            long checksum = 0;
+            for (int run = 0; run < 5; run++)
+            {
+                double started = RMBenchmarkNow();
+                for (long j = 0; j < objects.count; j++)
+                {
+                    const RMBenchmarkPurchaseObject *object = objects.objects[j];
+                    switch (query)
+                    {
+                        case 0:
+                            if (object->purchaseDate && *object->purchaseDate >= start && *object->purchaseDate < end) rows[checksum++ % table->count] = j;
+                            break;
+                        default:
+                            // Per product, with the product looked up by name
+                            for (long k = 0; object->productIdentifier && k < table->productCount; k++)
+                            {
+                                if (strncmp(object->productIdentifier, (const char*)table->productIdentifiers[k], table->productIdentifierLengths[k]) != 0 || object->productIdentifier[table->productIdentifierLengths[k]] != '\0') continue;
+                                if (query == 1) counts[k]++;
+                                else if (object->expirationDate && *object->expirationDate > latest[k]) latest[k] = (int64_t)*object->expirationDate;
+                                break;
+                            }
+                            break;
+                    }
+                }
+                double elapsed = RMBenchmarkNow() - started;
+                if (bestObjects < 0 || elapsed < bestObjects) bestObjects = elapsed;
+
+                started = RMBenchmarkNow();
+                switch (query)
+                {
+                    case 0: checksum += RMReceiptPurchaseTableSelectPurchasesBetween(table, start, end, rows); break;
+                    case 1: RMReceiptPurchaseTableCountProducts(table, counts); break;
+                    default: RMReceiptPurchaseTableGetLatestExpirations(table, latest); break;
+                }
+                elapsed = RMBenchmarkNow() - started;
+                if (bestColumns < 0 || elapsed < bestColumns) bestColumns = elapsed;
+            }
+            const char *names[] = {"range  ", "count  ", "latest "};
+            printf("table: %6zu, %s, %8.3f, %8.3f, %7.1fx\n", purchaseCounts[i], names[query], bestObjects * 1000, bestColumns * 1000, bestObjects / bestColumns);
+        }
+        free(rows);
+        free(counts);
+        free(latest);
+        for (long j = 0; j < objects.count; j++)
+        {
+            free(objects.objects[j]->productIdentifier);
+            free(objects.objects[j]->purchaseDate);
+            free(objects.objects[j]->expirationDate);
+            free(objects.objects[j]);
+        }
+        free(objects.objects);
+        RMReceiptPurchaseTableFree(table);
+        RMTestBufferFree(&payload);
+    }
+}
+
+// MARK: - Strings
+
+/* The product and original transaction identifiers of every purchase, copied one allocation each as NSString does, against interned in a string pool. Receipts repeat product identifiers and, across renewals, original transaction identifiers. */
+
+typedef struct
+{
+    RMReceiptStringPool *pool;
+    char **copies;
+    long count;
+    size_t size;
+} RMBenchmarkStringCopies;
+
+static int RMBenchmarkCopyStrings(const RMReceiptPurchase *purchase, void *context)
+{
+    RMBenchmarkStringCopies *strings = context;
+    const int types[] = {RMReceiptAttributeTypeProductIdentifier, RMReceiptAttributeTypeOriginalTransactionIdentifier};
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        long length;
+        const uint8_t *p = RMReceiptPurchaseGetValue(purchase, types[i], &length);
+        long stringLength;
+        const uint8_t *string = p ? RMReceiptASN1ReadString(&p, length, V_ASN1_UTF8STRING, &stringLength) : NULL;
+        if (!string) continue;
+
+        if (strings->pool)
+        {
+            const uint8_t *interned;
+            strings->count += RMReceiptStringPoolIntern(strings->pool, string, stringLength, &interned) >= 0;
+        }
+        else
+        {
+            char *copy = strndup((const char*)string, stringLength);
+            strings->size += RMBenchmarkMallocSize(copy);
+            strings->copies[strings->count++] = copy;
+        }
+    }
+    return 0;
+}
+
+/** Returns a receipt of auto-renewable subscriptions, where the purchases of each product form a renewal chain that shares the original transaction identifier.
+ */
+static RMTestBuffer RMBenchmarkRenewalPayload(size_t purchaseCount, size_t productCount)
+{
+    RMTestBuffer attributes = {0};
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeBundleIdentifier, V_ASN1_UTF8STRING, "net.robotmedia.test");
+    for (size_t i = 0; i < purchaseCount; i++)
+    {
+        char productIdentifier[64], transactionIdentifier[32], originalTransactionIdentifier[32];
+        snprintf(productIdentifier, sizeof(productIdentifier), "net.robotmedia.test.subscription%zu", i % productCount);
+        snprintf(transactionIdentifier, sizeof(transactionIdentifier), "%zu", 1000000000 + i);
+        snprintf(originalTransactionIdentifier, sizeof(originalTransactionIdentifier), "%zu", 1000000000 + i % productCount);
+        RMTestBuffer iap = {0};
+        RMTestAppendIntegerAttribute(&iap, RMReceiptAttributeTypeQuantity, 1);
+        RMTestAppendStringAttribute(&iap, RMReceiptAttributeTypeProductIdentifier, V_ASN1_UTF8STRING, productIdentifier);
+        RMTestAppendStringAttribute(&iap, RMReceiptAttributeTypeTransactionIdentifier, V_ASN1_UTF8STRING, transactionIdentifier);
+        RMTestAppendStringAttribute(&iap, RMReceiptAttributeTypeOriginalTransactionIdentifier, V_ASN1_UTF8STRING, originalTransactionIdentifier);
+        RMTestAppendStringAttribute(&iap, RMReceiptAttributeTypePurchaseDate, V_ASN1_IA5STRING, "2013-10-15T12:00:00Z");
+        RMTestAppendStringAttribute(&iap, RMReceiptAttributeTypeSubscriptionExpirationDate, V_ASN1_IA5STRING, "2013-11-15T12:00:00Z");
+        RMTestBuffer set = RMTestSet(&iap);
+        RMTestAppendAttribute(&attributes, RMReceiptAttributeTypeInAppPurchaseReceipt, &set);
+        RMTestBufferFree(&set);
+        RMTestBufferFree(&iap);
+    }
+    RMTestBuffer set = RMTestSet(&attributes);
+    RMTestBufferFree(&attributes);
+    return set;
+}
+
+static void RMBenchmarkStrings(void)
+{
+    const size_t purchaseCounts[] = {1000, 10000, 50000};
+    const uint32_t mask = RMReceiptPurchaseAttributeBit(RMReceiptAttributeTypeProductIdentifier) | RMReceiptPurchaseAttributeBit(RMReceiptAttributeTypeOriginalTransactionIdentifier);
+    printf("strings: purchases, renewals, copies (KB), copies (ms), pool (KB), pool (ms), distinct\n");
+    for (size_t i = 0; i < sizeof(purchaseCounts) / sizeof(purchaseCounts[0]); i++)
+    {
+        for (int renewals = 0; renewals < 2; renewals++)
+        {
+            RMTestBuffer payload = renewals ? RMBenchmarkRenewalPayload(purchaseCounts[i], 10) : RMTestReceiptPayload("net.robotmedia.test", purchaseCounts[i], 10);
+            RMBenchmarkStringCopies copies = {NULL, calloc(purchaseCounts[i] * 2, sizeof(char*)), 0, 0};
+            double copyTime = RMBenchmarkNow();
+            RMReceiptScanPurchases(payload.bytes, payload.length, mask, RMBenchmarkCopyStrings, &copies);
+            copyTime = RMBenchmarkNow() - copyTime;
+            RMBenchmarkStringCopies pooled = {RMReceiptStringPoolCreate(), NULL, 0, 0};
+            double poolTime = RMBenchmarkNow();
+            RMReceiptScanPurchases(payload.bytes, payload.length, mask, RMBenchmarkCopyStrings, &pooled);
+            poolTime = RMBenchmarkNow() - poolTime;
+            // Each copy also costs a malloc header, which malloc_usable_size doesn't count
+            const size_t copiesSize = copies.size + copies.count * sizeof(size_t);
+            printf("strings: %6zu, %-8s, %10.1f, %8.3f, %9.1f, %7.3f, %ld\n", purchaseCounts[i], renewals ? "yes" : "no", copiesSize / 1024.0, copyTime * 1000, RMReceiptStringPoolGetSize(pooled.pool) / 1024.0, poolTime * 1000, RMReceiptStringPoolGetCount(pooled.pool));
+            for (long j = 0; j < copies.count; j++) free(copies.copies[j]);
+            free(copies.copies);
+            RMReceiptStringPoolFree(pooled.pool);
+            RMTestBufferFree(&payload);
+        }
+    }
+}
+
+// MARK: - Timeline
+
+/* Many "active at T" and "next change after T" queries against the subscription history of one product: a scan of every purchase per query, as with -[RMAppReceiptIAP isActiveAutoRenewableSubscriptionForDate:], against a binary search of the merged timeline. Monthly renewals, with a lapse of a few days every year. */
+
+static void RMBenchmarkTimeline(void)
+{
+    const long purchaseCounts[] = {12, 120, 1000, 10000};
+    const double period = 30 * 86400, lapse = 5 * 86400, origin = 1381838400;
+    const long queryCount = 100000;
+    printf("timeline: purchases, intervals, build (ms), query, scan (ms), timeline (ms), speedup\n");
+    for (size_t i = 0; i < sizeof(purchaseCounts) / sizeof(purchaseCounts[0]); i++)
+    {
+        const long count = purchaseCounts[i];
+        double *starts = malloc(count * sizeof(*starts));
+        double *ends = malloc(count * sizeof(*ends));
+        for (long j = 0; j < count; j++)
+        {
+            starts[j] = origin + j * period + (j / 12) * lapse;
+            ends[j] = starts[j] + period;
+        }
+        double *times = malloc(queryCount * sizeof(*times));
+        unsigned int seed = 1701;
+        const double span = ends[count - 1] - origin + 2 * period;
+        for (long j = 0; j < queryCount; j++)
+        {
+            times[j] = origin - period + span * rand_r(&seed) / RAND_MAX;
+        }
+        double build = RMBenchmarkNow();
+        RMReceiptTimeline *timeline = RMReceiptTimelineCreate(starts, ends, count);
+        build = RMBenchmarkNow() - build;
+        printf("timeline: %6ld, %6ld, %8.3f\n", count, timeline->count, build * 1000);
+        
+        for (int query = 0; query < 2; query++)
+        {
+            double bestScan = -1, bestTimeline = -1;
+            double scanChecksum = 0, timelineChecksum = 0;
+            for (int run = 0; run < 3; run++)
+            {
+                scanChecksum = 0;
+                double started = RMBenchmarkNow();
+                for (long j = 0; j < queryCount; j++)
+                {
+                    const double time = times[j];
+                    if (query == 0)
+                    {
+                        int active = 0;
+                        for (long k = 0; k < count; k++) active |= starts[k] <= time && time <= ends[k];
+                        scanChecksum += active;
+                    }
+                    else
+                    {
+                        // The earliest start or end after the time that is not inside another purchase
+                        double next = INFINITY;
+                        for (long k = 0; k < count; k++)
+                        {
+                            if (starts[k] > time && starts[k] < next && (k == 0 || starts[k] > ends[k - 1])) next = starts[k];
+                            if (ends[k] > time && ends[k] < next && (k + 1 == count || ends[k] < starts[k + 1])) next = ends[k];
+                        }
+                        if (next != INFINITY) scanChecksum += next - time;
+                    }
+                }
+                double elapsed = RMBenchmarkNow() - started;
+                if (bestScan < 0 || elapsed < bestScan) bestScan = elapsed;
+                
+                timelineChecksum = 0;
+                started = RMBenchmarkNow();
+                for (long j = 0; j < queryCount; j++)
+                {
+                    if (query == 0)
+                    {
+                        timelineChecksum += RMReceiptTimelineIsActiveAt(timeline, times[j]);
+                    }
+                    else
+                    {
+                        double change;
+                        if (RMReceiptTimelineGetNextChangeAfter(timeline, times[j], &change)) timelineChecksum += change - times[j];
+                    }
+                }
+                elapsed = RMBenchmarkNow() - started;
+                if (bestTimeline < 0 || elapsed < bestTimeline) bestTimeline = elapsed;
+            }
+            if (scanChecksum != timelineChecksum) printf("timeline: results differ\n");
+            printf("timeline: %6ld, %6ld, %8s, %-6s, %8.3f, %8.3f, %7.1fx\n", count, timeline->count, "-", query == 0 ? "active" : "next", bestScan * 1000, bestTimeline * 1000, bestScan / bestTimeline);
+        }
+        RMReceiptTimelineFree(timeline);
+        free(times);
+        free(starts);
+        free(ends);
+    }
+}
+
+// MARK: - Parse
+
+/* The C share of -[RMAppReceipt initWithASN1Data:]: the top-level SET is enumerated once and the in-app purchases are split in contiguous chunks across threads. */
+
+typedef struct
+{
+    const uint8_t **values;
+    long *lengths;
+    size_t count;
+} RMBenchmarkRanges;
+
+typedef struct
+{
+    const RMBenchmarkRanges *ranges;
+    size_t start;
+    size_t end;
+    double checksum;
+} RMBenchmarkParseChunk;
+
+static int RMBenchmarkCollectPurchase(const uint8_t *value, long length, int type, void *context)
+{
+    RMBenchmarkRanges *ranges = context;
+    if (type == RMReceiptAttributeTypeInAppPurchaseReceipt)
+    {
+        ranges->values[ranges->count] = value;
+        ranges->lengths[ranges->count] = length;
+        ranges->count++;
+    }
+    return 0;
+}
+
+static int RMBenchmarkParsePurchaseAttribute(const uint8_t *value, long length, int type, void *context)
+{
+    RMBenchmarkParseChunk *chunk = context;
+    const uint8_t *p = value;
+    long stringLength;
+    const uint8_t *string;
+    double interval;
+    switch (type)
+    {
+        case RMReceiptAttributeTypeProductIdentifier:
+        { // Stands for the NSString that the index needs
+            string = RMReceiptASN1ReadString(&p, length, V_ASN1_UTF8STRING, &stringLength);
+            char *copy = string ? malloc(stringLength + 1) : NULL;
+            if (copy)
+            {
+                memcpy(copy, string, stringLength);
+                chunk->checksum += copy[stringLength - 1];
+                free(copy);
+            }
+            break;
+        }
+        case RMReceiptAttributeTypeQuantity:
+            chunk->checksum += RMReceiptASN1ReadInteger(&p, length);
+            break;
+        case RMReceiptAttributeTypeSubscriptionExpirationDate:
+            string = RMReceiptASN1ReadString(&p, length, V_ASN1_IA5STRING, &stringLength);
+            if (string && RMReceiptParseRFC3339Date(string, stringLength, &interval)) chunk->checksum += interval;
+            break;
+    }
+    return 0;
+}
+
+static void *RMBenchmarkParseThread(void *context)
+{
+    RMBenchmarkParseChunk *chunk = context;
+    for (size_t i = chunk->start; i < chunk->end; i++)
+    {
+        RMReceiptEnumerateAttributes(chunk->ranges->values[i], chunk->ranges->lengths[i], RMBenchmarkParsePurchaseAttribute, chunk);
+    }
+    return NULL;
+}
+
+static void RMBenchmarkParse(void)
+{
+    const size_t purchaseCounts[] = {1000, 10000, 50000};
+    const size_t threadCounts[] = {1, 2, 4, 8};
+    printf("parse: %ld cores\n", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("parse: purchases, threads, time (ms), speedup\n");
+    for (size_t i = 0; i < sizeof(purchaseCounts) / sizeof(purchaseCounts[0]); i++)
+    {
+        RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", purchaseCounts[i], 10);
+        RMBenchmarkRanges ranges = {malloc(purchaseCounts[i] * sizeof(uint8_t*)), malloc(purchaseCounts[i] * sizeof(long)), 0};
+        double serial = 0;
+        for (size_t j = 0; j < sizeof(threadCounts) / sizeof(threadCounts[0]); j++)
+        {
+            const size_t threadCount = threadCounts[j];
+            double best = -1;
+            for (int run = 0; run < 5; run++)
+            {
+                const double start = RMBenchmarkNow();
+                ranges.count = 0;
+                RMReceiptEnumerateAttributes(payload.bytes, payload.length, RMBenchmarkCollectPurchase, &ranges);
+                pthread_t threads[8];
+                RMBenchmarkParseChunk chunks[8];
+                for (size_t k = 0; k < threadCount; k++)
+                {
+                    chunks[k] = (RMBenchmarkParseChunk){&ranges, ranges.count * k / threadCount, ranges.count * (k + 1) / threadCount, 0};
+                    if (threadCount > 1) pthread_create(&threads[k], NULL, RMBenchmarkParseThread, &chunks[k]);
+                    else RMBenchmarkParseThread(&chunks[k]);
+                }
+                for (size_t k = 0; threadCount > 1 && k < threadCount; k++) pthread_join(threads[k], NULL);
+                const double elapsed = RMBenchmarkNow() - start;
+                if (best < 0 || elapsed < best) best = elapsed;
+            }
+            if (threadCount == 1) serial = best;
+            printf("parse: %6zu, %zu, %8.3f, %.2fx\n", purchaseCounts[i], threadCount, best * 1000, serial / best);
+        }
+        free(ranges.values);
+        free(ranges.lengths);
+        RMTestBufferFree(&payload);
+    }
+}
+
+// MARK: - Incremental
+
+/* Re-parse of a refreshed receipt with new purchases appended: the C share of a full parse against matching the purchases of the previous receipt and only parsing the new ones. */
+
+static void RMBenchmarkIncremental(void)
+{
+    const size_t previousCount = 10000;
+    const size_t appendedCounts[] = {1, 10, 100};
+    RMTestBuffer previousPayload = RMTestReceiptPayload("net.robotmedia.test", previousCount, 10);
+    RMBenchmarkRanges previous = {malloc(previousCount * sizeof(uint8_t*)), malloc(previousCount * sizeof(long)), 0};
+    RMReceiptEnumerateAttributes(previousPayload.bytes, previousPayload.length, RMBenchmarkCollectPurchase, &previous);
+    printf("incremental: purchases, appended, full (ms), incremental (ms), matched, speedup\n");
+    for (size_t i = 0; i < sizeof(appendedCounts) / sizeof(appendedCounts[0]); i++)
+    {
+        const size_t count = previousCount + appendedCounts[i];
+        RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", count, 10);
+        RMBenchmarkRanges ranges = {malloc(count * sizeof(uint8_t*)), malloc(count * sizeof(long)), 0};
+        long *matches = malloc(count * sizeof(long));
+        double bestFull = -1, bestIncremental = -1;
+        long matched = 0;
+        for (int run = 0; run < 5; run++)
+        {
+            double started = RMBenchmarkNow();
+            ranges.count = 0;
+            RMReceiptEnumerateAttributes(payload.bytes, payload.length, RMBenchmarkCollectPurchase, &ranges);
+            RMBenchmarkParseChunk chunk = {&ranges, 0, ranges.count, 0};
+            RMBenchmarkParseThread(&chunk);
+            double elapsed = RMBenchmarkNow() - started;
+            if (bestFull < 0 || elapsed < bestFull) bestFull = elapsed;
+            
+            started = RMBenchmarkNow();
+            ranges.count = 0;
+            RMReceiptEnumerateAttributes(payload.bytes, payload.length, RMBenchmarkCollectPurchase, &ranges);
+            matched = RMReceiptMatchEntries(previous.values, previous.lengths, previous.count, ranges.values, ranges.lengths, ranges.count, matches);
+            chunk = (RMBenchmarkParseChunk){&ranges, 0, 0, 0};
+            for (size_t j = 0; j < ranges.count; j++)
+            {
+                if (matches[j] >= 0) continue;
+                RMReceiptEnumerateAttributes(ranges.values[j], ranges.lengths[j], RMBenchmarkParsePurchaseAttribute, &chunk);
+            }
+            elapsed = RMBenchmarkNow() - started;
+            if (bestIncremental < 0 || elapsed < bestIncremental) bestIncremental = elapsed;
+        }
+        printf("incremental: %6zu, %4zu, %8.3f, %8.3f, %6ld, %.1fx\n", count, appendedCounts[i], bestFull * 1000, bestIncremental * 1000, matched, bestFull / bestIncremental);
+        free(matches);
+        free(ranges.values);
+        free(ranges.lengths);
+        RMTestBufferFree(&payload);
+    }
+    free(previous.values);
+    free(previous.lengths);
+    RMTestBufferFree(&previousPayload);
+}
+
+// MARK: - Snapshot
+
+/* Time to the first entitlement answer at cold start: verifying and parsing the receipt against mapping the receipt without verifying it and an authenticated snapshot of the parsed receipt. Both answer whether a product was purchased, the way -[RMAppReceipt containsInAppPurchaseOfProductIdentifier:] would. */
+
+typedef struct
+{
+    const uint8_t *payload;
+    RMReceiptSnapshotPurchase *purchase;
+} RMBenchmarkSnapshotRecord;
+
+static int RMBenchmarkRecordPurchaseAttribute(const uint8_t *value, long length, int type, void *context)
+{
+    RMBenchmarkSnapshotRecord *record = context;
+    if (type == RMReceiptAttributeTypeProductIdentifier)
+    {
+        record->purchase->productIdentifier = (RMReceiptSnapshotRange){(uint32_t)(value - record->payload), (uint32_t)length};
+    }
+    return 0;
+}
+
+static void RMBenchmarkSnapshotDigest(const RMReceiptFile *file, const RMTestBuffer *certificate, uint8_t digest[SHA256_DIGEST_LENGTH])
+{
+    long contentsLength;
+    const uint8_t *contents = RMReceiptFileGetContents(file, &contentsLength);
+    uint8_t message[2 * SHA256_DIGEST_LENGTH];
+    SHA256(contents, contentsLength, message);
+    SHA256(certificate->bytes, certificate->length, message + SHA256_DIGEST_LENGTH);
+    SHA256(message, sizeof(message), digest);
+}
+
+static void RMBenchmarkSnapshot(void)
+{
+    EVP_PKEY *key;
+    X509 *certificate;
+    RMTestCreateCertificate(&key, &certificate);
+    RMTestBuffer certificateData = RMTestCertificateData(certificate);
+    const uint8_t secret[32] = {1};
+    const char *path = "/tmp/RMAppReceiptCoreBenchmarks.receipt";
+    const char *snapshotPath = "/tmp/RMAppReceiptCoreBenchmarks.snapshot";
+    const char *productIdentifier = "net.robotmedia.test.product7";
+    const size_t purchaseCounts[] = {100, 1000, 10000, 50000};
+    printf("snapshot: purchases, full parse (ms), snapshot (ms), snapshot size (KB), speedup\n");
+    for (size_t i = 0; i < sizeof(purchaseCounts) / sizeof(purchaseCounts[0]); i++)
+    {
+        RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", purchaseCounts[i], 10);
+        RMTestWritePKCS7(path, &payload, key, certificate);
+
+        // The snapshot that a previous launch would have written
+        RMBenchmarkRanges ranges = {malloc(purchaseCounts[i] * sizeof(uint8_t*)), malloc(purchaseCounts[i] * sizeof(long)), 0};
+        RMReceiptEnumerateAttributes(payload.bytes, payload.length, RMBenchmarkCollectPurchase, &ranges);
+        RMReceiptSnapshotPurchase *purchases = calloc(ranges.count, sizeof(RMReceiptSnapshotPurchase));
+        for (size_t j = 0; j < ranges.count; j++)
+        {
+            purchases[j].entry = (RMReceiptSnapshotRange){(uint32_t)(ranges.values[j] - payload.bytes), (uint32_t)ranges.lengths[j]};
+            RMBenchmarkSnapshotRecord record = {payload.bytes, &purchases[j]};
+            RMReceiptEnumerateAttributes(ranges.values[j], ranges.lengths[j], RMBenchmarkRecordPurchaseAttribute, &record);
+        }
+        RMReceiptSnapshotHeader header = {0};
+        RMReceiptFile *file = RMReceiptFileOpen(path, NULL);
+        RMBenchmarkSnapshotDigest(file, &certificateData, header.digest);
+        RMReceiptFileClose(file);
+        header.purchaseCount = ranges.count;
+        header.payloadLength = payload.length;
+        RMReceiptSnapshotWrite(snapshotPath, &header, purchases, secret, sizeof(secret));
+
+        double bestFull = -1, bestSnapshot = -1;
+        int answers = 0;
+        for (int run = 0; run < 5; run++)
+        {
+            double started = RMBenchmarkNow();
+            RMReceiptVerifier *verifier = RMReceiptVerifierCreate(certificateData.bytes, certificateData.length);
+            file = RMReceiptFileOpen(path, verifier);
+            long length;
+            const uint8_t *bytes = RMReceiptFileGetPayload(file, &length);
+            ranges.count = 0;
+            RMReceiptEnumerateAttributes(bytes, length, RMBenchmarkCollectPurchase, &ranges);
+            RMBenchmarkParseChunk chunk = {&ranges, 0, ranges.count, 0};
+            RMBenchmarkParseThread(&chunk);
+            answers += RMReceiptContainsProduct(bytes, length, productIdentifier, strlen(productIdentifier));
+            RMReceiptFileClose(file);
+            RMReceiptVerifierFree(verifier);
+            double elapsed = RMBenchmarkNow() - started;
+            if (bestFull < 0 || elapsed < bestFull) bestFull = elapsed;
+
+            started = RMBenchmarkNow();
+            file = RMReceiptFileOpen(path, NULL);
+            uint8_t digest[SHA256_DIGEST_LENGTH];
+            RMBenchmarkSnapshotDigest(file, &certificateData, digest);
+            bytes = RMReceiptFileGetPayload(file, &length);
+            RMReceiptSnapshot *snapshot = RMReceiptSnapshotOpen(snapshotPath, digest, length, secret, sizeof(secret));
+            long count;
+            const RMReceiptSnapshotPurchase *records = RMReceiptSnapshotGetPurchases(snapshot, &count);
+            for (long j = 0; j < count; j++)
+            {
+                const uint8_t *p = bytes + records[j].productIdentifier.offset;
+                long stringLength;
+                const uint8_t *string = RMReceiptASN1ReadString(&p, records[j].productIdentifier.length, V_ASN1_UTF8STRING, &stringLength);
+                if (string && stringLength == (long)strlen(productIdentifier) && memcmp(string, productIdentifier, stringLength) == 0)
+                {
+                    answers++;
+                    break;
+                }
+            }
+            RMReceiptSnapshotClose(snapshot);
+            RMReceiptFileClose(file);
+            elapsed = RMBenchmarkNow() - started;
+            if (bestSnapshot < 0 || elapsed < bestSnapshot) bestSnapshot = elapsed;
+        }
+        printf("snapshot: %6zu, %8.3f, %8.3f, %7.1f, %.1fx%s\n", purchaseCounts[i], bestFull * 1000, bestSnapshot * 1000, header.length / 1024.0, bestFull / bestSnapshot, answers == 10 ? "" : " (wrong answer)");
+        free(purchases);
+        free(ranges.values);
+        free(ranges.lengths);
+        RMTestBufferFree(&payload);
+    }
+    unlink(path);
+    unlink(snapshotPath);
+    RMTestBufferFree(&certificateData);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+}
+
+// MARK: - Hash
+
+/* -[RMAppReceipt verifyReceiptHash] runs for every transaction verified with the app receipt. The old implementation concatenated the inputs in a new buffer and compared against another. */
+
+static int RMBenchmarkConcatenatedHash(const uint8_t *deviceIdentifier, const uint8_t *opaqueValue, long opaqueValueLength, const uint8_t *bundleIdentifier, long bundleIdentifierLength, const uint8_t *hash)
+{
+    const long length = 16 + opaqueValueLength + bundleIdentifierLength;
+    uint8_t *data = malloc(length);
+    uint8_t *expectedHash = malloc(SHA_DIGEST_LENGTH);
+    memcpy(data, deviceIdentifier, 16);
+    memcpy(data + 16, opaqueValue, opaqueValueLength);
+    memcpy(data + 16 + opaqueValueLength, bundleIdentifier, bundleIdentifierLength);
+    SHA1(data, length, expectedHash);
+    const int valid = memcmp(expectedHash, hash, SHA_DIGEST_LENGTH) == 0;
+    free(expectedHash);
+    free(data);
+    return valid;
+}
+
+static void RMBenchmarkHash(void)
+{
+    const uint8_t deviceIdentifier[16] = {0x3a, 0x1f, 0x7c, 0x52, 0x0e, 0x94, 0x4b, 0x6d, 0x8c, 0x21, 0x5e, 0xa7, 0x90, 0x3b, 0xd4, 0x68};
+    uint8_t opaqueValue[16];
+    for (size_t i = 0; i < sizeof(opaqueValue); i++) opaqueValue[i] = (uint8_t)(i * 37);
+    const char *identifier = "net.robotmedia.test";
+    uint8_t bundleIdentifier[64] = {V_ASN1_UTF8STRING, (uint8_t)strlen(identifier)};
+    memcpy(bundleIdentifier + 2, identifier, strlen(identifier));
+    const long bundleIdentifierLength = 2 + (long)strlen(identifier);
+    uint8_t hash[SHA_DIGEST_LENGTH];
+    uint8_t data[16 + sizeof(opaqueValue) + sizeof(bundleIdentifier)];
+    memcpy(data, deviceIdentifier, 16);
+    memcpy(data + 16, opaqueValue, sizeof(opaqueValue));
+    memcpy(data + 16 + sizeof(opaqueValue), bundleIdentifier, bundleIdentifierLength);
+    SHA1(data, 16 + sizeof(opaqueValue) + bundleIdentifierLength, hash);
+
+    const long iterations = 1000000;
+    double concatenated = -1, streamed = -1;
+    long valid = 0;
+    for (int run = 0; run < 5; run++)
+    {
+        double start = RMBenchmarkNow();
+        for (long i = 0; i < iterations; i++)
+        {
+            valid += RMBenchmarkConcatenatedHash(deviceIdentifier, opaqueValue, sizeof(opaqueValue), bundleIdentifier, bundleIdentifierLength, hash);
+        }
+        double elapsed = RMBenchmarkNow() - start;
+        if (concatenated < 0 || elapsed < concatenated) concatenated = elapsed;
+
+        start = RMBenchmarkNow();
+        for (long i = 0; i < iterations; i++)
+        {
+            valid += RMReceiptVerifyHash(deviceIdentifier, opaqueValue, sizeof(opaqueValue), bundleIdentifier, bundleIdentifierLength, hash, sizeof(hash));
+        }
+        elapsed = RMBenchmarkNow() - start;
+        if (streamed < 0 || elapsed < streamed) streamed = elapsed;
+    }
+    printf("hash: concatenated (ns), streamed (ns), speedup\n");
+    printf("hash: %8.1f, %8.1f, %.2fx%s\n", concatenated / iterations * 1e9, streamed / iterations * 1e9, concatenated / streamed, valid == 2 * 5 * iterations ? "" : " (wrong answer)");
+}
+
+// MARK: - Base64
+
+static const char _base64RequestPrefix[] = "{\"receipt-data\":\"";
+static const char _base64RequestSuffix[] = "\"}";
+
+/** What RMStoreTransactionReceiptVerifier used to do: encode into a calloc buffer, copy it into an NSString and copy that into the JSON request body.
+ */
+static size_t RMBenchmarkReferenceRequest(const uint8_t *receipt, size_t length)
+{
+    char *encoded = RMTestBase64EncodeReference(receipt, length);
+    const size_t encodedLength = strlen(encoded);
+    char *string = malloc(encodedLength);
+    memcpy(string, encoded, encodedLength);
+    free(encoded);
+    const size_t requestLength = sizeof(_base64RequestPrefix) - 1 + encodedLength + sizeof(_base64RequestSuffix) - 1;
+    char *request = malloc(requestLength);
+    memcpy(request, _base64RequestPrefix, sizeof(_base64RequestPrefix) - 1);
+    memcpy(request + sizeof(_base64RequestPrefix) - 1, string, encodedLength);
+    memcpy(request + requestLength - (sizeof(_base64RequestSuffix) - 1), _base64RequestSuffix, sizeof(_base64RequestSuffix) - 1);
+    free(string);
+    const size_t checksum = (size_t)request[requestLength / 2];
+    free(request);
+    return checksum;
+}
+
+/** What RMStoreTransactionReceiptVerifier does now: encode into the JSON request body.
+ */
+static size_t RMBenchmarkInPlaceRequest(const uint8_t *receipt, size_t length, RMStoreBase64Implementation implementation)
+{
+    const size_t requestLength = sizeof(_base64RequestPrefix) - 1 + RMStoreBase64EncodedLength(length) + sizeof(_base64RequestSuffix) - 1;
+    char *request = malloc(requestLength);
+    memcpy(request, _base64RequestPrefix, sizeof(_base64RequestPrefix) - 1);
+    RMStoreBase64EncodeWithImplementation(receipt, length, request + sizeof(_base64RequestPrefix) - 1, implementation);
+    memcpy(request + requestLength - (sizeof(_base64RequestSuffix) - 1), _base64RequestSuffix, sizeof(_base64RequestSuffix) - 1);
+    const size_t checksum = (size_t)request[requestLength / 2];
+    free(request);
+    return checksum;
+}
+
+static void RMBenchmarkBase64(void)
+{
+    const RMStoreBase64Implementation implementations[] = {RMStoreBase64ImplementationScalar, RMStoreBase64ImplementationSSSE3, RMStoreBase64ImplementationAVX2, RMStoreBase64ImplementationNEON};
+    const char *names[] = {"scalar", "ssse3", "avx2", "neon"};
+    const size_t sizes[] = {5 * 1024, 50 * 1024, 500 * 1024};
+    printf("base64: request body of a receipt, best of 5 (us); the speedup is of the fastest implementation over the reference\n");
+    printf("base64: %8s, %9s", "size", "reference");
+    for (size_t j = 0; j < sizeof(implementations) / sizeof(implementations[0]); j++)
+    {
+        if (RMStoreBase64ImplementationIsAvailable(implementations[j])) printf(", %8s", names[j]);
+    }
+    printf(", speedup\n");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        uint64_t state = sizes[i];
+        uint8_t *receipt = malloc(sizes[i]);
+        for (size_t k = 0; k < sizes[i]; k++) receipt[k] = (uint8_t)RMTestRandom(&state);
+        const long iterations = (long)(200 * 1024 * 1024 / sizes[i]);
+        size_t checksum = 0;
+
+        double reference = -1;
+        for (int run = 0; run < 5; run++)
+        {
+            const double start = RMBenchmarkNow();
+            for (long k = 0; k < iterations; k++) checksum += RMBenchmarkReferenceRequest(receipt, sizes[i]);
+            const double elapsed = RMBenchmarkNow() - start;
+            if (reference < 0 || elapsed < reference) reference = elapsed;
+        }
+        printf("base64: %7zuK, %9.1f", sizes[i] / 1024, reference / iterations * 1e6);
+
+        double fastest = reference;
+        for (size_t j = 0; j < sizeof(implementations) / sizeof(implementations[0]); j++)
+        {
+            if (!RMStoreBase64ImplementationIsAvailable(implementations[j])) continue;
+            double best = -1;
+            for (int run = 0; run < 5; run++)
+            {
+                const double start = RMBenchmarkNow();
+                for (long k = 0; k < iterations; k++) checksum += RMBenchmarkInPlaceRequest(receipt, sizes[i], implementations[j]);
+                const double elapsed = RMBenchmarkNow() - start;
+                if (best < 0 || elapsed < best) best = elapsed;
+            }
+            if (best < fastest) fastest = best;
+            printf(", %8.1f", best / iterations * 1e6);
+        }
+        printf(", %.2fx%s\n", reference / fastest, checksum ? "" : " (wrong answer)");
+        free(receipt);
+    }
+}
+
+// MARK: - Main
+
+typedef struct
+{
+    const char *name;
+    void (*function)(void);
+} RMBenchmarkCase;
+
+static const RMBenchmarkCase _cases[] = {
+    {"load", RMBenchmarkLoad},
+    {"verify", RMBenchmarkVerify},
+    {"asn1", RMBenchmarkASN1},
+    {"query", RMBenchmarkQuery},
+    {"prefilter", RMBenchmarkPrefilter},
+    {"table", RMBenchmarkTable},
+    {"strings", RMBenchmarkStrings},
+    {"timeline", RMBenchmarkTimeline},
+    {"parse", RMBenchmarkParse},
+    {"incremental", RMBenchmarkIncremental},
+    {"snapshot", RMBenchmarkSnapshot},
+    {"hash", RMBenchmarkHash},
+    {"base64", RMBenchmarkBase64},
+};
+
+int main(int argc, char *argv[])
+{
+    _executablePath = argv[0];
+    if (argc == 5 && strcmp(argv[1], "--load-child") == 0)
+    {
+        return RMBenchmarkLoadChild(argv[2], argv[3], argv[4]);
+    }
+    for (size_t i = 0; i < sizeof(_cases) / sizeof(_cases[0]); i++)
+    {
+        int selected = argc == 1;
+        for (int j = 1; j < argc; j++)
+        {
+            selected |= strcmp(argv[j], _cases[i].name) == 0;
+        }
+        if (selected)
+        {
+            _cases[i].function();
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+//
+//  RMAppReceiptGenerator.c
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+//  Generates synthetic receipts signed by a local test authority, for load tests and benchmarks. Runs offline.
+//  Trust the receipts by passing the root certificate written with --root-certificate to +[RMAppReceipt setAppleRootCertificateURL:].
+//
+
+#include "RMAppReceiptCoreTestSupport.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void RMGeneratorUsage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options] <receipt>\n"
+            "  --authority <pem>          Test authority to sign with. Created if the file doesn't exist.\n"
+            "  --root-certificate <der>   Writes the root certificate of the authority.\n"
+            "  --bundle-identifier <id>   Default: net.robotmedia.test\n"
+            "  --purchases <n>            Number of in-app purchases. Default: 100\n"
+            "  --size <n>[K|M]            Minimum payload size. Overrides --purchases.\n"
+            "  --products <n>             Number of consumable and non-consumable products. Default: 10\n"
+            "  --subscriptions <n>        Number of subscription products. Default: 2\n"
+            "  --chains <n>               Number of renewal chains. Default: 4\n"
+            "  --renewals <rate>          Fraction of purchases that renew a subscription. Default: 0.3\n"
+            "  --cancellations <rate>     Fraction of purchases that were canceled. Default: 0.01\n"
+            "  --seed <n>                 Default: 1\n"
+            "  --streamed                 Encodes the content with indefinite lengths, like some receipts do.\n",
+            name);
+}
+
+static int RMGeneratorParseSize(const char *string, size_t *size)
+{
+    char *end;
+    const unsigned long long value = strtoull(string, &end, 10);
+    unsigned long long multiplier = 1;
+    if (*end == 'K' || *end == 'k') multiplier = 1024, end++;
+    else if (*end == 'M' || *end == 'm') multiplier = 1024 * 1024, end++;
+    if (end == string || *end != '\0') return 0;
+    *size = (size_t)(value * multiplier);
+    return 1;
+}
+
+static int RMGeneratorWriteRootCertificate(const RMTestAuthority *authority, const char *path)
+{
+    RMTestBuffer data = RMTestCertificateData(authority->root);
+    FILE *fp = fopen(path, "wb");
+    int written = fp && fwrite(data.bytes, 1, data.length, fp) == data.length;
+    if (fp) written &= fclose(fp) == 0;
+    RMTestBufferFree(&data);
+    return written;
+}
+
+int main(int argc, char *argv[])
+{
+    RMTestReceiptOptions options = {.bundleIdentifier = "net.robotmedia.test", .purchaseCount = 100, .productCount = 10, .subscriptionCount = 2, .chainCount = 4, .renewalRate = 0.3, .cancellationRate = 0.01, .seed = 1};
+    const char *authorityPath = NULL, *rootCertificatePath = NULL, *path = NULL;
+    int streamed = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        int valid = 1;
+        if (strcmp(option, "--streamed") == 0)
+        {
+            streamed = 1;
+            continue;
+        }
+        else if (option[0] != '-' && !path)
+        {
+            path = option;
+            continue;
+        }
+        else if (!value) valid = 0;
+        else if (strcmp(option, "--authority") == 0) authorityPath = value;
+        else if (strcmp(option, "--root-certificate") == 0) rootCertificatePath = value;
+        else if (strcmp(option, "--bundle-identifier") == 0) options.bundleIdentifier = value;
+        else if (strcmp(option, "--purchases") == 0) options.purchaseCount = strtoul(value, NULL, 10);
+        else if (strcmp(option, "--size") == 0) valid = RMGeneratorParseSize(value, &options.minimumLength);
+        else if (strcmp(option, "--products") == 0) options.productCount = strtoul(value, NULL, 10);
+        else if (strcmp(option, "--subscriptions") == 0) options.subscriptionCount = strtoul(value, NULL, 10);
+        else if (strcmp(option, "--chains") == 0) options.chainCount = strtoul(value, NULL, 10);
+        else if (strcmp(option, "--renewals") == 0) options.renewalRate = strtod(value, NULL);
+        else if (strcmp(option, "--cancellations") == 0) options.cancellationRate = strtod(value, NULL);
+        else if (strcmp(option, "--seed") == 0) options.seed = strtoull(value, NULL, 10);
+        else valid = 0;
+        if (!valid)
+        {
+            RMGeneratorUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        i++;
+    }
+    if (!path)
+    {
+        RMGeneratorUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    RMTestAuthority authority;
+    if (authorityPath && access(authorityPath, F_OK) == 0)
+    {
+        if (!RMTestAuthorityRead(&authority, authorityPath))
+        {
+            fprintf(stderr, "%s: can't read the authority\n", authorityPath);
+            return EXIT_FAILURE;
+        }
+    }
+    else if (!RMTestAuthorityCreate(&authority) || (authorityPath && !RMTestAuthorityWrite(&authority, authorityPath)))
+    {
+        fprintf(stderr, "can't create the authority\n");
+        return EXIT_FAILURE;
+    }
+    if (rootCertificatePath && !RMGeneratorWriteRootCertificate(&authority, rootCertificatePath))
+    {
+        fprintf(stderr, "%s: can't write the root certificate\n", rootCertificatePath);
+        RMTestAuthorityFree(&authority);
+        return EXIT_FAILURE;
+    }
+
+    RMTestReceiptStatistics statistics;
+    RMTestBuffer payload = RMTestGenerateReceiptPayload(&options, &statistics);
+    const int written = RMTestAuthorityWritePKCS7(&authority, path, &payload, streamed);
+    RMTestAuthorityFree(&authority);
+    if (!written)
+    {
+        fprintf(stderr, "%s: can't write the receipt\n", path);
+        RMTestBufferFree(&payload);
+        return EXIT_FAILURE;
+    }
+    struct stat attributes;
+    const long long size = stat(path, &attributes) == 0 ? (long long)attributes.st_size : -1;
+    printf("%s: %lld bytes (payload %zu bytes), %zu purchases, %zu renewals, %zu cancellations\n",
+           path, size, payload.length, statistics.purchaseCount, statistics.renewalCount, statistics.cancellationCount);
+    RMTestBufferFree(&payload);
+    return EXIT_SUCCESS;
+}
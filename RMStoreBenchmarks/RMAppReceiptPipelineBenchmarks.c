@@ -0,0 +1,669 @@
+//
+//  RMAppReceiptPipelineBenchmarks.c
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+//  Times each stage of loading the bundle receipt over receipts of increasing size, and reports the p50 and p99 latency,
+//  the allocations and the peak heap of every stage. With --output the results are written as JSON, and with --baseline
+//  they are compared against a previous output: the run fails if the p50 of a stage regresses by more than --tolerance, or its
+//  allocations or peak heap by more than 10%. Timings are machine specific, so a missing baseline is created from the run
+//  instead of failing it.
+//
+
+#include "RMAppReceiptCore.h"
+#include "RMAppReceiptCoreTestSupport.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/opensslv.h>
+
+static double RMPipelineNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// MARK: - Allocations
+
+/* Allocations are counted by interposing malloc, which glibc allows from the executable. Elsewhere, and under sanitizers that
+   interpose malloc themselves, they are reported as unknown. The pipeline is single-threaded, so the counters are not atomic. */
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define RM_PIPELINE_COUNTS_ALLOCATIONS 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *pointer);
+
+static long _allocationCount = 0;
+static long _allocatedBytes = 0;
+static long _heapBytes = 0;
+static long _peakHeapBytes = 0;
+
+static void *RMPipelineCountAllocation(void *pointer)
+{
+    if (pointer)
+    {
+        const long size = (long)malloc_usable_size(pointer);
+        _allocationCount++;
+        _allocatedBytes += size;
+        _heapBytes += size;
+        if (_heapBytes > _peakHeapBytes) _peakHeapBytes = _heapBytes;
+    }
+    return pointer;
+}
+
+void *malloc(size_t size)
+{
+    return RMPipelineCountAllocation(__libc_malloc(size));
+}
+
+void *calloc(size_t count, size_t size)
+{
+    return RMPipelineCountAllocation(__libc_calloc(count, size));
+}
+
+void *realloc(void *pointer, size_t size)
+{
+    if (pointer) _heapBytes -= (long)malloc_usable_size(pointer);
+    void *result = __libc_realloc(pointer, size);
+    if (!result && pointer && size > 0)
+    { // The original block is still allocated
+        _heapBytes += (long)malloc_usable_size(pointer);
+        return NULL;
+    }
+    return RMPipelineCountAllocation(result);
+}
+
+int posix_memalign(void **pointer, size_t alignment, size_t size)
+{
+    *pointer = RMPipelineCountAllocation(__libc_memalign(alignment, size));
+    return *pointer || size == 0 ? 0 : ENOMEM;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return RMPipelineCountAllocation(__libc_memalign(alignment, size));
+}
+
+void free(void *pointer)
+{
+    if (pointer) _heapBytes -= (long)malloc_usable_size(pointer);
+    __libc_free(pointer);
+}
+#else
+#define RM_PIPELINE_COUNTS_ALLOCATIONS 0
+static long _allocationCount = -1;
+static long _allocatedBytes = -1;
+static long _heapBytes = 0;
+static long _peakHeapBytes = -1;
+#endif
+
+/** Returns the peak resident set size of the process in KB.
+ */
+static long RMPipelinePeakRSS(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+// MARK: - Pipeline
+
+/* The stages of +[RMAppReceipt bundleReceipt] on a cache miss, in the order they run. The C core stands for the Objective-C
+   objects: every string of a purchase is copied, like the NSStrings of RMAppReceiptIAP, and dates are parsed separately,
+   like the lazy dates of RMAppReceiptIAP. */
+
+typedef struct
+{
+    char *productIdentifier;
+    char *transactionIdentifier;
+    char *originalTransactionIdentifier;
+    long quantity;
+    double purchaseDate;
+    double originalPurchaseDate;
+    double subscriptionExpirationDate;
+    double cancellationDate;
+} RMPipelinePurchase;
+
+typedef struct
+{
+    const uint8_t *string;
+    long length;
+    double *interval;
+} RMPipelineDate;
+
+typedef struct
+{
+    const char *path;
+    RMReceiptVerifier *verifier;
+    uint8_t *contents;
+    long contentsLength;
+    PKCS7 *container;
+    int verified;
+    const uint8_t *payload;
+    long payloadLength;
+    const uint8_t *bundleIdentifier;
+    long bundleIdentifierLength;
+    const uint8_t *opaqueValue;
+    long opaqueValueLength;
+    const uint8_t *receiptHash;
+    long receiptHashLength;
+    const uint8_t **purchaseValues;
+    long *purchaseLengths;
+    size_t purchaseCount;
+    size_t purchaseCapacity;
+    RMPipelinePurchase *purchases;
+    RMPipelineDate *dates;
+    size_t dateCount;
+    size_t dateCapacity;
+    int hashValid;
+    long queryHits;
+} RMPipeline;
+
+static void RMPipelineRead(RMPipeline *pipeline)
+{
+    FILE *fp = fopen(pipeline->path, "rb");
+    struct stat attributes;
+    if (!fp) return;
+    if (fstat(fileno(fp), &attributes) == 0 && (pipeline->contents = malloc(attributes.st_size)))
+    {
+        pipeline->contentsLength = (long)fread(pipeline->contents, 1, attributes.st_size, fp);
+    }
+    fclose(fp);
+}
+
+static void RMPipelineDecode(RMPipeline *pipeline)
+{
+    const uint8_t *p = pipeline->contents;
+    pipeline->container = p ? d2i_PKCS7(NULL, &p, pipeline->contentsLength) : NULL;
+    if (pipeline->container)
+    {
+        RMReceiptGetPKCS7Payload(pipeline->container, &pipeline->payload, &pipeline->payloadLength);
+    }
+}
+
+static void RMPipelineVerify(RMPipeline *pipeline)
+{
+    pipeline->verified = pipeline->container && RMReceiptVerifierVerify(pipeline->verifier, pipeline->container);
+}
+
+static int RMPipelineEnumerateAttribute(const uint8_t *value, long length, int type, void *context)
+{
+    RMPipeline *pipeline = context;
+    switch (type)
+    {
+        case RMReceiptAttributeTypeBundleIdentifier:
+            pipeline->bundleIdentifier = value;
+            pipeline->bundleIdentifierLength = length;
+            break;
+        case RMReceiptAttributeTypeOpaqueValue:
+            pipeline->opaqueValue = value;
+            pipeline->opaqueValueLength = length;
+            break;
+        case RMReceiptAttributeTypeHash:
+            pipeline->receiptHash = value;
+            pipeline->receiptHashLength = length;
+            break;
+        case RMReceiptAttributeTypeInAppPurchaseReceipt:
+            if (pipeline->purchaseCount == pipeline->purchaseCapacity)
+            { // Grows like NSMutableArray
+                const size_t capacity = pipeline->purchaseCapacity > 0 ? pipeline->purchaseCapacity * 2 : 16;
+                const uint8_t **values = realloc(pipeline->purchaseValues, capacity * sizeof(uint8_t*));
+                if (values) pipeline->purchaseValues = values;
+                long *lengths = realloc(pipeline->purchaseLengths, capacity * sizeof(long));
+                if (lengths) pipeline->purchaseLengths = lengths;
+                if (!values || !lengths) return 1;
+                pipeline->purchaseCapacity = capacity;
+            }
+            pipeline->purchaseValues[pipeline->purchaseCount] = value;
+            pipeline->purchaseLengths[pipeline->purchaseCount] = length;
+            pipeline->purchaseCount++;
+            break;
+    }
+    return 0;
+}
+
+static void RMPipelineEnumerate(RMPipeline *pipeline)
+{
+    if (!pipeline->payload) return;
+    RMReceiptEnumerateAttributes(pipeline->payload, pipeline->payloadLength, RMPipelineEnumerateAttribute, pipeline);
+}
+
+static char *RMPipelineCopyString(const uint8_t *value, long length)
+{
+    const uint8_t *p = value;
+    long stringLength;
+    const uint8_t *string = RMReceiptASN1ReadString(&p, length, V_ASN1_UTF8STRING, &stringLength);
+    char *copy = string ? malloc(stringLength + 1) : NULL;
+    if (copy)
+    {
+        memcpy(copy, string, stringLength);
+        copy[stringLength] = '\0';
+    }
+    return copy;
+}
+
+static void RMPipelineAddDate(RMPipeline *pipeline, const uint8_t *value, long length, double *interval)
+{
+    const uint8_t *p = value;
+    long stringLength;
+    const uint8_t *string = RMReceiptASN1ReadString(&p, length, V_ASN1_IA5STRING, &stringLength);
+    if (string && pipeline->dateCount < pipeline->dateCapacity)
+    {
+        pipeline->dates[pipeline->dateCount++] = (RMPipelineDate){string, stringLength, interval};
+    }
+}
+
+typedef struct
+{
+    RMPipeline *pipeline;
+    RMPipelinePurchase *purchase;
+} RMPipelinePurchaseContext;
+
+static int RMPipelinePurchaseAttribute(const uint8_t *value, long length, int type, void *context)
+{
+    RMPipeline *pipeline = ((RMPipelinePurchaseContext*)context)->pipeline;
+    RMPipelinePurchase *purchase = ((RMPipelinePurchaseContext*)context)->purchase;
+    const uint8_t *p = value;
+    switch (type)
+    {
+        case RMReceiptAttributeTypeQuantity:
+            purchase->quantity = RMReceiptASN1ReadInteger(&p, length);
+            break;
+        case RMReceiptAttributeTypeProductIdentifier:
+            purchase->productIdentifier = RMPipelineCopyString(value, length);
+            break;
+        case RMReceiptAttributeTypeTransactionIdentifier:
+            purchase->transactionIdentifier = RMPipelineCopyString(value, length);
+            break;
+        case RMReceiptAttributeTypeOriginalTransactionIdentifier:
+            purchase->originalTransactionIdentifier = RMPipelineCopyString(value, length);
+            break;
+        case RMReceiptAttributeTypePurchaseDate:
+            RMPipelineAddDate(pipeline, value, length, &purchase->purchaseDate);
+            break;
+        case RMReceiptAttributeTypeOriginalPurchaseDate:
+            RMPipelineAddDate(pipeline, value, length, &purchase->originalPurchaseDate);
+            break;
+        case RMReceiptAttributeTypeSubscriptionExpirationDate:
+            RMPipelineAddDate(pipeline, value, length, &purchase->subscriptionExpirationDate);
+            break;
+        case RMReceiptAttributeTypeCancellationDate:
+            RMPipelineAddDate(pipeline, value, length, &purchase->cancellationDate);
+            break;
+    }
+    return 0;
+}
+
+static void RMPipelineCreatePurchases(RMPipeline *pipeline)
+{
+    pipeline->purchases = calloc(pipeline->purchaseCount > 0 ? pipeline->purchaseCount : 1, sizeof(RMPipelinePurchase));
+    pipeline->dates = malloc((pipeline->purchaseCount > 0 ? pipeline->purchaseCount : 1) * 4 * sizeof(RMPipelineDate)); // A purchase has at most 4 dates
+    if (!pipeline->purchases || !pipeline->dates) return;
+    pipeline->dateCapacity = pipeline->purchaseCount * 4;
+    for (size_t i = 0; i < pipeline->purchaseCount; i++)
+    {
+        RMPipelinePurchase *purchase = &pipeline->purchases[i];
+        purchase->purchaseDate = purchase->originalPurchaseDate = purchase->subscriptionExpirationDate = purchase->cancellationDate = NAN;
+        RMPipelinePurchaseContext context = {pipeline, purchase};
+        RMReceiptEnumerateAttributes(pipeline->purchaseValues[i], pipeline->purchaseLengths[i], RMPipelinePurchaseAttribute, &context);
+    }
+}
+
+static void RMPipelineParseDates(RMPipeline *pipeline)
+{
+    for (size_t i = 0; i < pipeline->dateCount; i++)
+    {
+        const RMPipelineDate *date = &pipeline->dates[i];
+        if (!RMReceiptParseRFC3339Date(date->string, date->length, date->interval)) *date->interval = NAN;
+    }
+}
+
+static void RMPipelineVerifyHash(RMPipeline *pipeline)
+{ // -[RMAppReceipt verifyReceiptHash] with the cached device identifier
+    static const uint8_t uuid[16] = {0x3a, 0x1f, 0x7c, 0x52, 0x0e, 0x94, 0x4b, 0x6d, 0x8c, 0x21, 0x5e, 0xa7, 0x90, 0x3b, 0xd4, 0x68};
+    pipeline->hashValid = RMReceiptVerifyHash(uuid, pipeline->opaqueValue, pipeline->opaqueValueLength, pipeline->bundleIdentifier, pipeline->bundleIdentifierLength, pipeline->receiptHash, pipeline->receiptHashLength);
+}
+
+static void RMPipelineQuery(RMPipeline *pipeline)
+{ // What an app asks at launch: whether it owns a few products, and until when a subscription is active
+    static const char *productIdentifiers[] = {"net.robotmedia.test.product0", "net.robotmedia.test.product9", "net.robotmedia.test.subscription1", "net.robotmedia.test.missing"};
+    if (!pipeline->payload) return;
+    for (size_t i = 0; i < sizeof(productIdentifiers) / sizeof(productIdentifiers[0]); i++)
+    {
+        pipeline->queryHits += RMReceiptContainsProduct(pipeline->payload, pipeline->payloadLength, productIdentifiers[i], strlen(productIdentifiers[i]));
+    }
+    double latestExpiration = -INFINITY;
+    for (size_t i = 0; pipeline->purchases && i < pipeline->purchaseCount; i++)
+    {
+        const RMPipelinePurchase *purchase = &pipeline->purchases[i];
+        if (purchase->productIdentifier && strcmp(purchase->productIdentifier, "net.robotmedia.test.subscription0") == 0 && isnan(purchase->cancellationDate) && purchase->subscriptionExpirationDate > latestExpiration)
+        {
+            latestExpiration = purchase->subscriptionExpirationDate;
+        }
+    }
+    pipeline->queryHits += latestExpiration > 0;
+}
+
+static void RMPipelineReset(RMPipeline *pipeline)
+{
+    for (size_t i = 0; pipeline->purchases && i < pipeline->purchaseCount; i++)
+    {
+        free(pipeline->purchases[i].productIdentifier);
+        free(pipeline->purchases[i].transactionIdentifier);
+        free(pipeline->purchases[i].originalTransactionIdentifier);
+    }
+    free(pipeline->purchases);
+    free(pipeline->dates);
+    free(pipeline->purchaseValues);
+    free(pipeline->purchaseLengths);
+    PKCS7_free(pipeline->container);
+    free(pipeline->contents);
+    *pipeline = (RMPipeline){.path = pipeline->path, .verifier = pipeline->verifier};
+}
+
+typedef struct
+{
+    const char *name;
+    void (*function)(RMPipeline *pipeline);
+} RMPipelineStage;
+
+static const RMPipelineStage _stages[] = {
+    {"read", RMPipelineRead},
+    {"decode", RMPipelineDecode},
+    {"verify", RMPipelineVerify},
+    {"enumerate", RMPipelineEnumerate},
+    {"purchases", RMPipelineCreatePurchases},
+    {"dates", RMPipelineParseDates},
+    {"hash", RMPipelineVerifyHash},
+    {"queries", RMPipelineQuery},
+};
+
+#define RMPipelineStageCount (sizeof(_stages) / sizeof(_stages[0]))
+
+// MARK: - Results
+
+typedef struct
+{
+    size_t size;
+    char stage[32];
+    long iterations;
+    double p50;
+    double p99;
+    long allocations;
+    long allocatedBytes;
+    long peakBytes;
+} RMPipelineResult;
+
+static int RMPipelineCompareDoubles(const void *a, const void *b)
+{
+    const double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/** Returns the given percentile of sorted samples with the nearest-rank method.
+ */
+static double RMPipelinePercentile(const double *samples, long count, double percentile)
+{
+    long rank = (long)ceil(percentile * count);
+    if (rank < 1) rank = 1;
+    return samples[rank - 1];
+}
+
+/** Runs the pipeline on the receipt at path and writes one result per stage.
+ @return 1 if every run verified the receipt, 0 otherwise.
+ */
+static int RMPipelineRun(const char *path, RMReceiptVerifier *verifier, size_t size, long iterations, RMPipelineResult *results, size_t *purchaseCount)
+{
+    double *samples = malloc(RMPipelineStageCount * iterations * sizeof(double));
+    if (!samples) return 0;
+    RMPipeline pipeline = {.path = path, .verifier = verifier};
+    int valid = 1;
+    for (long run = -1; run < iterations; run++) // The first run warms up the page cache
+    {
+        for (size_t i = 0; i < RMPipelineStageCount; i++)
+        {
+            const long allocationCount = _allocationCount, allocatedBytes = _allocatedBytes;
+            const long heapBytes = _heapBytes;
+            _peakHeapBytes = RM_PIPELINE_COUNTS_ALLOCATIONS ? heapBytes : -1;
+            const double start = RMPipelineNow();
+            _stages[i].function(&pipeline);
+            const double elapsed = RMPipelineNow() - start;
+            if (run < 0) continue;
+            samples[i * iterations + run] = elapsed * 1000;
+            // Allocations are deterministic, so the last run stands for all of them
+            results[i].allocations = RM_PIPELINE_COUNTS_ALLOCATIONS ? _allocationCount - allocationCount : -1;
+            results[i].allocatedBytes = RM_PIPELINE_COUNTS_ALLOCATIONS ? _allocatedBytes - allocatedBytes : -1;
+            results[i].peakBytes = RM_PIPELINE_COUNTS_ALLOCATIONS ? _peakHeapBytes - heapBytes : -1;
+        }
+        valid &= pipeline.verified && pipeline.purchases != NULL;
+        *purchaseCount = pipeline.purchaseCount;
+        RMPipelineReset(&pipeline);
+    }
+    for (size_t i = 0; i < RMPipelineStageCount; i++)
+    {
+        double *stageSamples = samples + i * iterations;
+        qsort(stageSamples, iterations, sizeof(double), RMPipelineCompareDoubles);
+        results[i].size = size;
+        snprintf(results[i].stage, sizeof(results[i].stage), "%s", _stages[i].name);
+        results[i].iterations = iterations;
+        results[i].p50 = RMPipelinePercentile(stageSamples, iterations, 0.50);
+        results[i].p99 = RMPipelinePercentile(stageSamples, iterations, 0.99);
+    }
+    free(samples);
+    return valid;
+}
+
+/* The output has one result per line, so that baselines can be read back without a JSON parser. */
+
+static int RMPipelineWriteResults(const char *path, const RMPipelineResult *results, size_t count, long peakRSS)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) return 0;
+    fprintf(fp, "{\n  \"version\": 1,\n  \"openssl\": \"%s\",\n  \"peak_rss_kb\": %ld,\n  \"results\": [\n", OPENSSL_VERSION_TEXT, peakRSS);
+    for (size_t i = 0; i < count; i++)
+    {
+        const RMPipelineResult *result = &results[i];
+        fprintf(fp, "    {\"size\": %zu, \"stage\": \"%s\", \"iterations\": %ld, \"p50_ms\": %.4f, \"p99_ms\": %.4f, \"allocations\": %ld, \"allocated_bytes\": %ld, \"peak_bytes\": %ld}%s\n",
+                result->size, result->stage, result->iterations, result->p50, result->p99, result->allocations, result->allocatedBytes, result->peakBytes, i + 1 < count ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    return fclose(fp) == 0;
+}
+
+/** Reads the results written by RMPipelineWriteResults.
+ @return The number of results read, or -1 if the file can't be read.
+ */
+static long RMPipelineReadResults(const char *path, RMPipelineResult *results, size_t capacity)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    char line[512];
+    size_t count = 0;
+    while (count < capacity && fgets(line, sizeof(line), fp))
+    {
+        RMPipelineResult *result = &results[count];
+        if (sscanf(line, " {\"size\": %zu, \"stage\": \"%31[^\"]\", \"iterations\": %ld, \"p50_ms\": %lf, \"p99_ms\": %lf, \"allocations\": %ld, \"allocated_bytes\": %ld, \"peak_bytes\": %ld}",
+                   &result->size, result->stage, &result->iterations, &result->p50, &result->p99, &result->allocations, &result->allocatedBytes, &result->peakBytes) == 8)
+        {
+            count++;
+        }
+    }
+    fclose(fp);
+    return (long)count;
+}
+
+/** Returns whether value exceeds baseline by more than the tolerance, ignoring differences under the noise floor. Unknown values never regress.
+ */
+static int RMPipelineRegressed(double value, double baseline, double tolerance, double floor)
+{
+    if (value < 0 || baseline < 0) return 0;
+    return value > baseline * (1 + tolerance) && value - baseline > floor;
+}
+
+/** Compares the results against a baseline and prints every regression.
+ @return The number of regressions.
+ */
+static int RMPipelineCompareResults(const RMPipelineResult *results, size_t count, const RMPipelineResult *baseline, size_t baselineCount, double tolerance)
+{
+    int regressions = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const RMPipelineResult *result = &results[i];
+        const RMPipelineResult *expected = NULL;
+        for (size_t j = 0; j < baselineCount && !expected; j++)
+        {
+            if (baseline[j].size == result->size && strcmp(baseline[j].stage, result->stage) == 0) expected = &baseline[j];
+        }
+        if (!expected)
+        {
+            printf("pipeline: %zu %s is not in the baseline\n", result->size, result->stage);
+            continue;
+        }
+        // p99 is too noisy to gate on with few iterations; it is reported only
+        if (RMPipelineRegressed(result->p50, expected->p50, tolerance, 0.02))
+        {
+            printf("pipeline: REGRESSION %zu %s: p50 %.4f ms, baseline %.4f ms\n", result->size, result->stage, result->p50, expected->p50);
+            regressions++;
+        }
+        // Allocations only vary with the code and the OpenSSL version, so they get a tighter tolerance than time
+        if (RMPipelineRegressed(result->allocations, expected->allocations, 0.1, 8))
+        {
+            printf("pipeline: REGRESSION %zu %s: %ld allocations, baseline %ld\n", result->size, result->stage, result->allocations, expected->allocations);
+            regressions++;
+        }
+        if (RMPipelineRegressed(result->peakBytes, expected->peakBytes, 0.1, 64 * 1024))
+        {
+            printf("pipeline: REGRESSION %zu %s: peak %ld bytes, baseline %ld\n", result->size, result->stage, result->peakBytes, expected->peakBytes);
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+// MARK: - Main
+
+typedef struct
+{
+    size_t size; // Minimum payload size
+    long iterations;
+} RMPipelineReceipt;
+
+static const RMPipelineReceipt _receipts[] = {
+    {1024, 500},
+    {64 * 1024, 200},
+    {1024 * 1024, 50},
+    {16 * 1024 * 1024, 10},
+};
+
+#define RMPipelineReceiptCount (sizeof(_receipts) / sizeof(_receipts[0]))
+
+int main(int argc, char *argv[])
+{
+    const char *outputPath = NULL, *baselinePath = NULL;
+    double tolerance = 0.5;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "--output") == 0) outputPath = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--baseline") == 0) baselinePath = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--tolerance") == 0) tolerance = strtod(argv[++i], NULL);
+        else
+        {
+            fprintf(stderr, "usage: %s [--output <json>] [--baseline <json>] [--tolerance <fraction, default 0.5>]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+#ifdef __GLIBC__
+    // glibc raises the mmap threshold as large blocks are freed, which makes the large stages depend on the history of the heap. Pinning it makes every run map its large buffers afresh, as on a cold start.
+    mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+#endif
+    RMTestAuthority authority;
+    if (!RMTestAuthorityCreate(&authority))
+    {
+        fprintf(stderr, "can't create the test authority\n");
+        return EXIT_FAILURE;
+    }
+    RMTestBuffer rootData = RMTestCertificateData(authority.root);
+    RMReceiptVerifier *verifier = RMReceiptVerifierCreate(rootData.bytes, rootData.length);
+    const char *path = "/tmp/RMAppReceiptPipelineBenchmarks.receipt";
+    RMPipelineResult results[RMPipelineReceiptCount * RMPipelineStageCount];
+    int valid = 1;
+    printf("pipeline: size, purchases, stage, p50 (ms), p99 (ms), allocations, peak heap (KB)\n");
+    for (size_t i = 0; i < RMPipelineReceiptCount; i++)
+    {
+        const RMTestReceiptOptions options = {.minimumLength = _receipts[i].size, .productCount = 10, .subscriptionCount = 2, .chainCount = 4, .renewalRate = 0.3, .cancellationRate = 0.01, .seed = 1};
+        RMTestBuffer payload = RMTestGenerateReceiptPayload(&options, NULL);
+        valid &= RMTestAuthorityWritePKCS7(&authority, path, &payload, 0);
+        RMTestBufferFree(&payload);
+        RMPipelineResult *receiptResults = results + i * RMPipelineStageCount;
+        size_t purchaseCount = 0;
+        valid &= RMPipelineRun(path, verifier, _receipts[i].size, _receipts[i].iterations, receiptResults, &purchaseCount);
+        for (size_t j = 0; j < RMPipelineStageCount; j++)
+        {
+            const RMPipelineResult *result = &receiptResults[j];
+            printf("pipeline: %8zu, %6zu, %-9s, %8.4f, %8.4f, %7ld, %8.1f\n", result->size, purchaseCount, result->stage, result->p50, result->p99, result->allocations, result->peakBytes < 0 ? -1.0 : result->peakBytes / 1024.0);
+        }
+    }
+    unlink(path);
+    RMReceiptVerifierFree(verifier);
+    RMTestBufferFree(&rootData);
+    RMTestAuthorityFree(&authority);
+    const size_t count = sizeof(results) / sizeof(results[0]);
+    const long peakRSS = RMPipelinePeakRSS();
+    printf("pipeline: peak RSS %ld KB\n", peakRSS);
+    if (!valid)
+    {
+        fprintf(stderr, "pipeline: the receipts failed to load\n");
+        return EXIT_FAILURE;
+    }
+    if (outputPath && !RMPipelineWriteResults(outputPath, results, count, peakRSS))
+    {
+        fprintf(stderr, "%s: can't write the results\n", outputPath);
+        return EXIT_FAILURE;
+    }
+    if (baselinePath)
+    {
+        RMPipelineResult baseline[RMPipelineReceiptCount * RMPipelineStageCount];
+        const long baselineCount = RMPipelineReadResults(baselinePath, baseline, sizeof(baseline) / sizeof(baseline[0]));
+        if (baselineCount < 0 && errno == ENOENT)
+        {
+            if (!RMPipelineWriteResults(baselinePath, results, count, peakRSS))
+            {
+                fprintf(stderr, "%s: can't write the baseline\n", baselinePath);
+                return EXIT_FAILURE;
+            }
+            printf("pipeline: created the baseline %s\n", baselinePath);
+            return EXIT_SUCCESS;
+        }
+        if (baselineCount < 0)
+        {
+            fprintf(stderr, "%s: can't read the baseline\n", baselinePath);
+            return EXIT_FAILURE;
+        }
+        const int regressions = RMPipelineCompareResults(results, count, baseline, (size_t)baselineCount, tolerance);
+        printf("pipeline: %d regression(s) against %s (tolerance %.0f%%)\n", regressions, baselinePath, tolerance * 100);
+        if (regressions > 0) return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
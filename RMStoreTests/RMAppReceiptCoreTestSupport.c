@@ -0,0 +1,540 @@
+//
+//  RMAppReceiptCoreTestSupport.c
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+
+#include "RMAppReceiptCoreTestSupport.h"
+#include "RMAppReceiptCore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/pem.h>
+#include <openssl/pkcs7.h>
+#include <openssl/rsa.h>
+#include <openssl/x509v3.h>
+
+void RMTestBufferAppend(RMTestBuffer *buffer, const void *bytes, size_t length)
+{
+    if (buffer->length + length > buffer->capacity)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity : 64;
+        while (capacity < buffer->length + length) capacity *= 2;
+        buffer->bytes = realloc(buffer->bytes, capacity);
+        buffer->capacity = capacity;
+    }
+    if (length > 0)
+    {
+        memcpy(buffer->bytes + buffer->length, bytes, length);
+    }
+    buffer->length += length;
+}
+
+void RMTestBufferFree(RMTestBuffer *buffer)
+{
+    free(buffer->bytes);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+void RMTestAppendTLV(RMTestBuffer *buffer, uint8_t tag, const void *content, size_t length)
+{
+    RMTestBufferAppend(buffer, &tag, 1);
+    if (length < 0x80)
+    {
+        const uint8_t byte = (uint8_t)length;
+        RMTestBufferAppend(buffer, &byte, 1);
+    }
+    else
+    {
+        uint8_t bytes[sizeof(size_t) + 1];
+        uint8_t count = 0;
+        for (size_t l = length; l > 0; l >>= 8) count++;
+        bytes[0] = 0x80 | count;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            bytes[1 + i] = (length >> (8 * (count - 1 - i))) & 0xFF;
+        }
+        RMTestBufferAppend(buffer, bytes, 1 + count);
+    }
+    RMTestBufferAppend(buffer, content, length);
+}
+
+void RMTestAppendInteger(RMTestBuffer *buffer, long value)
+{
+    uint8_t bytes[sizeof(long) + 1];
+    size_t count = 0;
+    do
+    {
+        bytes[sizeof(bytes) - 1 - count] = value & 0xFF;
+        value >>= 8;
+        count++;
+    } while (value > 0);
+    if (bytes[sizeof(bytes) - count] & 0x80)
+    { // Keep the value positive
+        bytes[sizeof(bytes) - 1 - count] = 0;
+        count++;
+    }
+    RMTestAppendTLV(buffer, V_ASN1_INTEGER, bytes + sizeof(bytes) - count, count);
+}
+
+void RMTestAppendAttribute(RMTestBuffer *buffer, int type, const RMTestBuffer *value)
+{
+    RMTestBuffer sequence = {0};
+    RMTestAppendInteger(&sequence, type);
+    RMTestAppendInteger(&sequence, 1);
+    RMTestAppendTLV(&sequence, V_ASN1_OCTET_STRING, value->bytes, value->length);
+    RMTestAppendTLV(buffer, V_ASN1_SEQUENCE | V_ASN1_CONSTRUCTED, sequence.bytes, sequence.length);
+    RMTestBufferFree(&sequence);
+}
+
+void RMTestAppendStringAttribute(RMTestBuffer *buffer, int type, uint8_t tag, const char *string)
+{
+    RMTestBuffer value = {0};
+    RMTestAppendTLV(&value, tag, string, strlen(string));
+    RMTestAppendAttribute(buffer, type, &value);
+    RMTestBufferFree(&value);
+}
+
+void RMTestAppendIntegerAttribute(RMTestBuffer *buffer, int type, long integer)
+{
+    RMTestBuffer value = {0};
+    RMTestAppendInteger(&value, integer);
+    RMTestAppendAttribute(buffer, type, &value);
+    RMTestBufferFree(&value);
+}
+
+RMTestBuffer RMTestSet(const RMTestBuffer *attributes)
+{
+    RMTestBuffer set = {0};
+    RMTestAppendTLV(&set, V_ASN1_SET | V_ASN1_CONSTRUCTED, attributes->bytes, attributes->length);
+    return set;
+}
+
+RMTestBuffer RMTestIAP(const char *productIdentifier, const char *transactionIdentifier, const char *purchaseDate, const char *expirationDate)
+{
+    RMTestBuffer attributes = {0};
+    RMTestAppendIntegerAttribute(&attributes, RMReceiptAttributeTypeQuantity, 1);
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeProductIdentifier, V_ASN1_UTF8STRING, productIdentifier);
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeTransactionIdentifier, V_ASN1_UTF8STRING, transactionIdentifier);
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeOriginalTransactionIdentifier, V_ASN1_UTF8STRING, transactionIdentifier);
+    if (purchaseDate)
+    {
+        RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypePurchaseDate, V_ASN1_IA5STRING, purchaseDate);
+        RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeOriginalPurchaseDate, V_ASN1_IA5STRING, purchaseDate);
+    }
+    if (expirationDate)
+    {
+        RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeSubscriptionExpirationDate, V_ASN1_IA5STRING, expirationDate);
+    }
+    RMTestBuffer set = RMTestSet(&attributes);
+    RMTestBufferFree(&attributes);
+    return set;
+}
+
+RMTestBuffer RMTestReceiptPayload(const char *bundleIdentifier, size_t purchaseCount, size_t productCount)
+{
+    RMTestBuffer attributes = {0};
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeBundleIdentifier, V_ASN1_UTF8STRING, bundleIdentifier);
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeAppVersion, V_ASN1_UTF8STRING, "1.0");
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeOriginalAppVersion, V_ASN1_UTF8STRING, "1.0");
+    for (size_t i = 0; i < purchaseCount; i++)
+    {
+        char productIdentifier[64], transactionIdentifier[32];
+        snprintf(productIdentifier, sizeof(productIdentifier), "net.robotmedia.test.product%zu", i % productCount);
+        snprintf(transactionIdentifier, sizeof(transactionIdentifier), "%zu", 1000000000 + i);
+        RMTestBuffer iap = RMTestIAP(productIdentifier, transactionIdentifier, "2013-10-15T12:00:00Z", "2013-11-15T12:00:00Z");
+        RMTestAppendAttribute(&attributes, RMReceiptAttributeTypeInAppPurchaseReceipt, &iap);
+        RMTestBufferFree(&iap);
+    }
+    RMTestBuffer set = RMTestSet(&attributes);
+    RMTestBufferFree(&attributes);
+    return set;
+}
+
+static EVP_PKEY *RMTestCreateKey(void)
+{
+    EVP_PKEY *key = NULL;
+    EVP_PKEY_CTX *context = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    if (!context) return NULL;
+    const int generated = EVP_PKEY_keygen_init(context) > 0 &&
+        EVP_PKEY_CTX_set_rsa_keygen_bits(context, 2048) > 0 &&
+        EVP_PKEY_keygen(context, &key) > 0;
+    EVP_PKEY_CTX_free(context);
+    if (!generated)
+    {
+        EVP_PKEY_free(key);
+        return NULL;
+    }
+    return key;
+}
+
+int RMTestCreateCertificate(EVP_PKEY **key, X509 **certificate)
+{
+    *certificate = NULL;
+    *key = RMTestCreateKey();
+    if (!*key) return 0;
+
+    X509 *x509 = X509_new();
+    X509_set_version(x509, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_get_notBefore(x509), -60);
+    X509_gmtime_adj(X509_get_notAfter(x509), 60L * 60 * 24 * 365);
+    X509_set_pubkey(x509, *key);
+    X509_NAME *name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"RMStore Test Root", -1, -1, 0);
+    X509_set_issuer_name(x509, name);
+    if (!X509_sign(x509, *key, EVP_sha256()))
+    {
+        X509_free(x509);
+        return 0;
+    }
+    *certificate = x509;
+    return 1;
+}
+
+static int RMTestSignPKCS7(const char *path, const RMTestBuffer *payload, EVP_PKEY *key, X509 *certificate, STACK_OF(X509) *certificates, int streamed)
+{
+    const int flags = streamed ? PKCS7_BINARY | PKCS7_STREAM : PKCS7_BINARY;
+    BIO *content = BIO_new_mem_buf(payload->bytes, (int)payload->length);
+    PKCS7 *p7 = PKCS7_sign(certificate, key, certificates, content, flags);
+    int written = 0;
+    if (p7 && streamed)
+    {
+        BIO *out = BIO_new_file(path, "wb");
+        written = out && i2d_PKCS7_bio_stream(out, p7, content, flags);
+        BIO_free(out);
+    }
+    else if (p7)
+    {
+        FILE *fp = fopen(path, "wb");
+        written = fp && i2d_PKCS7_fp(fp, p7);
+        if (fp) fclose(fp);
+    }
+    BIO_free(content);
+    PKCS7_free(p7);
+    return written;
+}
+
+int RMTestWritePKCS7(const char *path, const RMTestBuffer *payload, EVP_PKEY *key, X509 *certificate)
+{
+    return RMTestSignPKCS7(path, payload, key, certificate, NULL, 0);
+}
+
+int RMTestWriteStreamedPKCS7(const char *path, const RMTestBuffer *payload, EVP_PKEY *key, X509 *certificate)
+{
+    return RMTestSignPKCS7(path, payload, key, certificate, NULL, 1);
+}
+
+RMTestBuffer RMTestCertificateData(X509 *certificate)
+{
+    RMTestBuffer buffer = {0};
+    unsigned char *bytes = NULL;
+    const int length = i2d_X509(certificate, &bytes);
+    if (length > 0)
+    {
+        RMTestBufferAppend(&buffer, bytes, length);
+        OPENSSL_free(bytes);
+    }
+    return buffer;
+}
+
+// MARK: - Authority
+
+static int RMTestAddExtension(X509 *certificate, X509 *issuer, int nid, const char *value)
+{
+    X509V3_CTX context;
+    X509V3_set_ctx(&context, issuer, certificate, NULL, NULL, 0);
+    X509_EXTENSION *extension = X509V3_EXT_nconf_nid(NULL, &context, nid, (char *)value);
+    const int added = extension && X509_add_ext(certificate, extension, -1);
+    X509_EXTENSION_free(extension);
+    return added;
+}
+
+/** Issues a certificate for key. The certificate is self-signed if there is no issuer.
+ */
+static X509 *RMTestIssueCertificate(EVP_PKEY *key, const char *commonName, long serial, int authority, X509 *issuer, EVP_PKEY *issuerKey)
+{
+    X509 *certificate = X509_new();
+    if (!certificate) return NULL;
+    X509_set_version(certificate, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), serial);
+    X509_gmtime_adj(X509_get_notBefore(certificate), -60);
+    X509_gmtime_adj(X509_get_notAfter(certificate), 60L * 60 * 24 * 365 * 10);
+    X509_set_pubkey(certificate, key);
+    X509_NAME *name = X509_get_subject_name(certificate);
+    X509_NAME_add_entry_by_txt(name, "O", MBSTRING_ASC, (const unsigned char *)"RMStore Test Authority", -1, -1, 0);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)commonName, -1, -1, 0);
+    X509_set_issuer_name(certificate, issuer ? X509_get_subject_name(issuer) : name);
+    X509 *signer = issuer ? issuer : certificate;
+    int valid = authority ?
+        RMTestAddExtension(certificate, signer, NID_basic_constraints, "critical,CA:TRUE") &&
+        RMTestAddExtension(certificate, signer, NID_key_usage, "critical,keyCertSign,cRLSign") :
+        RMTestAddExtension(certificate, signer, NID_basic_constraints, "critical,CA:FALSE") &&
+        RMTestAddExtension(certificate, signer, NID_key_usage, "critical,digitalSignature");
+    valid = valid && X509_sign(certificate, issuer ? issuerKey : key, EVP_sha256());
+    if (!valid)
+    {
+        X509_free(certificate);
+        return NULL;
+    }
+    return certificate;
+}
+
+int RMTestAuthorityCreate(RMTestAuthority *authority)
+{
+    memset(authority, 0, sizeof(*authority));
+    authority->rootKey = RMTestCreateKey();
+    authority->intermediateKey = RMTestCreateKey();
+    authority->signerKey = RMTestCreateKey();
+    if (authority->rootKey && authority->intermediateKey && authority->signerKey)
+    {
+        authority->root = RMTestIssueCertificate(authority->rootKey, "RMStore Test Root CA", 1, 1, NULL, NULL);
+    }
+    if (authority->root)
+    {
+        authority->intermediate = RMTestIssueCertificate(authority->intermediateKey, "RMStore Test Intermediate CA", 2, 1, authority->root, authority->rootKey);
+    }
+    if (authority->intermediate)
+    {
+        authority->signer = RMTestIssueCertificate(authority->signerKey, "RMStore Test Receipt Signing", 3, 0, authority->intermediate, authority->intermediateKey);
+    }
+    if (!authority->signer)
+    {
+        RMTestAuthorityFree(authority);
+        return 0;
+    }
+    return 1;
+}
+
+int RMTestAuthorityWrite(const RMTestAuthority *authority, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) return 0;
+    const int written = PEM_write_PrivateKey(fp, authority->rootKey, NULL, NULL, 0, NULL, NULL) &&
+        PEM_write_X509(fp, authority->root) &&
+        PEM_write_PrivateKey(fp, authority->intermediateKey, NULL, NULL, 0, NULL, NULL) &&
+        PEM_write_X509(fp, authority->intermediate) &&
+        PEM_write_PrivateKey(fp, authority->signerKey, NULL, NULL, 0, NULL, NULL) &&
+        PEM_write_X509(fp, authority->signer);
+    return fclose(fp) == 0 && written;
+}
+
+int RMTestAuthorityRead(RMTestAuthority *authority, const char *path)
+{
+    memset(authority, 0, sizeof(*authority));
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+    // In the order written by RMTestAuthorityWrite
+    authority->rootKey = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+    authority->root = authority->rootKey ? PEM_read_X509(fp, NULL, NULL, NULL) : NULL;
+    authority->intermediateKey = authority->root ? PEM_read_PrivateKey(fp, NULL, NULL, NULL) : NULL;
+    authority->intermediate = authority->intermediateKey ? PEM_read_X509(fp, NULL, NULL, NULL) : NULL;
+    authority->signerKey = authority->intermediate ? PEM_read_PrivateKey(fp, NULL, NULL, NULL) : NULL;
+    authority->signer = authority->signerKey ? PEM_read_X509(fp, NULL, NULL, NULL) : NULL;
+    fclose(fp);
+    if (!authority->signer)
+    {
+        RMTestAuthorityFree(authority);
+        return 0;
+    }
+    return 1;
+}
+
+void RMTestAuthorityFree(RMTestAuthority *authority)
+{
+    X509_free(authority->signer);
+    EVP_PKEY_free(authority->signerKey);
+    X509_free(authority->intermediate);
+    EVP_PKEY_free(authority->intermediateKey);
+    X509_free(authority->root);
+    EVP_PKEY_free(authority->rootKey);
+    memset(authority, 0, sizeof(*authority));
+}
+
+int RMTestAuthorityWritePKCS7(const RMTestAuthority *authority, const char *path, const RMTestBuffer *payload, int streamed)
+{
+    STACK_OF(X509) *certificates = sk_X509_new_null();
+    if (!certificates || !sk_X509_push(certificates, authority->intermediate))
+    {
+        sk_X509_free(certificates);
+        return 0;
+    }
+    const int written = RMTestSignPKCS7(path, payload, authority->signerKey, authority->signer, certificates, streamed);
+    sk_X509_free(certificates); // The certificates belong to the authority
+    return written;
+}
+
+// MARK: - Generator
+
+uint64_t RMTestRandom(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double RMTestRandomDouble(uint64_t *state)
+{
+    return (RMTestRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void RMTestAppendRandomAttribute(RMTestBuffer *buffer, int type, size_t length, uint64_t *state)
+{
+    RMTestBuffer value = {0};
+    for (size_t i = 0; i < length; i++)
+    {
+        const uint8_t byte = (uint8_t)RMTestRandom(state);
+        RMTestBufferAppend(&value, &byte, 1);
+    }
+    RMTestAppendAttribute(buffer, type, &value);
+    RMTestBufferFree(&value);
+}
+
+static void RMTestAppendDateAttribute(RMTestBuffer *buffer, int type, time_t date)
+{
+    struct tm components;
+    char string[32];
+    gmtime_r(&date, &components);
+    strftime(string, sizeof(string), "%Y-%m-%dT%H:%M:%SZ", &components);
+    RMTestAppendStringAttribute(buffer, type, V_ASN1_IA5STRING, string);
+}
+
+typedef struct
+{
+    long originalTransactionIdentifier;
+    time_t originalPurchaseDate;
+    size_t renewalCount;
+} RMTestChain;
+
+RMTestBuffer RMTestGenerateReceiptPayload(const RMTestReceiptOptions *options, RMTestReceiptStatistics *statistics)
+{
+    RMTestReceiptStatistics counts = {0};
+    uint64_t state = options->seed;
+    const time_t start = 1381838400; // 2013-10-15T12:00:00Z
+    const time_t period = 30L * 24 * 60 * 60;
+    const int renewals = options->chainCount > 0 && options->subscriptionCount > 0;
+    RMTestChain *chains = calloc(renewals ? options->chainCount : 1, sizeof(RMTestChain));
+
+    RMTestBuffer attributes = {0};
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeBundleIdentifier, V_ASN1_UTF8STRING, options->bundleIdentifier ? options->bundleIdentifier : "net.robotmedia.test");
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeAppVersion, V_ASN1_UTF8STRING, "1.0");
+    RMTestAppendRandomAttribute(&attributes, RMReceiptAttributeTypeOpaqueValue, 16, &state);
+    RMTestAppendRandomAttribute(&attributes, RMReceiptAttributeTypeHash, 20, &state);
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeOriginalAppVersion, V_ASN1_UTF8STRING, "1.0");
+    for (size_t i = 0; options->minimumLength > 0 ? attributes.length < options->minimumLength : i < options->purchaseCount; i++)
+    {
+        const long transactionIdentifier = 1000000000 + (long)i;
+        long originalTransactionIdentifier = transactionIdentifier;
+        long quantity = 1;
+        time_t purchaseDate, originalPurchaseDate, expirationDate = 0;
+        char productIdentifier[64], string[32];
+        if (renewals && RMTestRandomDouble(&state) < options->renewalRate)
+        {
+            const size_t index = RMTestRandom(&state) % options->chainCount;
+            RMTestChain *chain = &chains[index];
+            if (chain->renewalCount == 0)
+            {
+                chain->originalTransactionIdentifier = transactionIdentifier;
+                chain->originalPurchaseDate = start + (time_t)(index % 365) * 24 * 60 * 60;
+            }
+            originalTransactionIdentifier = chain->originalTransactionIdentifier;
+            originalPurchaseDate = chain->originalPurchaseDate;
+            purchaseDate = originalPurchaseDate + (time_t)chain->renewalCount * period;
+            expirationDate = purchaseDate + period;
+            snprintf(productIdentifier, sizeof(productIdentifier), "net.robotmedia.test.subscription%zu", index % options->subscriptionCount);
+            chain->renewalCount++;
+            counts.renewalCount++;
+        }
+        else
+        { // Skewed towards the first products, like the sales of a real catalog
+            const double u = RMTestRandomDouble(&state);
+            const size_t productCount = options->productCount > 0 ? options->productCount : 1;
+            snprintf(productIdentifier, sizeof(productIdentifier), "net.robotmedia.test.product%zu", (size_t)(u * u * productCount));
+            quantity = 1 + (long)(RMTestRandom(&state) % 3);
+            purchaseDate = originalPurchaseDate = start + (time_t)i * 10 * 60;
+        }
+
+        RMTestBuffer iap = {0};
+        RMTestAppendIntegerAttribute(&iap, RMReceiptAttributeTypeQuantity, quantity);
+        RMTestAppendStringAttribute(&iap, RMReceiptAttributeTypeProductIdentifier, V_ASN1_UTF8STRING, productIdentifier);
+        snprintf(string, sizeof(string), "%ld", transactionIdentifier);
+        RMTestAppendStringAttribute(&iap, RMReceiptAttributeTypeTransactionIdentifier, V_ASN1_UTF8STRING, string);
+        RMTestAppendDateAttribute(&iap, RMReceiptAttributeTypePurchaseDate, purchaseDate);
+        snprintf(string, sizeof(string), "%ld", originalTransactionIdentifier);
+        RMTestAppendStringAttribute(&iap, RMReceiptAttributeTypeOriginalTransactionIdentifier, V_ASN1_UTF8STRING, string);
+        RMTestAppendDateAttribute(&iap, RMReceiptAttributeTypeOriginalPurchaseDate, originalPurchaseDate);
+        if (expirationDate)
+        {
+            RMTestAppendDateAttribute(&iap, RMReceiptAttributeTypeSubscriptionExpirationDate, expirationDate);
+            RMTestAppendIntegerAttribute(&iap, RMReceiptAttributeTypeWebOrderLineItemID, transactionIdentifier);
+        }
+        if (RMTestRandomDouble(&state) < options->cancellationRate)
+        {
+            RMTestAppendDateAttribute(&iap, RMReceiptAttributeTypeCancellationDate, purchaseDate + 60 * 60);
+            counts.cancellationCount++;
+        }
+        RMTestBuffer set = RMTestSet(&iap);
+        RMTestAppendAttribute(&attributes, RMReceiptAttributeTypeInAppPurchaseReceipt, &set);
+        RMTestBufferFree(&set);
+        RMTestBufferFree(&iap);
+        counts.purchaseCount++;
+    }
+    free(chains);
+
+    RMTestBuffer payload = RMTestSet(&attributes);
+    RMTestBufferFree(&attributes);
+    if (statistics) *statistics = counts;
+    return payload;
+}
+
+static const char _base64EncodingTable[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+char *RMTestBase64EncodeReference(const uint8_t *bytes, size_t length)
+{ // From: http://stackoverflow.com/a/4727124/143378
+    const unsigned char * objRawData = bytes;
+    char * objPointer;
+    char * strResult;
+    
+    // Get the Raw Data length and ensure we actually have data
+    size_t intLength = length;
+    if (intLength == 0) return NULL;
+    
+    // Setup the String-based Result placeholder and pointer within that placeholder
+    strResult = (char *)calloc((((intLength + 2) / 3) * 4) + 1, sizeof(char));
+    objPointer = strResult;
+    
+    // Iterate through everything
+    while (intLength > 2) { // keep going until we have less than 24 bits
+        *objPointer++ = _base64EncodingTable[objRawData[0] >> 2];
+        *objPointer++ = _base64EncodingTable[((objRawData[0] & 0x03) << 4) + (objRawData[1] >> 4)];
+        *objPointer++ = _base64EncodingTable[((objRawData[1] & 0x0f) << 2) + (objRawData[2] >> 6)];
+        *objPointer++ = _base64EncodingTable[objRawData[2] & 0x3f];
+        
+        // we just handled 3 octets (24 bits) of data
+        objRawData += 3;
+        intLength -= 3;
+    }
+    
+    // now deal with the tail end of things
+    if (intLength != 0) {
+        *objPointer++ = _base64EncodingTable[objRawData[0] >> 2];
+        if (intLength > 1) {
+            *objPointer++ = _base64EncodingTable[((objRawData[0] & 0x03) << 4) + (objRawData[1] >> 4)];
+            *objPointer++ = _base64EncodingTable[(objRawData[1] & 0x0f) << 2];
+            *objPointer++ = '=';
+        } else {
+            *objPointer++ = _base64EncodingTable[(objRawData[0] & 0x03) << 4];
+            *objPointer++ = '=';
+            *objPointer++ = '=';
+        }
+    }
+    
+    // Terminate the string-based result
+    *objPointer = '\0';
+    
+    return strResult;
+}
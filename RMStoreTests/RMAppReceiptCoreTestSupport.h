@@ -0,0 +1,142 @@
+//
+//  RMAppReceiptCoreTestSupport.h
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+
+#ifndef RMAppReceiptCoreTestSupport_h
+#define RMAppReceiptCoreTestSupport_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+/*
+ DER and PKCS #7 helpers to build receipts in the C tests. Payloads use the same attribute layout that RMAppReceipt consumes.
+ */
+
+typedef struct
+{
+    uint8_t *bytes;
+    size_t length;
+    size_t capacity;
+} RMTestBuffer;
+
+void RMTestBufferAppend(RMTestBuffer *buffer, const void *bytes, size_t length);
+
+void RMTestBufferFree(RMTestBuffer *buffer);
+
+/** Appends a DER element with the given tag and content.
+ */
+void RMTestAppendTLV(RMTestBuffer *buffer, uint8_t tag, const void *content, size_t length);
+
+void RMTestAppendInteger(RMTestBuffer *buffer, long value);
+
+/** Appends SEQUENCE { INTEGER type, INTEGER 1, OCTET STRING value }.
+ */
+void RMTestAppendAttribute(RMTestBuffer *buffer, int type, const RMTestBuffer *value);
+
+/** Appends an attribute whose value is a string with the given tag (e.g., 0x0C for UTF8String).
+ */
+void RMTestAppendStringAttribute(RMTestBuffer *buffer, int type, uint8_t tag, const char *string);
+
+/** Appends an attribute whose value is an INTEGER.
+ */
+void RMTestAppendIntegerAttribute(RMTestBuffer *buffer, int type, long value);
+
+/** Wraps the given attributes in a SET.
+ */
+RMTestBuffer RMTestSet(const RMTestBuffer *attributes);
+
+/** Returns the payload of an in-app purchase. Dates are RFC 3339 strings and can be NULL.
+ */
+RMTestBuffer RMTestIAP(const char *productIdentifier, const char *transactionIdentifier, const char *purchaseDate, const char *expirationDate);
+
+/** Returns the payload of a receipt with the given number of in-app purchases spread over productCount products.
+ */
+RMTestBuffer RMTestReceiptPayload(const char *bundleIdentifier, size_t purchaseCount, size_t productCount);
+
+/** Creates an RSA key and a self-signed certificate for it.
+ */
+int RMTestCreateCertificate(EVP_PKEY **key, X509 **certificate);
+
+/** Signs the payload as a PKCS #7 container and writes it to path.
+ */
+int RMTestWritePKCS7(const char *path, const RMTestBuffer *payload, EVP_PKEY *key, X509 *certificate);
+
+/** Signs the payload as a streamed PKCS #7 container, which uses indefinite lengths and splits the payload in segments, and writes it to path.
+ */
+int RMTestWriteStreamedPKCS7(const char *path, const RMTestBuffer *payload, EVP_PKEY *key, X509 *certificate);
+
+/** Returns the DER encoding of the certificate.
+ */
+RMTestBuffer RMTestCertificateData(X509 *certificate);
+
+/** A test certificate authority that mirrors the chain that signs App Store receipts: a root, an intermediate and a leaf that signs receipts. Receipts signed by the leaf verify against the root, which can be given to +[RMAppReceipt setAppleRootCertificateURL:].
+ */
+typedef struct
+{
+    EVP_PKEY *rootKey;
+    X509 *root;
+    EVP_PKEY *intermediateKey;
+    X509 *intermediate;
+    EVP_PKEY *signerKey;
+    X509 *signer;
+} RMTestAuthority;
+
+int RMTestAuthorityCreate(RMTestAuthority *authority);
+
+/** Writes the keys and certificates of the authority to path as PEM, to sign more receipts with it later.
+ */
+int RMTestAuthorityWrite(const RMTestAuthority *authority, const char *path);
+
+int RMTestAuthorityRead(RMTestAuthority *authority, const char *path);
+
+void RMTestAuthorityFree(RMTestAuthority *authority);
+
+/** Signs the payload with the leaf of the authority as a PKCS #7 container that includes the leaf and the intermediate, and writes it to path.
+ @param streamed Whether to use indefinite lengths and a segmented payload.
+ */
+int RMTestAuthorityWritePKCS7(const RMTestAuthority *authority, const char *path, const RMTestBuffer *payload, int streamed);
+
+/** Returns the next number of a splitmix64 generator, so that the same seed generates the same data on every platform.
+ */
+uint64_t RMTestRandom(uint64_t *state);
+
+/** Options of a synthetic receipt. Zeroed options generate an empty receipt.
+ */
+typedef struct
+{
+    const char *bundleIdentifier; // Defaults to net.robotmedia.test
+    size_t purchaseCount;
+    size_t minimumLength; // If not 0, in-app purchases are added until the payload is at least this long, regardless of purchaseCount
+    size_t productCount; // Products that are not subscriptions. Purchases are skewed towards the first ones.
+    size_t subscriptionCount; // Auto-renewable subscriptions
+    size_t chainCount; // Renewal chains, spread over the subscriptions
+    double renewalRate; // Share of the in-app purchases that renew a chain
+    double cancellationRate; // Share of the in-app purchases that are cancelled
+    uint64_t seed;
+} RMTestReceiptOptions;
+
+/** Statistics of a synthetic receipt.
+ */
+typedef struct
+{
+    size_t purchaseCount;
+    size_t renewalCount;
+    size_t cancellationCount;
+} RMTestReceiptStatistics;
+
+/** Returns the payload of a synthetic receipt with every attribute that RMAppReceipt reads. The same options always generate the same payload.
+ @param statistics If not NULL, what the receipt contains.
+ */
+RMTestBuffer RMTestGenerateReceiptPayload(const RMTestReceiptOptions *options, RMTestReceiptStatistics *statistics);
+
+/** Returns the base64 encoding of the bytes as a NUL-terminated string to free, or NULL if length is 0. Same algorithm as the original -[NSData rm_stringByBase64Encoding] of RMStoreTransactionReceiptVerifier, kept as the reference of RMStoreBase64.
+ */
+char *RMTestBase64EncodeReference(const uint8_t *bytes, size_t length);
+
+#endif
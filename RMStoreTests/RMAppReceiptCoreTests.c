@@ -0,0 +1,1157 @@
+//
+//  RMAppReceiptCoreTests.c
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+
+#include "RMAppReceiptCore.h"
+#include "RMAppReceiptCoreTestSupport.h"
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+
+static int _failures = 0;
+
+#define RMAssert(condition) do { if (!(condition)) { fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #condition); _failures++; } } while (0)
+
+typedef struct
+{
+    int count;
+    int types[16];
+    const uint8_t *values[16];
+    long lengths[16];
+    int stopAfter;
+} RMTestAttributes;
+
+static int RMTestCollectAttribute(const uint8_t *value, long length, int type, void *context)
+{
+    RMTestAttributes *attributes = context;
+    if (attributes->count < 16)
+    {
+        attributes->types[attributes->count] = type;
+        attributes->values[attributes->count] = value;
+        attributes->lengths[attributes->count] = length;
+    }
+    attributes->count++;
+    return attributes->stopAfter > 0 && attributes->count >= attributes->stopAfter;
+}
+
+static char *RMTestTemporaryPath(void)
+{
+    char *path = strdup("/tmp/RMAppReceiptCoreTests.XXXXXX");
+    const int fd = mkstemp(path);
+    if (fd >= 0) close(fd);
+    return path;
+}
+
+static void testReadInteger(void)
+{
+    RMTestBuffer buffer = {0};
+    RMTestAppendInteger(&buffer, 1712);
+    RMTestAppendInteger(&buffer, 255);
+    const uint8_t *p = buffer.bytes;
+    const uint8_t *end = p + buffer.length;
+    RMAssert(RMReceiptASN1ReadInteger(&p, end - p) == 1712);
+    RMAssert(RMReceiptASN1ReadInteger(&p, end - p) == 255);
+    RMAssert(p == end);
+    RMTestBufferFree(&buffer);
+}
+
+static void testReadInteger_range(void)
+{
+    const uint8_t maximum[] = {0x02, 0x04, 0x7F, 0xFF, 0xFF, 0xFF};
+    const uint8_t *p = maximum;
+    RMAssert(RMReceiptASN1ReadInteger(&p, sizeof(maximum)) == INT_MAX);
+    RMAssert(p == maximum + sizeof(maximum));
+
+    // 2^31 doesn't fit in an int
+    const uint8_t overflow[] = {0x02, 0x05, 0x00, 0x80, 0x00, 0x00, 0x00};
+    p = overflow;
+    RMAssert(RMReceiptASN1ReadInteger(&p, sizeof(overflow)) == 0);
+    RMAssert(p == overflow + sizeof(overflow));
+    p = overflow;
+    RMAssert(RMReceiptASN1ReadInteger64(&p, sizeof(overflow)) == 0x80000000LL);
+    RMAssert(p == overflow + sizeof(overflow));
+}
+
+static void testReadInteger64(void)
+{
+    const uint8_t maximum[] = {0x02, 0x08, 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    const uint8_t *p = maximum;
+    RMAssert(RMReceiptASN1ReadInteger64(&p, sizeof(maximum)) == INT64_MAX);
+    RMAssert(p == maximum + sizeof(maximum));
+
+    // 2^63 doesn't fit in an int64_t
+    const uint8_t overflow[] = {0x02, 0x09, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    p = overflow;
+    RMAssert(RMReceiptASN1ReadInteger64(&p, sizeof(overflow)) == 0);
+    RMAssert(p == overflow + sizeof(overflow));
+
+    const uint8_t negative[] = {0x02, 0x01, 0xFF};
+    p = negative;
+    RMAssert(RMReceiptASN1ReadInteger64(&p, sizeof(negative)) == 0);
+    RMAssert(p == negative + sizeof(negative));
+}
+
+static void testReadString(void)
+{
+    RMTestBuffer buffer = {0};
+    RMTestAppendTLV(&buffer, V_ASN1_UTF8STRING, "test", 4);
+    const uint8_t *p = buffer.bytes;
+    long length;
+    const uint8_t *value = RMReceiptASN1ReadString(&p, buffer.length, V_ASN1_UTF8STRING, &length);
+    RMAssert(value == buffer.bytes + 2);
+    RMAssert(length == 4);
+    RMAssert(p == buffer.bytes + buffer.length);
+
+    p = buffer.bytes;
+    value = RMReceiptASN1ReadString(&p, buffer.length, V_ASN1_IA5STRING, &length);
+    RMAssert(value == NULL);
+    RMAssert(p == buffer.bytes + buffer.length);
+    RMTestBufferFree(&buffer);
+}
+
+static void testEnumerateAttributes(void)
+{
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 2, 1);
+    RMTestAttributes attributes = {0};
+    RMReceiptEnumerateAttributes(payload.bytes, payload.length, RMTestCollectAttribute, &attributes);
+    RMAssert(attributes.count == 5);
+    RMAssert(attributes.types[0] == RMReceiptAttributeTypeBundleIdentifier);
+    RMAssert(attributes.types[3] == RMReceiptAttributeTypeInAppPurchaseReceipt);
+    RMAssert(attributes.values[0] > payload.bytes && attributes.values[0] < payload.bytes + payload.length);
+
+    const uint8_t *p = attributes.values[0];
+    long length;
+    const uint8_t *bundleIdentifier = RMReceiptASN1ReadString(&p, attributes.lengths[0], V_ASN1_UTF8STRING, &length);
+    RMAssert(length == strlen("net.robotmedia.test") && memcmp(bundleIdentifier, "net.robotmedia.test", length) == 0);
+
+    RMTestAttributes purchase = {0};
+    RMReceiptEnumerateAttributes(attributes.values[3], attributes.lengths[3], RMTestCollectAttribute, &purchase);
+    RMAssert(purchase.count == 7);
+    RMAssert(purchase.types[1] == RMReceiptAttributeTypeProductIdentifier);
+    RMTestBufferFree(&payload);
+}
+
+static void testEnumerateAttributes_stop(void)
+{
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 10, 1);
+    RMTestAttributes attributes = {.stopAfter = 2};
+    RMReceiptEnumerateAttributes(payload.bytes, payload.length, RMTestCollectAttribute, &attributes);
+    RMAssert(attributes.count == 2);
+    RMTestBufferFree(&payload);
+}
+
+static void testEnumerateAttributes_invalid(void)
+{
+    RMTestAttributes attributes = {0};
+    RMReceiptEnumerateAttributes(NULL, 0, RMTestCollectAttribute, &attributes);
+    RMAssert(attributes.count == 0);
+
+    RMTestBuffer buffer = {0};
+    RMTestAppendTLV(&buffer, V_ASN1_UTF8STRING, "test", 4);
+    RMReceiptEnumerateAttributes(buffer.bytes, buffer.length, RMTestCollectAttribute, &attributes);
+    RMAssert(attributes.count == 0);
+    RMTestBufferFree(&buffer);
+
+    // Declared lengths past the end of the buffer
+    const uint8_t overflowingSet[] = {0x31, 0x84, 0x7F, 0xFF, 0xFF, 0xFF, 0x30, 0x00};
+    RMReceiptEnumerateAttributes(overflowingSet, sizeof(overflowingSet), RMTestCollectAttribute, &attributes);
+    const uint8_t overflowingValue[] = {0x31, 0x0B, 0x30, 0x09, 0x02, 0x01, 0x02, 0x02, 0x01, 0x01, 0x04, 0x7F, 0x00};
+    RMReceiptEnumerateAttributes(overflowingValue, sizeof(overflowingValue), RMTestCollectAttribute, &attributes);
+    const uint8_t indefiniteSet[] = {0x31, 0x80, 0x30, 0x09, 0x02, 0x01, 0x02, 0x02, 0x01, 0x01, 0x04, 0x01, 0x00, 0x00, 0x00};
+    RMReceiptEnumerateAttributes(indefiniteSet, sizeof(indefiniteSet), RMTestCollectAttribute, &attributes);
+    const uint8_t negativeType[] = {0x31, 0x0B, 0x30, 0x09, 0x02, 0x01, 0x82, 0x02, 0x01, 0x01, 0x04, 0x01, 0x00};
+    RMReceiptEnumerateAttributes(negativeType, sizeof(negativeType), RMTestCollectAttribute, &attributes);
+    RMAssert(attributes.count == 0);
+
+    const uint8_t valid[] = {0x31, 0x0B, 0x30, 0x09, 0x02, 0x01, 0x02, 0x02, 0x01, 0x01, 0x04, 0x01, 0x00};
+    RMReceiptEnumerateAttributes(valid, sizeof(valid), RMTestCollectAttribute, &attributes);
+    RMAssert(attributes.count == 1 && attributes.types[0] == 2 && attributes.lengths[0] == 1);
+}
+
+typedef struct
+{
+    const uint8_t *start;
+    const uint8_t *end;
+    int outOfBounds;
+    int depth;
+} RMTestFuzzContext;
+
+static int RMTestFuzzAttribute(const uint8_t *value, long length, int type, void *context)
+{
+    RMTestFuzzContext *fuzz = context;
+    if (length < 0 || value < fuzz->start || value + length > fuzz->end) fuzz->outOfBounds++;
+
+    const uint8_t *p = value;
+    long stringLength;
+    RMReceiptASN1ReadString(&p, length, V_ASN1_UTF8STRING, &stringLength);
+    if (p < value || p > value + length) fuzz->outOfBounds++;
+    p = value;
+    RMReceiptASN1ReadInteger(&p, length);
+    if (p < value || p > value + length) fuzz->outOfBounds++;
+
+    if (type == RMReceiptAttributeTypeInAppPurchaseReceipt && fuzz->depth == 0)
+    {
+        fuzz->depth++;
+        RMReceiptEnumerateAttributes(value, length, RMTestFuzzAttribute, fuzz);
+        fuzz->depth--;
+    }
+    return 0;
+}
+
+static void testEnumerateAttributes_fuzz(void)
+{
+    // Mutations of a valid receipt: bit flips, overwritten lengths and truncations. Each input is copied to an exact-size allocation so that sanitizers catch overreads.
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 20, 3);
+    unsigned int seed = 1701;
+    int outOfBounds = 0;
+    for (int i = 0; i < 20000; i++)
+    {
+        const size_t length = i % 4 == 3 ? rand_r(&seed) % payload.length : payload.length;
+        uint8_t *input = malloc(length > 0 ? length : 1);
+        memcpy(input, payload.bytes, length);
+        const int mutations = 1 + rand_r(&seed) % 8;
+        for (int j = 0; j < mutations && length > 0; j++)
+        {
+            const size_t offset = rand_r(&seed) % length;
+            switch (rand_r(&seed) % 3)
+            {
+                case 0: input[offset] ^= 1 << (rand_r(&seed) % 8); break;
+                case 1: input[offset] = 0x80 | (rand_r(&seed) % 6); break; // Long-form or indefinite length
+                default: input[offset] = rand_r(&seed) & 0xFF; break;
+            }
+        }
+        RMTestFuzzContext context = {input, input + length, 0, 0};
+        RMReceiptEnumerateAttributes(input, length, RMTestFuzzAttribute, &context);
+        outOfBounds += context.outOfBounds;
+        free(input);
+    }
+    RMAssert(outOfBounds == 0);
+    RMTestBufferFree(&payload);
+}
+
+typedef struct
+{
+    int count;
+    int stopAfter;
+    int missing;
+} RMTestScan;
+
+static int RMTestScanPurchase(const RMReceiptPurchase *purchase, void *context)
+{
+    RMTestScan *scan = context;
+    long length;
+    scan->missing += RMReceiptPurchaseGetValue(purchase, RMReceiptAttributeTypeTransactionIdentifier, &length) == NULL;
+    scan->missing += RMReceiptPurchaseGetValue(purchase, RMReceiptAttributeTypeSubscriptionExpirationDate, &length) == NULL;
+    scan->missing += RMReceiptPurchaseGetValue(purchase, RMReceiptAttributeTypeProductIdentifier, &length) != NULL; // Not requested
+    scan->count++;
+    return scan->stopAfter > 0 && scan->count >= scan->stopAfter;
+}
+
+static void testScanPurchases(void)
+{
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 10, 3);
+    const uint32_t mask = RMReceiptPurchaseAttributeBit(RMReceiptAttributeTypeTransactionIdentifier) | RMReceiptPurchaseAttributeBit(RMReceiptAttributeTypeSubscriptionExpirationDate);
+    RMTestScan scan = {0};
+    RMAssert(RMReceiptScanPurchases(payload.bytes, payload.length, mask, RMTestScanPurchase, &scan) == 0);
+    RMAssert(scan.count == 10);
+    RMAssert(scan.missing == 0);
+
+    scan = (RMTestScan){.stopAfter = 4};
+    RMAssert(RMReceiptScanPurchases(payload.bytes, payload.length, mask, RMTestScanPurchase, &scan) == 1);
+    RMAssert(scan.count == 4);
+    RMTestBufferFree(&payload);
+}
+
+static void testContainsProduct(void)
+{
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 10, 3);
+    RMAssert(RMReceiptContainsProduct(payload.bytes, payload.length, "net.robotmedia.test.product2", strlen("net.robotmedia.test.product2")));
+    RMAssert(!RMReceiptContainsProduct(payload.bytes, payload.length, "net.robotmedia.test.product3", strlen("net.robotmedia.test.product3")));
+    RMAssert(!RMReceiptContainsProduct(payload.bytes, payload.length, "net.robotmedia.test.product", strlen("net.robotmedia.test.product")));
+    RMAssert(!RMReceiptContainsProduct(payload.bytes, payload.length, "", 0));
+    RMAssert(!RMReceiptContainsProduct(NULL, 0, "net.robotmedia.test.product2", strlen("net.robotmedia.test.product2")));
+    RMTestBufferFree(&payload);
+}
+
+static const uint8_t *RMTestFindBytes(const uint8_t *bytes, long length, const uint8_t *needle, long needleLength)
+{
+    for (long i = 0; i + needleLength <= length; i++)
+    {
+        if (memcmp(bytes + i, needle, needleLength) == 0) return bytes + i;
+    }
+    return NULL;
+}
+
+static void testFindBytes(void)
+{
+    // A small alphabet makes partial matches of the first and last byte frequent
+    const RMReceiptSearchImplementation implementations[] = {RMReceiptSearchAutomatic, RMReceiptSearchScalar, RMReceiptSearchSSE2, RMReceiptSearchAVX2, RMReceiptSearchNEON};
+    unsigned int seed = 1702;
+    for (size_t i = 0; i < sizeof(implementations) / sizeof(implementations[0]); i++)
+    {
+        if (!RMReceiptSearchIsAvailable(implementations[i])) continue;
+
+        int mismatches = 0;
+        for (int j = 0; j < 5000; j++)
+        {
+            const long length = rand_r(&seed) % 200;
+            const long needleLength = 1 + rand_r(&seed) % 40;
+            uint8_t *bytes = malloc(length > 0 ? length : 1);
+            uint8_t *needle = malloc(needleLength);
+            for (long k = 0; k < length; k++) bytes[k] = 'a' + rand_r(&seed) % 3;
+            if (length >= needleLength && j % 2 == 0)
+            {
+                memcpy(needle, bytes + rand_r(&seed) % (length - needleLength + 1), needleLength);
+            }
+            else
+            {
+                for (long k = 0; k < needleLength; k++) needle[k] = 'a' + rand_r(&seed) % 3;
+            }
+            mismatches += RMReceiptFindBytes(bytes, length, needle, needleLength, implementations[i]) != RMTestFindBytes(bytes, length, needle, needleLength);
+            free(bytes);
+            free(needle);
+        }
+        RMAssert(mismatches == 0);
+    }
+    RMAssert(RMReceiptSearchIsAvailable(RMReceiptSearchScalar));
+    RMAssert(RMReceiptFindBytes((const uint8_t*)"abc", 3, (const uint8_t*)"abcd", 4, RMReceiptSearchAutomatic) == NULL);
+}
+
+static int RMTestMatchProduct(const RMReceiptPurchase *purchase, void *context)
+{
+    const char *productIdentifier = context;
+    long length;
+    const uint8_t *p = RMReceiptPurchaseGetValue(purchase, RMReceiptAttributeTypeProductIdentifier, &length);
+    if (!p) return 0;
+
+    long stringLength;
+    const uint8_t *string = RMReceiptASN1ReadString(&p, length, V_ASN1_UTF8STRING, &stringLength);
+    return string && stringLength == (long)strlen(productIdentifier) && memcmp(string, productIdentifier, stringLength) == 0;
+}
+
+static int RMTestContainsProduct(const uint8_t *payload, long length, const char *productIdentifier)
+{
+    return RMReceiptScanPurchases(payload, length, RMReceiptPurchaseAttributeBit(RMReceiptAttributeTypeProductIdentifier), RMTestMatchProduct, (void*)productIdentifier);
+}
+
+static void testContainsProduct_prefilter(void)
+{
+    // Decoys: identifiers in other attributes and as prefixes of other identifiers. Identifiers of 128 bytes or more use long-form lengths.
+    char longIdentifier[300];
+    memset(longIdentifier, 'x', sizeof(longIdentifier) - 1);
+    longIdentifier[sizeof(longIdentifier) - 1] = '\0';
+    RMTestBuffer attributes = {0};
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeBundleIdentifier, V_ASN1_UTF8STRING, "net.robotmedia.decoy");
+    const char *purchases[][2] = {{"net.robotmedia.decoy.a", "net.robotmedia.decoy.b"}, {"net.robotmedia.decoy.c2", "1"}, {longIdentifier, "2"}, {"net.robotmedia.decoy.d", "3"}};
+    for (size_t i = 0; i < sizeof(purchases) / sizeof(purchases[0]); i++)
+    {
+        RMTestBuffer iap = RMTestIAP(purchases[i][0], purchases[i][1], NULL, NULL);
+        RMTestAppendAttribute(&attributes, RMReceiptAttributeTypeInAppPurchaseReceipt, &iap);
+        RMTestBufferFree(&iap);
+    }
+    RMTestBuffer payload = RMTestSet(&attributes);
+    RMTestBufferFree(&attributes);
+
+    const char *queries[] = {"net.robotmedia.decoy", "net.robotmedia.decoy.a", "net.robotmedia.decoy.b", "net.robotmedia.decoy.c", "net.robotmedia.decoy.c2", "net.robotmedia.decoy.d", "1", "2", "", longIdentifier, longIdentifier + 1};
+    for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++)
+    {
+        RMAssert(RMReceiptContainsProduct(payload.bytes, payload.length, queries[i], strlen(queries[i])) == RMTestContainsProduct(payload.bytes, payload.length, queries[i]));
+    }
+    RMAssert(RMReceiptContainsProduct(payload.bytes, payload.length, longIdentifier, strlen(longIdentifier)));
+
+    // Mutated receipts must give the same answer as the full scan
+    RMTestBuffer receipt = RMTestReceiptPayload("net.robotmedia.test", 20, 5);
+    unsigned int seed = 1703;
+    int mismatches = 0;
+    for (int i = 0; i < 5000; i++)
+    {
+        uint8_t *input = malloc(receipt.length);
+        memcpy(input, receipt.bytes, receipt.length);
+        const int mutations = 1 + rand_r(&seed) % 4;
+        for (int j = 0; j < mutations; j++)
+        {
+            input[rand_r(&seed) % receipt.length] = rand_r(&seed) & 0xFF;
+        }
+        char productIdentifier[64];
+        snprintf(productIdentifier, sizeof(productIdentifier), "net.robotmedia.test.product%d", rand_r(&seed) % 6);
+        mismatches += RMReceiptContainsProduct(input, receipt.length, productIdentifier, strlen(productIdentifier)) != RMTestContainsProduct(input, receipt.length, productIdentifier);
+        free(input);
+    }
+    RMAssert(mismatches == 0);
+    RMTestBufferFree(&receipt);
+    RMTestBufferFree(&payload);
+}
+
+static RMTestBuffer RMTestTablePurchase(const char *productIdentifier, long quantity, const char *purchaseDate, const char *expirationDate, const char *cancellationDate, long webOrderLineItemID)
+{
+    RMTestBuffer attributes = {0};
+    RMTestAppendIntegerAttribute(&attributes, RMReceiptAttributeTypeQuantity, quantity);
+    if (productIdentifier) RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeProductIdentifier, V_ASN1_UTF8STRING, productIdentifier);
+    if (purchaseDate) RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypePurchaseDate, V_ASN1_IA5STRING, purchaseDate);
+    if (expirationDate) RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeSubscriptionExpirationDate, V_ASN1_IA5STRING, expirationDate);
+    if (cancellationDate) RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeCancellationDate, V_ASN1_IA5STRING, cancellationDate);
+    RMTestAppendIntegerAttribute(&attributes, RMReceiptAttributeTypeWebOrderLineItemID, webOrderLineItemID);
+    RMTestBuffer set = RMTestSet(&attributes);
+    RMTestBufferFree(&attributes);
+    return set;
+}
+
+static void testPurchaseTable(void)
+{
+    RMTestBuffer purchases[] = {
+        RMTestTablePurchase("a", 1, "2013-10-15T12:00:00Z", "2013-11-15T12:00:00Z", NULL, 1000000000),
+        RMTestTablePurchase("b", 2, "2013-11-15T12:00:00Z", "2013-12-15T12:00:00Z", NULL, 0x0123456789L),
+        RMTestTablePurchase("a", 1, "2013-12-15T12:00:00Z", "2014-01-15T12:00:00Z", "2013-12-20T12:00:00Z", 1000000002),
+        RMTestTablePurchase(NULL, 1, "2013-12-16T12:00:00Z", NULL, NULL, 0),
+        RMTestTablePurchase("c", 1, "2013-12-17 12:00:00", NULL, NULL, 0),
+    };
+    RMTestBuffer attributes = {0};
+    RMTestAppendStringAttribute(&attributes, RMReceiptAttributeTypeBundleIdentifier, V_ASN1_UTF8STRING, "net.robotmedia.test");
+    for (size_t i = 0; i < sizeof(purchases) / sizeof(purchases[0]); i++)
+    {
+        RMTestAppendAttribute(&attributes, RMReceiptAttributeTypeInAppPurchaseReceipt, &purchases[i]);
+        RMTestBufferFree(&purchases[i]);
+    }
+    RMTestBuffer payload = RMTestSet(&attributes);
+    RMTestBufferFree(&attributes);
+
+    RMReceiptPurchaseTable *table = RMReceiptPurchaseTableCreate(payload.bytes, payload.length);
+    RMAssert(table != NULL);
+    RMAssert(table->count == 5);
+    RMAssert(table->productCount == 3);
+    RMAssert(table->productIndices[0] == 0 && table->productIndices[1] == 1 && table->productIndices[2] == 0 && table->productIndices[3] == -1 && table->productIndices[4] == 2);
+    RMAssert(table->productIdentifierLengths[1] == 1 && table->productIdentifiers[1][0] == 'b');
+    RMAssert(RMReceiptPurchaseTableFindProduct(table, "b", 1) == 1);
+    RMAssert(RMReceiptPurchaseTableFindProduct(table, "d", 1) == -1);
+    RMAssert(table->quantities[1] == 2);
+    RMAssert(table->webOrderLineItemIDs[1] == 0x0123456789L);
+    RMAssert(table->purchaseDates[0] == 1381838400);
+    RMAssert(table->originalPurchaseDates[0] == RMReceiptPurchaseTableNoDate);
+    RMAssert(table->expirationDates[2] == 1389787200);
+    RMAssert(table->cancellationDates[2] == 1387540800);
+    RMAssert(table->cancellationDates[0] == RMReceiptPurchaseTableNoDate);
+    RMAssert(table->purchaseDates[4] == RMReceiptPurchaseTableUnparsedDate);
+    RMAssert(table->unparsedDateCount == 1);
+
+    // [2013-11-15T12:00:00Z, 2013-12-16T12:00:00Z)
+    RMAssert(RMReceiptPurchaseTableCountPurchasesBetween(table, 1384516800, 1387195200) == 2);
+    long rows[5];
+    RMAssert(RMReceiptPurchaseTableSelectPurchasesBetween(table, 1384516800, 1387195201, rows) == 3);
+    RMAssert(rows[0] == 1 && rows[1] == 2 && rows[2] == 3);
+    long counts[3];
+    RMReceiptPurchaseTableCountProducts(table, counts);
+    RMAssert(counts[0] == 2 && counts[1] == 1 && counts[2] == 1);
+    int64_t latest[3];
+    RMReceiptPurchaseTableGetLatestExpirations(table, latest);
+    RMAssert(latest[0] == 1389787200 && latest[1] == 1387108800 && latest[2] == RMReceiptPurchaseTableNoDate);
+    RMReceiptPurchaseTableFree(table);
+    RMTestBufferFree(&payload);
+
+    table = RMReceiptPurchaseTableCreate(NULL, 0);
+    RMAssert(table != NULL && table->count == 0 && table->productCount == 0);
+    RMReceiptPurchaseTableFree(table);
+}
+
+typedef struct
+{
+    const RMReceiptPurchaseTable *table;
+    long row;
+    int mismatches;
+} RMTestTableCheck;
+
+static int RMTestCheckTableRow(const RMReceiptPurchase *purchase, void *context)
+{
+    RMTestTableCheck *check = context;
+    long length;
+    const uint8_t *p = RMReceiptPurchaseGetValue(purchase, RMReceiptAttributeTypeProductIdentifier, &length);
+    long stringLength;
+    const uint8_t *string = RMReceiptASN1ReadString(&p, length, V_ASN1_UTF8STRING, &stringLength);
+    const int32_t index = check->table->productIndices[check->row++];
+    check->mismatches += index < 0 || check->table->productIdentifierLengths[index] != stringLength || memcmp(check->table->productIdentifiers[index], string, stringLength) != 0;
+    return 0;
+}
+
+static void testPurchaseTable_products(void)
+{
+    // More products than the initial capacity of the interning set
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 1000, 100);
+    RMReceiptPurchaseTable *table = RMReceiptPurchaseTableCreate(payload.bytes, payload.length);
+    RMAssert(table->count == 1000);
+    RMAssert(table->productCount == 100);
+    RMTestTableCheck check = {table, 0, 0};
+    RMReceiptScanPurchases(payload.bytes, payload.length, RMReceiptPurchaseAttributeBit(RMReceiptAttributeTypeProductIdentifier), RMTestCheckTableRow, &check);
+    RMAssert(check.row == 1000);
+    RMAssert(check.mismatches == 0);
+    long counts[100];
+    RMReceiptPurchaseTableCountProducts(table, counts);
+    for (int i = 0; i < 100; i++) RMAssert(counts[i] == 10);
+    RMReceiptPurchaseTableFree(table);
+    RMTestBufferFree(&payload);
+}
+
+static void testStringPool(void)
+{
+    RMReceiptStringPool *pool = RMReceiptStringPoolCreate();
+    const uint8_t *a, *b, *a2, *empty, *empty2;
+    RMAssert(RMReceiptStringPoolIntern(pool, (const uint8_t*)"product", 7, &a) == 0);
+    RMAssert(RMReceiptStringPoolIntern(pool, (const uint8_t*)"products", 8, &b) == 1);
+    RMAssert(RMReceiptStringPoolIntern(pool, (const uint8_t*)"product", 7, &a2) == 0);
+    RMAssert(a == a2 && memcmp(a, "product", 7) == 0);
+    RMAssert(b != a && memcmp(b, "products", 8) == 0);
+    RMAssert(RMReceiptStringPoolIntern(pool, NULL, 0, &empty) == 2);
+    RMAssert(RMReceiptStringPoolIntern(pool, (const uint8_t*)"", 0, &empty2) == 2);
+    RMAssert(empty != NULL && empty == empty2);
+
+    // Larger than a chunk
+    char *large = malloc(40000);
+    memset(large, 'x', 40000);
+    const uint8_t *interned;
+    RMAssert(RMReceiptStringPoolIntern(pool, (const uint8_t*)large, 40000, &interned) == 3);
+    RMAssert(memcmp(interned, large, 40000) == 0);
+    free(large);
+
+    // Earlier strings don't move when the hash table grows or new chunks are allocated
+    for (int i = 0; i < 10000; i++)
+    {
+        char string[32];
+        const int length = snprintf(string, sizeof(string), "%d", 1000000000 + i);
+        RMAssert(RMReceiptStringPoolIntern(pool, (const uint8_t*)string, length, &interned) == 4 + i);
+    }
+    RMAssert(RMReceiptStringPoolIntern(pool, (const uint8_t*)"1000000042", 10, &interned) == 46);
+    RMAssert(RMReceiptStringPoolIntern(pool, (const uint8_t*)"product", 7, &a2) == 0 && a2 == a);
+    RMAssert(memcmp(a, "product", 7) == 0);
+    RMAssert(RMReceiptStringPoolGetCount(pool) == 10004);
+    RMAssert(RMReceiptStringPoolGetSize(pool) > 40000 + 10000 * 10);
+    RMReceiptStringPoolFree(pool);
+}
+
+static void testTimeline(void)
+{
+    // Unsorted, overlapping, touching, empty and invalid intervals
+    const double starts[] = {50, 10, 20, 30, 45, 70, 60, NAN};
+    const double ends[] = {60, 20, 25, 40, 45, 65, 50, 90};
+    RMReceiptTimeline *timeline = RMReceiptTimelineCreate(starts, ends, sizeof(starts) / sizeof(starts[0]));
+    RMAssert(timeline->count == 4);
+    const double expected[] = {10, 25, 30, 40, 45, 45, 50, 60};
+    RMAssert(memcmp(timeline->boundaries, expected, sizeof(expected)) == 0);
+
+    RMAssert(!RMReceiptTimelineIsActiveAt(timeline, 9.5));
+    RMAssert(RMReceiptTimelineIsActiveAt(timeline, 10));
+    RMAssert(RMReceiptTimelineIsActiveAt(timeline, 25));
+    RMAssert(!RMReceiptTimelineIsActiveAt(timeline, 25.5));
+    RMAssert(RMReceiptTimelineIsActiveAt(timeline, 45));
+    RMAssert(!RMReceiptTimelineIsActiveAt(timeline, 45.5));
+    RMAssert(RMReceiptTimelineIsActiveAt(timeline, 60));
+    RMAssert(!RMReceiptTimelineIsActiveAt(timeline, 61));
+
+    double change = 0;
+    RMAssert(RMReceiptTimelineGetNextChangeAfter(timeline, 0, &change) && change == 10);
+    RMAssert(RMReceiptTimelineGetNextChangeAfter(timeline, 10, &change) && change == 25);
+    RMAssert(RMReceiptTimelineGetNextChangeAfter(timeline, 25, &change) && change == 30);
+    RMAssert(RMReceiptTimelineGetNextChangeAfter(timeline, 42, &change) && change == 45);
+    RMAssert(RMReceiptTimelineGetNextChangeAfter(timeline, 45, &change) && change == 50);
+    RMAssert(!RMReceiptTimelineGetNextChangeAfter(timeline, 60, &change));
+    RMReceiptTimelineFree(timeline);
+
+    timeline = RMReceiptTimelineCreate(NULL, NULL, 0);
+    RMAssert(timeline->count == 0);
+    RMAssert(!RMReceiptTimelineIsActiveAt(timeline, 0));
+    RMAssert(!RMReceiptTimelineGetNextChangeAfter(timeline, 0, &change));
+    RMReceiptTimelineFree(timeline);
+
+    // Zero-length interval
+    const double instant = 100;
+    timeline = RMReceiptTimelineCreate(&instant, &instant, 1);
+    RMAssert(!RMReceiptTimelineIsActiveAt(timeline, 99.5));
+    RMAssert(RMReceiptTimelineIsActiveAt(timeline, 100));
+    RMAssert(!RMReceiptTimelineIsActiveAt(timeline, 100.5));
+    RMAssert(RMReceiptTimelineGetNextChangeAfter(timeline, 99.5, &change) && change == 100);
+    RMAssert(!RMReceiptTimelineGetNextChangeAfter(timeline, 100, &change));
+    RMReceiptTimelineFree(timeline);
+}
+
+static void testTimeline_random(void)
+{
+    // Against a linear scan of the intervals. Small integer times make ties and touching intervals common.
+    unsigned int seed = 1701;
+    for (int i = 0; i < 500; i++)
+    {
+        const long count = rand_r(&seed) % 20;
+        double starts[20], ends[20];
+        for (long j = 0; j < count; j++)
+        {
+            starts[j] = rand_r(&seed) % 100;
+            ends[j] = starts[j] + (double)(rand_r(&seed) % 12) - 1;
+        }
+        RMReceiptTimeline *timeline = RMReceiptTimelineCreate(starts, ends, count);
+        for (double time = -1; time <= 112; time += 0.5)
+        {
+            int active = 0;
+            double next = INFINITY;
+            for (long j = 0; j < count; j++)
+            {
+                if (ends[j] < starts[j]) continue;
+                
+                active |= starts[j] <= time && time <= ends[j];
+                // A boundary is a change unless it is inside another interval
+                int startCovered = 0, endCovered = 0;
+                for (long k = 0; k < count; k++)
+                {
+                    if (k == j || ends[k] < starts[k]) continue;
+                    startCovered |= starts[k] < starts[j] && starts[j] <= ends[k];
+                    endCovered |= starts[k] <= ends[j] && ends[j] < ends[k];
+                }
+                if (!startCovered && starts[j] > time && starts[j] < next) next = starts[j];
+                if (!endCovered && ends[j] > time && ends[j] < next) next = ends[j];
+            }
+            RMAssert(RMReceiptTimelineIsActiveAt(timeline, time) == active);
+            double change = 0;
+            const int found = RMReceiptTimelineGetNextChangeAfter(timeline, time, &change);
+            RMAssert(found == (next != INFINITY));
+            RMAssert(!found || change == next);
+        }
+        RMReceiptTimelineFree(timeline);
+    }
+}
+
+static void testMatchEntries(void)
+{
+    const char *previous[] = {"a", "bb", "ccc", "bb", "dddd"};
+    long previousLengths[5];
+    for (int i = 0; i < 5; i++) previousLengths[i] = strlen(previous[i]);
+    long matches[8];
+
+    // Appended
+    const char *appended[] = {"a", "bb", "ccc", "bb", "dddd", "e", "ff"};
+    long lengths[8];
+    for (int i = 0; i < 7; i++) lengths[i] = strlen(appended[i]);
+    RMAssert(RMReceiptMatchEntries((const uint8_t *const *)previous, previousLengths, 5, (const uint8_t *const *)appended, lengths, 7, matches) == 5);
+    RMAssert(matches[0] == 0 && matches[1] == 1 && matches[2] == 2 && matches[3] == 3 && matches[4] == 4 && matches[5] == -1 && matches[6] == -1);
+
+    // Inserted, changed and removed. Duplicates match different entries.
+    const char *changed[] = {"e", "bb", "a", "cc", "bb", "bb"};
+    for (int i = 0; i < 6; i++) lengths[i] = strlen(changed[i]);
+    RMAssert(RMReceiptMatchEntries((const uint8_t *const *)previous, previousLengths, 5, (const uint8_t *const *)changed, lengths, 6, matches) == 3);
+    RMAssert(matches[0] == -1 && matches[1] == 1 && matches[2] == 0 && matches[3] == -1 && matches[4] == 3 && matches[5] == -1);
+
+    RMAssert(RMReceiptMatchEntries(NULL, NULL, 0, (const uint8_t *const *)changed, lengths, 6, matches) == 0);
+    RMAssert(matches[0] == -1 && matches[5] == -1);
+    RMAssert(RMReceiptMatchEntries((const uint8_t *const *)previous, previousLengths, 5, NULL, NULL, 0, matches) == 0);
+}
+
+static void testParseRFC3339Date(void)
+{
+    const char *valid[] = {"2013-10-15T12:00:00Z", "1970-01-01T00:00:00Z", "1969-12-31T23:59:59Z", "2000-02-29T23:59:59Z", "2100-02-28T00:00:00Z", "2038-01-19T03:14:08Z", "9999-12-31T23:59:59Z", "1600-03-01T00:00:00Z"};
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++)
+    {
+        struct tm tm = {0};
+        sscanf(valid[i], "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        const double expected = (double)timegm(&tm);
+        double result = 0;
+        RMAssert(RMReceiptParseRFC3339Date((const uint8_t *)valid[i], strlen(valid[i]), &result));
+        RMAssert(result == expected);
+    }
+
+    double result = 0;
+    const char *offset = "2013-10-15T12:00:00-0800";
+    RMAssert(RMReceiptParseRFC3339Date((const uint8_t *)offset, strlen(offset), &result));
+    RMAssert(result == 1381838400 + 8 * 3600);
+
+    const char *invalid[] = {"2013-10-15 12:00:00Z", "2013-10-15T12:00:00", "2013-10-15T12:00Z", "2013-02-29T12:00:00Z", "2013-13-01T12:00:00Z", "2013-10-15T24:00:00Z", "2013-10-15T12:00:60Z", "1582-10-10T00:00:00Z", "2013-10-15T12:00:00+2400", "2013-1O-15T12:00:00Z", ""};
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        RMAssert(!RMReceiptParseRFC3339Date((const uint8_t *)invalid[i], strlen(invalid[i]), &result));
+    }
+}
+
+static void testVerifyHash(void)
+{
+    const uint8_t deviceIdentifier[16] = {0x3a, 0x1f, 0x7c, 0x52, 0x0e, 0x94, 0x4b, 0x6d, 0x8c, 0x21, 0x5e, 0xa7, 0x90, 0x3b, 0xd4, 0x68};
+    const uint8_t opaqueValue[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+    const uint8_t bundleIdentifier[] = {V_ASN1_UTF8STRING, 4, 't', 'e', 's', 't'};
+    uint8_t data[sizeof(deviceIdentifier) + sizeof(opaqueValue) + sizeof(bundleIdentifier)];
+    memcpy(data, deviceIdentifier, sizeof(deviceIdentifier));
+    memcpy(data + sizeof(deviceIdentifier), opaqueValue, sizeof(opaqueValue));
+    memcpy(data + sizeof(deviceIdentifier) + sizeof(opaqueValue), bundleIdentifier, sizeof(bundleIdentifier));
+    uint8_t hash[SHA_DIGEST_LENGTH];
+    SHA1(data, sizeof(data), hash);
+
+    RMAssert(RMReceiptVerifyHash(deviceIdentifier, opaqueValue, sizeof(opaqueValue), bundleIdentifier, sizeof(bundleIdentifier), hash, sizeof(hash)) == 1);
+    RMAssert(RMReceiptVerifyHash(deviceIdentifier, opaqueValue, sizeof(opaqueValue), bundleIdentifier, sizeof(bundleIdentifier), hash, sizeof(hash) - 1) == 0);
+    RMAssert(RMReceiptVerifyHash(deviceIdentifier, bundleIdentifier, sizeof(bundleIdentifier), opaqueValue, sizeof(opaqueValue), hash, sizeof(hash)) == 0); // Order matters
+    RMAssert(RMReceiptVerifyHash(deviceIdentifier, NULL, 0, NULL, 0, hash, sizeof(hash)) == 0);
+    for (size_t i = 0; i < sizeof(hash); i++)
+    {
+        hash[i] ^= 0x80;
+        RMAssert(RMReceiptVerifyHash(deviceIdentifier, opaqueValue, sizeof(opaqueValue), bundleIdentifier, sizeof(bundleIdentifier), hash, sizeof(hash)) == 0);
+        hash[i] ^= 0x80;
+    }
+}
+
+static void testCopyPayloadAtPath(void)
+{
+    EVP_PKEY *key;
+    X509 *certificate;
+    RMAssert(RMTestCreateCertificate(&key, &certificate));
+    RMTestBuffer certificateData = RMTestCertificateData(certificate);
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 3, 2);
+    char *path = RMTestTemporaryPath();
+    RMAssert(RMTestWritePKCS7(path, &payload, key, certificate));
+
+    RMReceiptVerifier *verifier = RMReceiptVerifierCreate(certificateData.bytes, certificateData.length);
+    RMAssert(verifier != NULL);
+    long length = 0;
+    uint8_t *result = RMReceiptCopyPayloadAtPath(path, verifier, &length);
+    RMAssert(result != NULL);
+    RMAssert(length == (long)payload.length && memcmp(result, payload.bytes, length) == 0);
+    free(result);
+
+    result = RMReceiptCopyPayloadAtPath(path, NULL, &length);
+    RMAssert(result != NULL);
+    free(result);
+
+    EVP_PKEY *otherKey;
+    X509 *otherCertificate;
+    RMAssert(RMTestCreateCertificate(&otherKey, &otherCertificate));
+    RMTestBuffer otherCertificateData = RMTestCertificateData(otherCertificate);
+    RMReceiptVerifier *otherVerifier = RMReceiptVerifierCreate(otherCertificateData.bytes, otherCertificateData.length);
+    result = RMReceiptCopyPayloadAtPath(path, otherVerifier, &length);
+    RMAssert(result == NULL);
+
+    RMReceiptVerifierFree(otherVerifier);
+    RMReceiptVerifierFree(verifier);
+    unlink(path);
+    free(path);
+    RMTestBufferFree(&otherCertificateData);
+    RMTestBufferFree(&certificateData);
+    RMTestBufferFree(&payload);
+    X509_free(otherCertificate);
+    EVP_PKEY_free(otherKey);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+}
+
+static void testCopyPayloadAtPath_invalid(void)
+{
+    long length;
+    RMAssert(RMReceiptCopyPayloadAtPath("/nonexistent/receipt", NULL, &length) == NULL);
+
+    char *path = RMTestTemporaryPath();
+    FILE *fp = fopen(path, "wb");
+    fputs("receipt", fp);
+    fclose(fp);
+    RMAssert(RMReceiptCopyPayloadAtPath(path, NULL, &length) == NULL);
+    unlink(path);
+    free(path);
+}
+
+static void testVerifierCreate_invalid(void)
+{
+    const uint8_t certificate[] = {0x30, 0x03, 0x02, 0x01, 0x01};
+    RMAssert(RMReceiptVerifierCreate(certificate, sizeof(certificate)) == NULL);
+    RMAssert(RMReceiptVerifierCreate(certificate, 0) == NULL);
+}
+
+typedef struct
+{
+    RMReceiptVerifier *verifier;
+    const char *path;
+    int verified;
+} RMTestVerification;
+
+static void *RMTestVerify(void *context)
+{
+    RMTestVerification *verification = context;
+    for (int i = 0; i < 20; i++)
+    {
+        PKCS7 *p7 = RMReceiptReadPKCS7(verification->path);
+        verification->verified += p7 && RMReceiptVerifierVerify(verification->verifier, p7);
+        PKCS7_free(p7);
+    }
+    return NULL;
+}
+
+static void testVerifierVerify_threads(void)
+{
+    EVP_PKEY *key;
+    X509 *certificate;
+    RMAssert(RMTestCreateCertificate(&key, &certificate));
+    RMTestBuffer certificateData = RMTestCertificateData(certificate);
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 10, 2);
+    char *path = RMTestTemporaryPath();
+    RMAssert(RMTestWritePKCS7(path, &payload, key, certificate));
+
+    RMReceiptVerifier *verifier = RMReceiptVerifierCreate(certificateData.bytes, certificateData.length);
+    RMAssert(verifier != NULL);
+    pthread_t threads[4];
+    RMTestVerification verifications[4];
+    for (int i = 0; i < 4; i++)
+    {
+        verifications[i] = (RMTestVerification){verifier, path, 0};
+        pthread_create(&threads[i], NULL, RMTestVerify, &verifications[i]);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], NULL);
+        RMAssert(verifications[i].verified == 20);
+    }
+
+    RMReceiptVerifierFree(verifier);
+    unlink(path);
+    free(path);
+    RMTestBufferFree(&payload);
+    RMTestBufferFree(&certificateData);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+}
+
+static void testReceiptFileOpen(void)
+{
+    EVP_PKEY *key;
+    X509 *certificate;
+    RMAssert(RMTestCreateCertificate(&key, &certificate));
+    RMTestBuffer certificateData = RMTestCertificateData(certificate);
+    RMReceiptVerifier *verifier = RMReceiptVerifierCreate(certificateData.bytes, certificateData.length);
+    EVP_PKEY *otherKey;
+    X509 *otherCertificate;
+    RMAssert(RMTestCreateCertificate(&otherKey, &otherCertificate));
+    RMTestBuffer otherCertificateData = RMTestCertificateData(otherCertificate);
+    RMReceiptVerifier *otherVerifier = RMReceiptVerifierCreate(otherCertificateData.bytes, otherCertificateData.length);
+    const size_t purchaseCounts[] = {1, 300};
+    for (size_t i = 0; i < sizeof(purchaseCounts) / sizeof(purchaseCounts[0]); i++)
+    {
+        RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", purchaseCounts[i], 2);
+        for (int streamed = 0; streamed <= 1; streamed++)
+        {
+            char *path = RMTestTemporaryPath();
+            RMAssert(streamed ? RMTestWriteStreamedPKCS7(path, &payload, key, certificate) : RMTestWritePKCS7(path, &payload, key, certificate));
+
+            RMReceiptFile *file = RMReceiptFileOpen(path, verifier);
+            RMAssert(file != NULL);
+            if (file)
+            {
+                long length;
+                const uint8_t *result = RMReceiptFileGetPayload(file, &length);
+                RMAssert(length == (long)payload.length && memcmp(result, payload.bytes, length) == 0);
+                RMReceiptFileClose(file);
+            }
+
+            file = RMReceiptFileOpen(path, NULL);
+            RMAssert(file != NULL);
+            if (file)
+            {
+                long length;
+                RMAssert(RMReceiptFileGetContents(file, &length) != NULL && length > (long)payload.length);
+                RMAssert(RMReceiptFileVerify(file, otherVerifier) == 0);
+                RMAssert(RMReceiptFileVerify(file, verifier) == 1);
+                const uint8_t *result = RMReceiptFileGetPayload(file, &length);
+                RMAssert(length == (long)payload.length && memcmp(result, payload.bytes, length) == 0);
+                RMReceiptFileClose(file);
+            }
+
+            unlink(path);
+            free(path);
+        }
+        RMTestBufferFree(&payload);
+    }
+    RMReceiptVerifierFree(otherVerifier);
+    RMReceiptVerifierFree(verifier);
+    RMTestBufferFree(&otherCertificateData);
+    RMTestBufferFree(&certificateData);
+    X509_free(otherCertificate);
+    EVP_PKEY_free(otherKey);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+}
+
+static void testReceiptFileOpen_invalid(void)
+{
+    RMAssert(RMReceiptFileOpen("/nonexistent/receipt", NULL) == NULL);
+
+    char *path = RMTestTemporaryPath();
+    RMAssert(RMReceiptFileOpen(path, NULL) == NULL); // Empty
+    FILE *fp = fopen(path, "wb");
+    fputs("receipt", fp);
+    fclose(fp);
+    RMAssert(RMReceiptFileOpen(path, NULL) == NULL);
+    unlink(path);
+    free(path);
+}
+
+static void testFindPKCS7Payload(void)
+{
+    EVP_PKEY *key;
+    X509 *certificate;
+    RMAssert(RMTestCreateCertificate(&key, &certificate));
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 1, 1);
+    char *path = RMTestTemporaryPath();
+    RMAssert(RMTestWritePKCS7(path, &payload, key, certificate));
+    RMTestBuffer container = {0};
+    FILE *fp = fopen(path, "rb");
+    uint8_t chunk[4096];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0) RMTestBufferAppend(&container, chunk, read);
+    fclose(fp);
+
+    const uint8_t *result;
+    long length;
+    RMAssert(RMReceiptFindPKCS7Payload(container.bytes, container.length, &result, &length));
+    RMAssert(result > container.bytes && length == (long)payload.length && memcmp(result, payload.bytes, length) == 0);
+    for (size_t truncated = 0; truncated < container.length; truncated += 7)
+    { // Must not read past the end
+        uint8_t *bytes = malloc(truncated + 1);
+        memcpy(bytes, container.bytes, truncated);
+        RMReceiptFindPKCS7Payload(bytes, truncated, &result, &length);
+        free(bytes);
+    }
+
+    unlink(path);
+    free(path);
+    RMTestBufferFree(&container);
+    RMTestBufferFree(&payload);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+}
+
+static void RMTestSnapshotHeader(RMReceiptSnapshotHeader *header, const RMTestBuffer *payload, uint64_t purchaseCount)
+{
+    memset(header, 0, sizeof(RMReceiptSnapshotHeader));
+    memset(header->digest, 0xAB, sizeof(header->digest));
+    header->purchaseCount = purchaseCount;
+    header->payloadLength = payload->length;
+    header->bundleIdentifier = (RMReceiptSnapshotRange){ 2, 5 };
+    header->expirationDate = NAN;
+}
+
+static void testGenerateReceiptPayload(void)
+{
+    RMTestReceiptOptions options = {.bundleIdentifier = "net.robotmedia.test", .purchaseCount = 500, .productCount = 10, .subscriptionCount = 2, .chainCount = 5, .renewalRate = 0.5, .cancellationRate = 0.1, .seed = 42};
+    RMTestReceiptStatistics statistics;
+    RMTestBuffer payload = RMTestGenerateReceiptPayload(&options, &statistics);
+    RMAssert(statistics.purchaseCount == 500);
+    RMAssert(statistics.renewalCount > 0 && statistics.renewalCount < 500);
+    RMAssert(statistics.cancellationCount > 0 && statistics.cancellationCount < statistics.purchaseCount);
+
+    RMReceiptPurchaseTable *table = RMReceiptPurchaseTableCreate(payload.bytes, payload.length);
+    RMAssert(table != NULL && table->count == 500 && table->unparsedDateCount == 0);
+    if (table)
+    {
+        size_t renewalCount = 0, cancellationCount = 0;
+        for (long i = 0; i < table->count; i++)
+        {
+            renewalCount += table->expirationDates[i] != RMReceiptPurchaseTableNoDate;
+            cancellationCount += table->cancellationDates[i] != RMReceiptPurchaseTableNoDate;
+        }
+        RMAssert(renewalCount == statistics.renewalCount);
+        RMAssert(cancellationCount == statistics.cancellationCount);
+        RMAssert(table->productCount <= 12);
+        RMReceiptPurchaseTableFree(table);
+    }
+
+    RMTestBuffer again = RMTestGenerateReceiptPayload(&options, NULL);
+    RMAssert(again.length == payload.length && memcmp(again.bytes, payload.bytes, payload.length) == 0); // Same seed, same receipt
+    RMTestBufferFree(&again);
+    RMTestBufferFree(&payload);
+
+    options = (RMTestReceiptOptions){.minimumLength = 1024, .productCount = 1, .seed = 1};
+    payload = RMTestGenerateReceiptPayload(&options, &statistics);
+    RMAssert(payload.length >= 1024 && payload.length < 2048);
+    RMAssert(statistics.renewalCount == 0 && statistics.cancellationCount == 0);
+    RMTestBufferFree(&payload);
+}
+
+static void testAuthority(void)
+{
+    RMTestAuthority authority;
+    RMAssert(RMTestAuthorityCreate(&authority));
+    char *authorityPath = RMTestTemporaryPath();
+    RMAssert(RMTestAuthorityWrite(&authority, authorityPath));
+    RMTestAuthorityFree(&authority);
+    RMAssert(RMTestAuthorityRead(&authority, authorityPath));
+
+    RMTestBuffer rootData = RMTestCertificateData(authority.root);
+    RMReceiptVerifier *verifier = RMReceiptVerifierCreate(rootData.bytes, rootData.length);
+    RMTestBuffer signerData = RMTestCertificateData(authority.signer);
+    RMReceiptVerifier *signerVerifier = RMReceiptVerifierCreate(signerData.bytes, signerData.length);
+    RMTestReceiptOptions options = {.purchaseCount = 100, .productCount = 5, .subscriptionCount = 1, .chainCount = 1, .renewalRate = 0.3, .seed = 7};
+    RMTestBuffer payload = RMTestGenerateReceiptPayload(&options, NULL);
+    for (int streamed = 0; streamed <= 1; streamed++)
+    {
+        char *path = RMTestTemporaryPath();
+        RMAssert(RMTestAuthorityWritePKCS7(&authority, path, &payload, streamed));
+        RMReceiptFile *file = RMReceiptFileOpen(path, verifier);
+        RMAssert(file != NULL);
+        if (file)
+        {
+            long length;
+            const uint8_t *result = RMReceiptFileGetPayload(file, &length);
+            RMAssert(length == (long)payload.length && memcmp(result, payload.bytes, length) == 0);
+            RMReceiptFileClose(file);
+        }
+        RMAssert(RMReceiptFileOpen(path, signerVerifier) == NULL); // Only the root is trusted
+        unlink(path);
+        free(path);
+    }
+    RMTestBufferFree(&payload);
+    RMReceiptVerifierFree(signerVerifier);
+    RMTestBufferFree(&signerData);
+    RMReceiptVerifierFree(verifier);
+    RMTestBufferFree(&rootData);
+    RMTestAuthorityFree(&authority);
+    RMAssert(RMTestAuthorityRead(&authority, "/nonexistent/authority.pem") == 0);
+    unlink(authorityPath);
+    free(authorityPath);
+}
+
+static void testSnapshot(void)
+{
+    const uint8_t key[] = "key";
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 2, 1);
+    RMReceiptSnapshotHeader header;
+    RMTestSnapshotHeader(&header, &payload, 2);
+    RMReceiptSnapshotPurchase purchases[2];
+    memset(purchases, 0, sizeof(purchases));
+    purchases[0].entry = (RMReceiptSnapshotRange){ 0, 10 };
+    purchases[0].quantity = 3;
+    purchases[0].purchaseDate = 1381838400;
+    purchases[0].subscriptionExpirationDate = NAN;
+    purchases[1].productIdentifier = (RMReceiptSnapshotRange){ 10, (uint32_t)payload.length - 10 };
+    purchases[1].webOrderLineItemID = -1;
+    char *path = RMTestTemporaryPath();
+    RMAssert(RMReceiptSnapshotWrite(path, &header, purchases, key, sizeof(key)));
+    RMAssert(header.length == sizeof(header) + sizeof(purchases));
+
+    RMReceiptSnapshot *snapshot = RMReceiptSnapshotOpen(path, header.digest, payload.length, key, sizeof(key));
+    RMAssert(snapshot != NULL);
+    if (snapshot)
+    {
+        const RMReceiptSnapshotHeader *result = RMReceiptSnapshotGetHeader(snapshot);
+        RMAssert(result->purchaseCount == 2 && result->bundleIdentifier.offset == 2 && result->bundleIdentifier.length == 5 && isnan(result->expirationDate));
+        long count;
+        const RMReceiptSnapshotPurchase *resultPurchases = RMReceiptSnapshotGetPurchases(snapshot, &count);
+        RMAssert(count == 2 && memcmp(resultPurchases, purchases, sizeof(purchases)) == 0);
+        RMReceiptSnapshotClose(snapshot);
+    }
+
+    // Replaced atomically
+    RMTestSnapshotHeader(&header, &payload, 0);
+    RMAssert(RMReceiptSnapshotWrite(path, &header, NULL, key, sizeof(key)));
+    snapshot = RMReceiptSnapshotOpen(path, header.digest, payload.length, key, sizeof(key));
+    long count = -1;
+    RMAssert(snapshot != NULL && RMReceiptSnapshotGetPurchases(snapshot, &count) != NULL && count == 0);
+    RMReceiptSnapshotClose(snapshot);
+
+    unlink(path);
+    free(path);
+    RMTestBufferFree(&payload);
+}
+
+static void testSnapshot_invalid(void)
+{
+    const uint8_t key[] = "key";
+    RMTestBuffer payload = RMTestReceiptPayload("net.robotmedia.test", 1, 1);
+    RMReceiptSnapshotHeader header;
+    RMTestSnapshotHeader(&header, &payload, 0);
+    char *path = RMTestTemporaryPath();
+    RMAssert(RMReceiptSnapshotOpen("/nonexistent/snapshot", header.digest, payload.length, key, sizeof(key)) == NULL);
+    RMAssert(RMReceiptSnapshotOpen(path, header.digest, payload.length, key, sizeof(key)) == NULL); // Empty
+    RMAssert(RMReceiptSnapshotWrite(path, &header, NULL, key, sizeof(key)));
+
+    // Another receipt or key
+    RMAssert(RMReceiptSnapshotOpen(path, header.digest, payload.length - 1, key, sizeof(key)) == NULL);
+    uint8_t digest[32];
+    memcpy(digest, header.digest, sizeof(digest));
+    digest[31] ^= 1;
+    RMAssert(RMReceiptSnapshotOpen(path, digest, payload.length, key, sizeof(key)) == NULL);
+    const uint8_t otherKey[] = "kez";
+    RMAssert(RMReceiptSnapshotOpen(path, header.digest, payload.length, otherKey, sizeof(otherKey)) == NULL);
+
+    // Tampered or truncated
+    RMTestBuffer contents = {0};
+    FILE *fp = fopen(path, "rb");
+    uint8_t chunk[4096];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0) RMTestBufferAppend(&contents, chunk, read);
+    fclose(fp);
+    for (size_t i = 0; i < contents.length; i += 3)
+    {
+        contents.bytes[i] ^= 0x20;
+        fp = fopen(path, "wb");
+        fwrite(contents.bytes, 1, contents.length, fp);
+        fclose(fp);
+        RMAssert(RMReceiptSnapshotOpen(path, header.digest, payload.length, key, sizeof(key)) == NULL);
+        contents.bytes[i] ^= 0x20;
+    }
+    for (size_t length = 0; length < contents.length; length += 5)
+    {
+        fp = fopen(path, "wb");
+        fwrite(contents.bytes, 1, length, fp);
+        fclose(fp);
+        RMAssert(RMReceiptSnapshotOpen(path, header.digest, payload.length, key, sizeof(key)) == NULL);
+    }
+
+    // Authenticated but out of bounds
+    RMTestSnapshotHeader(&header, &payload, 0);
+    header.receiptHash = (RMReceiptSnapshotRange){ (uint32_t)payload.length, 1 };
+    RMAssert(RMReceiptSnapshotWrite(path, &header, NULL, key, sizeof(key)));
+    RMAssert(RMReceiptSnapshotOpen(path, header.digest, payload.length, key, sizeof(key)) == NULL);
+
+    unlink(path);
+    free(path);
+    RMTestBufferFree(&contents);
+    RMTestBufferFree(&payload);
+}
+
+int main(void)
+{
+    testReadInteger();
+    testReadInteger_range();
+    testReadInteger64();
+    testReadString();
+    testEnumerateAttributes();
+    testEnumerateAttributes_stop();
+    testEnumerateAttributes_invalid();
+    testEnumerateAttributes_fuzz();
+    testScanPurchases();
+    testContainsProduct();
+    testFindBytes();
+    testContainsProduct_prefilter();
+    testPurchaseTable();
+    testPurchaseTable_products();
+    testStringPool();
+    testTimeline();
+    testTimeline_random();
+    testMatchEntries();
+    testParseRFC3339Date();
+    testVerifyHash();
+    testCopyPayloadAtPath();
+    testCopyPayloadAtPath_invalid();
+    testVerifierCreate_invalid();
+    testVerifierVerify_threads();
+    testReceiptFileOpen();
+    testReceiptFileOpen_invalid();
+    testFindPKCS7Payload();
+    testGenerateReceiptPayload();
+    testAuthority();
+    testSnapshot();
+    testSnapshot_invalid();
+    if (_failures > 0)
+    {
+        fprintf(stderr, "%d assertion(s) failed\n", _failures);
+        return EXIT_FAILURE;
+    }
+    printf("All tests passed\n");
+    return EXIT_SUCCESS;
+}
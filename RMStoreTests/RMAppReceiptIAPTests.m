@@ -8,6 +8,7 @@
 
 #import <XCTest/XCTest.h>
 #import "RMAppReceipt.h"
+#import "RMAppReceiptTestData.h"
 
 @interface RMAppReceiptIAPTests : XCTestCase
 
@@ -33,6 +34,38 @@
     XCTAssertTrue(_purchase.webOrderLineItemID == 0, @"");
 }
 
+- (void)testInitWithASN1Data_webOrderLineItemID
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    // Web order line item IDs of real receipts don't fit in 32 bits
+    const NSInteger webOrderLineItemID = 1000000012345678;
+    NSData *data = RMASN1TestSet(@[RMASN1TestAttribute(1711, RMASN1TestInteger(webOrderLineItemID))]);
+    _purchase = [[RMAppReceiptIAP alloc] initWithASN1Data:data];
+    XCTAssertTrue(_purchase.webOrderLineItemID == webOrderLineItemID, @"");
+}
+
+- (void)testProperties_concurrentAccess
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    _purchase = [[RMAppReceiptIAP alloc] initWithASN1Data:RMAppReceiptTestIAPData(@"product", @"1000000000", @"2013-10-15T12:00:00Z", nil)];
+    NSMutableSet *productIdentifiers = [NSMutableSet set];
+    NSMutableSet *purchaseDates = [NSMutableSet set];
+    NSMutableArray *absentDates = [NSMutableArray array];
+    dispatch_apply(64, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+        NSString *productIdentifier = _purchase.productIdentifier;
+        NSDate *purchaseDate = _purchase.purchaseDate;
+        NSDate *absentDate = _purchase.cancellationDate ? : _purchase.subscriptionExpirationDate;
+        @synchronized(productIdentifiers)
+        { // Pointers, so that every thread must see the same decoded objects
+            [productIdentifiers addObject:[NSValue valueWithNonretainedObject:productIdentifier]];
+            [purchaseDates addObject:[NSValue valueWithNonretainedObject:purchaseDate]];
+            if (absentDate) [absentDates addObject:absentDate];
+        }
+    });
+    XCTAssertEqual(productIdentifiers.count, (NSUInteger)1, @"");
+    XCTAssertEqual(purchaseDates.count, (NSUInteger)1, @"");
+    XCTAssertEqual(absentDates.count, (NSUInteger)0, @"");
+    XCTAssertEqualObjects(_purchase.productIdentifier, @"product", @"");
+}
+
 - (void)testIsActiveAutoRenewableSubscriptionForDate_throws
 {
     _purchase = [[RMAppReceiptIAP alloc] initWithASN1Data:[NSData data]];
@@ -0,0 +1,62 @@
+//
+//  RMAppReceiptRenewalChainTests.m
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import "RMAppReceipt.h"
+#import "RMAppReceiptTestData.h"
+
+@interface RMAppReceiptRenewalChainTests : XCTestCase
+
+@end
+
+@implementation RMAppReceiptRenewalChainTests {
+    RMAppReceiptRenewalChain *_chain;
+}
+
+- (void)testInitWithInAppPurchases_empty
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    _chain = [[RMAppReceiptRenewalChain alloc] initWithInAppPurchases:@[]];
+    XCTAssertNotNil(_chain, @"");
+    XCTAssertTrue(_chain.count == 0, @"");
+    XCTAssertNil(_chain.head, @"");
+    XCTAssertNil(_chain.tail, @"");
+    XCTAssertNil(_chain.originalTransactionIdentifier, @"");
+}
+
+- (void)testInitWithInAppPurchases_sorted
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSArray *purchases = @[[self renewalWithTransactionIdentifier:@"1000000000" purchaseDate:@"2013-10-15T12:00:00Z"],
+                           [self renewalWithTransactionIdentifier:@"1000000001" purchaseDate:@"2013-11-15T12:00:00Z"]];
+    _chain = [[RMAppReceiptRenewalChain alloc] initWithInAppPurchases:purchases];
+    XCTAssertEqualObjects(_chain.inAppPurchases, purchases, @"");
+    XCTAssertEqualObjects(_chain.originalTransactionIdentifier, @"1000000000", @"");
+    XCTAssertTrue(_chain.head == purchases[0], @"");
+    XCTAssertTrue(_chain.tail == purchases[1], @"");
+    XCTAssertTrue(_chain.count == 2, @"");
+}
+
+- (void)testInitWithInAppPurchases_unsorted
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSArray *purchases = @[[self renewalWithTransactionIdentifier:@"1000000003" purchaseDate:@"2013-12-15T12:00:00Z"],
+                           [self renewalWithTransactionIdentifier:@"1000000001" purchaseDate:@"2013-11-15T12:00:00Z"],
+                           [self renewalWithTransactionIdentifier:@"1000000002" purchaseDate:@"2013-11-15T12:00:00Z"],
+                           [self renewalWithTransactionIdentifier:@"1000000000" purchaseDate:nil],
+                           [self renewalWithTransactionIdentifier:@"1000000004" purchaseDate:@"2013-10-15T12:00:00-0800"]];
+    _chain = [[RMAppReceiptRenewalChain alloc] initWithInAppPurchases:purchases];
+    XCTAssertEqualObjects([_chain.inAppPurchases valueForKey:@"transactionIdentifier"], (@[@"1000000000", @"1000000004", @"1000000001", @"1000000002", @"1000000003"]), @"");
+    XCTAssertEqualObjects(_chain.head.transactionIdentifier, @"1000000000", @"");
+    XCTAssertEqualObjects(_chain.tail.transactionIdentifier, @"1000000003", @"");
+}
+
+- (RMAppReceiptIAP*)renewalWithTransactionIdentifier:(NSString*)transactionIdentifier purchaseDate:(NSString*)purchaseDate
+{
+    NSData *data = RMAppReceiptTestRenewalIAPData(@"subscription", transactionIdentifier, @"1000000000", purchaseDate, @"2014-01-15T12:00:00Z");
+    return [[RMAppReceiptIAP alloc] initWithASN1Data:data];
+}
+
+@end
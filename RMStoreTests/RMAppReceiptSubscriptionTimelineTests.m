@@ -0,0 +1,117 @@
+//
+//  RMAppReceiptSubscriptionTimelineTests.m
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import "RMAppReceipt.h"
+#import "RMAppReceiptTestData.h"
+
+@interface RMAppReceiptSubscriptionTimelineTests : XCTestCase
+
+@end
+
+@implementation RMAppReceiptSubscriptionTimelineTests {
+    RMAppReceiptSubscriptionTimeline *_timeline;
+}
+
+- (void)testInitWithInAppPurchases_empty
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    _timeline = [[RMAppReceiptSubscriptionTimeline alloc] initWithInAppPurchases:@[]];
+    XCTAssertNotNil(_timeline, @"");
+    XCTAssertTrue(_timeline.periodCount == 0, @"");
+    XCTAssertFalse([_timeline isActiveForDate:[NSDate date]], @"");
+    XCTAssertNil([_timeline nextChangeAfterDate:[NSDate date]], @"");
+}
+
+- (void)testInitWithInAppPurchases_lapse
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSArray *purchases = @[[self purchaseFromDate:@"2013-12-15T12:00:00Z" toDate:@"2014-01-15T12:00:00Z"],
+                           [self purchaseFromDate:@"2013-10-15T12:00:00Z" toDate:@"2013-11-15T12:00:00Z"],
+                           [self purchaseFromDate:@"2013-10-20T12:00:00Z" toDate:@"2013-11-01T12:00:00Z"]];
+    _timeline = [[RMAppReceiptSubscriptionTimeline alloc] initWithInAppPurchases:purchases];
+    XCTAssertTrue(_timeline.periodCount == 2, @"");
+
+    NSDate *purchased = [NSDate dateWithTimeIntervalSince1970:1381838400]; // 2013-10-15T12:00:00Z
+    NSDate *expired = [NSDate dateWithTimeIntervalSince1970:1384516800]; // 2013-11-15T12:00:00Z
+    NSDate *lapsed = [NSDate dateWithTimeIntervalSince1970:1385899200]; // 2013-12-01T12:00:00Z
+    NSDate *renewed = [NSDate dateWithTimeIntervalSince1970:1387108800]; // 2013-12-15T12:00:00Z
+    XCTAssertFalse([_timeline isActiveForDate:[purchased dateByAddingTimeInterval:-1]], @"");
+    XCTAssertTrue([_timeline isActiveForDate:purchased], @"");
+    XCTAssertTrue([_timeline isActiveForDate:expired], @"");
+    XCTAssertFalse([_timeline isActiveForDate:lapsed], @"");
+    XCTAssertTrue([_timeline isActiveForDate:renewed], @"");
+    XCTAssertEqualObjects([_timeline nextChangeAfterDate:purchased], expired, @"");
+    XCTAssertEqualObjects([_timeline nextChangeAfterDate:lapsed], renewed, @"");
+    XCTAssertEqualObjects([_timeline nextChangeAfterDate:renewed], [NSDate dateWithTimeIntervalSince1970:1389787200], @""); // 2014-01-15T12:00:00Z
+    XCTAssertNil([_timeline nextChangeAfterDate:[NSDate distantFuture]], @"");
+}
+
+- (void)testInitWithInAppPurchases_canceled
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSMutableArray *attributes = [NSMutableArray array];
+    [attributes addObject:RMASN1TestAttribute(1702, RMASN1TestUTF8String(@"subscription"))];
+    [attributes addObject:RMASN1TestAttribute(1704, RMASN1TestIA5String(@"2013-10-15T12:00:00Z"))];
+    [attributes addObject:RMASN1TestAttribute(1708, RMASN1TestIA5String(@"2013-11-15T12:00:00Z"))];
+    [attributes addObject:RMASN1TestAttribute(1712, RMASN1TestIA5String(@"2013-10-20T12:00:00Z"))];
+    RMAppReceiptIAP *canceled = [[RMAppReceiptIAP alloc] initWithASN1Data:RMASN1TestSet(attributes)];
+    RMAppReceiptIAP *product = [[RMAppReceiptIAP alloc] initWithASN1Data:RMAppReceiptTestIAPData(@"product", @"1000000001", @"2013-10-15T12:00:00Z", nil)];
+    _timeline = [[RMAppReceiptSubscriptionTimeline alloc] initWithInAppPurchases:@[canceled, product]];
+    XCTAssertTrue(_timeline.periodCount == 0, @"");
+    XCTAssertFalse([_timeline isActiveForDate:[NSDate dateWithTimeIntervalSince1970:1381838400]], @"");
+}
+
+- (void)testIsActiveForDate_inAppPurchases
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSArray *purchases = @[[self purchaseFromDate:@"2013-10-15T12:00:00Z" toDate:@"2013-11-15T12:00:00Z"],
+                           [self purchaseFromDate:@"2013-11-15T12:00:00Z" toDate:@"2013-12-15T12:00:00Z"],
+                           [self purchaseFromDate:@"2013-12-20T12:00:00Z" toDate:@"2014-01-20T12:00:00Z"],
+                           [self purchaseFromDate:nil toDate:@"2013-09-15T12:00:00Z"]];
+    _timeline = [[RMAppReceiptSubscriptionTimeline alloc] initWithInAppPurchases:purchases];
+    for (NSTimeInterval interval = 1375000000; interval < 1392000000; interval += 43200)
+    {
+        NSDate *date = [NSDate dateWithTimeIntervalSince1970:interval];
+        BOOL active = NO;
+        for (RMAppReceiptIAP *purchase in purchases)
+        {
+            active |= [purchase isActiveAutoRenewableSubscriptionForDate:date];
+        }
+        XCTAssertEqual([_timeline isActiveForDate:date], active, @"%@", date);
+    }
+}
+
+- (void)testPerformanceIsActiveForDate
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSMutableArray *purchases = [NSMutableArray array];
+    NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
+    formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+    formatter.timeZone = [NSTimeZone timeZoneForSecondsFromGMT:0];
+    formatter.dateFormat = @"yyyy-MM-dd'T'HH:mm:ss'Z'";
+    NSDate *start = [NSDate dateWithTimeIntervalSince1970:1381838400];
+    for (NSUInteger i = 0; i < 1000; i++)
+    {
+        // Monthly renewals with a lapse every year
+        NSDate *purchaseDate = [start dateByAddingTimeInterval:i * 30 * 86400 + (i / 12) * 5 * 86400];
+        NSDate *expirationDate = [purchaseDate dateByAddingTimeInterval:30 * 86400];
+        [purchases addObject:[self purchaseFromDate:[formatter stringFromDate:purchaseDate] toDate:[formatter stringFromDate:expirationDate]]];
+    }
+    _timeline = [[RMAppReceiptSubscriptionTimeline alloc] initWithInAppPurchases:purchases];
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 100000; i++)
+        {
+            NSDate *date = [start dateByAddingTimeInterval:(i * 7919) % (1000 * 31 * 86400)];
+            [_timeline isActiveForDate:date];
+            [_timeline nextChangeAfterDate:date];
+        }
+    }];
+}
+
+- (RMAppReceiptIAP*)purchaseFromDate:(NSString*)purchaseDate toDate:(NSString*)expirationDate
+{
+    return [[RMAppReceiptIAP alloc] initWithASN1Data:RMAppReceiptTestIAPData(@"subscription", @"1000000000", purchaseDate, expirationDate)];
+}
+
+@end
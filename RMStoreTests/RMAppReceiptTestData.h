@@ -0,0 +1,50 @@
+//
+//  RMAppReceiptTestData.h
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/** DER helpers to build app receipt payloads in tests. Values are encoded in the same attribute layout that RMAppReceipt consumes.
+ */
+
+NSData* RMASN1TestInteger(NSInteger value);
+
+NSData* RMASN1TestUTF8String(NSString *string);
+
+NSData* RMASN1TestIA5String(NSString *string);
+
+/** Returns SEQUENCE { INTEGER type, INTEGER 1, OCTET STRING value }.
+ */
+NSData* RMASN1TestAttribute(NSInteger type, NSData *value);
+
+/** Returns a SET with the given attributes.
+ */
+NSData* RMASN1TestSet(NSArray *attributes);
+
+/** Returns the payload of an in-app purchase. Dates are RFC 3339 strings and can be nil.
+ */
+NSData* RMAppReceiptTestIAPData(NSString *productIdentifier, NSString *transactionIdentifier, NSString *purchaseDate, NSString *expirationDate);
+
+/** Returns the payload of an in-app purchase that renews the given original transaction. Dates are RFC 3339 strings and can be nil.
+ */
+NSData* RMAppReceiptTestRenewalIAPData(NSString *productIdentifier, NSString *transactionIdentifier, NSString *originalTransactionIdentifier, NSString *purchaseDate, NSString *expirationDate);
+
+/** Returns the payload of an app receipt with the given in-app purchase payloads.
+ */
+NSData* RMAppReceiptTestData(NSString *bundleIdentifier, NSArray *inAppPurchases);
+
+/** Returns the payload of an app receipt with the given number of in-app purchases, spread over productCount products.
+ */
+NSData* RMAppReceiptTestDataWithPurchaseCount(NSUInteger purchaseCount, NSUInteger productCount);
+
+/** Returns the payload of an app receipt with the given number of monthly auto-renewable subscription purchases, spread over chainCount renewal chains of one product each.
+ */
+NSData* RMAppReceiptTestRenewalDataWithPurchaseCount(NSUInteger purchaseCount, NSUInteger chainCount);
+
+/** Returns an unsigned PKCS #7 container with the given payload. Only usable when the signature is not verified.
+ */
+NSData* RMAppReceiptTestPKCS7Data(NSData *payload);
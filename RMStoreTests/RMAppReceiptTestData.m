@@ -0,0 +1,171 @@
+//
+//  RMAppReceiptTestData.m
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+
+#import "RMAppReceiptTestData.h"
+
+static NSData* RMASN1TestEncode(uint8_t tag, NSData *content)
+{
+    NSMutableData *data = [NSMutableData dataWithBytes:&tag length:1];
+    const NSUInteger length = content.length;
+    if (length < 0x80)
+    {
+        const uint8_t byte = length;
+        [data appendBytes:&byte length:1];
+    }
+    else
+    {
+        uint8_t bytes[sizeof(NSUInteger)];
+        uint8_t count = 0;
+        for (NSUInteger l = length; l > 0; l >>= 8) count++;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            bytes[i] = (length >> (8 * (count - 1 - i))) & 0xFF;
+        }
+        const uint8_t lengthOfLength = 0x80 | count;
+        [data appendBytes:&lengthOfLength length:1];
+        [data appendBytes:bytes length:count];
+    }
+    [data appendData:content];
+    return data;
+}
+
+NSData* RMASN1TestInteger(NSInteger value)
+{
+    uint8_t bytes[sizeof(NSInteger) + 1];
+    NSUInteger count = 0;
+    do
+    {
+        bytes[sizeof(bytes) - 1 - count] = value & 0xFF;
+        value >>= 8;
+        count++;
+    } while (value > 0);
+    if (bytes[sizeof(bytes) - count] & 0x80)
+    { // Keep the value positive
+        bytes[sizeof(bytes) - 1 - count] = 0;
+        count++;
+    }
+    return RMASN1TestEncode(0x02, [NSData dataWithBytes:bytes + sizeof(bytes) - count length:count]);
+}
+
+NSData* RMASN1TestUTF8String(NSString *string)
+{
+    return RMASN1TestEncode(0x0C, [string dataUsingEncoding:NSUTF8StringEncoding]);
+}
+
+NSData* RMASN1TestIA5String(NSString *string)
+{
+    return RMASN1TestEncode(0x16, [string dataUsingEncoding:NSASCIIStringEncoding]);
+}
+
+NSData* RMASN1TestAttribute(NSInteger type, NSData *value)
+{
+    NSMutableData *content = [NSMutableData data];
+    [content appendData:RMASN1TestInteger(type)];
+    [content appendData:RMASN1TestInteger(1)];
+    [content appendData:RMASN1TestEncode(0x04, value)];
+    return RMASN1TestEncode(0x30, content);
+}
+
+NSData* RMASN1TestSet(NSArray *attributes)
+{
+    NSMutableData *content = [NSMutableData data];
+    for (NSData *attribute in attributes)
+    {
+        [content appendData:attribute];
+    }
+    return RMASN1TestEncode(0x31, content);
+}
+
+NSData* RMAppReceiptTestIAPData(NSString *productIdentifier, NSString *transactionIdentifier, NSString *purchaseDate, NSString *expirationDate)
+{
+    return RMAppReceiptTestRenewalIAPData(productIdentifier, transactionIdentifier, transactionIdentifier, purchaseDate, expirationDate);
+}
+
+NSData* RMAppReceiptTestRenewalIAPData(NSString *productIdentifier, NSString *transactionIdentifier, NSString *originalTransactionIdentifier, NSString *purchaseDate, NSString *expirationDate)
+{
+    NSMutableArray *attributes = [NSMutableArray array];
+    [attributes addObject:RMASN1TestAttribute(1701, RMASN1TestInteger(1))];
+    [attributes addObject:RMASN1TestAttribute(1702, RMASN1TestUTF8String(productIdentifier))];
+    [attributes addObject:RMASN1TestAttribute(1703, RMASN1TestUTF8String(transactionIdentifier))];
+    [attributes addObject:RMASN1TestAttribute(1705, RMASN1TestUTF8String(originalTransactionIdentifier))];
+    if (purchaseDate)
+    {
+        [attributes addObject:RMASN1TestAttribute(1704, RMASN1TestIA5String(purchaseDate))];
+        [attributes addObject:RMASN1TestAttribute(1706, RMASN1TestIA5String(purchaseDate))];
+    }
+    if (expirationDate)
+    {
+        [attributes addObject:RMASN1TestAttribute(1708, RMASN1TestIA5String(expirationDate))];
+    }
+    return RMASN1TestSet(attributes);
+}
+
+NSData* RMAppReceiptTestData(NSString *bundleIdentifier, NSArray *inAppPurchases)
+{
+    NSMutableArray *attributes = [NSMutableArray array];
+    [attributes addObject:RMASN1TestAttribute(2, RMASN1TestUTF8String(bundleIdentifier))];
+    [attributes addObject:RMASN1TestAttribute(3, RMASN1TestUTF8String(@"1.0"))];
+    [attributes addObject:RMASN1TestAttribute(19, RMASN1TestUTF8String(@"1.0"))];
+    for (NSData *inAppPurchase in inAppPurchases)
+    {
+        [attributes addObject:RMASN1TestAttribute(17, inAppPurchase)];
+    }
+    return RMASN1TestSet(attributes);
+}
+
+NSData* RMAppReceiptTestDataWithPurchaseCount(NSUInteger purchaseCount, NSUInteger productCount)
+{
+    NSMutableArray *inAppPurchases = [NSMutableArray arrayWithCapacity:purchaseCount];
+    for (NSUInteger i = 0; i < purchaseCount; i++)
+    {
+        NSString *productIdentifier = [NSString stringWithFormat:@"net.robotmedia.test.product%lu", (unsigned long)(i % productCount)];
+        NSString *transactionIdentifier = [NSString stringWithFormat:@"%lu", (unsigned long)(1000000000 + i)];
+        NSData *inAppPurchase = RMAppReceiptTestIAPData(productIdentifier, transactionIdentifier, @"2013-10-15T12:00:00Z", @"2013-11-15T12:00:00Z");
+        [inAppPurchases addObject:inAppPurchase];
+    }
+    return RMAppReceiptTestData(@"net.robotmedia.test", inAppPurchases);
+}
+
+NSData* RMAppReceiptTestRenewalDataWithPurchaseCount(NSUInteger purchaseCount, NSUInteger chainCount)
+{
+    NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
+    formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+    formatter.timeZone = [NSTimeZone timeZoneForSecondsFromGMT:0];
+    formatter.dateFormat = @"yyyy-MM-dd'T'HH:mm:ss'Z'";
+    NSMutableArray *inAppPurchases = [NSMutableArray arrayWithCapacity:purchaseCount];
+    for (NSUInteger i = 0; i < purchaseCount; i++)
+    {
+        const NSUInteger chain = i % chainCount;
+        NSString *productIdentifier = [NSString stringWithFormat:@"net.robotmedia.test.subscription%lu", (unsigned long)chain];
+        NSString *transactionIdentifier = [NSString stringWithFormat:@"%lu", (unsigned long)(1000000000 + i)];
+        NSString *originalTransactionIdentifier = [NSString stringWithFormat:@"%lu", (unsigned long)(1000000000 + chain)];
+        NSDate *purchaseDate = [NSDate dateWithTimeIntervalSince1970:1381838400 + (i / chainCount) * 30 * 86400.0];
+        NSDate *expirationDate = [purchaseDate dateByAddingTimeInterval:30 * 86400];
+        NSData *inAppPurchase = RMAppReceiptTestRenewalIAPData(productIdentifier, transactionIdentifier, originalTransactionIdentifier, [formatter stringFromDate:purchaseDate], [formatter stringFromDate:expirationDate]);
+        [inAppPurchases addObject:inAppPurchase];
+    }
+    return RMAppReceiptTestData(@"net.robotmedia.test", inAppPurchases);
+}
+
+NSData* RMAppReceiptTestPKCS7Data(NSData *payload)
+{
+    static const uint8_t signedDataOID[] = {0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x02};
+    static const uint8_t dataOID[] = {0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x01};
+    NSMutableData *contentInfo = [NSMutableData data];
+    [contentInfo appendData:RMASN1TestEncode(0x06, [NSData dataWithBytes:dataOID length:sizeof(dataOID)])];
+    [contentInfo appendData:RMASN1TestEncode(0xA0, RMASN1TestEncode(0x04, payload))];
+    NSMutableData *signedData = [NSMutableData data];
+    [signedData appendData:RMASN1TestInteger(1)];
+    [signedData appendData:RMASN1TestSet(@[])];
+    [signedData appendData:RMASN1TestEncode(0x30, contentInfo)];
+    [signedData appendData:RMASN1TestSet(@[])];
+    NSMutableData *container = [NSMutableData data];
+    [container appendData:RMASN1TestEncode(0x06, [NSData dataWithBytes:signedDataOID length:sizeof(signedDataOID)])];
+    [container appendData:RMASN1TestEncode(0xA0, RMASN1TestEncode(0x30, signedData))];
+    return RMASN1TestEncode(0x30, container);
+}
@@ -7,7 +7,30 @@
 //
 
 #import <XCTest/XCTest.h>
+#import <UIKit/UIKit.h>
 #import "RMAppReceipt.h"
+#import "RMAppReceiptTestData.h"
+#import "RMAppReceiptCore.h"
+#import <malloc/malloc.h>
+#import <openssl/sha.h>
+
+@interface RMAppReceipt(Private)
+
++ (NSDate*)dateFromRFC3339Bytes:(const uint8_t*)bytes length:(long)length;
+
++ (NSDate*)formatRFC3339String:(NSString*)string;
+
++ (RMAppReceipt*)cachedReceiptAtPath:(NSString*)path;
+
++ (void)setParsingConcurrency:(NSUInteger)concurrency;
+
++ (void)setStringInterningEnabled:(BOOL)enabled;
+
++ (RMAppReceipt*)receiptWithSnapshotAtPath:(NSString*)path container:(NSData*)container digest:(NSData*)digest;
+
+- (BOOL)writeSnapshotToPath:(NSString*)path container:(NSData*)container digest:(NSData*)digest;
+
+@end
 
 @interface RMAppReceiptTests : XCTestCase
 
@@ -32,6 +55,214 @@
     XCTAssertNil(_receipt.expirationDate, @"");
 }
 
+- (void)testInitWithASN1Data
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *purchaseData = RMAppReceiptTestIAPData(@"product", @"1000000000", @"2013-10-15T12:00:00Z", nil);
+    NSData *data = RMAppReceiptTestData(@"net.robotmedia.test", @[purchaseData]);
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    XCTAssertEqualObjects(_receipt.bundleIdentifier, @"net.robotmedia.test", @"");
+    XCTAssertEqualObjects(_receipt.appVersion, @"1.0", @"");
+    XCTAssertEqualObjects(_receipt.originalAppVersion, @"1.0", @"");
+    XCTAssertTrue(_receipt.inAppPurchases.count == 1, @"");
+    RMAppReceiptIAP *purchase = _receipt.inAppPurchases.firstObject;
+    XCTAssertEqualObjects(purchase.productIdentifier, @"product", @"");
+    XCTAssertEqualObjects(purchase.transactionIdentifier, @"1000000000", @"");
+    XCTAssertEqualObjects(purchase.purchaseDate, [NSDate dateWithTimeIntervalSince1970:1381838400], @"");
+    XCTAssertNil(purchase.subscriptionExpirationDate, @"");
+}
+
+- (void)testInitWithASN1Data_mutableData
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *purchaseData = RMAppReceiptTestIAPData(@"product", @"1000000000", nil, nil);
+    NSMutableData *data = [RMAppReceiptTestData(@"net.robotmedia.test", @[purchaseData]) mutableCopy];
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    [data resetBytesInRange:NSMakeRange(0, data.length)];
+    RMAppReceiptIAP *purchase = _receipt.inAppPurchases.firstObject;
+    XCTAssertEqualObjects(purchase.productIdentifier, @"product", @"");
+}
+
+- (void)testInitWithASN1Data_parallel
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(3001, 7);
+    [RMAppReceipt setParsingConcurrency:1];
+    RMAppReceipt *serialReceipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    [RMAppReceipt setParsingConcurrency:4];
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    [RMAppReceipt setParsingConcurrency:0];
+    XCTAssertTrue(_receipt.inAppPurchases.count == 3001, @"");
+    XCTAssertEqualObjects([_receipt.inAppPurchases valueForKey:@"transactionIdentifier"], [serialReceipt.inAppPurchases valueForKey:@"transactionIdentifier"], @"");
+    XCTAssertTrue([_receipt inAppPurchasesOfProductIdentifier:@"net.robotmedia.test.product6"].count == 428, @"");
+}
+
+- (void)testInitWithASN1DataPreviousReceipt
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *purchase0 = RMAppReceiptTestIAPData(@"subscription", @"1000000000", @"2013-10-15T12:00:00Z", @"2013-11-15T12:00:00Z");
+    NSData *purchase1 = RMAppReceiptTestIAPData(@"subscription", @"1000000001", @"2013-11-15T12:00:00Z", @"2013-12-15T12:00:00Z");
+    NSData *purchase2 = RMAppReceiptTestIAPData(@"product", @"1000000002", @"2013-11-20T12:00:00Z", nil);
+    NSData *changed2 = RMAppReceiptTestIAPData(@"product", @"1000000002", @"2013-11-21T12:00:00Z", nil);
+    NSData *purchase3 = RMAppReceiptTestIAPData(@"subscription", @"1000000003", @"2013-12-15T12:00:00Z", @"2014-01-15T12:00:00Z");
+    RMAppReceipt *previousReceipt = [[RMAppReceipt alloc] initWithASN1Data:RMAppReceiptTestData(@"net.robotmedia.test", @[purchase0, purchase1, purchase2])];
+    RMAppReceiptIAP *previousPurchase = previousReceipt.inAppPurchases[1];
+    NSDate *purchaseDate = previousPurchase.purchaseDate;
+    
+    // Reordered, changed and appended
+    NSData *data = RMAppReceiptTestData(@"net.robotmedia.test", @[purchase1, purchase0, changed2, purchase3]);
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:data previousReceipt:previousReceipt];
+    RMAppReceipt *fullReceipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    XCTAssertTrue(_receipt.inAppPurchases.count == 4, @"");
+    RMAppReceiptIAP *purchase = _receipt.inAppPurchases[0];
+    XCTAssertTrue(purchase != previousPurchase, @"");
+    XCTAssertTrue(purchase.purchaseDate == purchaseDate, @"");
+    XCTAssertTrue(purchase.productIdentifier == previousPurchase.productIdentifier, @"");
+    for (NSString *key in @[@"quantity", @"productIdentifier", @"transactionIdentifier", @"originalTransactionIdentifier", @"purchaseDate", @"originalPurchaseDate", @"subscriptionExpirationDate", @"cancellationDate", @"webOrderLineItemID"])
+    {
+        XCTAssertEqualObjects([_receipt.inAppPurchases valueForKey:key], [fullReceipt.inAppPurchases valueForKey:key], @"%@", key);
+    }
+    XCTAssertEqualObjects([_receipt.inAppPurchases[2] purchaseDate], [NSDate dateWithTimeIntervalSince1970:1385035200], @""); // 2013-11-21T12:00:00Z
+    XCTAssertTrue([_receipt renewalChainOfOriginalTransactionIdentifier:@"1000000003"].count == 1, @"");
+}
+
+- (void)testInitWithASN1DataPreviousReceipt_nil
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(10, 3);
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:data previousReceipt:nil];
+    XCTAssertTrue(_receipt.inAppPurchases.count == 10, @"");
+}
+
+- (void)testReceiptWithSnapshotAtPath
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *purchase0 = RMAppReceiptTestRenewalIAPData(@"subscription", @"1000000000", @"1000000000", @"2013-10-15T12:00:00Z", @"2013-11-15T12:00:00Z");
+    NSData *purchase1 = RMAppReceiptTestRenewalIAPData(@"subscription", @"1000000001", @"1000000000", @"2013-11-15T12:00:00Z", @"2013-12-15T12:00:00Z");
+    NSData *purchase2 = RMAppReceiptTestIAPData(@"product", @"1000000002", @"2013-11-20T12:00:00Z", nil);
+    NSData *data = RMAppReceiptTestData(@"net.robotmedia.test", @[purchase0, purchase1, purchase2]);
+    NSData *container = RMAppReceiptTestPKCS7Data(data);
+    NSMutableData *digest = [NSMutableData dataWithLength:32];
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    RMAppReceipt *fullReceipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    XCTAssertTrue([fullReceipt writeSnapshotToPath:path container:container digest:digest], @"");
+    
+    _receipt = [RMAppReceipt receiptWithSnapshotAtPath:path container:container digest:digest];
+    XCTAssertNotNil(_receipt, @"");
+    for (NSString *key in @[@"bundleIdentifier", @"bundleIdentifierData", @"appVersion", @"opaqueValue", @"receiptHash", @"originalAppVersion", @"expirationDate"])
+    {
+        XCTAssertEqualObjects([_receipt valueForKey:key], [fullReceipt valueForKey:key], @"%@", key);
+    }
+    XCTAssertTrue(_receipt.inAppPurchases.count == 3, @"");
+    for (NSString *key in @[@"quantity", @"productIdentifier", @"transactionIdentifier", @"originalTransactionIdentifier", @"purchaseDate", @"originalPurchaseDate", @"subscriptionExpirationDate", @"cancellationDate", @"webOrderLineItemID"])
+    {
+        XCTAssertEqualObjects([_receipt.inAppPurchases valueForKey:key], [fullReceipt.inAppPurchases valueForKey:key], @"%@", key);
+    }
+    XCTAssertTrue([_receipt containsInAppPurchaseOfProductIdentifier:@"product"], @"");
+    XCTAssertTrue([_receipt containsActiveAutoRenewableSubscriptionOfProductIdentifier:@"subscription" forDate:[NSDate dateWithTimeIntervalSince1970:1386158400]], @""); // 2013-12-04T12:00:00Z
+    XCTAssertTrue([_receipt renewalChainOfOriginalTransactionIdentifier:@"1000000000"].count == 2, @"");
+    XCTAssertTrue([_receipt subscriptionTimelineOfProductIdentifier:@"subscription"].periodCount == 1, @"");
+    
+    // Restored receipts can be the previous receipt of a refreshed one
+    NSData *purchase3 = RMAppReceiptTestIAPData(@"product", @"1000000003", @"2013-12-20T12:00:00Z", nil);
+    RMAppReceipt *refreshedReceipt = [[RMAppReceipt alloc] initWithASN1Data:RMAppReceiptTestData(@"net.robotmedia.test", @[purchase0, purchase1, purchase2, purchase3]) previousReceipt:_receipt];
+    XCTAssertEqualObjects([refreshedReceipt.inAppPurchases[1] subscriptionExpirationDate], [NSDate dateWithTimeIntervalSince1970:1387108800], @""); // 2013-12-15T12:00:00Z
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testReceiptWithSnapshotAtPath_otherReceipt
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(10, 3);
+    NSData *container = RMAppReceiptTestPKCS7Data(data);
+    NSMutableData *digest = [NSMutableData dataWithLength:32];
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    XCTAssertNil([RMAppReceipt receiptWithSnapshotAtPath:path container:container digest:digest], @"");
+    XCTAssertTrue([receipt writeSnapshotToPath:path container:container digest:digest], @"");
+    
+    // The receipt must be the payload of the container
+    XCTAssertFalse([receipt writeSnapshotToPath:path container:RMAppReceiptTestPKCS7Data(RMAppReceiptTestDataWithPurchaseCount(11, 3)) digest:digest], @"");
+    
+    NSMutableData *otherDigest = [digest mutableCopy];
+    ((uint8_t*)otherDigest.mutableBytes)[0] = 1;
+    XCTAssertNil([RMAppReceipt receiptWithSnapshotAtPath:path container:container digest:otherDigest], @"");
+    XCTAssertNil([RMAppReceipt receiptWithSnapshotAtPath:path container:RMAppReceiptTestPKCS7Data(RMAppReceiptTestDataWithPurchaseCount(11, 3)) digest:digest], @"");
+    XCTAssertNotNil([RMAppReceipt receiptWithSnapshotAtPath:path container:container digest:digest], @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testSetSnapshotsEnabled_NO
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject;
+    NSString *path = [cachesPath stringByAppendingPathComponent:@"RMAppReceipt.snapshot"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:cachesPath withIntermediateDirectories:YES attributes:nil error:nil];
+    [[NSData dataWithBytes:"snapshot" length:8] writeToFile:path atomically:YES];
+    [RMAppReceipt setSnapshotsEnabled:NO];
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:path], @"");
+}
+
+- (void)testSetSnapshotsEnabled_YES
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    // Without a certificate receipts are not verified, so there are no snapshots
+    [RMAppReceipt setSnapshotsEnabled:YES];
+    [RMAppReceipt setAppleRootCertificateURL:[NSURL fileURLWithPath:@"/nonexistent.cer"]];
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    [RMAppReceiptTestPKCS7Data(RMAppReceiptTestData(@"net.robotmedia.test", @[])) writeToFile:path atomically:YES];
+    RMAppReceipt *receipt = [RMAppReceipt cachedReceiptAtPath:path];
+    XCTAssertEqualObjects(receipt.bundleIdentifier, @"net.robotmedia.test", @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    [RMAppReceipt setAppleRootCertificateURL:nil];
+    [RMAppReceipt setSnapshotsEnabled:NO];
+}
+
+- (void)testInitWithASN1Data_internedStrings
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(10, 3);
+    NSString *productIdentifier;
+    @autoreleasepool
+    {
+        _receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+        RMAppReceiptIAP *purchase = _receipt.inAppPurchases[0];
+        productIdentifier = purchase.productIdentifier;
+        XCTAssertTrue(productIdentifier == [_receipt.inAppPurchases[3] productIdentifier], @"");
+        XCTAssertTrue(productIdentifier != [_receipt.inAppPurchases[1] productIdentifier], @"");
+        _receipt = nil;
+    }
+    // Interned strings outlive their receipt
+    XCTAssertEqualObjects(productIdentifier, @"net.robotmedia.test.product0", @"");
+    
+    NSArray *purchases = @[RMAppReceiptTestIAPData(@"subscription", @"1000000000000000001", nil, nil),
+                           RMAppReceiptTestIAPData(@"subscription", @"1000000000000000001", nil, nil)];
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:RMAppReceiptTestData(@"net.robotmedia.test", purchases)];
+    XCTAssertTrue([_receipt.inAppPurchases[0] originalTransactionIdentifier] == [_receipt.inAppPurchases[1] originalTransactionIdentifier], @"");
+    XCTAssertEqualObjects([_receipt.inAppPurchases[1] originalTransactionIdentifier], @"1000000000000000001", @"");
+}
+
+- (void)testInitWithASN1Data_internedStrings_invalid
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    const uint8_t invalidBytes[] = {0x0C, 0x02, 0xC3, 0x28}; // UTF8String with an invalid sequence
+    NSData *invalidPurchase = RMASN1TestSet(@[RMASN1TestAttribute(1702, [NSData dataWithBytes:invalidBytes length:sizeof(invalidBytes)])]);
+    NSArray *purchases = @[invalidPurchase, invalidPurchase, RMAppReceiptTestIAPData(@"", @"1000000000", nil, nil)];
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:RMAppReceiptTestData(@"net.robotmedia.test", purchases)];
+    XCTAssertNil([_receipt.inAppPurchases[0] productIdentifier], @"");
+    XCTAssertNil([_receipt.inAppPurchases[1] productIdentifier], @"");
+    XCTAssertEqualObjects([_receipt.inAppPurchases[2] productIdentifier], @"", @"");
+}
+
+- (void)testContainsInAppPurchaseOfProductIdentifier_YES
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(10, 2);
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    BOOL result = [_receipt containsInAppPurchaseOfProductIdentifier:@"net.robotmedia.test.product1"];
+    XCTAssertTrue(result, @"");
+}
+
+- (void)testContainsInAppPurchaseOfProductIdentifierInASN1Data
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(10, 2);
+    XCTAssertTrue([RMAppReceipt containsInAppPurchaseOfProductIdentifier:@"net.robotmedia.test.product1" inASN1Data:data], @"");
+    XCTAssertFalse([RMAppReceipt containsInAppPurchaseOfProductIdentifier:@"net.robotmedia.test.product2" inASN1Data:data], @"");
+    XCTAssertFalse([RMAppReceipt containsInAppPurchaseOfProductIdentifier:nil inASN1Data:data], @"");
+    XCTAssertFalse([RMAppReceipt containsInAppPurchaseOfProductIdentifier:@"net.robotmedia.test.product1" inASN1Data:[NSData data]], @"");
+}
+
 - (void)testContainsInAppPurchaseOfProductIdentifier_NO
 { SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
     NSData *data = [NSData data];
@@ -48,12 +279,251 @@
     XCTAssertFalse(result, @"");
 }
 
+- (void)testContainsActiveAutoRenewableSubscriptionOfProductIdentifierForDate_latest
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSArray *purchases = @[RMAppReceiptTestIAPData(@"subscription", @"1000000000", @"2013-10-15T12:00:00Z", @"2013-11-15T12:00:00Z"),
+                           RMAppReceiptTestIAPData(@"subscription", @"1000000001", @"2013-12-15T12:00:00Z", @"2014-01-15T12:00:00Z"),
+                           RMAppReceiptTestIAPData(@"subscription", @"1000000002", @"2013-11-15T12:00:00Z", @"2013-12-15T12:00:00Z")];
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:RMAppReceiptTestData(@"net.robotmedia.test", purchases)];
+    NSDate *before = [NSDate dateWithTimeIntervalSince1970:1385899200]; // 2013-12-01T12:00:00Z
+    NSDate *renewed = [NSDate dateWithTimeIntervalSince1970:1388577600]; // 2014-01-01T12:00:00Z
+    NSDate *expired = [NSDate dateWithTimeIntervalSince1970:1390046400]; // 2014-01-18T12:00:00Z
+    XCTAssertFalse([_receipt containsActiveAutoRenewableSubscriptionOfProductIdentifier:@"subscription" forDate:before], @"");
+    XCTAssertTrue([_receipt containsActiveAutoRenewableSubscriptionOfProductIdentifier:@"subscription" forDate:renewed], @"");
+    XCTAssertFalse([_receipt containsActiveAutoRenewableSubscriptionOfProductIdentifier:@"subscription" forDate:expired], @"");
+    XCTAssertFalse([_receipt containsActiveAutoRenewableSubscriptionOfProductIdentifier:@"other" forDate:renewed], @"");
+}
+
+- (void)testRenewalChains
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSArray *purchases = @[RMAppReceiptTestRenewalIAPData(@"monthly", @"1000000002", @"1000000000", @"2013-12-15T12:00:00Z", @"2014-01-15T12:00:00Z"),
+                           RMAppReceiptTestRenewalIAPData(@"yearly", @"1000000003", @"1000000003", @"2013-10-20T12:00:00Z", @"2014-10-20T12:00:00Z"),
+                           RMAppReceiptTestRenewalIAPData(@"monthly", @"1000000000", @"1000000000", @"2013-10-15T12:00:00Z", @"2013-11-15T12:00:00Z"),
+                           RMAppReceiptTestRenewalIAPData(@"monthly", @"1000000001", @"1000000000", @"2013-11-15T12:00:00Z", @"2013-12-15T12:00:00Z"),
+                           RMAppReceiptTestRenewalIAPData(@"product", @"1000000004", @"1000000000", @"2013-10-15T12:00:00Z", nil)];
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:RMAppReceiptTestData(@"net.robotmedia.test", purchases)];
+    XCTAssertEqualObjects([_receipt.renewalChains valueForKey:@"originalTransactionIdentifier"], (@[@"1000000000", @"1000000003"]), @"");
+
+    RMAppReceiptRenewalChain *chain = [_receipt renewalChainOfOriginalTransactionIdentifier:@"1000000000"];
+    XCTAssertTrue(chain == _receipt.renewalChains[0], @"");
+    XCTAssertTrue(chain.count == 3, @"");
+    XCTAssertEqualObjects([chain.inAppPurchases valueForKey:@"transactionIdentifier"], (@[@"1000000000", @"1000000001", @"1000000002"]), @"");
+    XCTAssertEqualObjects(chain.head.transactionIdentifier, @"1000000000", @"");
+    XCTAssertEqualObjects(chain.tail.transactionIdentifier, @"1000000002", @"");
+    XCTAssertTrue([_receipt renewalChainOfOriginalTransactionIdentifier:@"1000000003"].count == 1, @"");
+    XCTAssertNil([_receipt renewalChainOfOriginalTransactionIdentifier:@"1000000004"], @"");
+    XCTAssertNil([_receipt renewalChainOfOriginalTransactionIdentifier:nil], @"");
+}
+
+- (void)testRenewalChains_empty
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:[NSData data]];
+    XCTAssertTrue(_receipt.renewalChains.count == 0, @"");
+}
+
+- (void)testSubscriptionTimelineOfProductIdentifier
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    _receipt = [self purchaseTableReceiptWithPurchaseTableEnabled:NO];
+    RMAppReceiptSubscriptionTimeline *timeline = [_receipt subscriptionTimelineOfProductIdentifier:@"subscription"];
+    XCTAssertNotNil(timeline, @"");
+    XCTAssertTrue(timeline == [_receipt subscriptionTimelineOfProductIdentifier:@"subscription"], @"");
+    XCTAssertTrue(timeline.periodCount == 1, @"");
+    // Unlike containsActiveAutoRenewableSubscriptionOfProductIdentifier:forDate:, earlier purchases count
+    NSDate *before = [NSDate dateWithTimeIntervalSince1970:1385899200]; // 2013-12-01T12:00:00Z
+    XCTAssertTrue([timeline isActiveForDate:before], @"");
+    XCTAssertFalse([_receipt containsActiveAutoRenewableSubscriptionOfProductIdentifier:@"subscription" forDate:before], @"");
+    XCTAssertEqualObjects([timeline nextChangeAfterDate:before], [NSDate dateWithTimeIntervalSince1970:1389787200], @""); // 2014-01-15T12:00:00Z
+    XCTAssertNil([_receipt subscriptionTimelineOfProductIdentifier:@"product"], @"");
+    XCTAssertNil([_receipt subscriptionTimelineOfProductIdentifier:@"other"], @"");
+    XCTAssertNil([_receipt subscriptionTimelineOfProductIdentifier:nil], @"");
+}
+
+- (void)testInAppPurchasesOfProductIdentifier
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(10, 3);
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    NSArray *purchases = [_receipt inAppPurchasesOfProductIdentifier:@"net.robotmedia.test.product1"];
+    XCTAssertTrue(purchases.count == 3, @"");
+    NSArray *transactionIdentifiers = [purchases valueForKey:@"transactionIdentifier"];
+    XCTAssertEqualObjects(transactionIdentifiers, (@[@"1000000001", @"1000000004", @"1000000007"]), @"");
+    XCTAssertTrue([_receipt inAppPurchasesOfProductIdentifier:@"test"].count == 0, @"");
+    XCTAssertTrue([_receipt inAppPurchasesOfProductIdentifier:nil].count == 0, @"");
+}
+
+- (void)testInAppPurchasesFromDateToDate
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSDate *start = [NSDate dateWithTimeIntervalSince1970:1384516800]; // 2013-11-15T12:00:00Z
+    NSDate *end = [NSDate dateWithTimeIntervalSince1970:1387108800.5]; // 2013-12-15T12:00:00.5Z
+    for (NSNumber *enabled in @[@NO, @YES])
+    {
+        _receipt = [self purchaseTableReceiptWithPurchaseTableEnabled:enabled.boolValue];
+        NSArray *purchases = [_receipt inAppPurchasesFromDate:start toDate:end];
+        XCTAssertEqualObjects([purchases valueForKey:@"transactionIdentifier"], (@[@"1000000001", @"1000000002"]), @"%@", enabled);
+        XCTAssertTrue([_receipt inAppPurchasesFromDate:end toDate:start].count == 0, @"%@", enabled);
+    }
+}
+
+- (void)testInAppPurchaseCountsByProductIdentifier
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    for (NSNumber *enabled in @[@NO, @YES])
+    {
+        _receipt = [self purchaseTableReceiptWithPurchaseTableEnabled:enabled.boolValue];
+        XCTAssertEqualObjects([_receipt inAppPurchaseCountsByProductIdentifier], (@{@"subscription" : @3, @"product" : @1}), @"%@", enabled);
+    }
+}
+
+- (void)testLatestSubscriptionExpirationDatesByProductIdentifier
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    for (NSNumber *enabled in @[@NO, @YES])
+    {
+        _receipt = [self purchaseTableReceiptWithPurchaseTableEnabled:enabled.boolValue];
+        XCTAssertEqualObjects([_receipt latestSubscriptionExpirationDatesByProductIdentifier], (@{@"subscription" : [NSDate dateWithTimeIntervalSince1970:1389787200]}), @"%@", enabled);
+    }
+}
+
+- (void)testSetPurchaseTableEnabled
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    // Dates only parsed by the date formatter must agree too
+    NSArray *purchases = @[RMAppReceiptTestIAPData(@"subscription", @"1000000000", @"2013-10-15T12:00:00+0530", @"2013-11-15T12:00:00-0800"),
+                           RMAppReceiptTestIAPData(@"subscription", @"1000000001", @"2013-10-15 12:00:00Z", @"2013-12-15T12:00:60Z")];
+    NSData *data = RMAppReceiptTestData(@"net.robotmedia.test", purchases);
+    RMAppReceipt *objectReceipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    [RMAppReceipt setPurchaseTableEnabled:YES];
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    [RMAppReceipt setPurchaseTableEnabled:NO];
+    NSDate *start = [NSDate dateWithTimeIntervalSince1970:0];
+    NSDate *end = [NSDate distantFuture];
+    XCTAssertEqualObjects([[_receipt inAppPurchasesFromDate:start toDate:end] valueForKey:@"transactionIdentifier"], [[objectReceipt inAppPurchasesFromDate:start toDate:end] valueForKey:@"transactionIdentifier"], @"");
+    XCTAssertEqualObjects([_receipt latestSubscriptionExpirationDatesByProductIdentifier], [objectReceipt latestSubscriptionExpirationDatesByProductIdentifier], @"");
+}
+
+- (void)testPurchaseTable_webOrderLineItemID
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    // One that fits in 32 bits and one that doesn't, as in real receipts
+    NSArray *webOrderLineItemIDs = @[@1000, @1000000012345678];
+    NSMutableArray *purchases = [NSMutableArray array];
+    for (NSNumber *webOrderLineItemID in webOrderLineItemIDs)
+    {
+        [purchases addObject:RMASN1TestSet(@[RMASN1TestAttribute(1702, RMASN1TestUTF8String(@"subscription")),
+                                             RMASN1TestAttribute(1711, RMASN1TestInteger(webOrderLineItemID.integerValue))])];
+    }
+    NSData *data = RMAppReceiptTestData(@"net.robotmedia.test", purchases);
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    RMReceiptPurchaseTable *table = RMReceiptPurchaseTableCreate((const uint8_t*)data.bytes, (long)data.length);
+    XCTAssertTrue(table != NULL, @"");
+    XCTAssertTrue(table->count == (long)webOrderLineItemIDs.count, @"");
+    for (NSUInteger i = 0; i < webOrderLineItemIDs.count; i++)
+    {
+        RMAppReceiptIAP *purchase = _receipt.inAppPurchases[i];
+        XCTAssertTrue(purchase.webOrderLineItemID == [webOrderLineItemIDs[i] integerValue], @"%lu", (unsigned long)i);
+        XCTAssertTrue(table->webOrderLineItemIDs[i] == (int64_t)purchase.webOrderLineItemID, @"%lu", (unsigned long)i);
+    }
+    RMReceiptPurchaseTableFree(table);
+}
+
 - (void)testBundleReceipt_nil
 { SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
     RMAppReceipt *receipt = [RMAppReceipt bundleReceipt];
     XCTAssertNil(receipt, @"");
 }
 
+- (void)testLoadBundleReceiptWithCompletion
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    XCTestExpectation *expectation = [self expectationWithDescription:@"load"];
+    [RMAppReceipt loadBundleReceiptWithCompletion:^(RMAppReceipt *receipt) {
+        XCTAssertTrue([NSThread isMainThread], @"");
+        XCTAssertNil(receipt, @"");
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+- (void)testLoadBundleReceiptOnQueue_concurrent
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    dispatch_queue_t queue = dispatch_queue_create("net.robotmedia.RMAppReceiptTests", DISPATCH_QUEUE_SERIAL);
+    const void *key = &key;
+    dispatch_queue_set_specific(queue, key, (void*)key, NULL);
+    for (NSInteger i = 0; i < 10; i++)
+    {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"load %ld", (long)i]];
+        [RMAppReceipt loadBundleReceiptOnQueue:queue completion:^(RMAppReceipt *receipt) {
+            XCTAssertTrue(dispatch_get_specific(key) == key, @"");
+            [expectation fulfill];
+        }];
+    }
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+- (void)testCachedReceiptAtPath
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    // The container is not signed
+    [RMAppReceipt setAppleRootCertificateURL:[NSURL fileURLWithPath:@"/nonexistent.cer"]];
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    [RMAppReceiptTestPKCS7Data(RMAppReceiptTestData(@"net.robotmedia.test1", @[])) writeToFile:path atomically:YES];
+    const NSUInteger hits = [RMAppReceipt bundleReceiptCacheHits];
+    const NSUInteger misses = [RMAppReceipt bundleReceiptCacheMisses];
+    
+    RMAppReceipt *receipt = [RMAppReceipt cachedReceiptAtPath:path];
+    RMAppReceipt *cachedReceipt = [RMAppReceipt cachedReceiptAtPath:path];
+    XCTAssertEqualObjects(receipt.bundleIdentifier, @"net.robotmedia.test1", @"");
+    XCTAssertTrue(receipt == cachedReceipt, @"");
+    XCTAssertTrue([RMAppReceipt bundleReceiptCacheHits] == hits + 1, @"");
+    XCTAssertTrue([RMAppReceipt bundleReceiptCacheMisses] == misses + 1, @"");
+    
+    // Same size and possibly the same modification date, but different contents
+    [RMAppReceiptTestPKCS7Data(RMAppReceiptTestData(@"net.robotmedia.test2", @[])) writeToFile:path atomically:YES];
+    RMAppReceipt *changedReceipt = [RMAppReceipt cachedReceiptAtPath:path];
+    XCTAssertEqualObjects(changedReceipt.bundleIdentifier, @"net.robotmedia.test2", @"");
+    XCTAssertTrue([RMAppReceipt bundleReceiptCacheMisses] == misses + 2, @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    [RMAppReceipt setAppleRootCertificateURL:nil];
+}
+
+- (void)testCachedReceiptAtPath_concurrent
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    // The container is not signed
+    [RMAppReceipt setAppleRootCertificateURL:[NSURL fileURLWithPath:@"/nonexistent.cer"]];
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    [RMAppReceiptTestPKCS7Data(RMAppReceiptTestData(@"net.robotmedia.test", @[])) writeToFile:path atomically:YES];
+    const NSUInteger hits = [RMAppReceipt bundleReceiptCacheHits];
+    const NSUInteger misses = [RMAppReceipt bundleReceiptCacheMisses];
+    const size_t iterations = 16;
+    
+    NSMutableSet *receipts = [NSMutableSet set];
+    dispatch_apply(iterations, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+        RMAppReceipt *receipt = [RMAppReceipt cachedReceiptAtPath:path];
+        @synchronized(receipts)
+        {
+            [receipts addObject:[NSValue valueWithNonretainedObject:receipt]];
+        }
+    });
+    // Parsed once, shared by every caller
+    XCTAssertTrue(receipts.count == 1, @"");
+    XCTAssertTrue([RMAppReceipt bundleReceiptCacheMisses] == misses + 1, @"");
+    XCTAssertTrue([RMAppReceipt bundleReceiptCacheHits] == hits + iterations - 1, @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    [RMAppReceipt setAppleRootCertificateURL:nil];
+}
+    
+- (void)testSetVerificationCacheEnabled_NO
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+    [defaults setObject:[NSData dataWithBytes:"tag" length:3] forKey:@"RMAppReceiptVerification"];
+    [RMAppReceipt setVerificationCacheEnabled:NO];
+    XCTAssertNil([defaults objectForKey:@"RMAppReceiptVerification"], @"");
+}
+
+- (void)testSetVerificationCacheEnabled_YES
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMAppReceipt setVerificationCacheEnabled:YES];
+    [RMAppReceipt setAppleRootCertificateURL:nil];
+    RMAppReceipt *receipt = [RMAppReceipt bundleReceipt];
+    XCTAssertNil(receipt, @"");
+    [RMAppReceipt setVerificationCacheEnabled:NO];
+}
+
 - (void)testVerifyReceiptHash_NO
 { SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
     _receipt = [[RMAppReceipt alloc] initWithASN1Data:[NSData data]];
@@ -61,9 +531,409 @@
     XCTAssertFalse(result, @"");
 }
 
+- (void)testVerifyReceiptHash_YES
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:[self hashedReceiptData]];
+    BOOL result = [_receipt verifyReceiptHash];
+    XCTAssertTrue(result, @"");
+}
+
+- (void)testVerifyReceiptHash_otherOpaqueValue
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = [self hashedReceiptData];
+    NSData *opaqueValue = [@"opaque" dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableData *otherData = [data mutableCopy];
+    const NSRange range = [data rangeOfData:opaqueValue options:0 range:NSMakeRange(0, data.length)];
+    [otherData replaceBytesInRange:range withBytes:"OPAQUE"];
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:otherData];
+    BOOL result = [_receipt verifyReceiptHash];
+    XCTAssertFalse(result, @"");
+}
+
 - (void)testSetAppleRootCertificateURL
 { SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
     [RMAppReceipt setAppleRootCertificateURL:nil];
 }
 
+- (void)testDateFromRFC3339Bytes
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSArray *strings = @[@"2013-10-15T12:00:00Z",
+                         @"1970-01-01T00:00:00Z",
+                         @"1969-12-31T23:59:59Z",
+                         @"2000-02-29T23:59:59Z",
+                         @"2100-02-28T00:00:00Z",
+                         @"2012-02-29T12:00:00Z",
+                         @"2038-01-19T03:14:08Z",
+                         @"9999-12-31T23:59:59Z",
+                         @"1600-03-01T00:00:00Z",
+                         @"2013-10-15T12:00:00-0800",
+                         @"2013-10-15T12:00:00+0530",
+                         @"2013-12-31T23:30:00-0100",
+                         @"2013-10-15T12:00:00+0000",
+                         // Not handled by the fast path
+                         @"2013-10-15 12:00:00Z",
+                         @"2013-10-15T12:00:00",
+                         @"2013-10-15T12:00Z",
+                         @"2013-02-29T12:00:00Z",
+                         @"2013-13-01T12:00:00Z",
+                         @"2013-10-15T24:00:00Z",
+                         @"2013-10-15T12:00:60Z",
+                         @"1582-10-10T00:00:00Z",
+                         @"2013-10-15T12:00:00+2400",
+                         @"2013-1O-15T12:00:00Z",
+                         @""];
+    for (NSString *string in strings)
+    {
+        NSData *data = [string dataUsingEncoding:NSASCIIStringEncoding];
+        NSDate *expected = [RMAppReceipt formatRFC3339String:string];
+        NSDate *result = [RMAppReceipt dateFromRFC3339Bytes:(const uint8_t*)data.bytes length:data.length];
+        XCTAssertEqualObjects(result, expected, @"%@", string);
+    }
+}
+
+#pragma mark - Performance
+
+- (void)testPerformanceDateFromRFC3339Bytes
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = [@"2013-10-15T12:00:00Z" dataUsingEncoding:NSASCIIStringEncoding];
+    [self measureBlock:^{
+        for (NSInteger i = 0; i < 10000; i++)
+        {
+            [RMAppReceipt dateFromRFC3339Bytes:(const uint8_t*)data.bytes length:data.length];
+        }
+    }];
+}
+
+- (void)testPerformanceVerifyReceiptHash
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    // verifyAppReceipt calls verifyReceiptHash for every transaction
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:[self hashedReceiptData]];
+    [self measureBlock:^{
+        for (NSInteger i = 0; i < 10000; i++)
+        {
+            [_receipt verifyReceiptHash];
+        }
+    }];
+}
+
+- (void)testPerformanceFormatRFC3339String
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSString *string = @"2013-10-15T12:00:00Z";
+    [self measureBlock:^{
+        for (NSInteger i = 0; i < 10000; i++)
+        {
+            [RMAppReceipt formatRFC3339String:string];
+        }
+    }];
+}
+
+- (void)testPerformanceContainsInAppPurchaseOfProductIdentifier_lazy
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(5000, 10);
+    [self logAllocationsOfBlock:^{
+        RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+        [receipt containsInAppPurchaseOfProductIdentifier:@"net.robotmedia.test.product9"];
+        return receipt;
+    } name:@"lazy"];
+    [self measureBlock:^{
+        RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+        [receipt containsInAppPurchaseOfProductIdentifier:@"net.robotmedia.test.product9"];
+    }];
+}
+
+- (void)testPerformanceContainsInAppPurchaseOfProductIdentifier_allFields
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    // Decoding every field matches the cost of the former eager model
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(5000, 10);
+    [self logAllocationsOfBlock:^{
+        RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+        [self decodeAllFieldsOfReceipt:receipt];
+        return receipt;
+    } name:@"all fields"];
+    [self measureBlock:^{
+        RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+        [self decodeAllFieldsOfReceipt:receipt];
+    }];
+}
+
+- (void)testPerformanceContainsInAppPurchaseOfProductIdentifier_10k
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(10000, 100);
+    RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    NSDate *date = [NSDate dateWithTimeIntervalSince1970:1383000000];
+    [self measureBlock:^{
+        for (NSInteger i = 0; i < 10000; i++)
+        {
+            NSString *productIdentifier = i % 2 ? @"net.robotmedia.test.product99" : @"net.robotmedia.test.missing";
+            [receipt containsInAppPurchaseOfProductIdentifier:productIdentifier];
+            [receipt containsActiveAutoRenewableSubscriptionOfProductIdentifier:productIdentifier forDate:date];
+        }
+    }];
+}
+
+- (void)testPerformanceInitWithASN1Data_10k
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    // Parsing pays for the index once
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(10000, 100);
+    [self measureBlock:^{
+        RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+        [receipt containsInAppPurchaseOfProductIdentifier:@"net.robotmedia.test.product99"];
+    }];
+}
+
+- (void)testPerformanceCachedReceiptAtPath
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMAppReceipt setAppleRootCertificateURL:[NSURL fileURLWithPath:@"/nonexistent.cer"]];
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    [RMAppReceiptTestPKCS7Data(RMAppReceiptTestDataWithPurchaseCount(5000, 10)) writeToFile:path atomically:YES];
+    [self measureBlock:^{
+        for (NSInteger i = 0; i < 300; i++)
+        {
+            [RMAppReceipt cachedReceiptAtPath:path];
+        }
+    }];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    [RMAppReceipt setAppleRootCertificateURL:nil];
+}
+
+- (void)testPerformanceContainsInAppPurchaseOfProductIdentifierInASN1Data
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    // Compare with testPerformanceContainsInAppPurchaseOfProductIdentifier_lazy, which creates the receipt
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(5000, 10);
+    [self measureBlock:^{
+        [RMAppReceipt containsInAppPurchaseOfProductIdentifier:@"net.robotmedia.test.product9" inASN1Data:data];
+        [RMAppReceipt containsInAppPurchaseOfProductIdentifier:@"net.robotmedia.test.missing" inASN1Data:data];
+    }];
+}
+
+- (void)testPerformanceInitWithASN1Data_parallel
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    const NSUInteger purchaseCounts[] = {1000, 10000, 50000};
+    const NSUInteger concurrencies[] = {1, 2, 4, 8};
+    for (NSUInteger i = 0; i < sizeof(purchaseCounts) / sizeof(purchaseCounts[0]); i++)
+    {
+        NSData *data = RMAppReceiptTestDataWithPurchaseCount(purchaseCounts[i], 10);
+        for (NSUInteger j = 0; j < sizeof(concurrencies) / sizeof(concurrencies[0]); j++)
+        {
+            [RMAppReceipt setParsingConcurrency:concurrencies[j]];
+            const CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+            RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+            const CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+            NSLog(@"%lu purchases, %lu threads: %.2f ms (%lu parsed)", (unsigned long)purchaseCounts[i], (unsigned long)concurrencies[j], elapsed * 1000, (unsigned long)receipt.inAppPurchases.count);
+        }
+    }
+    [RMAppReceipt setParsingConcurrency:0];
+    
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(10000, 10);
+    [self measureBlock:^{
+        [[RMAppReceipt alloc] initWithASN1Data:data];
+    }];
+}
+
+- (void)testPerformancePurchaseTable
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(50000, 10);
+    NSDate *start = [NSDate dateWithTimeIntervalSince1970:1381752000];
+    NSDate *end = [NSDate dateWithTimeIntervalSince1970:1381924800];
+    for (NSNumber *enabled in @[@NO, @YES])
+    {
+        [RMAppReceipt setPurchaseTableEnabled:enabled.boolValue];
+        CFAbsoluteTime started = CFAbsoluteTimeGetCurrent();
+        RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+        const CFAbsoluteTime parse = CFAbsoluteTimeGetCurrent() - started;
+        started = CFAbsoluteTimeGetCurrent();
+        [receipt inAppPurchasesFromDate:start toDate:end];
+        const CFAbsoluteTime range = CFAbsoluteTimeGetCurrent() - started;
+        started = CFAbsoluteTimeGetCurrent();
+        [receipt inAppPurchaseCountsByProductIdentifier];
+        const CFAbsoluteTime counts = CFAbsoluteTimeGetCurrent() - started;
+        started = CFAbsoluteTimeGetCurrent();
+        [receipt latestSubscriptionExpirationDatesByProductIdentifier];
+        const CFAbsoluteTime latest = CFAbsoluteTimeGetCurrent() - started;
+        NSLog(@"Purchase table %@: parse %.2f ms, range %.2f ms, counts %.2f ms, latest %.2f ms", enabled.boolValue ? @"enabled" : @"disabled", parse * 1000, range * 1000, counts * 1000, latest * 1000);
+    }
+    
+    RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    [RMAppReceipt setPurchaseTableEnabled:NO];
+    [self measureBlock:^{
+        [receipt inAppPurchasesFromDate:start toDate:end];
+        [receipt inAppPurchaseCountsByProductIdentifier];
+        [receipt latestSubscriptionExpirationDatesByProductIdentifier];
+    }];
+}
+
+- (void)testPerformanceInitWithASN1Data_internedStrings
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    const NSUInteger purchaseCounts[] = {1000, 10000, 50000};
+    for (NSUInteger i = 0; i < sizeof(purchaseCounts) / sizeof(purchaseCounts[0]); i++)
+    {
+        NSData *data = RMAppReceiptTestDataWithPurchaseCount(purchaseCounts[i], 10);
+        for (NSNumber *enabled in @[@NO, @YES])
+        {
+            [RMAppReceipt setStringInterningEnabled:enabled.boolValue];
+            NSString *name = [NSString stringWithFormat:@"%lu purchases, interning %@", (unsigned long)purchaseCounts[i], enabled.boolValue ? @"enabled" : @"disabled"];
+            __block CFAbsoluteTime elapsed;
+            [self logAllocationsOfBlock:^{
+                const CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+                RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+                [self decodeAllFieldsOfReceipt:receipt];
+                elapsed = CFAbsoluteTimeGetCurrent() - start;
+                return receipt;
+            } name:name];
+            NSLog(@"%@: %.2f ms", name, elapsed * 1000);
+        }
+    }
+    [RMAppReceipt setStringInterningEnabled:YES];
+    
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(10000, 10);
+    [self measureBlock:^{
+        RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+        [self decodeAllFieldsOfReceipt:receipt];
+    }];
+}
+
+- (void)testPerformanceInitWithASN1DataPreviousReceipt
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    RMAppReceipt *previousReceipt = [[RMAppReceipt alloc] initWithASN1Data:RMAppReceiptTestDataWithPurchaseCount(10000, 10)];
+    [self decodeAllFieldsOfReceipt:previousReceipt];
+    const NSUInteger appendedCounts[] = {1, 10, 100};
+    for (NSUInteger i = 0; i < sizeof(appendedCounts) / sizeof(appendedCounts[0]); i++)
+    {
+        NSData *data = RMAppReceiptTestDataWithPurchaseCount(10000 + appendedCounts[i], 10);
+        CFAbsoluteTime started = CFAbsoluteTimeGetCurrent();
+        RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+        [self decodeAllFieldsOfReceipt:receipt];
+        const CFAbsoluteTime full = CFAbsoluteTimeGetCurrent() - started;
+        started = CFAbsoluteTimeGetCurrent();
+        receipt = [[RMAppReceipt alloc] initWithASN1Data:data previousReceipt:previousReceipt];
+        [self decodeAllFieldsOfReceipt:receipt];
+        const CFAbsoluteTime incremental = CFAbsoluteTimeGetCurrent() - started;
+        NSLog(@"Re-parse of 10000 purchases with %lu appended: full %.2f ms, incremental %.2f ms", (unsigned long)appendedCounts[i], full * 1000, incremental * 1000);
+    }
+    
+    NSData *data = RMAppReceiptTestDataWithPurchaseCount(10010, 10);
+    [self measureBlock:^{
+        RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data previousReceipt:previousReceipt];
+        [self decodeAllFieldsOfReceipt:receipt];
+    }];
+}
+
+- (void)testPerformanceReceiptWithSnapshotAtPath
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    NSMutableData *digest = [NSMutableData dataWithLength:32];
+    const NSUInteger purchaseCounts[] = {100, 1000, 10000};
+    for (NSUInteger i = 0; i < sizeof(purchaseCounts) / sizeof(purchaseCounts[0]); i++)
+    {
+        NSData *data = RMAppReceiptTestDataWithPurchaseCount(purchaseCounts[i], 10);
+        NSData *container = RMAppReceiptTestPKCS7Data(data);
+        [[[RMAppReceipt alloc] initWithASN1Data:data] writeSnapshotToPath:path container:container digest:digest];
+        
+        // Time to the first entitlement answer
+        CFAbsoluteTime started = CFAbsoluteTimeGetCurrent();
+        RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+        [receipt containsInAppPurchaseOfProductIdentifier:@"net.robotmedia.test.product7"];
+        const CFAbsoluteTime full = CFAbsoluteTimeGetCurrent() - started;
+        started = CFAbsoluteTimeGetCurrent();
+        receipt = [RMAppReceipt receiptWithSnapshotAtPath:path container:container digest:digest];
+        [receipt containsInAppPurchaseOfProductIdentifier:@"net.robotmedia.test.product7"];
+        const CFAbsoluteTime snapshot = CFAbsoluteTimeGetCurrent() - started;
+        NSLog(@"First entitlement answer with %lu purchases: parse %.2f ms, snapshot %.2f ms", (unsigned long)purchaseCounts[i], full * 1000, snapshot * 1000);
+    }
+    
+    NSData *container = RMAppReceiptTestPKCS7Data(RMAppReceiptTestDataWithPurchaseCount(10000, 10));
+    [self measureBlock:^{
+        RMAppReceipt *receipt = [RMAppReceipt receiptWithSnapshotAtPath:path container:container digest:digest];
+        [receipt containsInAppPurchaseOfProductIdentifier:@"net.robotmedia.test.product7"];
+    }];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testPerformanceRenewalChains
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    NSData *data = RMAppReceiptTestRenewalDataWithPurchaseCount(10000, 100);
+    _receipt = [[RMAppReceipt alloc] initWithASN1Data:data];
+    NSMutableArray *originalTransactionIdentifiers = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 100; i++)
+    {
+        [originalTransactionIdentifiers addObject:[NSString stringWithFormat:@"%lu", (unsigned long)(1000000000 + i)]];
+    }
+    
+    CFAbsoluteTime started = CFAbsoluteTimeGetCurrent();
+    NSUInteger scanned = 0;
+    for (NSString *originalTransactionIdentifier in originalTransactionIdentifiers)
+    {
+        // Without the index
+        for (RMAppReceiptIAP *purchase in _receipt.inAppPurchases)
+        {
+            scanned += [purchase.originalTransactionIdentifier isEqualToString:originalTransactionIdentifier];
+        }
+    }
+    const CFAbsoluteTime scan = CFAbsoluteTimeGetCurrent() - started;
+    started = CFAbsoluteTimeGetCurrent();
+    NSUInteger indexed = 0;
+    for (NSString *originalTransactionIdentifier in originalTransactionIdentifiers)
+    {
+        indexed += [_receipt renewalChainOfOriginalTransactionIdentifier:originalTransactionIdentifier].count;
+    }
+    const CFAbsoluteTime index = CFAbsoluteTimeGetCurrent() - started;
+    XCTAssertEqual(scanned, indexed, @"");
+    NSLog(@"Renewal chains of 10000 purchases: scan %.2f ms, index %.4f ms", scan * 1000, index * 1000);
+    
+    [self measureBlock:^{
+        [[RMAppReceipt alloc] initWithASN1Data:data];
+    }];
+}
+
+- (RMAppReceipt*)purchaseTableReceiptWithPurchaseTableEnabled:(BOOL)enabled
+{
+    NSArray *purchases = @[RMAppReceiptTestIAPData(@"subscription", @"1000000000", @"2013-10-15T12:00:00Z", @"2013-11-15T12:00:00Z"),
+                           RMAppReceiptTestIAPData(@"subscription", @"1000000001", @"2013-12-15T12:00:00Z", @"2014-01-15T12:00:00Z"),
+                           RMAppReceiptTestIAPData(@"subscription", @"1000000002", @"2013-11-15T12:00:00Z", @"2013-12-15T12:00:00Z"),
+                           RMAppReceiptTestIAPData(@"product", @"1000000003", @"2013-12-15T12:00:01Z", nil)];
+    [RMAppReceipt setPurchaseTableEnabled:enabled];
+    RMAppReceipt *receipt = [[RMAppReceipt alloc] initWithASN1Data:RMAppReceiptTestData(@"net.robotmedia.test", purchases)];
+    [RMAppReceipt setPurchaseTableEnabled:NO];
+    return receipt;
+}
+
+/** Returns the payload of a receipt whose hash was made with the vendor identifier of this device.
+ */
+- (NSData*)hashedReceiptData
+{
+    NSData *bundleIdentifierData = RMASN1TestUTF8String(@"net.robotmedia.test");
+    NSData *opaqueValue = [@"opaque" dataUsingEncoding:NSUTF8StringEncoding];
+    uuid_t uuidBytes;
+    [[UIDevice currentDevice].identifierForVendor getUUIDBytes:uuidBytes];
+    NSMutableData *data = [NSMutableData dataWithBytes:uuidBytes length:sizeof(uuidBytes)];
+    [data appendData:opaqueValue];
+    [data appendData:bundleIdentifierData];
+    NSMutableData *hash = [NSMutableData dataWithLength:SHA_DIGEST_LENGTH];
+    SHA1((const uint8_t*)data.bytes, data.length, (uint8_t*)hash.mutableBytes);
+    return RMASN1TestSet(@[RMASN1TestAttribute(2, bundleIdentifierData), RMASN1TestAttribute(4, opaqueValue), RMASN1TestAttribute(5, hash)]);
+}
+
+- (void)decodeAllFieldsOfReceipt:(RMAppReceipt*)receipt
+{
+    for (RMAppReceiptIAP *purchase in receipt.inAppPurchases)
+    {
+        [purchase productIdentifier];
+        [purchase transactionIdentifier];
+        [purchase originalTransactionIdentifier];
+        [purchase purchaseDate];
+        [purchase originalPurchaseDate];
+        [purchase subscriptionExpirationDate];
+        [purchase cancellationDate];
+    }
+}
+
+- (void)logAllocationsOfBlock:(id (^)())block name:(NSString*)name
+{
+    malloc_statistics_t before, after;
+    malloc_zone_statistics(NULL, &before);
+    id result = block();
+    malloc_zone_statistics(NULL, &after);
+    NSLog(@"%@: %ld blocks, %ld bytes in use by %@", name, (long)(after.blocks_in_use - before.blocks_in_use), (long)(after.size_in_use - before.size_in_use), NSStringFromClass([result class]));
+}
+
 @end
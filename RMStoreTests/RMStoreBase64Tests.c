@@ -0,0 +1,141 @@
+//
+//  RMStoreBase64Tests.c
+//  RMStore
+//
+//  Created by Hermes on 10/17/26.
+//  Copyright (c) 2013 Robot Media. All rights reserved.
+//
+
+#include "RMStoreBase64.h"
+#include "RMAppReceiptCoreTestSupport.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int _failures = 0;
+
+#define RMAssert(condition) do { if (!(condition)) { fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #condition); _failures++; } } while (0)
+
+static const RMStoreBase64Implementation _implementations[] = {
+    RMStoreBase64ImplementationScalar,
+    RMStoreBase64ImplementationSSSE3,
+    RMStoreBase64ImplementationAVX2,
+    RMStoreBase64ImplementationNEON,
+};
+
+static const char *_implementationNames[] = {"scalar", "ssse3", "avx2", "neon"};
+
+/** Encodes with every available implementation and RMStoreBase64Encode, and compares with the reference encoder. Input and output are allocated with their exact length, so that the sanitizers catch any access past them.
+ @return 1 if all encodings match.
+ */
+static int RMTestBase64Matches(const uint8_t *bytes, size_t length)
+{
+    uint8_t *input = malloc(length + 1);
+    memcpy(input, bytes, length);
+    char *expected = RMTestBase64EncodeReference(input, length);
+    const size_t expectedLength = expected ? strlen(expected) : 0;
+    int matches = RMStoreBase64EncodedLength(length) == expectedLength;
+    for (size_t i = 0; i <= sizeof(_implementations) / sizeof(_implementations[0]); i++)
+    {
+        const int automatic = i == sizeof(_implementations) / sizeof(_implementations[0]);
+        if (!automatic && !RMStoreBase64ImplementationIsAvailable(_implementations[i])) continue;
+
+        char *output = malloc(expectedLength + 1);
+        const size_t written = automatic ? RMStoreBase64Encode(input, length, output) : RMStoreBase64EncodeWithImplementation(input, length, output, _implementations[i]);
+        if (written != expectedLength || (expectedLength > 0 && memcmp(output, expected, expectedLength) != 0))
+        {
+            fprintf(stderr, "%s: mismatch for %zu bytes\n", automatic ? "automatic" : _implementationNames[i], length);
+            matches = 0;
+        }
+        free(output);
+    }
+    free(expected);
+    free(input);
+    return matches;
+}
+
+static void testEncode(void)
+{ // From: https://tools.ietf.org/html/rfc4648#section-10
+    const char *inputs[] = {"", "f", "fo", "foo", "foob", "fooba", "foobar"};
+    const char *outputs[] = {"", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy"};
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++)
+    {
+        char output[16];
+        const size_t written = RMStoreBase64Encode((const uint8_t *)inputs[i], strlen(inputs[i]), output);
+        RMAssert(written == strlen(outputs[i]));
+        RMAssert(memcmp(output, outputs[i], written) == 0);
+    }
+}
+
+static void testEncode_alphabet(void)
+{ // Every 6-bit index, so that each range of the vector lookups is covered
+    uint8_t bytes[48];
+    for (size_t i = 0; i < 16; i++)
+    {
+        const uint32_t indices = (uint32_t)(4 * i) << 18 | (uint32_t)(4 * i + 1) << 12 | (uint32_t)(4 * i + 2) << 6 | (uint32_t)(4 * i + 3);
+        bytes[3 * i] = (uint8_t)(indices >> 16);
+        bytes[3 * i + 1] = (uint8_t)(indices >> 8);
+        bytes[3 * i + 2] = (uint8_t)indices;
+    }
+    for (size_t i = 0; i < sizeof(_implementations) / sizeof(_implementations[0]); i++)
+    {
+        if (!RMStoreBase64ImplementationIsAvailable(_implementations[i])) continue;
+        char output[64];
+        RMAssert(RMStoreBase64EncodeWithImplementation(bytes, sizeof(bytes), output, _implementations[i]) == 64);
+        RMAssert(memcmp(output, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/", 64) == 0);
+    }
+}
+
+static void testEncode_fuzz(void)
+{
+    uint64_t state = 0x5eed;
+    const size_t capacity = 4096;
+    uint8_t *bytes = malloc(capacity);
+    for (size_t i = 0; i < capacity; i++) bytes[i] = (uint8_t)RMTestRandom(&state);
+
+    for (size_t length = 0; length <= 256; length++)
+    {
+        RMAssert(RMTestBase64Matches(bytes, length));
+    }
+    for (int iteration = 0; iteration < 2000; iteration++)
+    {
+        const size_t offset = RMTestRandom(&state) % 64;
+        const size_t length = RMTestRandom(&state) % (capacity - offset);
+        for (size_t i = 0; i < length; i++) bytes[offset + i] = (uint8_t)RMTestRandom(&state);
+        RMAssert(RMTestBase64Matches(bytes + offset, length));
+    }
+    free(bytes);
+}
+
+static void testEncodedLength(void)
+{
+    RMAssert(RMStoreBase64EncodedLength(0) == 0);
+    RMAssert(RMStoreBase64EncodedLength(1) == 4);
+    RMAssert(RMStoreBase64EncodedLength(3) == 4);
+    RMAssert(RMStoreBase64EncodedLength(4) == 8);
+}
+
+static void testImplementationIsAvailable(void)
+{
+    RMAssert(RMStoreBase64ImplementationIsAvailable(RMStoreBase64ImplementationScalar));
+    for (size_t i = 0; i < sizeof(_implementations) / sizeof(_implementations[0]); i++)
+    {
+        printf("%s: %s\n", _implementationNames[i], RMStoreBase64ImplementationIsAvailable(_implementations[i]) ? "available" : "not available");
+    }
+}
+
+int main(void)
+{
+    testEncode();
+    testEncode_alphabet();
+    testEncode_fuzz();
+    testEncodedLength();
+    testImplementationIsAvailable();
+    if (_failures > 0)
+    {
+        fprintf(stderr, "%d assertion(s) failed\n", _failures);
+        return EXIT_FAILURE;
+    }
+    printf("All tests passed\n");
+    return EXIT_SUCCESS;
+}
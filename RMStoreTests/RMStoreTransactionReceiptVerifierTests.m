@@ -10,17 +10,134 @@
 #import "RMStoreTransactionReceiptVerifier.h"
 #import <OCMock/OCMock.h>
 
-@interface RMStoreTransactionReceiptVerifierTests : XCTestCase
+/** Stands for the verification servers of Apple. Each server answers with its given status.
+ */
+@interface RMStoreVerificationServerStub : NSURLProtocol
+
+@end
+
+static NSInteger _stubProductionStatus = 0;
+static NSInteger _stubSandboxStatus = 0;
+static NSTimeInterval _stubDelay = 0;
+static NSInteger _stubActiveRequestCount = 0;
+static NSInteger _stubMaximumActiveRequestCount = 0;
+static NSMutableArray *_stubRequestedHosts = nil;
+
+@implementation RMStoreVerificationServerStub {
+    NSThread *_clientThread;
+    NSArray *_clientModes;
+}
+
++ (void)resetWithProductionStatus:(NSInteger)status delay:(NSTimeInterval)delay
+{
+    [self resetWithProductionStatus:status sandboxStatus:0 delay:delay];
+}
+
++ (void)resetWithProductionStatus:(NSInteger)productionStatus sandboxStatus:(NSInteger)sandboxStatus delay:(NSTimeInterval)delay
+{
+    @synchronized(self)
+    {
+        _stubProductionStatus = productionStatus;
+        _stubSandboxStatus = sandboxStatus;
+        _stubDelay = delay;
+        _stubActiveRequestCount = 0;
+        _stubMaximumActiveRequestCount = 0;
+        _stubRequestedHosts = [NSMutableArray array];
+    }
+}
+
++ (NSArray*)requestedHosts
+{
+    @synchronized(self)
+    {
+        return [_stubRequestedHosts copy];
+    }
+}
+
++ (NSInteger)maximumActiveRequestCount
+{
+    @synchronized(self)
+    {
+        return _stubMaximumActiveRequestCount;
+    }
+}
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return [request.URL.host hasSuffix:@"itunes.apple.com"];
+}
+
++ (NSURLRequest*)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (void)startLoading
+{
+    NSTimeInterval delay;
+    @synchronized([RMStoreVerificationServerStub class])
+    {
+        _stubActiveRequestCount++;
+        _stubMaximumActiveRequestCount = MAX(_stubMaximumActiveRequestCount, _stubActiveRequestCount);
+        [_stubRequestedHosts addObject:self.request.URL.host];
+        delay = _stubDelay;
+    }
+    // The client must be called on the thread that started loading
+    _clientThread = [NSThread currentThread];
+    _clientModes = @[[NSRunLoop currentRunLoop].currentMode ? : NSDefaultRunLoopMode];
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [self performSelector:@selector(respond) onThread:_clientThread withObject:nil waitUntilDone:NO modes:_clientModes];
+    });
+}
+
+- (void)respond
+{
+    NSInteger status;
+    @synchronized([RMStoreVerificationServerStub class])
+    {
+        _stubActiveRequestCount--;
+        status = [self.request.URL.host hasPrefix:@"sandbox"] ? _stubSandboxStatus : _stubProductionStatus;
+    }
+    NSData *data = [NSJSONSerialization dataWithJSONObject:@{@"status" : @(status)} options:0 error:nil];
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:@{@"Content-Type" : @"application/json"}];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    [self.client URLProtocol:self didLoadData:data];
+    [self.client URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading
+{
+}
+
+@end
+
+@interface RMStoreTransactionReceiptVerifierTests : XCTestCase<RMStoreVerificationMetricsSink>
 
 @end
 
 @implementation RMStoreTransactionReceiptVerifierTests {
     RMStoreTransactionReceiptVerifier *_verifier;
+    NSMutableArray *_metrics;
 }
 
 - (void)setUp
 {
     _verifier = [[RMStoreTransactionReceiptVerifier alloc] init];
+    _metrics = [NSMutableArray array];
+    [[NSUserDefaults standardUserDefaults] removeObjectForKey:@"RMStoreTransactionReceiptVerifierEnvironments"];
+}
+
+- (void)tearDown
+{
+    [[NSUserDefaults standardUserDefaults] removeObjectForKey:@"RMStoreTransactionReceiptVerifierEnvironments"];
+}
+
+- (void)receiptVerifier:(RMStoreTransactionReceiptVerifier*)verifier didFinishRequestWithMetrics:(RMStoreVerificationRequestMetrics*)metrics
+{
+    @synchronized(_metrics)
+    {
+        [_metrics addObject:metrics];
+    }
 }
 
 - (void)testVerifyTransaction_NoReceipt_Nil_Nil
@@ -56,6 +173,245 @@
     [_verifier verifyTransaction:transaction success:nil failure:nil];
 }
 
+- (void)testInit_maximumConcurrentRequests
+{
+    XCTAssertEqual(_verifier.maximumConcurrentRequests, (NSUInteger)4, @"");
+}
+
+- (void)testInit_environmentRoutingEnabled
+{
+    XCTAssertTrue(_verifier.environmentRoutingEnabled, @"");
+    XCTAssertFalse(_verifier.hedgedRequestsEnabled, @"");
+}
+
+- (void)testVerifyTransaction_stub_success
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMStoreVerificationServerStub resetWithProductionStatus:0 delay:0];
+    _verifier = [self stubbedVerifier];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"verify"];
+    [_verifier verifyTransaction:[self mockPaymentTransaction] success:^{
+        XCTAssertTrue([NSThread isMainThread], @"");
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"%@", error);
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    XCTAssertEqual(_metrics.count, (NSUInteger)1, @"");
+    RMStoreVerificationRequestMetrics *metrics = _metrics.firstObject;
+    XCTAssertEqualObjects(metrics.URL, [NSURL URLWithString:@"https://buy.itunes.apple.com/verifyReceipt"], @"");
+    XCTAssertEqual(metrics.HTTPStatusCode, (NSInteger)200, @"");
+    XCTAssertTrue(metrics.duration >= 0, @"");
+    XCTAssertNil(metrics.error, @"");
+}
+
+- (void)testVerifyTransaction_stub_sandbox
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMStoreVerificationServerStub resetWithProductionStatus:21007 delay:0];
+    _verifier = [self stubbedVerifier];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"verify"];
+    [_verifier verifyTransaction:[self mockPaymentTransaction] success:^{
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"%@", error);
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    XCTAssertEqual(_metrics.count, (NSUInteger)2, @"");
+    XCTAssertEqualObjects([_metrics[0] URL].host, @"buy.itunes.apple.com", @"");
+    XCTAssertEqualObjects([_metrics[1] URL].host, @"sandbox.itunes.apple.com", @"");
+}
+
+- (void)testVerifyTransaction_stub_failure
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMStoreVerificationServerStub resetWithProductionStatus:21002 delay:0];
+    _verifier = [self stubbedVerifier];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"verify"];
+    [_verifier verifyTransaction:[self mockPaymentTransaction] success:^{
+        XCTFail(@"");
+    } failure:^(NSError *error) {
+        XCTAssertEqual(error.code, (NSInteger)21002, @"");
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+- (void)testVerifyTransaction_stub_maximumConcurrentRequests
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMStoreVerificationServerStub resetWithProductionStatus:0 delay:0.05];
+    _verifier = [self stubbedVerifier];
+    _verifier.maximumConcurrentRequests = 3;
+    for (NSInteger i = 0; i < 20; i++)
+    {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"verify %ld", (long)i]];
+        [_verifier verifyTransaction:[self mockPaymentTransaction] success:^{
+            [expectation fulfill];
+        } failure:^(NSError *error) {
+            XCTFail(@"%@", error);
+        }];
+    }
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+
+    XCTAssertTrue([RMStoreVerificationServerStub maximumActiveRequestCount] <= 3, @"");
+    XCTAssertEqual(_metrics.count, (NSUInteger)20, @"");
+    NSTimeInterval queueDuration = 0;
+    for (RMStoreVerificationRequestMetrics *metrics in _metrics)
+    {
+        queueDuration = MAX(queueDuration, metrics.queueDuration);
+    }
+    XCTAssertTrue(queueDuration > 0, @"");
+}
+
+- (void)testVerifyTransaction_stub_routing
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMStoreVerificationServerStub resetWithProductionStatus:21007 delay:0];
+    _verifier = [self stubbedVerifier];
+    id transaction = [self mockPaymentTransactionWithEnvironment:@"Sandbox"];
+    [self verifyTransactionSuccessfully:transaction];
+    [self verifyTransactionSuccessfully:transaction];
+
+    NSArray *expectedHosts = @[@"buy.itunes.apple.com", @"sandbox.itunes.apple.com", @"sandbox.itunes.apple.com"];
+    XCTAssertEqualObjects([RMStoreVerificationServerStub requestedHosts], expectedHosts, @"");
+}
+
+- (void)testVerifyTransaction_stub_routing_otherOrigin
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMStoreVerificationServerStub resetWithProductionStatus:21007 delay:0];
+    _verifier = [self stubbedVerifier];
+    [self verifyTransactionSuccessfully:[self mockPaymentTransactionWithEnvironment:@"Sandbox"]];
+    [RMStoreVerificationServerStub resetWithProductionStatus:0 sandboxStatus:21008 delay:0];
+
+    [self verifyTransactionSuccessfully:[self mockPaymentTransaction]];
+
+    XCTAssertEqualObjects([RMStoreVerificationServerStub requestedHosts], @[@"buy.itunes.apple.com"], @"");
+}
+
+- (void)testVerifyTransaction_stub_routing_wrongEnvironment
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMStoreVerificationServerStub resetWithProductionStatus:21007 delay:0];
+    _verifier = [self stubbedVerifier];
+    id transaction = [self mockPaymentTransactionWithEnvironment:@"Sandbox"];
+    [self verifyTransactionSuccessfully:transaction];
+    [RMStoreVerificationServerStub resetWithProductionStatus:0 sandboxStatus:21008 delay:0];
+
+    [self verifyTransactionSuccessfully:transaction];
+    [self verifyTransactionSuccessfully:transaction];
+
+    NSArray *expectedHosts = @[@"sandbox.itunes.apple.com", @"buy.itunes.apple.com", @"buy.itunes.apple.com"];
+    XCTAssertEqualObjects([RMStoreVerificationServerStub requestedHosts], expectedHosts, @"");
+}
+
+- (void)testVerifyTransaction_stub_routing_disabled
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMStoreVerificationServerStub resetWithProductionStatus:21007 delay:0];
+    _verifier = [self stubbedVerifier];
+    _verifier.environmentRoutingEnabled = NO;
+    id transaction = [self mockPaymentTransactionWithEnvironment:@"Sandbox"];
+    [self verifyTransactionSuccessfully:transaction];
+    [self verifyTransactionSuccessfully:transaction];
+
+    NSArray *expectedHosts = @[@"buy.itunes.apple.com", @"sandbox.itunes.apple.com", @"buy.itunes.apple.com", @"sandbox.itunes.apple.com"];
+    XCTAssertEqualObjects([RMStoreVerificationServerStub requestedHosts], expectedHosts, @"");
+}
+
+- (void)testVerifyTransaction_stub_routing_failure
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMStoreVerificationServerStub resetWithProductionStatus:21007 sandboxStatus:21005 delay:0];
+    _verifier = [self stubbedVerifier];
+    id transaction = [self mockPaymentTransactionWithEnvironment:@"Sandbox"];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"verify"];
+    [_verifier verifyTransaction:transaction success:^{
+        XCTFail(@"");
+    } failure:^(NSError *error) {
+        XCTAssertEqual(error.code, (NSInteger)21005, @"");
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    [RMStoreVerificationServerStub resetWithProductionStatus:21007 delay:0];
+
+    [self verifyTransactionSuccessfully:transaction];
+
+    NSArray *expectedHosts = @[@"buy.itunes.apple.com", @"sandbox.itunes.apple.com"];
+    XCTAssertEqualObjects([RMStoreVerificationServerStub requestedHosts], expectedHosts, @"");
+}
+
+- (void)testVerifyTransaction_stub_hedged
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMStoreVerificationServerStub resetWithProductionStatus:21007 delay:0.05];
+    _verifier = [self stubbedVerifier];
+    _verifier.hedgedRequestsEnabled = YES;
+    [self verifyTransactionSuccessfully:[self mockPaymentTransactionWithEnvironment:@"Sandbox"]];
+
+    NSSet *expectedHosts = [NSSet setWithObjects:@"buy.itunes.apple.com", @"sandbox.itunes.apple.com", nil];
+    XCTAssertEqualObjects([NSSet setWithArray:[RMStoreVerificationServerStub requestedHosts]], expectedHosts, @"");
+    XCTAssertEqual([RMStoreVerificationServerStub maximumActiveRequestCount], (NSInteger)2, @"");
+}
+
+- (void)testVerifyTransaction_stub_hedged_routing
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMStoreVerificationServerStub resetWithProductionStatus:21007 delay:0];
+    _verifier = [self stubbedVerifier];
+    _verifier.hedgedRequestsEnabled = YES;
+    id transaction = [self mockPaymentTransactionWithEnvironment:@"Sandbox"];
+    [self verifyTransactionSuccessfully:transaction];
+    [RMStoreVerificationServerStub resetWithProductionStatus:21007 delay:0];
+    _verifier.hedgedRequestsEnabled = NO;
+
+    [self verifyTransactionSuccessfully:transaction];
+
+    XCTAssertEqualObjects([RMStoreVerificationServerStub requestedHosts], @[@"sandbox.itunes.apple.com"], @"");
+}
+
+- (void)testVerifyTransaction_stub_hedged_failure
+{ SKIP_IF_VERSION(NSFoundationVersionNumber_iOS_6_1)
+    [RMStoreVerificationServerStub resetWithProductionStatus:21005 sandboxStatus:21008 delay:0];
+    _verifier = [self stubbedVerifier];
+    _verifier.hedgedRequestsEnabled = YES;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"verify"];
+    [_verifier verifyTransaction:[self mockPaymentTransaction] success:^{
+        XCTFail(@"");
+    } failure:^(NSError *error) {
+        XCTAssertEqual(error.code, (NSInteger)21005, @"");
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    XCTAssertEqual(_metrics.count, (NSUInteger)2, @"");
+}
+
+- (void)verifyTransactionSuccessfully:(id)transaction
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"verify"];
+    [_verifier verifyTransaction:transaction success:^{
+        [expectation fulfill];
+    } failure:^(NSError *error) {
+        XCTFail(@"%@", error);
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+- (RMStoreTransactionReceiptVerifier*)stubbedVerifier
+{
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[RMStoreVerificationServerStub class]];
+    NSURLSession *session = [NSURLSession sessionWithConfiguration:configuration];
+    RMStoreTransactionReceiptVerifier *verifier = [[RMStoreTransactionReceiptVerifier alloc] initWithSession:session];
+    verifier.metricsSink = self;
+    return verifier;
+}
+
+- (id)mockPaymentTransaction
+{
+    NSData *receipt = [@"receipt" dataUsingEncoding:NSUTF8StringEncoding];
+    return [self mockPaymentTransactionWithReceipt:receipt];
+}
+
+- (id)mockPaymentTransactionWithEnvironment:(NSString*)environment
+{
+    NSString *receipt = [NSString stringWithFormat:@"{\n\t\"purchase-info\" = \"cHVyY2hhc2U=\";\n\t\"environment\" = \"%@\";\n}", environment];
+    return [self mockPaymentTransactionWithReceipt:[receipt dataUsingEncoding:NSUTF8StringEncoding]];
+}
+
 - (id)mockPaymentTransactionWithReceipt:(NSData*)receipt
 {
     id transaction = [OCMockObject mockForClass:[SKPaymentTransaction class]];